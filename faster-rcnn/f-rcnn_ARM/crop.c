@@ -1,51 +1,180 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 #include "vp_interface.h"
+#include "crop.h"
+#include "trace.h"
+
+// One output row or column of a crop: bilinear interpolation between the elements at offsets lo and hi
+// (already scaled by the layout's stride) with weight lerp on hi. lo < 0 marks a sample outside the
+// feature map, which is extrapolated to CROP_EXTRAPOLATION_VALUE as in TensorFlow's CropAndResize.
+typedef struct crop_sample {
+    int32_t lo, hi;
+    float lerp;
+} crop_sample_t;
+
+#define CROP_EXTRAPOLATION_VALUE 0.0f
+
+// Scratch arena for the sampling tables of crop_and_resize(), one per thread, grown on demand and reset on every call
+static __thread vp_arena_t* scratch_arena = NULL;
+
+void crop_release_scratch() {
+    vp_arena_destroy(scratch_arena);
+    scratch_arena = NULL;
+}
+
+// Samples out_size points evenly from start to end inclusive (the ends align with the roi corners),
+// or the midpoint if out_size is 1, along an axis of in_size elements that are stride apart
+static void build_samples(crop_sample_t* restrict samples, size_t out_size,
+                          float start, float end, size_t in_size, size_t stride) {
+    float scale = out_size > 1 ? (end - start) / (out_size - 1) : 0.0f;
+    for(size_t i = 0; i < out_size; i++) {
+        float in = out_size > 1 ? start + i * scale : 0.5f * (start + end);
+        if(in < 0.0f || in > in_size - 1) {
+            samples[i].lo = -1;
+            samples[i].hi = -1;
+            samples[i].lerp = 0.0f;
+            continue;
+        }
+        int32_t lo = floorf(in);
+        int32_t hi = ceilf(in);
+        samples[i].lo = lo * stride;
+        samples[i].hi = hi * stride;
+        samples[i].lerp = in - lo;
+    }
+}
 
 // ------------------------------------------------------------------------------------------------------------------------------------------------------ //
-// vp_tensor_fix16_t* crop() takes vp_tensor_fix16_t*   rois            - nms output with data array in the following format:                             //  
-//                                                                          [bottom-left(x, y), top-right(x, y), class ID, ...]                           //
-//                                 vp_tensor_float32_t* feature_map     - feature map generated for each image (flattened to 1-D array)                   //  
-//                                                                          [feature_map of channel 0, feature_map of channel 1, ...]                     //
-// as arguments, returns a         vp_tensor_float32_t* cropped_map     - 1-D array of n*c*roi_area entries                                               //      
+// vp_tensor_float32_t* crop_and_resize() takes vp_tensor_fix16_t*   rois        - nms output with data array in the following format:                     //
+//                                                                                   [bottom-left(x, y), top-right(x, y), class ID, ...]                   //
+//                                                                                 in feature map coordinates                                            //
+//                                              vp_tensor_float32_t* feature_map - feature map generated for each image, n = 1, in the given layout      //
+//                                              size_t               crop_h      - output height of every crop                                          //
+//                                              size_t               crop_w      - output width of every crop                                           //
+//                                              vp_layout_t          layout      - VP_NCHW or VP_NHWC, for both feature_map and the output              //
+// as arguments, returns a                      vp_tensor_float32_t*             - (num_rois, c, crop_h, crop_w) tensor of bilinearly resized crops,    //
+//                                                                                 stored in the given layout                                            //
+// Each RoI first fills a sampling table with the source offsets and weights of every output row and column, so the inner loops are plain          //
+// multiply-adds. In NHWC the innermost loop runs over contiguous channels; in NCHW it runs over an output row.                                     //
 // ------------------------------------------------------------------------------------------------------------------------------------------------------ //
-vp_tensor_float32_output crop(vp_tensor_fix16_input rois,       
-                              vp_tensor_float32_input feature_map) {
+vp_tensor_float32_output crop_and_resize(vp_tensor_fix16_input rois,
+                                         vp_tensor_float32_input feature_map,
+                                         const size_t crop_h, const size_t crop_w,
+                                         const vp_layout_t layout) {
     // Safety checks
-    assert(rois->h > 0);
+    assert(rois->h > 0 && rois->w == 5);
     assert(feature_map->n == 1);
+    assert(crop_h > 0 && crop_w > 0);
+    assert(layout == VP_NCHW || layout == VP_NHWC);
+
+    const size_t num_rois = rois->h;
+    const size_t channels = feature_map->c;
+    const size_t height = feature_map->h;
+    const size_t width = feature_map->w;
+    const size_t crop_area = crop_h * crop_w;
+
+    vp_tensor_float32_t* crops = vp_tensor_float32_malloc(num_rois, channels, crop_h, crop_w);
+    if(crops == NULL)
+        return NULL;
+    TRACE(TRACE_CROP_ALLOC, num_rois * channels * crop_area, 0, 0, 0);
+
+    // Sampling table, rebuilt for each roi
+    size_t size = (crop_h + crop_w) * sizeof(crop_sample_t) + SIMD_ALIGNMENT;
+    if(scratch_arena == NULL || scratch_arena->capacity < size) {
+        vp_arena_destroy(scratch_arena);
+        scratch_arena = vp_arena_create(size);
+    }
+    else
+        vp_arena_reset(scratch_arena);
+    crop_sample_t* ys = scratch_arena == NULL ? NULL
+                      : vp_arena_alloc(scratch_arena, (crop_h + crop_w) * sizeof(crop_sample_t), _Alignof(crop_sample_t));
+    if(ys == NULL) {
+        vp_tensor_free(crops);
+        return NULL;
+    }
+    crop_sample_t* xs = ys + crop_h;
+
+    // Strides of a row and of a column in the feature map
+    const size_t row_stride = layout == VP_NHWC ? width * channels : width;
+    const size_t col_stride = layout == VP_NHWC ? channels : 1;
 
-    int16_t num_rois = rois->h;
-    int16_t map_area = feature_map->h*feature_map->w;
-    int16_t offset = 0;
-    vp_tensor_float32_t* cropped_feature_maps = vp_tensor_float32_malloc(num_rois, feature_map->c, feature_map->h, feature_map->w);
-    printf("malloc-ed size: %d\n", num_rois*map_area*feature_map->c);
     for(size_t i = 0; i < num_rois; i++) {
-        int16_t roi_rows = rois->data[i*5+3] - rois->data[i*5+1] + 1;
-        int16_t roi_cols = rois->data[i*5+2] - rois->data[i*5+0] + 1;
-        int16_t roi_area = roi_rows * roi_cols;
-        printf("roi_area = %d\n", roi_area);
-        for(size_t j = 0; j < feature_map->c; j++) {
-            for(size_t k = 0; k < roi_rows; k++) {
-                for(size_t l = 0; l < roi_cols; l++) {
-                    const int16_t curr_row = rois->data[i*5+1] + k;
-                    const int16_t curr_col = rois->data[i*5+0] + l;
-                    cropped_feature_maps->data[offset + j*roi_area + k*roi_cols + l] = feature_map->data[j*map_area + feature_map->w*curr_row + curr_col];
-                    // printf("feature_map_data_index: %d\n", j*map_area + feature_map->w*curr_row + curr_col);
+        const int16_t* roi = &rois->data[i*5];
+        TRACE(TRACE_CROP_ROI, i, (roi[2] - roi[0] + 1) * (roi[3] - roi[1] + 1), 0, 0);
+        build_samples(ys, crop_h, roi[1], roi[3], height, row_stride);
+        build_samples(xs, crop_w, roi[0], roi[2], width, col_stride);
+        float* restrict out = crops->data + i * channels * crop_area;
+
+        if(layout == VP_NHWC) {
+            for(size_t y = 0; y < crop_h; y++) {
+                for(size_t x = 0; x < crop_w; x++) {
+                    float* restrict dst = out + (y * crop_w + x) * channels;
+                    if(ys[y].lo < 0 || xs[x].lo < 0) {
+                        for(size_t c = 0; c < channels; c++)
+                            dst[c] = CROP_EXTRAPOLATION_VALUE;
+                        continue;
+                    }
+                    const float* restrict tl = feature_map->data + ys[y].lo + xs[x].lo;
+                    const float* restrict tr = feature_map->data + ys[y].lo + xs[x].hi;
+                    const float* restrict bl = feature_map->data + ys[y].hi + xs[x].lo;
+                    const float* restrict br = feature_map->data + ys[y].hi + xs[x].hi;
+                    const float x_lerp = xs[x].lerp;
+                    const float y_lerp = ys[y].lerp;
+                    #pragma omp simd
+                    for(size_t c = 0; c < channels; c++) {
+                        float top = tl[c] + (tr[c] - tl[c]) * x_lerp;
+                        float bottom = bl[c] + (br[c] - bl[c]) * x_lerp;
+                        dst[c] = top + (bottom - top) * y_lerp;
+                    }
+                }
+            }
+        }
+        else {
+            for(size_t c = 0; c < channels; c++) {
+                const float* restrict plane = feature_map->data + c * height * width;
+                for(size_t y = 0; y < crop_h; y++) {
+                    float* restrict dst = out + c * crop_area + y * crop_w;
+                    if(ys[y].lo < 0) {
+                        for(size_t x = 0; x < crop_w; x++)
+                            dst[x] = CROP_EXTRAPOLATION_VALUE;
+                        continue;
+                    }
+                    const float* restrict top_row = plane + ys[y].lo;
+                    const float* restrict bottom_row = plane + ys[y].hi;
+                    const float y_lerp = ys[y].lerp;
+                    #pragma omp simd
+                    for(size_t x = 0; x < crop_w; x++) {
+                        int32_t lo = xs[x].lo < 0 ? 0 : xs[x].lo;
+                        int32_t hi = xs[x].lo < 0 ? 0 : xs[x].hi;
+                        float top = top_row[lo] + (top_row[hi] - top_row[lo]) * xs[x].lerp;
+                        float bottom = bottom_row[lo] + (bottom_row[hi] - bottom_row[lo]) * xs[x].lerp;
+                        float value = top + (bottom - top) * y_lerp;
+                        dst[x] = xs[x].lo < 0 ? CROP_EXTRAPOLATION_VALUE : value;
+                    }
                 }
-            }            
+            }
         }
-        offset += roi_area*feature_map->c;
     }
-    vp_tensor_float32_output process_map = vp_tensor_float32_calloc(1, 1, 1, offset, &cropped_feature_maps->data[0]);
-    return process_map;
+    return crops;
+}
+
+// ------------------------------------------------------------------------------------------------------------------------------------------------------ //
+// vp_tensor_float32_t* crop() takes vp_tensor_fix16_t*   rois            - nms output, as for crop_and_resize()                                          //
+//                                   vp_tensor_float32_t* feature_map     - feature map generated for each image, NCHW                                     //
+// as arguments, returns a           vp_tensor_float32_t* cropped_map     - (num_rois, c, CROP_HEIGHT, CROP_WIDTH) tensor, NCHW                            //
+// ------------------------------------------------------------------------------------------------------------------------------------------------------ //
+vp_tensor_float32_output crop(vp_tensor_fix16_input rois,       
+                              vp_tensor_float32_input feature_map) {
+    return crop_and_resize(rois, feature_map, CROP_HEIGHT, CROP_WIDTH, VP_NCHW);
 }
 
 /* -----------------------------------------------------------------------
 ------------------------------- Testing ----------------------------------
 ----------------------------------------------------------------------- */
+// Left out with -DNO_TEST_MAIN when linked into the pipeline test
+#ifndef NO_TEST_MAIN
 int main() {
     const float feature_map_scores[1*5*5] = {
         0.3, 0.4, 0.3, 0.4, 0.5,
@@ -59,22 +188,69 @@ int main() {
         0, 0, 2, 2, 0,
         2, 2, 4, 4, 1
     };
-    vp_tensor_float32_t* feature_map = vp_tensor_float32_calloc(1, 1, 5, 5, &feature_map_scores);
-    vp_tensor_fix16_t* rois = vp_tensor_fix16_calloc(1, 1, 2, 5, 0, &rois_raw);
+    vp_tensor_float32_t* feature_map = vp_tensor_float32_calloc(1, 1, 5, 5, feature_map_scores);
+    vp_tensor_fix16_t* rois = vp_tensor_fix16_calloc(1, 1, 2, 5, 0, rois_raw);
 
-    vp_tensor_float32_t* cropped_map = crop(rois, feature_map);
-    for(int i = 0; i < cropped_map->w; i++) {
+    // A 3 x 3 crop of a 3 x 3 roi samples the feature map at integer points, i.e. copies it
+    vp_tensor_float32_t* cropped_map = crop_and_resize(rois, feature_map, 3, 3, VP_NCHW);
+    for(size_t i = 0; i < 2; i++)
+        for(size_t y = 0; y < 3; y++)
+            for(size_t x = 0; x < 3; x++)
+                assert(cropped_map->data[i*9 + y*3 + x] == feature_map_scores[(rois_raw[i*5+1] + y)*5 + rois_raw[i*5+0] + x]);
+    for(int i = 0; i < cropped_map->n * cropped_map->h * cropped_map->w; i++) {
         if(i % 3 == 0) {printf("\n");}
         printf("%f ", cropped_map->data[i]);
     }
     printf("\n");
 
-    // vp_tensor_float32_t** tensor_4d = vp_tensor_float32_malloc(1, 1, 1, cropped_map->w);
-    // tensor_4d[0][0]->data = &cropped_map->data[9];
+    // A 5 x 5 crop of the second roi lands halfway between feature map entries on odd rows and columns
+    vp_tensor_float32_t* resized_map = crop_and_resize(rois, feature_map, 5, 5, VP_NCHW);
+    const float* second = resized_map->data + 25;
+    assert(fabsf(second[1*5+1] - (0.6f + 0.8f + 0.7f + 0.9f) / 4) < 1e-6f);
+    assert(fabsf(second[0*5+1] - (0.6f + 0.8f) / 2) < 1e-6f);
+
+    // NCHW and NHWC must give the same crops, including rois partly outside the feature map
+    #define CHANNELS 19
+    #define MAP_H 11
+    #define MAP_W 13
+    const int16_t random_rois_raw[5*3] = {
+        1, 2, 9, 7, 0,
+        -3, 4, 6, 14, 1,
+        5, 5, 5, 5, 2
+    };
+    vp_tensor_float32_t* nchw = vp_tensor_float32_malloc(1, CHANNELS, MAP_H, MAP_W);
+    vp_tensor_float32_t* nhwc = vp_tensor_float32_malloc(1, CHANNELS, MAP_H, MAP_W);
+    srand(1);
+    for(size_t c = 0; c < CHANNELS; c++) {
+        for(size_t h = 0; h < MAP_H; h++) {
+            for(size_t w = 0; w < MAP_W; w++) {
+                float value = (float)rand() / RAND_MAX;
+                nchw->data[(c*MAP_H + h)*MAP_W + w] = value;
+                nhwc->data[(h*MAP_W + w)*CHANNELS + c] = value;
+            }
+        }
+    }
+    vp_tensor_fix16_t* random_rois = vp_tensor_fix16_calloc(1, 1, 3, 5, 0, random_rois_raw);
+    vp_tensor_float32_t* crops_nchw = crop_and_resize(random_rois, nchw, CROP_HEIGHT, CROP_WIDTH, VP_NCHW);
+    vp_tensor_float32_t* crops_nhwc = crop_and_resize(random_rois, nhwc, CROP_HEIGHT, CROP_WIDTH, VP_NHWC);
+    for(size_t i = 0; i < 3; i++)
+        for(size_t c = 0; c < CHANNELS; c++)
+            for(size_t y = 0; y < CROP_HEIGHT; y++)
+                for(size_t x = 0; x < CROP_WIDTH; x++)
+                    assert(crops_nchw->data[((i*CHANNELS + c)*CROP_HEIGHT + y)*CROP_WIDTH + x]
+                           == crops_nhwc->data[((i*CROP_HEIGHT + y)*CROP_WIDTH + x)*CHANNELS + c]);
+    trace_dump(stdout);
 
     vp_tensor_free(feature_map);
     vp_tensor_free(rois);
     vp_tensor_free(cropped_map);
+    vp_tensor_free(resized_map);
+    vp_tensor_free(nchw);
+    vp_tensor_free(nhwc);
+    vp_tensor_free(random_rois);
+    vp_tensor_free(crops_nchw);
+    vp_tensor_free(crops_nhwc);
 
     return 0;
 }
+#endif /*NO_TEST_MAIN*/
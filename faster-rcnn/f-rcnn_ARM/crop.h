@@ -1,6 +1,22 @@
 #ifndef CROP_AND_RESIZE_H_
+#define CROP_AND_RESIZE_H_
 #include "vp_interface.h"
 
+// Output size of crop(), as expected by the CropAndResize input of the classifier DAG
+#define CROP_HEIGHT 14
+#define CROP_WIDTH 14
+
+// Memory layout of a feature map and of the crops made from it
+typedef enum vp_layout {
+    VP_NCHW = 0,
+    VP_NHWC
+} vp_layout_t;
+
+vp_tensor_float32_output crop_and_resize(vp_tensor_fix16_input rois, vp_tensor_float32_input feature_map,
+                                         const size_t crop_h, const size_t crop_w, const vp_layout_t layout);
 inline vp_tensor_float32_output crop(vp_tensor_fix16_input rois, vp_tensor_float32_input feature_map);
 
+// Frees the scratch arena the calling thread keeps for crop_and_resize(). Call before a worker thread exits.
+void crop_release_scratch();
+
 #endif /*CROP_AND_RESIZE_H_*/
\ No newline at end of file
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "vp_interface.h"
+#include "nms.h"
+#include "map_scores.h"
+#include "crop.h"
+#include "pipeline.h"
+#include "spsc_queue.h"
+#include "frcnn_pipeline.h"
+
+/* ----------------------------------------------------------------------
+-------------------------------- Stages ---------------------------------
+---------------------------------------------------------------------- */
+static bool stage_rpn(void* frame, void* context) {
+    const frcnn_dags_t* dags = context;
+    return dags->rpn(frame, dags->rpn_context);
+}
+
+// rois, roi_indices = ARM.nms_indexed(scores, region_proposals, len(scores))
+static bool stage_nms_indexed(void* arg, void* context) {
+    frcnn_frame_t* frame = arg;
+    if(frame->region_proposals == NULL || frame->scores == NULL)
+        return false;
+    vp_scalar_fix16_t* N = vp_scalar_fix16_calloc(0, frame->region_proposals->h);
+    if(N == NULL)
+        return false;
+    frame->rois = nms_indexed(frame->scores, frame->region_proposals, N, &frame->roi_indices);
+    vp_scalar_free(N);
+    return frame->rois != NULL;
+}
+
+// mapped_scores = ARM.map_scores_indexed(scores, roi_indices)
+static bool stage_map_scores(void* arg, void* context) {
+    frcnn_frame_t* frame = arg;
+    if(frame->roi_indices == NULL)
+        return false;
+    frame->mapped_scores = map_scores_indexed(frame->scores, frame->roi_indices);
+    return frame->mapped_scores != NULL;
+}
+
+// cropped_feature_maps = ARM.crop_and_resize(rois, feature_map, 14, 14, ARM.VP_NHWC)
+static bool stage_crop(void* arg, void* context) {
+    frcnn_frame_t* frame = arg;
+    if(frame->rois == NULL || frame->feature_map == NULL)
+        return false;
+    frame->cropped_feature_maps = crop_and_resize(frame->rois, frame->feature_map, CROP_HEIGHT, CROP_WIDTH, VP_NHWC);
+    return frame->cropped_feature_maps != NULL;
+}
+
+static bool stage_classifier(void* frame, void* context) {
+    const frcnn_dags_t* dags = context;
+    if(((frcnn_frame_t*)frame)->cropped_feature_maps == NULL)
+        return false;
+    return dags->classifier(frame, dags->classifier_context);
+}
+
+// bounding_boxes = ARM.nms(mapped_scores, box_predictions, len(mapped_scores))
+static bool stage_nms(void* arg, void* context) {
+    frcnn_frame_t* frame = arg;
+    if(frame->mapped_scores == NULL || frame->box_predictions == NULL)
+        return false;
+    vp_scalar_fix16_t* N = vp_scalar_fix16_calloc(0, frame->mapped_scores->w);
+    if(N == NULL)
+        return false;
+    frame->bounding_boxes = nms(frame->mapped_scores, frame->box_predictions, N);
+    vp_scalar_free(N);
+    return frame->bounding_boxes != NULL;
+}
+
+// Release hooks: each kernel keeps a scratch arena per thread
+static void release_nms(void* context) {
+    nms_release_scratch();
+}
+
+static void release_map_scores(void* context) {
+    map_scores_release_scratch();
+}
+
+static void release_crop(void* context) {
+    crop_release_scratch();
+}
+
+void frcnn_pipeline_stages(const frcnn_dags_t* dags, pipeline_stage_t stages[FRCNN_NUM_STAGES]) {
+    stages[0] = (pipeline_stage_t){"rpn", stage_rpn, (void*)dags, NULL};
+    stages[1] = (pipeline_stage_t){"nms_indexed", stage_nms_indexed, NULL, release_nms};
+    stages[2] = (pipeline_stage_t){"map_scores_indexed", stage_map_scores, NULL, release_map_scores};
+    stages[3] = (pipeline_stage_t){"crop_and_resize", stage_crop, NULL, release_crop};
+    stages[4] = (pipeline_stage_t){"classifier", stage_classifier, (void*)dags, NULL};
+    stages[5] = (pipeline_stage_t){"nms", stage_nms, NULL, release_nms};
+}
+
+void frcnn_frame_clear(frcnn_frame_t* frame) {
+    vp_tensor_free(frame->feature_map);
+    vp_tensor_free(frame->region_proposals);
+    vp_tensor_free(frame->scores);
+    vp_tensor_free(frame->rois);
+    vp_tensor_free(frame->roi_indices);
+    vp_tensor_free(frame->mapped_scores);
+    vp_tensor_free(frame->cropped_feature_maps);
+    vp_tensor_free(frame->classes);
+    vp_tensor_free(frame->box_predictions);
+    vp_tensor_free(frame->bounding_boxes);
+    frame->feature_map = NULL;
+    frame->region_proposals = NULL;
+    frame->scores = NULL;
+    frame->rois = NULL;
+    frame->roi_indices = NULL;
+    frame->mapped_scores = NULL;
+    frame->cropped_feature_maps = NULL;
+    frame->classes = NULL;
+    frame->box_predictions = NULL;
+    frame->bounding_boxes = NULL;
+}
+
+/* ----------------------------------------------------------------------
+------------------------------ Stub DAGs --------------------------------
+---------------------------------------------------------------------- */
+// Deterministic per-frame random numbers, independent of the thread that draws them
+static uint32_t next_random(uint32_t* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static float random_unit(uint32_t* state) {
+    return next_random(state) / (float)(1u << 24);
+}
+
+// Sleeps, as the ARM core is idle while the VP runs, or spins to stand in for ARM compute
+static void vp_latency(unsigned us, bool busy_wait) {
+    struct timespec t = {us / 1000000, (us % 1000000) * 1000L};
+    if(!busy_wait) {
+        nanosleep(&t, NULL);
+        return;
+    }
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    while((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000 < (long)us);
+}
+
+bool frcnn_stub_rpn(frcnn_frame_t* frame, void* context) {
+    const frcnn_stub_config_t* config = context;
+    uint32_t state = frame->index * 2654435761u + 1;
+    size_t n = config->num_proposals;
+    frame->feature_map = vp_tensor_float32_malloc(1, config->channels, config->map_h, config->map_w);
+    frame->region_proposals = vp_tensor_fix16_malloc(1, 1, n, 5, 0);
+    frame->scores = vp_tensor_float32_malloc(1, 1, 1, n);
+    if(frame->feature_map == NULL || frame->region_proposals == NULL || frame->scores == NULL)
+        return false;
+    for(size_t i = 0; i < config->channels * config->map_h * config->map_w; i++)
+        frame->feature_map->data[i] = random_unit(&state);
+    // Boxes of 2 to 9 cells, within the feature map
+    for(size_t i = 0; i < n; i++) {
+        int16_t* box = &frame->region_proposals->data[i*5];
+        box[0] = next_random(&state) % (config->map_w - 9);
+        box[1] = next_random(&state) % (config->map_h - 9);
+        box[2] = box[0] + 2 + next_random(&state) % 8;
+        box[3] = box[1] + 2 + next_random(&state) % 8;
+        box[4] = 0;
+        frame->scores->data[i] = random_unit(&state);
+    }
+    vp_latency(config->rpn_latency_us, config->busy_wait);
+    return true;
+}
+
+bool frcnn_stub_classifier(frcnn_frame_t* frame, void* context) {
+    const frcnn_stub_config_t* config = context;
+    uint32_t state = frame->index * 2246822519u + 7;
+    size_t num_rois = frame->rois->h;
+    frame->classes = vp_tensor_float32_malloc(1, 1, num_rois, config->num_classes);
+    frame->box_predictions = vp_tensor_fix16_malloc(1, 1, num_rois, 5, 0);
+    if(frame->classes == NULL || frame->box_predictions == NULL)
+        return false;
+    for(size_t i = 0; i < num_rois * config->num_classes; i++)
+        frame->classes->data[i] = random_unit(&state);
+    // Refined boxes: each roi moved by up to one cell
+    for(size_t i = 0; i < num_rois; i++) {
+        const int16_t* roi = &frame->rois->data[i*5];
+        int16_t* box = &frame->box_predictions->data[i*5];
+        int16_t dx = (int16_t)(next_random(&state) % 3) - 1;
+        int16_t dy = (int16_t)(next_random(&state) % 3) - 1;
+        box[0] = roi[0] + dx;
+        box[1] = roi[1] + dy;
+        box[2] = roi[2] + dx;
+        box[3] = roi[3] + dy;
+        box[4] = roi[4];
+    }
+    vp_latency(config->classifier_latency_us, config->busy_wait);
+    return true;
+}
+
+/* ----------------------------------------------------------------------
+------------------------------- Testing ----------------------------------
+----------------------------------------------------------------------- */
+#define NUM_FRAMES 64
+#define QUEUE_DEPTH 2
+#define NUM_ITEMS 1000000
+
+static void* produce_items(void* arg) {
+    spsc_queue_t* queue = arg;
+    for(uintptr_t i = 1; i <= NUM_ITEMS; i++)
+        while(!spsc_queue_push(queue, (void*)i))
+            sched_yield();
+    return NULL;
+}
+
+typedef struct feeder {
+    pipeline_t* pipeline;
+    frcnn_frame_t* frames;
+} feeder_t;
+
+static void* feed_frames(void* arg) {
+    feeder_t* feeder = arg;
+    for(size_t f = 0; f < NUM_FRAMES; f++)
+        pipeline_submit(feeder->pipeline, &feeder->frames[f]);
+    pipeline_close(feeder->pipeline);
+    return NULL;
+}
+
+// A single stage that holds its first frame until opened, to count how many frames the queues take
+static atomic_bool gate_open;
+static atomic_size_t num_gate_submitted;
+
+static bool stage_gate(void* frame, void* context) {
+    while(!atomic_load(&gate_open))
+        sched_yield();
+    return true;
+}
+
+static void* feed_gate(void* arg) {
+    pipeline_t* pipeline = arg;
+    for(size_t f = 0; f < NUM_FRAMES; f++) {
+        pipeline_submit(pipeline, (void*)(f + 1));
+        atomic_fetch_add(&num_gate_submitted, 1);
+    }
+    pipeline_close(pipeline);
+    return NULL;
+}
+
+static double elapsed_ms(const struct timespec* start, const struct timespec* stop) {
+    return (stop->tv_sec - start->tv_sec) * 1e3 + (stop->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Usage: pipeline [-l LANES] [-b]
+//   -l LANES  run the pipeline with 1 to LANES lanes (default: one per core)
+//   -b        busy-wait in the stub DAGs, so every stage keeps a core busy as ARM compute would
+int main(int argc, char* argv[]) {
+    long max_lanes = sysconf(_SC_NPROCESSORS_ONLN);
+    frcnn_stub_config_t config = FRCNN_STUB_DEFAULT_CONFIG;
+    int opt;
+    while((opt = getopt(argc, argv, "l:b")) != -1) {
+        if(opt == 'l' && atol(optarg) >= 1)
+            max_lanes = atol(optarg);
+        else if(opt == 'b')
+            config.busy_wait = true;
+        else {
+            fprintf(stderr, "Usage: %s [-l LANES] [-b]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(max_lanes < 1)
+        max_lanes = 1;
+
+    // The queue hands every item over once and in order
+    spsc_queue_t queue;
+    pthread_t producer;
+    bool ok = spsc_queue_init(&queue, 6);
+    assert(ok && queue.mask == 7);
+    pthread_create(&producer, NULL, produce_items, &queue);
+    for(uintptr_t i = 1; i <= NUM_ITEMS; i++) {
+        void* item;
+        while((item = spsc_queue_pop(&queue)) == NULL)
+            sched_yield();
+        assert((uintptr_t)item == i);
+    }
+    pthread_join(producer, NULL);
+    void* left = spsc_queue_pop(&queue);
+    assert(left == NULL);
+    spsc_queue_destroy(&queue);
+    printf("spsc_queue: %d items in order\n", NUM_ITEMS);
+
+    // A queue holds depth frames: with its only stage held, a lane takes the frame in the stage and depth more
+    // waiting in front of it, and pipeline_submit() then blocks
+    pipeline_stage_t gate = {"gate", stage_gate, NULL, NULL};
+    pipeline_t* pipeline = pipeline_create(&gate, 1, 1, QUEUE_DEPTH);
+    if(pipeline == NULL)
+        return EXIT_FAILURE;
+    pthread_t feeder_thread;
+    pthread_create(&feeder_thread, NULL, feed_gate, pipeline);
+    size_t expected_held = QUEUE_DEPTH + 1;
+    while(atomic_load(&num_gate_submitted) < expected_held)
+        sched_yield();
+    struct timespec settle = {0, 20000000};
+    nanosleep(&settle, NULL);
+    size_t held = atomic_load(&num_gate_submitted);
+    assert(held == expected_held);
+    atomic_store(&gate_open, true);
+    for(size_t f = 0; f < NUM_FRAMES; f++) {
+        void* frame = pipeline_collect(pipeline);
+        assert(frame == (void*)(f + 1));
+    }
+    void* end = pipeline_collect(pipeline);
+    assert(end == NULL);
+    pthread_join(feeder_thread, NULL);
+    pipeline_destroy(pipeline);
+    printf("pipeline: a held 1-stage lane of depth %d takes %zu frames\n", QUEUE_DEPTH, held);
+
+    // Reference: the stages one after the other, one frame at a time
+    frcnn_dags_t dags = {frcnn_stub_rpn, &config, frcnn_stub_classifier, &config};
+    pipeline_stage_t stages[FRCNN_NUM_STAGES];
+    frcnn_pipeline_stages(&dags, stages);
+    static frcnn_frame_t frames[NUM_FRAMES];
+    static int16_t* expected[NUM_FRAMES];
+    static size_t expected_n[NUM_FRAMES];
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t f = 0; f < NUM_FRAMES; f++) {
+        frames[f].index = f;
+        for(size_t s = 0; s < FRCNN_NUM_STAGES; s++) {
+            ok = stages[s].run(&frames[f], stages[s].context);
+            assert(ok);
+        }
+        expected_n[f] = frames[f].bounding_boxes->h;
+        expected[f] = malloc(expected_n[f] * 5 * sizeof(int16_t));
+        memcpy(expected[f], frames[f].bounding_boxes->data, expected_n[f] * 5 * sizeof(int16_t));
+        frcnn_frame_clear(&frames[f]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double sequential_ms = elapsed_ms(&start, &stop);
+    printf("sequential: %d frames, %.1f frames/s\n", NUM_FRAMES, NUM_FRAMES / (sequential_ms / 1e3));
+
+    // Pipelined, from 1 lane up to max_lanes: same boxes, same order
+    for(long lanes = 1; lanes <= max_lanes; lanes++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pipeline = pipeline_create(stages, FRCNN_NUM_STAGES, lanes, QUEUE_DEPTH);
+        if(pipeline == NULL)
+            return EXIT_FAILURE;
+        feeder_t feeder = {pipeline, frames};
+        pthread_create(&feeder_thread, NULL, feed_frames, &feeder);
+        frcnn_frame_t* frame;
+        size_t f = 0;
+        while((frame = pipeline_collect(pipeline)) != NULL) {
+            assert(frame == &frames[f]);
+            assert(frame->bounding_boxes->h == expected_n[f]);
+            assert(memcmp(frame->bounding_boxes->data, expected[f], expected_n[f] * 5 * sizeof(int16_t)) == 0);
+            frcnn_frame_clear(frame);
+            f++;
+        }
+        assert(f == NUM_FRAMES);
+        pthread_join(feeder_thread, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        assert(!pipeline_failed(pipeline));
+        double ms = elapsed_ms(&start, &stop);
+        printf("\npipelined, %ld lane(s): %d frames, %.1f frames/s (%.2fx sequential)\n", lanes, NUM_FRAMES,
+               NUM_FRAMES / (ms / 1e3), sequential_ms / ms);
+        pipeline_print_stats(pipeline, stdout);
+        pipeline_destroy(pipeline);
+    }
+
+    for(size_t f = 0; f < NUM_FRAMES; f++)
+        free(expected[f]);
+    // The sequential reference ran the kernels on this thread
+    nms_release_scratch();
+    map_scores_release_scratch();
+    crop_release_scratch();
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * The Faster R-CNN chain of template_frcnn.py as pipeline stages
+ *     rpn -> nms_indexed -> map_scores_indexed -> crop_and_resize -> classifier -> nms
+ *   - A frcnn_frame_t carries every tensor of one frame from stage to stage. Each stage reads the outputs of the
+ *     stages before it and sets its own; frcnn_frame_clear() frees them all.
+ *   - The two CVflow DAGs (rpn and classifier) are callbacks, so the chain runs with the real DAGs on the target and
+ *     with frcnn_stub_rpn() and frcnn_stub_classifier() elsewhere. The stubs sleep for a set latency, as the ARM core
+ *     is idle while the VP runs, or spin for it with busy_wait, so every stage is CPU-bound when measuring how the
+ *     frame rate scales with lanes. Either way they make deterministic outputs from the frame index.
+ */
+#ifndef FRCNN_PIPELINE_H_
+#define FRCNN_PIPELINE_H_
+#include <stddef.h>
+#include <stdbool.h>
+#include "vp_interface.h"
+#include "pipeline.h"
+
+#define FRCNN_NUM_STAGES 6
+
+typedef struct frcnn_frame {
+    size_t index;
+    vp_tensor_float32_t* image;                // FS.input
+    vp_tensor_fix16_t* anchors;                // FS.anchors
+    vp_tensor_float32_t* feature_map;          // rpn: (1, c, h, w) in NHWC
+    vp_tensor_fix16_t* region_proposals;       // rpn: (1, 1, N, 5) in feature map coordinates
+    vp_tensor_float32_t* scores;               // rpn: (1, 1, 1, N)
+    vp_tensor_fix16_t* rois;                   // nms_indexed
+    vp_tensor_fix16_t* roi_indices;            // nms_indexed
+    vp_tensor_float32_t* mapped_scores;        // map_scores_indexed
+    vp_tensor_float32_t* cropped_feature_maps; // crop_and_resize: (num_rois, c, 14, 14) in NHWC
+    vp_tensor_float32_t* classes;              // classifier: (1, 1, num_rois, num_classes)
+    vp_tensor_fix16_t* box_predictions;        // classifier: (1, 1, num_rois, 5)
+    vp_tensor_fix16_t* bounding_boxes;         // nms
+} frcnn_frame_t;
+
+// A CVflow DAG: reads the inputs it needs from frame and sets its outputs. Returns false on failure.
+typedef bool (*frcnn_dag_fn)(frcnn_frame_t* frame, void* context);
+
+typedef struct frcnn_dags {
+    frcnn_dag_fn rpn;        // sets feature_map, region_proposals and scores
+    void* rpn_context;
+    frcnn_dag_fn classifier; // sets classes and box_predictions from rois and cropped_feature_maps
+    void* classifier_context;
+} frcnn_dags_t;
+
+// Parameters of the stub DAGs, shared by both
+typedef struct frcnn_stub_config {
+    size_t num_proposals;     // RPN proposals per frame
+    size_t channels;          // feature map depth
+    size_t map_h, map_w;      // feature map size
+    size_t num_classes;
+    unsigned rpn_latency_us;  // time each DAG takes on the VP
+    unsigned classifier_latency_us;
+    bool busy_wait;           // spin for the latency instead of sleeping, to load the core as ARM compute would
+} frcnn_stub_config_t;
+
+#define FRCNN_STUB_DEFAULT_CONFIG { .num_proposals = 300, .channels = 64, .map_h = 38, .map_w = 50, \
+                                    .num_classes = 91, .rpn_latency_us = 2000, .classifier_latency_us = 2000, \
+                                    .busy_wait = false }
+
+// Stub DAGs; context is a const frcnn_stub_config_t*
+bool frcnn_stub_rpn(frcnn_frame_t* frame, void* context);
+bool frcnn_stub_classifier(frcnn_frame_t* frame, void* context);
+
+// Fills stages with the chain, the DAG stages calling dags, which must outlive the pipeline
+void frcnn_pipeline_stages(const frcnn_dags_t* dags, pipeline_stage_t stages[FRCNN_NUM_STAGES]);
+
+// Frees the tensors set by the stages, keeping index, image and anchors
+void frcnn_frame_clear(frcnn_frame_t* frame);
+
+#endif /*FRCNN_PIPELINE_H_*/
@@ -2,7 +2,35 @@
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
+#include <string.h>
 #include "vp_interface.h"
+#include "trace.h"
+
+// Packed 80-bit box key: the four coordinates in a 64-bit word and the class ID on the side
+static inline uint64_t box_key(const int16_t* box) {
+    return (uint64_t)(uint16_t)box[0]       | (uint64_t)(uint16_t)box[1] << 16 |
+           (uint64_t)(uint16_t)box[2] << 32 | (uint64_t)(uint16_t)box[3] << 48;
+}
+
+static inline size_t box_hash(const int16_t* box, size_t mask) {
+    uint64_t h = box_key(box) ^ ((uint64_t)(uint16_t)box[4] * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h & mask;
+}
+
+static inline int same_box(const int16_t* a, const int16_t* b) {
+    return box_key(a) == box_key(b) && a[4] == b[4];
+}
+
+// Scratch arena for the hash table of map_scores(), one per thread, grown on demand and reset on every call
+static __thread vp_arena_t* scratch_arena = NULL;
+
+void map_scores_release_scratch() {
+    vp_arena_destroy(scratch_arena);
+    scratch_arena = NULL;
+}
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------- //
 // vp_tensor_fix16_t* mapped_scores() takes vp_tensor_float32_t* idx_scores - original 1-D array of scores corresponding to all RPN proposals         // 
@@ -11,6 +39,8 @@
 //                                          vp_tensor_fix16_t*   proposals  - original 1-D array of proposal coordinates and corresponding ID:        //  
 //                                                                              [bottom-left(x, y), top-right(x, y), class ID, ...]                   //    
 // as arguments, returns a                  vp_tensor_float32_t*            - 1-D array of scores corresponding to each roi generated by nms          //      
+// Proposals are indexed once in an open-addressing hash table on their packed 80-bit key, so each roi is an O(1) lookup.                            //
+// When nms_indexed() is available, map_scores_indexed() skips the table altogether.                                                                  //
 // -------------------------------------------------------------------------------------------------------------------------------------------------- //
 vp_tensor_float32_output map_scores(vp_tensor_float32_input idx_scores,       
                                 vp_tensor_fix16_input rois,               // nms output
@@ -18,28 +48,70 @@ vp_tensor_float32_output map_scores(vp_tensor_float32_input idx_scores,
     // Safety checks
     assert(idx_scores->w >= rois->h);
     int16_t num_rois = rois->h;
+    size_t num_proposals = proposals->h;
     vp_tensor_float32_output mapped_scores = vp_tensor_float32_malloc(1, 1, 1, num_rois);
+
+    // Hash table of proposal indices, at most half full; -1 marks an empty slot
+    size_t num_slots = 16;
+    while(num_slots < 2 * num_proposals)
+        num_slots *= 2;
+    size_t size = num_slots * sizeof(int32_t) + SIMD_ALIGNMENT;
+    if(scratch_arena == NULL || scratch_arena->capacity < size) {
+        vp_arena_destroy(scratch_arena);
+        scratch_arena = vp_arena_create(size);
+    }
+    else
+        vp_arena_reset(scratch_arena);
+    int32_t* slots = scratch_arena == NULL ? NULL
+                   : vp_arena_alloc(scratch_arena, num_slots * sizeof(int32_t), SIMD_ALIGNMENT);
+    if(slots == NULL) {
+        perror("Could not allocate the proposal hash table");
+        return mapped_scores;
+    }
+    memset(slots, 0xFF, num_slots * sizeof(int32_t));
+
+    // Insert proposals; the first of several identical proposals wins, as in a linear search
+    for(size_t p = 0; p < num_proposals; p++) {
+        const int16_t* box = &proposals->data[p*5];
+        size_t slot = box_hash(box, num_slots - 1);
+        while(slots[slot] >= 0 && !same_box(&proposals->data[slots[slot]*5], box))
+            slot = (slot + 1) & (num_slots - 1);
+        if(slots[slot] < 0)
+            slots[slot] = p;
+    }
+
     for(size_t i = 0; i < num_rois; i++) {
-        int16_t counter = 0;
-        // Found matching roi
-        while(counter <= proposals->h) {
-           if(proposals->data[counter*5+0] == rois->data[i*5+0] &&
-           proposals->data[counter*5+1] == rois->data[i*5+1] && 
-           proposals->data[counter*5+2] == rois->data[i*5+2] &&
-           proposals->data[counter*5+3] == rois->data[i*5+3] && 
-           proposals->data[counter*5+4] == rois->data[i*5+4]) {
-               mapped_scores->data[i] = idx_scores->data[counter];
-               break;
-           }
-           else {
-               counter++;
-           } 
-        }
+        const int16_t* roi = &rois->data[i*5];
+        size_t slot = box_hash(roi, num_slots - 1);
+        while(slots[slot] >= 0 && !same_box(&proposals->data[slots[slot]*5], roi))
+            slot = (slot + 1) & (num_slots - 1);
         // Did not find a match, throw error
-        if(counter > proposals->h) {
+        if(slots[slot] < 0) {
             perror("Count not find roi in original set of proposals");
             break;
-        }   
+        }
+        // Found matching roi
+        mapped_scores->data[i] = idx_scores->data[slots[slot]];
+        TRACE(TRACE_MAP_SCORES_MATCH, i, slots[slot], 0, 0);
+    }
+    return mapped_scores;
+}
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------- //
+// vp_tensor_float32_t* map_scores_indexed() takes vp_tensor_float32_t* idx_scores - original 1-D array of scores corresponding to all RPN proposals  //
+//                                                 vp_tensor_fix16_t*   indices    - proposal index of each roi, as emitted by nms_indexed()          //
+// as arguments, returns a                         vp_tensor_float32_t*            - 1-D array of scores corresponding to each roi generated by nms   //
+// -------------------------------------------------------------------------------------------------------------------------------------------------- //
+vp_tensor_float32_output map_scores_indexed(vp_tensor_float32_input idx_scores,
+                                            vp_tensor_fix16_input indices) {
+    // Safety checks
+    assert(idx_scores->w >= indices->w);
+    size_t num_rois = indices->w;
+    vp_tensor_float32_output mapped_scores = vp_tensor_float32_malloc(1, 1, 1, num_rois);
+    for(size_t i = 0; i < num_rois; i++) {
+        assert(indices->data[i] >= 0 && indices->data[i] < idx_scores->w);
+        mapped_scores->data[i] = idx_scores->data[indices->data[i]];
+        TRACE(TRACE_MAP_SCORES_MATCH, i, indices->data[i], 0, 0);
     }
     return mapped_scores;
 }
@@ -1,6 +1,13 @@
 #ifndef MAP_SCORES_H_
+#define MAP_SCORES_H_
 #include "vp_interface.h"
 
 inline vp_tensor_float32_output map_scores(vp_tensor_float32_input idx_scores, vp_tensor_fix16_input rois, vp_tensor_fix16_input proposals);
 
+// O(rois) fast path for rois from nms_indexed(): indices holds the proposal index of each roi
+vp_tensor_float32_output map_scores_indexed(vp_tensor_float32_input idx_scores, vp_tensor_fix16_input indices);
+
+// Frees the scratch arena the calling thread keeps for map_scores(). Call before a worker thread exits.
+void map_scores_release_scratch();
+
 #endif /*MAP_SCORES_H_*/
\ No newline at end of file
@@ -2,8 +2,15 @@
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
 #include "vp_interface.h"
+#include "nms.h"
 #include "map_scores.h"
+#include "iou.h"
+#include "nms_grid.h"
+#include "trace.h"
 
 /* ----------------------------------------------------------------------
 --------------------------- Utility Macros ------------------------------
@@ -16,9 +23,11 @@
                     _a > _b ? _a : _b; })
 #define CLAMPF(num, max, min) (fmaxf(fminf(num, max), min))
 #define NMS_THRESH 0.3f // Global IoU threshold
+#define NMS_THRESH_Q IOU_THRESH_Q(NMS_THRESH) // Fixed-point threshold for iou_exceeds()
 #define NUM_ANCHORS 9 // Number of anchor boxes per proposal region
 
-// Intersection area over Union area
+#ifndef NO_TEST_MAIN
+// Intersection area over Union area (floating-point reference for iou_exceeds() in the test below)
 static float iou(vp_tensor_fix16_input xmins, vp_tensor_fix16_input ymins,
                  vp_tensor_fix16_input xmaxs, vp_tensor_fix16_input ymaxs,
                  vp_tensor_fix16_input areas, int16_t i, int16_t j) {
@@ -41,9 +50,104 @@ static float iou(vp_tensor_fix16_input xmins, vp_tensor_fix16_input ymins,
     int16_t u_area = area1 + area2 - i_area;
     
     out = CLAMPF(((float)i_area)/((float)u_area), 1.0f, 0.0f);
-    printf("\nComparing entries %d and %d: i_area = %d, u_area = %d, iou = %f\n",i, j, i_area, u_area, out);
+    TRACE(TRACE_NMS_IOU, i, j, i_area, u_area);
     return out;
 }
+#endif /*NO_TEST_MAIN*/
+
+// Bytes of scratch that nms_impl() needs with a grid of num_entries entries: NMS_ARENA_SIZE(N), the cell offsets,
+// the entries and a candidate list of up to N proposals
+#define NMS_GRID_SCRATCH_SIZE(N, num_entries) (NMS_ARENA_SIZE(N) + (NMS_GRID_MAX_CELLS + 1 + (size_t)(num_entries) + (size_t)(N)) \
+                                               * sizeof(uint32_t) + 3 * SIMD_ALIGNMENT)
+
+// Lays a grid of cell x cell pixels over the proposals. Returns the number of entries it needs.
+static size_t grid_layout(nms_grid_t* grid, vp_tensor_fix16_input proposals, size_t N, int32_t cell) {
+    int32_t x_lo = INT16_MAX, y_lo = INT16_MAX, x_hi = INT16_MIN, y_hi = INT16_MIN;
+    for(size_t i = 0; i < N; i++) {
+        x_lo = MIN(x_lo, (int32_t)MIN(proposals->data[i*5+0], proposals->data[i*5+2]));
+        y_lo = MIN(y_lo, (int32_t)MIN(proposals->data[i*5+1], proposals->data[i*5+3]));
+        x_hi = MAX(x_hi, (int32_t)MAX(proposals->data[i*5+0], proposals->data[i*5+2]));
+        y_hi = MAX(y_hi, (int32_t)MAX(proposals->data[i*5+1], proposals->data[i*5+3]));
+    }
+    nms_grid_layout(grid, x_lo, y_lo, x_hi, y_hi, cell);
+    size_t num_entries = 0;
+    for(size_t i = 0; i < N; i++)
+        num_entries += nms_grid_box_cells(grid, MIN(proposals->data[i*5+0], proposals->data[i*5+2]),
+                                          MIN(proposals->data[i*5+1], proposals->data[i*5+3]),
+                                          MAX(proposals->data[i*5+0], proposals->data[i*5+2]),
+                                          MAX(proposals->data[i*5+1], proposals->data[i*5+3]));
+    return num_entries;
+}
+
+// Fills a grid laid out by grid_layout(), with its cells taken from scratch. Returns false if scratch is too small.
+static bool grid_build(nms_grid_t* grid, vp_arena_t* scratch, vp_tensor_fix16_input proposals, size_t N) {
+    size_t num_cells = nms_grid_num_cells(grid);
+    grid->starts = vp_arena_alloc(scratch, (num_cells + 1) * sizeof(uint32_t), _Alignof(uint32_t));
+    if(grid->starts == NULL)
+        return false;
+    memset(grid->starts, 0, (num_cells + 1) * sizeof(uint32_t));
+    for(size_t i = 0; i < N; i++)
+        nms_grid_count(grid, MIN(proposals->data[i*5+0], proposals->data[i*5+2]),
+                       MIN(proposals->data[i*5+1], proposals->data[i*5+3]),
+                       MAX(proposals->data[i*5+0], proposals->data[i*5+2]),
+                       MAX(proposals->data[i*5+1], proposals->data[i*5+3]));
+    size_t num_entries = nms_grid_prefix(grid);
+    grid->entries = vp_arena_alloc(scratch, num_entries * sizeof(uint32_t), _Alignof(uint32_t));
+    if(grid->entries == NULL)
+        return false;
+    for(size_t i = 0; i < N; i++)
+        nms_grid_insert(grid, i, MIN(proposals->data[i*5+0], proposals->data[i*5+2]),
+                        MIN(proposals->data[i*5+1], proposals->data[i*5+3]),
+                        MAX(proposals->data[i*5+0], proposals->data[i*5+2]),
+                        MAX(proposals->data[i*5+1], proposals->data[i*5+3]));
+    nms_grid_finish(grid);
+    return true;
+}
+
+static int compare_index(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// The later proposals that are still kept and that share with proposal i the grid cell where their intersection
+// starts, in ascending order, i.e. the order the exhaustive loop visits them in. Returns their number.
+static size_t grid_candidates(const nms_grid_t* grid, size_t i,
+                              vp_tensor_fix16_input xmins, vp_tensor_fix16_input ymins,
+                              vp_tensor_fix16_input xmaxs, vp_tensor_fix16_input ymaxs,
+                              vp_tensor_fix16_input keep, uint32_t* candidates) {
+    const int32_t x_lo = MIN(xmins->data[i], xmaxs->data[i]), y_lo = MIN(ymins->data[i], ymaxs->data[i]);
+    const int32_t x_hi = MAX(xmins->data[i], xmaxs->data[i]), y_hi = MAX(ymins->data[i], ymaxs->data[i]);
+    int32_t c0, r0, c1, r1;
+    nms_grid_span(grid, x_lo, y_lo, x_hi, y_hi, &c0, &r0, &c1, &r1);
+    size_t num_candidates = 0;
+    for(int32_t r = r0; r <= r1; r++) {
+        for(int32_t c = c0; c <= c1; c++) {
+            const uint32_t* begin = grid->entries + grid->starts[r * grid->cols + c];
+            const uint32_t* end = grid->entries + grid->starts[r * grid->cols + c + 1];
+            // Entries are ascending, so walk back until the proposals before i
+            while(end != begin && *(end - 1) > i) {
+                uint32_t j = *--end;
+                if(keep->data[j] != 1)
+                    continue;
+                int32_t x = MAX(x_lo, (int32_t)MIN(xmins->data[j], xmaxs->data[j]));
+                int32_t y = MAX(y_lo, (int32_t)MIN(ymins->data[j], ymaxs->data[j]));
+                if(nms_grid_owns(grid, c, r, x, y))
+                    candidates[num_candidates++] = j;
+            }
+        }
+    }
+    if(r0 == r1 && c0 == c1) {
+        // A single cell was walked in descending order
+        for(size_t k = 0; k < num_candidates / 2; k++) {
+            uint32_t j = candidates[k];
+            candidates[k] = candidates[num_candidates - 1 - k];
+            candidates[num_candidates - 1 - k] = j;
+        }
+    }
+    else
+        qsort(candidates, num_candidates, sizeof(uint32_t), compare_index);
+    return num_candidates;
+}
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------- //
 // vp_tensor_fix16_t* nms() takes vp_tensor_float32_t* idx_scores - 1-D array of scores corresponding to N proposals.                                 //  
@@ -54,22 +158,35 @@ static float iou(vp_tensor_fix16_input xmins, vp_tensor_fix16_input ymins,
 // as arguments, returns a        vp_tensor_fix16_t*              - proposals with redundancies (non-maximal scores for overlapping regions) removed. //      
 // -------------------------------------------------------------------------------------------------------------------------------------------------- //
 
-vp_tensor_fix16_t* nms(vp_tensor_float32_input idx_scores,    // Scores of each anchor proposal, N scores 
-                       vp_tensor_fix16_input proposals,       // There will be 1 entry in idx_scores corresponding to each proposal (5 entries, 5th column is proposal ID)
-                       vp_scalar_fix16_input N) {             // Number of proposals
+// Temporaries come from scratch; the outputs come from out_arena, or from the heap if out_arena is NULL.
+// If indices is not NULL, *indices receives the proposal index of each output row.
+// If layout is not NULL, only the candidate pairs of a grid with that layout are compared, with the same result.
+static vp_tensor_fix16_t* nms_impl(vp_arena_t* scratch, vp_arena_t* out_arena,
+                                   vp_tensor_float32_input idx_scores,
+                                   vp_tensor_fix16_input proposals,
+                                   vp_scalar_fix16_input N,
+                                   vp_tensor_fix16_t** indices,
+                                   const bool class_aware,
+                                   const nms_grid_t* layout) {
     // Safety checks
     assert(N->data > 0);
     assert(proposals->h == N->data && proposals->w == 5);
     assert(idx_scores->w == N->data);
     
-    vp_tensor_fix16_t* xmins = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);
-    vp_tensor_fix16_t* xmaxs = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);
-    vp_tensor_fix16_t* ymins = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);
-    vp_tensor_fix16_t* ymaxs = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);
-    vp_tensor_fix16_t* areas = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);
-    vp_tensor_fix16_t* keep = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);      // maps i-th proposal to keep[i] = 1 or 0 corresponding to 1: Keep proposal, 0: Discard proposal
+    if(scratch == NULL)
+        return NULL;
+    vp_tensor_fix16_t* xmins = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* xmaxs = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* ymins = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* ymaxs = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* areas = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* keep = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);      // maps i-th proposal to keep[i] = 1 or 0 corresponding to 1: Keep proposal, 0: Discard proposal
+    if(keep == NULL)
+        return NULL; // arena too small; earlier allocations are released with it
 
     // Initialize array values
+    int32_t lowest = INT16_MAX;
+    int32_t highest = INT16_MIN;
     for(size_t i = 0; i < N->data; i++) {
         xmins->data[i] = proposals->data[i*5+0];
         ymins->data[i] = proposals->data[i*5+1];
@@ -77,69 +194,284 @@ vp_tensor_fix16_t* nms(vp_tensor_float32_input idx_scores,    // Scores of each
         ymaxs->data[i] = proposals->data[i*5+3];
         areas->data[i] = abs(xmaxs->data[i] - xmins->data[i]) * abs(ymaxs->data[i] - ymins->data[i]);
         keep->data[i] = 1;
-        // printf("Dims: (%d, %d), (%d, %d).   Class_ID = %d\n", xmins->data[i], ymins->data[i], xmaxs->data[i], ymaxs->data[i], proposals->data[i*5+4]);   
+        lowest = MIN(lowest, MIN(MIN(xmins->data[i], ymins->data[i]), MIN(xmaxs->data[i], ymaxs->data[i])));
+        highest = MAX(highest, MAX(MAX(xmins->data[i], ymins->data[i]), MAX(xmaxs->data[i], ymaxs->data[i])));
+    }
+
+    // Class-aware mode: shifting every box by class ID x span along both axes puts each class in its own
+    // region of the plane, so boxes of different classes never overlap and one pass handles all classes
+    const int32_t span = class_aware ? highest - lowest + 1 : 0;
+
+    // Grid mode: pairs outside a common cell do not intersect, so iou_exceeds() would not fire on them anyway. Class
+    // offsets only ever separate boxes, so the grid is built on the unshifted coordinates.
+    nms_grid_t grid;
+    uint32_t* candidates = NULL;
+    if(layout != NULL) {
+        grid = *layout;
+        candidates = vp_arena_alloc(scratch, N->data * sizeof(uint32_t), _Alignof(uint32_t));
+        if(candidates == NULL || !grid_build(&grid, scratch, proposals, N->data))
+            return NULL;
     }
 
     // Main NMS loops
     int16_t num_keep = N->data;             // Keeps track of the number of 1's in keep[]
     for(size_t i = 0; i < N->data; i++) {
         if(keep->data[i] != 1) continue;
-        for(size_t j = i+1; j < N->data; j++) {
+        size_t num_candidates = layout == NULL ? N->data - i - 1
+                              : grid_candidates(&grid, i, xmins, ymins, xmaxs, ymaxs, keep, candidates);
+        for(size_t c = 0; c < num_candidates; c++) {
+            size_t j = layout == NULL ? i + 1 + c : candidates[c];
             if(i == j) continue;
             if(keep->data[j] != 1) continue;
-            float iou_result = iou(xmins, ymins, xmaxs, ymaxs, areas, i, j);
-            if(iou_result >= NMS_THRESH) {
+            // Intersection and union areas, widened to 32 bits
+            const int32_t offset_i = span * proposals->data[i*5+4];
+            const int32_t offset_j = span * proposals->data[j*5+4];
+            int32_t x1 = MAX(xmins->data[i] + offset_i, xmins->data[j] + offset_j);
+            int32_t y1 = MAX(ymins->data[i] + offset_i, ymins->data[j] + offset_j);
+            int32_t x2 = MIN(xmaxs->data[i] + offset_i, xmaxs->data[j] + offset_j);
+            int32_t y2 = MIN(ymaxs->data[i] + offset_i, ymaxs->data[j] + offset_j);
+            int32_t i_area = MAX(x2 - x1 + 1, 0) * MAX(y2 - y1 + 1, 0);
+            int32_t u_area = areas->data[i] + areas->data[j] - i_area;
+            if(iou_exceeds(i_area, u_area, NMS_THRESH_Q)) {
                 // Exceeded IoU threshold, keep higher score of the 2 proposals
-                printf("NMS threshold exceeded. iou value = %f\n", iou_result);
+                TRACE(TRACE_NMS_EXCEEDED, i, j, i_area, u_area);
                 num_keep--;
                 if(idx_scores->data[i] >= idx_scores->data[j]) {
                     keep->data[j] = 0;
-                    printf("idx_scores->data[proposal %zd] = %f > %f = idx_scores->data[proposal %zd]\n", i, idx_scores->data[i], idx_scores->data[j], j);
-                    printf("Setting keep[proposal %zd] to 0\n", j);
+                    TRACE(TRACE_NMS_DISCARD, j, i, 0, 0);
                 }
                 else {
                     keep->data[i] = 0;
-                    printf("idx_scores->data[proposal %zd] = %f < %f = idx_scores->data[proposal %zd]\n", i, idx_scores->data[i], idx_scores->data[j], j);
-                    printf("Setting keep[proposal %zd] to 0\n", i);
+                    TRACE(TRACE_NMS_DISCARD, i, j, 0, 0);
                     break;
                 }
             }
-            else printf("Did not exceed NMS threshold, iou value = %f\n", iou_result);
+            else TRACE(TRACE_NMS_NOT_EXCEEDED, i, j, i_area, u_area);
         }
     }
     assert(num_keep <= N->data);
 
     // Re-generate proposals, discard redundant proposals
     int16_t idx = 0;
-    vp_tensor_fix16_t* output = vp_tensor_fix16_malloc(1, 1, num_keep, 5, 0);    
+    vp_tensor_fix16_t* output = out_arena == NULL
+                              ? vp_tensor_fix16_malloc(1, 1, num_keep, 5, 0)
+                              : vp_tensor_fix16_arena_malloc(out_arena, 1, 1, num_keep, 5, 0);
+    if(output == NULL)
+        return NULL;
+    vp_tensor_fix16_t* kept = NULL;
+    if(indices != NULL) {
+        kept = out_arena == NULL
+             ? vp_tensor_fix16_malloc(1, 1, 1, num_keep, 0)
+             : vp_tensor_fix16_arena_malloc(out_arena, 1, 1, 1, num_keep, 0);
+        if(kept == NULL) {
+            if(out_arena == NULL)
+                vp_tensor_free(output);
+            return NULL;
+        }
+        *indices = kept;
+    }
     for(size_t i = 0; i < num_keep; i++) {
         // Find next i such that keep[i] = 1 
         while(keep->data[idx] != 1) {
             idx++;
         }
-        printf("\nAdding proposal number: %d\n", idx);    
+        TRACE(TRACE_NMS_KEEP, i, idx, 0, 0);
         output->data[i*5+0] = proposals->data[idx*5+0];
         output->data[i*5+1] = proposals->data[idx*5+1];
         output->data[i*5+2] = proposals->data[idx*5+2];
         output->data[i*5+3] = proposals->data[idx*5+3];
         output->data[i*5+4] = proposals->data[idx*5+4];
+        if(kept != NULL)
+            kept->data[i] = idx;
         idx++;
     }
+    return output;
+}
 
-    // Free allocated memory
-    vp_tensor_free(xmins);
-    vp_tensor_free(ymins);
-    vp_tensor_free(xmaxs);
-    vp_tensor_free(ymaxs);
-    vp_tensor_free(areas);
-    vp_tensor_free(keep);
-            
+// Scratch arena for the temporaries of nms(), one per thread, grown on demand and reset on every call
+static __thread vp_arena_t* scratch_arena = NULL;
+
+static vp_arena_t* reset_scratch_arena(size_t size) {
+    if(scratch_arena == NULL || scratch_arena->capacity < size) {
+        vp_arena_destroy(scratch_arena);
+        scratch_arena = vp_arena_create(size);
+    }
+    else
+        vp_arena_reset(scratch_arena);
+    return scratch_arena;
+}
+
+void nms_release_scratch() {
+    vp_arena_destroy(scratch_arena);
+    scratch_arena = NULL;
+}
+
+vp_tensor_fix16_t* nms(vp_tensor_float32_input idx_scores,    // Scores of each anchor proposal, N scores 
+                       vp_tensor_fix16_input proposals,       // There will be 1 entry in idx_scores corresponding to each proposal (5 entries, 5th column is proposal ID)
+                       vp_scalar_fix16_input N) {             // Number of proposals
+    vp_arena_t* scratch = reset_scratch_arena(NMS_ARENA_SIZE(N->data));
+    return nms_impl(scratch, NULL, idx_scores, proposals, N, NULL, false, NULL);
+}
+
+vp_tensor_fix16_t* nms_indexed(vp_tensor_float32_input idx_scores,
+                               vp_tensor_fix16_input proposals,
+                               vp_scalar_fix16_input N,
+                               vp_tensor_fix16_t** indices) {
+    vp_arena_t* scratch = reset_scratch_arena(NMS_ARENA_SIZE(N->data));
+    return nms_impl(scratch, NULL, idx_scores, proposals, N, indices, false, NULL);
+}
+
+vp_tensor_fix16_t* nms_class_aware(vp_tensor_float32_input idx_scores,
+                                   vp_tensor_fix16_input proposals,
+                                   vp_scalar_fix16_input N) {
+    vp_arena_t* scratch = reset_scratch_arena(NMS_ARENA_SIZE(N->data));
+    return nms_impl(scratch, NULL, idx_scores, proposals, N, NULL, true, NULL);
+}
+
+vp_tensor_fix16_t* nms_with_grid(vp_tensor_float32_input idx_scores,
+                                 vp_tensor_fix16_input proposals,
+                                 vp_scalar_fix16_input N,
+                                 vp_scalar_fix16_input cell) {
+    assert(N->data > 0);
+    nms_grid_t layout;
+    size_t num_entries = grid_layout(&layout, proposals, N->data, cell->data);
+    vp_arena_t* scratch = reset_scratch_arena(NMS_GRID_SCRATCH_SIZE(N->data, num_entries));
+    return nms_impl(scratch, NULL, idx_scores, proposals, N, NULL, false, &layout);
+}
+
+vp_tensor_fix16_t* nms_arena(vp_arena_t* arena,
+                             vp_tensor_float32_input idx_scores,
+                             vp_tensor_fix16_input proposals,
+                             vp_scalar_fix16_input N,
+                             vp_tensor_fix16_t** indices) {
+    return nms_impl(arena, arena, idx_scores, proposals, N, indices, false, NULL);
+}
+
+// The proposals that are still candidates stay packed at the front of the temporaries. Each selection makes one pass
+// over them that decays their scores, drops those below the floor while preserving order, and finds the next best one.
+vp_tensor_fix16_t* nms_soft(const nms_soft_config_t* config,
+                            vp_tensor_float32_input idx_scores,
+                            vp_tensor_fix16_input proposals,
+                            vp_scalar_fix16_input N,
+                            vp_tensor_float32_t** scores) {
+    // Safety checks
+    assert(N->data > 0);
+    assert(proposals->h == N->data && proposals->w == 5);
+    assert(idx_scores->w == N->data);
+
+    vp_arena_t* scratch = reset_scratch_arena(NMS_SOFT_ARENA_SIZE(N->data));
+    if(scratch == NULL)
+        return NULL;
+    vp_tensor_fix16_t* xmins = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* xmaxs = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* ymins = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* ymaxs = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* rows = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);          // proposal index of each candidate
+    vp_tensor_fix16_t* selected = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);      // proposal index of each selection
+    vp_tensor_float32_t* areas = vp_tensor_float32_arena_malloc(scratch, 1, 1, 1, N->data);        // float, so large boxes do not wrap
+    vp_tensor_float32_t* decayed = vp_tensor_float32_arena_malloc(scratch, 1, 1, 1, N->data);      // decayed score of each candidate
+    vp_tensor_float32_t* selected_scores = vp_tensor_float32_arena_malloc(scratch, 1, 1, 1, N->data);
+    if(selected_scores == NULL)
+        return NULL;
+
+    const nms_mode_t mode = config->mode;
+    const int64_t thresh_q = IOU_THRESH_Q(config->iou_thresh);
+    const float inv_sigma = 1.0f / config->sigma;
+    const float floor = config->score_floor;
+    const size_t limit = config->max_detections > 0 ? MIN(config->max_detections, (size_t)N->data) : (size_t)N->data;
+
+    // Gather the candidates above the floor, and find the best one
+    size_t n = 0;
+    size_t best = 0;
+    for(size_t i = 0; i < N->data; i++) {
+        if(idx_scores->data[i] < floor)
+            continue;
+        xmins->data[n] = proposals->data[i*5+0];
+        ymins->data[n] = proposals->data[i*5+1];
+        xmaxs->data[n] = proposals->data[i*5+2];
+        ymaxs->data[n] = proposals->data[i*5+3];
+        areas->data[n] = (float)abs(xmaxs->data[n] - xmins->data[n]) * (float)abs(ymaxs->data[n] - ymins->data[n]);
+        decayed->data[n] = idx_scores->data[i];
+        rows->data[n] = i;
+        if(decayed->data[n] > decayed->data[best])
+            best = n;
+        n++;
+    }
+
+    size_t num_selected = 0;
+    while(n > 0 && num_selected < limit) {
+        selected->data[num_selected] = rows->data[best];
+        selected_scores->data[num_selected] = decayed->data[best];
+        num_selected++;
+        const int32_t bx1 = xmins->data[best], by1 = ymins->data[best];
+        const int32_t bx2 = xmaxs->data[best], by2 = ymaxs->data[best];
+        const float barea = areas->data[best];
+        const size_t current = best;
+
+        // Decay, compact and find the next best candidate in one pass
+        size_t m = 0;
+        best = 0;
+        for(size_t k = 0; k < n; k++) {
+            if(k == current)
+                continue;
+            int32_t x1 = MAX(bx1, (int32_t)xmins->data[k]);
+            int32_t y1 = MAX(by1, (int32_t)ymins->data[k]);
+            int32_t x2 = MIN(bx2, (int32_t)xmaxs->data[k]);
+            int32_t y2 = MIN(by2, (int32_t)ymaxs->data[k]);
+            int32_t i_area = MAX(x2 - x1 + 1, 0) * MAX(y2 - y1 + 1, 0);
+            int32_t u_area = (int32_t)(barea + areas->data[k]) - i_area;
+            float weight = 1.0f;
+            if(mode == NMS_SOFT_GAUSSIAN) {
+                if(i_area > 0) {
+                    float ratio = CLAMPF((float)i_area / (float)u_area, 1.0f, 0.0f);
+                    weight = expf(-ratio * ratio * inv_sigma);
+                }
+            }
+            else if(iou_exceeds(i_area, u_area, thresh_q))
+                weight = mode == NMS_HARD ? 0.0f : 1.0f - CLAMPF((float)i_area / (float)u_area, 1.0f, 0.0f);
+            float score = decayed->data[k] * weight;
+            TRACE(TRACE_NMS_IOU, rows->data[current], rows->data[k], i_area, u_area);
+            if(weight == 0.0f || score < floor) {
+                TRACE(TRACE_NMS_DISCARD, rows->data[k], rows->data[current], 0, 0);
+                continue;
+            }
+            xmins->data[m] = xmins->data[k];
+            ymins->data[m] = ymins->data[k];
+            xmaxs->data[m] = xmaxs->data[k];
+            ymaxs->data[m] = ymaxs->data[k];
+            areas->data[m] = areas->data[k];
+            decayed->data[m] = score;
+            rows->data[m] = rows->data[k];
+            if(score > decayed->data[best])
+                best = m;
+            m++;
+        }
+        n = m;
+    }
+
+    // Gather the selected proposals
+    vp_tensor_fix16_t* output = vp_tensor_fix16_malloc(1, 1, num_selected, 5, 0);
+    if(output == NULL)
+        return NULL;
+    if(scores != NULL) {
+        *scores = vp_tensor_float32_calloc(1, 1, 1, num_selected, selected_scores->data);
+        if(*scores == NULL) {
+            vp_tensor_free(output);
+            return NULL;
+        }
+    }
+    for(size_t i = 0; i < num_selected; i++) {
+        TRACE(TRACE_NMS_KEEP, i, selected->data[i], 0, 0);
+        memcpy(&output->data[i*5], &proposals->data[selected->data[i]*5], 5 * sizeof(int16_t));
+    }
     return output;
 }
 
 /* -----------------------------------------------------------------------
 ------------------------------- Testing ----------------------------------
 ----------------------------------------------------------------------- */
+// Left out with -DNO_TEST_MAIN when linked into the pipeline test
+#ifndef NO_TEST_MAIN
 int main() {
     // Test nms
     #define NUM_PROPOSALS 6
@@ -188,6 +520,65 @@ int main() {
         printf("Dims: (%d, %d), (%d, %d).   Class_ID = %d\n", output_2->data[i*5+0], output_2->data[i*5+1], output_2->data[i*5+2], output_2->data[i*5+3], output_2->data[i*5+4]);
     }
     
+    // nms_arena() must match nms(), and a reset arena must be reusable frame after frame
+    vp_arena_t* arena = vp_arena_create(NMS_ARENA_SIZE(NUM_PROPS_2));
+    for(size_t frame = 0; frame < 3; frame++) {
+        vp_arena_reset(arena);
+        vp_tensor_fix16_t* output_arena = nms_arena(arena, idx_scores_2, proposals_2, N, NULL);
+        assert(output_arena != NULL && output_arena->h == output_2->h);
+        assert(memcmp(output_arena->data, output_2->data, output_2->h * 5 * sizeof(int16_t)) == 0);
+        assert(arena->offset <= NMS_ARENA_SIZE(NUM_PROPS_2));
+    }
+    vp_arena_destroy(arena);
+
+    // nms_class_aware() must keep the same rows as running nms() on each class separately
+    vp_scalar_fix16_t* N_1 = vp_scalar_fix16_calloc(0, NUM_PROPOSALS);
+    vp_tensor_fix16_t* output_class_aware = nms_class_aware(idx_scores_1, proposals_1, N_1);
+    const size_t class_begin[4] = {0, 3, 5, NUM_PROPOSALS};     // data_proposals_1 is grouped by class ID
+    size_t row = 0;
+    for(size_t c = 0; c < 3; c++) {
+        vp_scalar_fix16_t* N_class = vp_scalar_fix16_calloc(0, class_begin[c+1] - class_begin[c]);
+        vp_tensor_float32_t* class_scores = vp_tensor_float32_calloc(1, 1, 1, N_class->data, &data_scores_1[class_begin[c]]);
+        vp_tensor_fix16_t* class_proposals = vp_tensor_fix16_calloc(1, 1, N_class->data, 5, 0, &data_proposals_1[class_begin[c]*5]);
+        vp_tensor_fix16_t* class_output = nms(class_scores, class_proposals, N_class);
+        assert(row + class_output->h <= output_class_aware->h);
+        assert(memcmp(&output_class_aware->data[row*5], class_output->data, class_output->h * 5 * sizeof(int16_t)) == 0);
+        row += class_output->h;
+        vp_scalar_free(N_class);
+        vp_tensor_free(class_scores);
+        vp_tensor_free(class_proposals);
+        vp_tensor_free(class_output);
+    }
+    assert(row == output_class_aware->h && output_class_aware->h > output_1->h);
+    vp_scalar_free(N_1);
+    vp_tensor_free(output_class_aware);
+
+    // Compare iou_exceeds() against the floating-point iou() on all pairs
+    vp_tensor_fix16_t* xmins = vp_tensor_fix16_malloc(1, 1, 1, NUM_PROPOSALS, 0);
+    vp_tensor_fix16_t* ymins = vp_tensor_fix16_malloc(1, 1, 1, NUM_PROPOSALS, 0);
+    vp_tensor_fix16_t* xmaxs = vp_tensor_fix16_malloc(1, 1, 1, NUM_PROPOSALS, 0);
+    vp_tensor_fix16_t* ymaxs = vp_tensor_fix16_malloc(1, 1, 1, NUM_PROPOSALS, 0);
+    vp_tensor_fix16_t* areas = vp_tensor_fix16_malloc(1, 1, 1, NUM_PROPOSALS, 0);
+    for(size_t i = 0; i < NUM_PROPOSALS; i++) {
+        xmins->data[i] = data_proposals_1[i*5+0];
+        ymins->data[i] = data_proposals_1[i*5+1];
+        xmaxs->data[i] = data_proposals_1[i*5+2];
+        ymaxs->data[i] = data_proposals_1[i*5+3];
+        areas->data[i] = abs(xmaxs->data[i] - xmins->data[i]) * abs(ymaxs->data[i] - ymins->data[i]);
+    }
+    for(int16_t i = 0; i < NUM_PROPOSALS; i++) {
+        for(int16_t j = 0; j < NUM_PROPOSALS; j++) {
+            int32_t x1 = MAX(xmins->data[i], xmins->data[j]);
+            int32_t y1 = MAX(ymins->data[i], ymins->data[j]);
+            int32_t x2 = MIN(xmaxs->data[i], xmaxs->data[j]);
+            int32_t y2 = MIN(ymaxs->data[i], ymaxs->data[j]);
+            int32_t i_area = MAX(x2 - x1 + 1, 0) * MAX(y2 - y1 + 1, 0);
+            int32_t u_area = areas->data[i] + areas->data[j] - i_area;
+            float iou_result = iou(xmins, ymins, xmaxs, ymaxs, areas, i, j);
+            assert((iou_result > NMS_THRESH) == iou_exceeds(i_area, u_area, NMS_THRESH_Q));
+        }
+    }
+
     // Compare mapped scores output  
     vp_tensor_float32_t* mapped_scores = map_scores(idx_scores_2, output_2, proposals_2);    
     for(size_t i = 0; i < idx_scores_2->w; i++) {
@@ -201,6 +592,113 @@ int main() {
         printf("\n");     
     }
 
+    // nms_indexed() must return the same rows as nms(), and map_scores_indexed() the same scores as map_scores()
+    vp_tensor_fix16_t* indices = NULL;
+    vp_tensor_fix16_t* output_indexed = nms_indexed(idx_scores_2, proposals_2, N, &indices);
+    assert(output_indexed->h == output_2->h && indices->w == output_2->h);
+    for(size_t i = 0; i < output_2->h; i++) {
+        assert(memcmp(&output_indexed->data[i*5], &output_2->data[i*5], 5 * sizeof(int16_t)) == 0);
+        assert(memcmp(&proposals_2->data[indices->data[i]*5], &output_2->data[i*5], 5 * sizeof(int16_t)) == 0);
+    }
+    vp_tensor_float32_t* mapped_indexed = map_scores_indexed(idx_scores_2, indices);
+    assert(memcmp(mapped_indexed->data, mapped_scores->data, mapped_scores->w * sizeof(float)) == 0);
+
+    // nms_soft() in NMS_HARD mode must select the rows nms() keeps, highest score first
+    nms_soft_config_t soft_config = NMS_SOFT_DEFAULT_CONFIG;
+    soft_config.mode = NMS_HARD;
+    soft_config.iou_thresh = NMS_THRESH;
+    vp_tensor_float32_t* soft_scores = NULL;
+    vp_tensor_fix16_t* output_soft = nms_soft(&soft_config, idx_scores_2, proposals_2, N, &soft_scores);
+    assert(output_soft->h == output_2->h && soft_scores->w == output_2->h);
+    for(size_t i = 0; i < output_soft->h; i++) {
+        bool found = false;
+        for(size_t j = 0; j < output_2->h; j++)
+            found |= memcmp(&output_soft->data[i*5], &output_2->data[j*5], 5 * sizeof(int16_t)) == 0;
+        assert(found);
+        assert(i == 0 || soft_scores->data[i] <= soft_scores->data[i-1]);
+    }
+    vp_tensor_free(output_soft);
+    vp_tensor_free(soft_scores);
+
+    // Linear decay keeps every proposal of this example, with non-increasing scores that never grow
+    soft_config.mode = NMS_SOFT_LINEAR;
+    output_soft = nms_soft(&soft_config, idx_scores_2, proposals_2, N, &soft_scores);
+    assert(output_soft->h == NUM_PROPS_2 && soft_scores->data[0] == 0.7f);
+    for(size_t i = 1; i < output_soft->h; i++)
+        assert(soft_scores->data[i] <= soft_scores->data[i-1]);
+    printf("\nSoft-NMS (linear):\n");
+    for(size_t i = 0; i < output_soft->h; i++) {
+        printf("Dims: (%d, %d), (%d, %d).   Class_ID = %d   Score = %f\n", output_soft->data[i*5+0], output_soft->data[i*5+1], output_soft->data[i*5+2], output_soft->data[i*5+3], output_soft->data[i*5+4], soft_scores->data[i]);
+    }
+    vp_tensor_free(output_soft);
+    vp_tensor_free(soft_scores);
+
+    // Gaussian decay with a cap returns the best proposal only
+    soft_config.mode = NMS_SOFT_GAUSSIAN;
+    soft_config.max_detections = 1;
+    output_soft = nms_soft(&soft_config, idx_scores_2, proposals_2, N, NULL);
+    assert(output_soft->h == 1);
+    assert(memcmp(output_soft->data, &proposals_2->data[1*5], 5 * sizeof(int16_t)) == 0);
+    vp_tensor_free(output_soft);
+
+    // nms_with_grid() must return exactly what nms() returns, for any cell size
+    #define NUM_DENSE 2000
+    vp_scalar_fix16_t* N_dense = vp_scalar_fix16_calloc(0, NUM_DENSE);
+    vp_tensor_fix16_t* dense_proposals = vp_tensor_fix16_malloc(1, 1, NUM_DENSE, 5, 0);
+    vp_tensor_float32_t* dense_scores = vp_tensor_float32_malloc(1, 1, 1, NUM_DENSE);
+    srand(2);
+    for(size_t i = 0; i < NUM_DENSE; i++) {
+        int16_t x = rand() % 480, y = rand() % 360;
+        dense_proposals->data[i*5+0] = x;
+        dense_proposals->data[i*5+1] = y;
+        dense_proposals->data[i*5+2] = x + 8 + rand() % 56;
+        dense_proposals->data[i*5+3] = y + 8 + rand() % 56;
+        dense_proposals->data[i*5+4] = rand() % 4;
+        dense_scores->data[i] = (float)rand() / RAND_MAX;
+    }
+    clock_t start = clock();
+    vp_tensor_fix16_t* output_dense = nms(dense_scores, dense_proposals, N_dense);
+    clock_t exhaustive = clock() - start;
+    const int16_t cells[4] = {4, 32, 64, 1024};
+    for(size_t k = 0; k < 4; k++) {
+        vp_scalar_fix16_t* cell = vp_scalar_fix16_calloc(0, cells[k]);
+        start = clock();
+        vp_tensor_fix16_t* output_grid = nms_with_grid(dense_scores, dense_proposals, N_dense, cell);
+        clock_t gridded = clock() - start;
+        assert(output_grid->h == output_dense->h);
+        assert(memcmp(output_grid->data, output_dense->data, output_dense->h * 5 * sizeof(int16_t)) == 0);
+        printf("nms: %.3f ms, nms_with_grid (cell %d): %.3f ms on %d proposals\n",
+               1000.0 * exhaustive / CLOCKS_PER_SEC, cells[k], 1000.0 * gridded / CLOCKS_PER_SEC, NUM_DENSE);
+        vp_scalar_free(cell);
+        vp_tensor_free(output_grid);
+    }
+    vp_scalar_free(N_dense);
+    vp_tensor_free(dense_proposals);
+    vp_tensor_free(dense_scores);
+    vp_tensor_free(output_dense);
+
+    // The hashed lookup in map_scores() must agree with a linear search, including duplicate proposals
+    #define NUM_RANDOM 6000
+    #define NUM_RANDOM_ROIS 300
+    srand(1);
+    vp_tensor_fix16_t* random_proposals = vp_tensor_fix16_malloc(1, 1, NUM_RANDOM, 5, 0);
+    vp_tensor_float32_t* random_scores = vp_tensor_float32_malloc(1, 1, 1, NUM_RANDOM);
+    vp_tensor_fix16_t* random_rois = vp_tensor_fix16_malloc(1, 1, NUM_RANDOM_ROIS, 5, 0);
+    for(size_t i = 0; i < NUM_RANDOM * 5; i++)
+        random_proposals->data[i] = rand() % 64 - 8;
+    for(size_t i = 0; i < NUM_RANDOM; i++)
+        random_scores->data[i] = (float)rand() / RAND_MAX;
+    for(size_t i = 0; i < NUM_RANDOM_ROIS; i++)
+        memcpy(&random_rois->data[i*5], &random_proposals->data[(rand() % NUM_RANDOM)*5], 5 * sizeof(int16_t));
+    vp_tensor_float32_t* random_mapped = map_scores(random_scores, random_rois, random_proposals);
+    for(size_t i = 0; i < NUM_RANDOM_ROIS; i++) {
+        size_t p = 0;
+        while(memcmp(&random_proposals->data[p*5], &random_rois->data[i*5], 5 * sizeof(int16_t)) != 0)
+            p++;
+        assert(random_mapped->data[i] == random_scores->data[p]);
+    }
+
+    trace_dump(stdout);
     printf("\nDon't compile on a windows machine, posix is a unix library.\n");
 
     // Free allocated memory
@@ -212,6 +710,19 @@ int main() {
     vp_tensor_free(proposals_2);
     vp_tensor_free(output_2);
     vp_tensor_free(mapped_scores);
+    vp_tensor_free(output_indexed);
+    vp_tensor_free(indices);
+    vp_tensor_free(mapped_indexed);
+    vp_tensor_free(random_proposals);
+    vp_tensor_free(random_scores);
+    vp_tensor_free(random_rois);
+    vp_tensor_free(random_mapped);
+    vp_tensor_free(xmins);
+    vp_tensor_free(ymins);
+    vp_tensor_free(xmaxs);
+    vp_tensor_free(ymaxs);
+    vp_tensor_free(areas);
     
     return 0;
-}
\ No newline at end of file
+}
+#endif /*NO_TEST_MAIN*/
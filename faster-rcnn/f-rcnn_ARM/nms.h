@@ -4,4 +4,58 @@
 
 inline vp_tensor_fix16_t* nms(vp_tensor_float32_input idx_scores, vp_tensor_fix16_input proposals, vp_scalar_fix16_input N);
 
+// Same as nms(), but the 5th proposal column (class ID) is honored: proposals of different classes never suppress each other
+vp_tensor_fix16_t* nms_class_aware(vp_tensor_float32_input idx_scores, vp_tensor_fix16_input proposals, vp_scalar_fix16_input N);
+
+// Same as nms(), but only proposals that share a cell of a uniform grid of cell x cell pixels are compared (see
+// nms_grid.h); the output is bit-identical. With cells about the size of a typical proposal, the work grows with N
+// times the number of neighbours rather than N^2, which pays off on frames dense with small proposals.
+vp_tensor_fix16_t* nms_with_grid(vp_tensor_float32_input idx_scores, vp_tensor_fix16_input proposals, vp_scalar_fix16_input N,
+                                 vp_scalar_fix16_input cell);
+
+// Same as nms(), and *indices receives a (1, 1, 1, num_keep) tensor holding, for each output row, the index of that
+// proposal in the input. Pass it to map_scores_indexed(). Free both tensors with vp_tensor_free.
+vp_tensor_fix16_t* nms_indexed(vp_tensor_float32_input idx_scores, vp_tensor_fix16_input proposals, vp_scalar_fix16_input N, vp_tensor_fix16_t** indices);
+
+// Bytes of arena that nms_arena() needs for N proposals: 6 temporaries of N entries, an output of up to N x 5 and up to N indices
+#define NMS_ARENA_SIZE(N) (12 * (size_t)(N) * sizeof(int16_t) + 8 * (sizeof(vp_tensor_fix16_t) + 2 * SIMD_ALIGNMENT))
+
+// Same as nms_indexed() (indices may be NULL), but the temporaries and the returned tensors come from arena and are
+// released by vp_arena_reset(arena). Returns NULL if arena has less than NMS_ARENA_SIZE(N->data) bytes left.
+vp_tensor_fix16_t* nms_arena(vp_arena_t* arena, vp_tensor_float32_input idx_scores, vp_tensor_fix16_input proposals, vp_scalar_fix16_input N, vp_tensor_fix16_t** indices);
+
+// Frees the scratch arena the calling thread keeps for nms() and its variants. Call before a worker thread exits.
+void nms_release_scratch();
+
+// How nms_soft() treats the proposals that overlap a selected one
+typedef enum nms_mode {
+    NMS_HARD,           // discard them if IoU > iou_thresh
+    NMS_SOFT_LINEAR,    // scale their score by (1 - IoU) if IoU > iou_thresh
+    NMS_SOFT_GAUSSIAN   // scale their score by exp(-IoU^2 / sigma)
+} nms_mode_t;
+
+typedef struct nms_soft_config {
+    nms_mode_t mode;
+    float iou_thresh;       // NMS_HARD and NMS_SOFT_LINEAR
+    float sigma;            // NMS_SOFT_GAUSSIAN
+    float score_floor;      // proposals whose decayed score drops below are discarded
+    size_t max_detections;  // stop after this many proposals, 0 for no limit
+} nms_soft_config_t;
+
+// Soft-NMS as in Bodla et al.
+#define NMS_SOFT_DEFAULT_CONFIG { .mode = NMS_SOFT_LINEAR, .iou_thresh = 0.3f, .sigma = 0.5f, \
+                                  .score_floor = 0.001f, .max_detections = 0 }
+
+// Bytes of scratch that nms_soft() needs for N proposals: 6 temporaries of N int16 and 3 of N float
+#define NMS_SOFT_ARENA_SIZE(N) (6 * (size_t)(N) * sizeof(int16_t) + 3 * (size_t)(N) * sizeof(float) \
+                                + 9 * (sizeof(vp_tensor_fix16_t) + sizeof(vp_tensor_float32_t) + 2 * SIMD_ALIGNMENT))
+
+// Soft-NMS: repeatedly selects the proposal with the highest (decayed) score, then decays the scores of the proposals
+// overlapping it according to config->mode. Stops when no score is left above config->score_floor, or after
+// config->max_detections proposals, so the work is about N per selected proposal rather than N^2.
+// Returns the selected proposals in selection order, i.e. by descending decayed score, and *scores (if not NULL)
+// receives a (1, 1, 1, num_selected) tensor of their decayed scores. Free both tensors with vp_tensor_free.
+vp_tensor_fix16_t* nms_soft(const nms_soft_config_t* config, vp_tensor_float32_input idx_scores, vp_tensor_fix16_input proposals,
+                            vp_scalar_fix16_input N, vp_tensor_float32_t** scores);
+
 #endif /*NMS_H_*/
\ No newline at end of file
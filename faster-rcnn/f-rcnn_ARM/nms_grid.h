@@ -0,0 +1,123 @@
+/*
+ * Uniform-grid index of boxes, used by NMS to skip pairs that cannot overlap
+ *   - The bounding rectangle of all boxes is cut into square cells of
+ *     cell x cell pixels, and every box is listed in each cell it touches
+ *     (inclusive of its edges). Two boxes with a positive intersection share
+ *     at least one cell, so only pairs found in a common cell are tested.
+ *   - A pair can share several cells. It is reported only in the cell that
+ *     contains the top-left corner of the intersection, i.e.
+ *     (max of the left edges, max of the top edges); see nms_grid_owns().
+ *   - Pairs the grid skips have zero intersection, and iou_exceeds() never
+ *     suppresses such a pair, so NMS results are bit-identical to the
+ *     exhaustive loop.
+ *   - The cells are stored in compressed form: cell c lists
+ *     entries[starts[c] .. starts[c+1]), with box indices in ascending order.
+ *     Building takes one counting pass and one filling pass:
+ *         nms_grid_layout(), then nms_grid_count() per box,
+ *         nms_grid_prefix(), then nms_grid_insert() per box in index order,
+ *         then nms_grid_finish().
+ *   - Coordinates are passed as (x_lo, y_lo, x_hi, y_hi); callers whose
+ *     boxes store the corners in another order swap them first.
+ *   - This header is duplicated in rfcn/, faster-rcnn/f-rcnn_ARM/ and
+ *     ssd/ssd_ARM/; keep the copies identical.
+ */
+#ifndef NMS_GRID_H_
+#define NMS_GRID_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* The cell size is doubled until the grid has at most this many cells */
+#define NMS_GRID_MAX_CELLS 4096
+
+typedef struct nms_grid {
+    int32_t x0, y0;    // top-left corner of cell 0
+    int32_t cell;      // cell size in pixels
+    int32_t cols, rows;
+    uint32_t* starts;  // cols * rows + 1 offsets into entries
+    uint32_t* entries; // box indices, ascending within each cell
+} nms_grid_t;
+
+/* Sets the geometry of g to cover [x_lo, x_hi] x [y_lo, y_hi]. */
+static inline void nms_grid_layout(nms_grid_t* g, int32_t x_lo, int32_t y_lo,
+                                   int32_t x_hi, int32_t y_hi, int32_t cell) {
+    g->x0 = x_lo;
+    g->y0 = y_lo;
+    g->cell = cell > 0 ? cell : 1;
+    for(;;) {
+        g->cols = (x_hi - x_lo) / g->cell + 1;
+        g->rows = (y_hi - y_lo) / g->cell + 1;
+        if((int64_t)g->cols * g->rows <= NMS_GRID_MAX_CELLS)
+            break;
+        g->cell *= 2;
+    }
+}
+
+static inline size_t nms_grid_num_cells(const nms_grid_t* g) {
+    return (size_t)g->cols * g->rows;
+}
+
+/* Columns [*c0, *c1] and rows [*r0, *r1] touched by a box */
+static inline void nms_grid_span(const nms_grid_t* g, int32_t x_lo,
+                                 int32_t y_lo, int32_t x_hi, int32_t y_hi,
+                                 int32_t* c0, int32_t* r0,
+                                 int32_t* c1, int32_t* r1) {
+    *c0 = (x_lo - g->x0) / g->cell;
+    *r0 = (y_lo - g->y0) / g->cell;
+    *c1 = (x_hi - g->x0) / g->cell;
+    *r1 = (y_hi - g->y0) / g->cell;
+}
+
+/* Number of cells a box touches, i.e. its number of entries */
+static inline size_t nms_grid_box_cells(const nms_grid_t* g, int32_t x_lo,
+                                        int32_t y_lo, int32_t x_hi,
+                                        int32_t y_hi) {
+    int32_t c0, r0, c1, r1;
+    nms_grid_span(g, x_lo, y_lo, x_hi, y_hi, &c0, &r0, &c1, &r1);
+    return (size_t)(c1 - c0 + 1) * (r1 - r0 + 1);
+}
+
+/* Counting pass; g->starts must hold nms_grid_num_cells(g) + 1 zeros. */
+static inline void nms_grid_count(nms_grid_t* g, int32_t x_lo, int32_t y_lo,
+                                  int32_t x_hi, int32_t y_hi) {
+    int32_t c0, r0, c1, r1;
+    nms_grid_span(g, x_lo, y_lo, x_hi, y_hi, &c0, &r0, &c1, &r1);
+    for(int32_t r = r0; r <= r1; r++)
+        for(int32_t c = c0; c <= c1; c++)
+            g->starts[r * g->cols + c + 1]++;
+}
+
+/* Turns the counts into offsets. Returns the total number of entries. */
+static inline size_t nms_grid_prefix(nms_grid_t* g) {
+    size_t cells = nms_grid_num_cells(g);
+    for(size_t c = 0; c < cells; c++)
+        g->starts[c+1] += g->starts[c];
+    return g->starts[cells];
+}
+
+/* Filling pass; starts[c] serves as the write cursor of cell c. */
+static inline void nms_grid_insert(nms_grid_t* g, uint32_t box, int32_t x_lo,
+                                   int32_t y_lo, int32_t x_hi, int32_t y_hi) {
+    int32_t c0, r0, c1, r1;
+    nms_grid_span(g, x_lo, y_lo, x_hi, y_hi, &c0, &r0, &c1, &r1);
+    for(int32_t r = r0; r <= r1; r++)
+        for(int32_t c = c0; c <= c1; c++)
+            g->entries[g->starts[r * g->cols + c]++] = box;
+}
+
+/* After the filling pass each cursor points at the start of the next cell;
+ * shift them back into place. */
+static inline void nms_grid_finish(nms_grid_t* g) {
+    for(size_t c = nms_grid_num_cells(g); c > 0; c--)
+        g->starts[c] = g->starts[c-1];
+    g->starts[0] = 0;
+}
+
+/* Whether the pair whose intersection starts at (x, y) is reported in cell
+ * (c, r) */
+static inline bool nms_grid_owns(const nms_grid_t* g, int32_t c, int32_t r,
+                                 int32_t x, int32_t y) {
+    return (x - g->x0) / g->cell == c && (y - g->y0) / g->cell == r;
+}
+
+#endif
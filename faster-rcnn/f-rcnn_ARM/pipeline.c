@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "pipeline.h"
+#include "spsc_queue.h"
+
+/* ----------------------------------------------------------------------
+--------------------------- Utility Macros ------------------------------
+---------------------------------------------------------------------- */
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+#define SPIN_LIMIT 64    // polls before yielding the core
+#define YIELD_LIMIT 128  // polls before sleeping
+#define SLEEP_NS 50000   // sleep between polls after that
+
+// Pushed through every lane by pipeline_close(); never handed to a stage function
+static char end_marker;
+#define END_OF_INPUT ((void*)&end_marker)
+
+typedef struct pipeline_worker {
+    pipeline_t* pipeline;
+    const pipeline_stage_t* stage;
+    spsc_queue_t* input;
+    spsc_queue_t* output;
+    pthread_t thread;
+    bool started;
+    // Written by the worker, read by pipeline_get_stats()
+    _Alignas(64) atomic_size_t num_frames;
+    atomic_uint_fast64_t busy_ns;
+    atomic_uint_fast64_t starved_ns;
+    atomic_uint_fast64_t blocked_ns;
+} pipeline_worker_t;
+
+struct pipeline {
+    const pipeline_stage_t* stages;
+    size_t num_stages;
+    size_t num_lanes;
+    size_t depth;               // frames a queue holds at most, the end marker aside
+    spsc_queue_t* queues;       // num_stages + 1 per lane: the input of each stage, then the output of the last one
+    pipeline_worker_t* workers; // num_stages per lane
+    size_t num_submitted;
+    size_t num_collected;
+    bool drained;               // pipeline_collect() saw the end of the input
+    atomic_bool failed;
+    uint64_t start_ns;
+};
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+// Waits between two polls of a queue: spins, then yields, then sleeps
+static void backoff(unsigned* polls) {
+    if(*polls < SPIN_LIMIT)
+        CPU_RELAX();
+    else if(*polls < YIELD_LIMIT)
+        sched_yield();
+    else {
+        struct timespec t = {0, SLEEP_NS};
+        nanosleep(&t, NULL);
+    }
+    (*polls)++;
+}
+
+// Frames wait for the queue to hold fewer than depth items; the end marker goes into the slot kept free for it
+static void push(pipeline_t* pipeline, spsc_queue_t* queue, void* item) {
+    unsigned polls = 0;
+    while((item != END_OF_INPUT && spsc_queue_size(queue) >= pipeline->depth) || !spsc_queue_push(queue, item))
+        backoff(&polls);
+}
+
+static void* pop(spsc_queue_t* queue) {
+    void* item;
+    unsigned polls = 0;
+    while((item = spsc_queue_pop(queue)) == NULL)
+        backoff(&polls);
+    return item;
+}
+
+static void* run_worker(void* arg) {
+    pipeline_worker_t* worker = arg;
+    for(;;) {
+        uint64_t start = now_ns();
+        void* frame = pop(worker->input);
+        uint64_t popped = now_ns();
+        atomic_fetch_add_explicit(&worker->starved_ns, popped - start, memory_order_relaxed);
+
+        uint64_t done = popped;
+        if(frame != END_OF_INPUT) {
+            if(!worker->stage->run(frame, worker->stage->context))
+                atomic_store(&worker->pipeline->failed, true);
+            done = now_ns();
+            atomic_fetch_add_explicit(&worker->busy_ns, done - popped, memory_order_relaxed);
+            atomic_fetch_add_explicit(&worker->num_frames, 1, memory_order_relaxed);
+        }
+
+        push(worker->pipeline, worker->output, frame);
+        atomic_fetch_add_explicit(&worker->blocked_ns, now_ns() - done, memory_order_relaxed);
+        if(frame == END_OF_INPUT) {
+            if(worker->stage->release != NULL)
+                worker->stage->release(worker->stage->context);
+            return NULL;
+        }
+    }
+}
+
+// Ends every lane and joins the workers that were started
+static void stop_workers(pipeline_t* pipeline) {
+    for(size_t l = 0; l < pipeline->num_lanes; l++)
+        push(pipeline, &pipeline->queues[l * (pipeline->num_stages + 1)], END_OF_INPUT);
+    for(size_t w = 0; w < pipeline->num_lanes * pipeline->num_stages; w++)
+        if(pipeline->workers[w].started)
+            pthread_join(pipeline->workers[w].thread, NULL);
+}
+
+static void free_pipeline(pipeline_t* pipeline) {
+    if(pipeline->queues != NULL)
+        for(size_t q = 0; q < pipeline->num_lanes * (pipeline->num_stages + 1); q++)
+            spsc_queue_destroy(&pipeline->queues[q]);
+    free(pipeline->queues);
+    free(pipeline->workers);
+    free(pipeline);
+}
+
+pipeline_t* pipeline_create(const pipeline_stage_t* stages, size_t num_stages, size_t num_lanes, size_t depth) {
+    assert(num_stages > 0 && num_lanes > 0 && depth > 0);
+    pipeline_t* pipeline = calloc(1, sizeof(pipeline_t));
+    if(pipeline == NULL) {
+        perror("Could not allocate the pipeline");
+        return NULL;
+    }
+    pipeline->stages = stages;
+    pipeline->num_stages = num_stages;
+    pipeline->num_lanes = num_lanes;
+    pipeline->depth = depth;
+    atomic_init(&pipeline->failed, false);
+    size_t num_queues = num_lanes * (num_stages + 1);
+    // Both hold _Alignas(64) members, so head and tail of each queue get a cache line of their own
+    pipeline->queues = aligned_alloc(64, (num_queues * sizeof(spsc_queue_t) + 63) & ~(size_t)63);
+    pipeline->workers = aligned_alloc(64, (num_lanes * num_stages * sizeof(pipeline_worker_t) + 63) & ~(size_t)63);
+    if(pipeline->queues == NULL || pipeline->workers == NULL) {
+        perror("Could not allocate the pipeline");
+        free(pipeline->queues);
+        pipeline->queues = NULL;
+        free_pipeline(pipeline);
+        return NULL;
+    }
+    memset(pipeline->queues, 0, num_queues * sizeof(spsc_queue_t));
+    memset(pipeline->workers, 0, num_lanes * num_stages * sizeof(pipeline_worker_t));
+    // push() stops frames at depth, so the extra slot is left for the end marker and pipeline_close() never waits on
+    // a queue full of frames. The ring may round up to more slots, which push() leaves unused.
+    for(size_t q = 0; q < num_queues; q++) {
+        if(!spsc_queue_init(&pipeline->queues[q], depth + 1)) {
+            perror("Could not allocate the pipeline queues");
+            free_pipeline(pipeline);
+            return NULL;
+        }
+    }
+
+    pipeline->start_ns = now_ns();
+    for(size_t l = 0; l < num_lanes; l++) {
+        for(size_t s = 0; s < num_stages; s++) {
+            pipeline_worker_t* worker = &pipeline->workers[l * num_stages + s];
+            worker->pipeline = pipeline;
+            worker->stage = &stages[s];
+            worker->input = &pipeline->queues[l * (num_stages + 1) + s];
+            worker->output = worker->input + 1;
+            atomic_init(&worker->num_frames, 0);
+            atomic_init(&worker->busy_ns, 0);
+            atomic_init(&worker->starved_ns, 0);
+            atomic_init(&worker->blocked_ns, 0);
+            if(pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+                fprintf(stderr, "Could not start the worker of stage %s\n", stages[s].name);
+                stop_workers(pipeline);
+                free_pipeline(pipeline);
+                return NULL;
+            }
+            worker->started = true;
+        }
+    }
+    return pipeline;
+}
+
+void pipeline_submit(pipeline_t* pipeline, void* frame) {
+    assert(frame != NULL && frame != END_OF_INPUT);
+    size_t lane = pipeline->num_submitted++ % pipeline->num_lanes;
+    push(pipeline, &pipeline->queues[lane * (pipeline->num_stages + 1)], frame);
+}
+
+void* pipeline_collect(pipeline_t* pipeline) {
+    if(pipeline->drained)
+        return NULL;
+    size_t lane = pipeline->num_collected % pipeline->num_lanes;
+    void* frame = pop(&pipeline->queues[lane * (pipeline->num_stages + 1) + pipeline->num_stages]);
+    if(frame == END_OF_INPUT) {
+        // Lanes end in the order frames are dealt, so the other lanes have nothing left either
+        pipeline->drained = true;
+        return NULL;
+    }
+    pipeline->num_collected++;
+    return frame;
+}
+
+void pipeline_close(pipeline_t* pipeline) {
+    // Starting with the lane of the next frame keeps the end markers in submission order
+    for(size_t i = 0; i < pipeline->num_lanes; i++) {
+        size_t lane = (pipeline->num_submitted + i) % pipeline->num_lanes;
+        push(pipeline, &pipeline->queues[lane * (pipeline->num_stages + 1)], END_OF_INPUT);
+    }
+}
+
+bool pipeline_failed(pipeline_t* pipeline) {
+    return atomic_load(&pipeline->failed);
+}
+
+uint64_t pipeline_get_stats(pipeline_t* pipeline, pipeline_stage_stats_t* stats) {
+    for(size_t s = 0; s < pipeline->num_stages; s++) {
+        memset(&stats[s], 0, sizeof(pipeline_stage_stats_t));
+        stats[s].name = pipeline->stages[s].name;
+        for(size_t l = 0; l < pipeline->num_lanes; l++) {
+            pipeline_worker_t* worker = &pipeline->workers[l * pipeline->num_stages + s];
+            stats[s].num_frames += atomic_load_explicit(&worker->num_frames, memory_order_relaxed);
+            stats[s].busy_ns += atomic_load_explicit(&worker->busy_ns, memory_order_relaxed);
+            stats[s].starved_ns += atomic_load_explicit(&worker->starved_ns, memory_order_relaxed);
+            stats[s].blocked_ns += atomic_load_explicit(&worker->blocked_ns, memory_order_relaxed);
+        }
+    }
+    return now_ns() - pipeline->start_ns;
+}
+
+void pipeline_print_stats(pipeline_t* pipeline, FILE* stream) {
+    pipeline_stage_stats_t stats[pipeline->num_stages];
+    uint64_t wall_ns = pipeline_get_stats(pipeline, stats);
+    fprintf(stream, "%-20s %8s %10s %10s %12s %12s %12s\n", "stage", "frames", "frames/s", "occupancy",
+            "ms/frame", "starved ms", "blocked ms");
+    for(size_t s = 0; s < pipeline->num_stages; s++) {
+        fprintf(stream, "%-20s %8zu %10.1f %9.1f%% %12.3f %12.1f %12.1f\n", stats[s].name, stats[s].num_frames,
+                stats[s].num_frames / (wall_ns / 1e9),
+                100.0 * stats[s].busy_ns / ((double)wall_ns * pipeline->num_lanes),
+                stats[s].num_frames ? stats[s].busy_ns / 1e6 / stats[s].num_frames : 0.0,
+                stats[s].starved_ns / 1e6, stats[s].blocked_ns / 1e6);
+    }
+}
+
+void pipeline_destroy(pipeline_t* pipeline) {
+    if(pipeline == NULL)
+        return;
+    for(size_t w = 0; w < pipeline->num_lanes * pipeline->num_stages; w++)
+        pthread_join(pipeline->workers[w].thread, NULL);
+    free_pipeline(pipeline);
+}
@@ -0,0 +1,76 @@
+/*
+ * Pipelined executor for chains of ARM stages
+ *   - Each stage of a lane runs on its own worker thread. Consecutive stages
+ *     are linked by bounded SPSC queues (spsc_queue.h), so frame t+1 enters
+ *     a stage as soon as frame t leaves it, and the frame rate is set by the
+ *     slowest stage rather than by the sum of all stages.
+ *   - With several lanes, the whole chain is replicated and frames are dealt
+ *     round-robin, which scales the frame rate with the core count once the
+ *     slowest stage is saturated. The latency of a frame does not change.
+ *     pipeline_collect() takes the lanes in the same order, so frames come
+ *     out in submission order.
+ *   - Frames are opaque to the executor: a frame is whatever the stage
+ *     functions agree on, e.g. a frcnn_frame_t (frcnn_pipeline.h).
+ *   - A stage function returning false marks the pipeline failed. The frame
+ *     still moves on, so later stages must cope with its missing outputs.
+ *   - Workers spin briefly, then yield, then sleep while their input queue
+ *     is empty or their output queue is full. Time spent so is counted as
+ *     starved or blocked, apart from the time spent in the stage function.
+ */
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef bool (*pipeline_stage_fn)(void* frame, void* context);
+
+// Called by each worker of a stage before it exits, e.g. to free the thread-local scratch memory of the kernels
+typedef void (*pipeline_release_fn)(void* context);
+
+typedef struct pipeline_stage {
+    const char* name;
+    pipeline_stage_fn run;
+    void* context;
+    pipeline_release_fn release; // may be NULL
+} pipeline_stage_t;
+
+typedef struct pipeline_stage_stats {
+    const char* name;
+    size_t num_frames;   // frames through the stage, over all lanes
+    uint64_t busy_ns;    // time in the stage function
+    uint64_t starved_ns; // time waiting for an input
+    uint64_t blocked_ns; // time waiting for room downstream
+} pipeline_stage_stats_t;
+
+typedef struct pipeline pipeline_t;
+
+// Starts num_lanes copies of the num_stages stages, with depth frames of room between stages. stages must outlive the
+// pipeline. Returns NULL, with a message on stderr, if out of memory or a thread cannot start.
+pipeline_t* pipeline_create(const pipeline_stage_t* stages, size_t num_stages, size_t num_lanes, size_t depth);
+
+// Feeds the next frame (not NULL) to the first stage, waiting for room. Call from one thread only.
+void pipeline_submit(pipeline_t* pipeline, void* frame);
+
+// The next frame out of the last stage, in submission order, waiting for it. Returns NULL once every frame submitted
+// before pipeline_close() is out. Call from one thread only; it may differ from the submitting one.
+void* pipeline_collect(pipeline_t* pipeline);
+
+// Ends the input: workers exit once the frames already submitted have passed them.
+void pipeline_close(pipeline_t* pipeline);
+
+// Whether a stage function returned false
+bool pipeline_failed(pipeline_t* pipeline);
+
+// stats[s] receives the counters of stage s, and the return value is the time since pipeline_create() in ns.
+// The counters are updated as frames go, so they may be read while the pipeline runs.
+uint64_t pipeline_get_stats(pipeline_t* pipeline, pipeline_stage_stats_t* stats);
+
+// Prints per-stage frames, frame rate, occupancy (busy time over wall time, per lane), and starved and blocked times.
+void pipeline_print_stats(pipeline_t* pipeline, FILE* stream);
+
+// Joins the workers, which requires pipeline_close() and every frame collected, and frees the pipeline.
+void pipeline_destroy(pipeline_t* pipeline);
+
+#endif /*PIPELINE_H_*/
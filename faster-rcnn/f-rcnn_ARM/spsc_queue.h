@@ -0,0 +1,71 @@
+/*
+ * Bounded lock-free single-producer single-consumer queue of pointers
+ *   - One thread pushes and one thread pops; neither ever takes a lock or
+ *     makes a system call. The producer only writes tail and the consumer
+ *     only writes head, each on its own cache line.
+ *   - The capacity is a power of two. head and tail count every push and pop
+ *     ever made, so tail - head is the number of queued items and slots are
+ *     indexed by masking.
+ *   - A slot is published by the release store of tail, and handed back by
+ *     the release store of head, so the item pointed to is visible to the
+ *     consumer as the producer wrote it.
+ *   - Items must not be NULL; spsc_queue_pop() returns NULL when empty.
+ */
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct spsc_queue {
+    void** slots;
+    size_t mask;                    // capacity - 1
+    _Alignas(64) atomic_size_t head; // next item to pop, written by the consumer
+    _Alignas(64) atomic_size_t tail; // next slot to push, written by the producer
+} spsc_queue_t;
+
+// capacity is rounded up to a power of two. Returns false if out of memory.
+static inline bool spsc_queue_init(spsc_queue_t* queue, size_t capacity) {
+    size_t size = 1;
+    while(size < capacity)
+        size *= 2;
+    queue->slots = calloc(size, sizeof(void*));
+    queue->mask = size - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return queue->slots != NULL;
+}
+
+static inline void spsc_queue_destroy(spsc_queue_t* queue) {
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+// Producer side. Returns false if the queue is full.
+static inline bool spsc_queue_push(spsc_queue_t* queue, void* item) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if(tail - atomic_load_explicit(&queue->head, memory_order_acquire) > queue->mask)
+        return false;
+    queue->slots[tail & queue->mask] = item;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// Consumer side. Returns NULL if the queue is empty.
+static inline void* spsc_queue_pop(spsc_queue_t* queue) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if(head == atomic_load_explicit(&queue->tail, memory_order_acquire))
+        return NULL;
+    void* item = queue->slots[head & queue->mask];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return item;
+}
+
+// Number of queued items; exact only from the producer or the consumer thread
+static inline size_t spsc_queue_size(spsc_queue_t* queue) {
+    return atomic_load_explicit(&queue->tail, memory_order_acquire)
+         - atomic_load_explicit(&queue->head, memory_order_acquire);
+}
+
+#endif /*SPSC_QUEUE_H_*/
@@ -41,6 +41,46 @@ void _aligned_free(void* ptr) {
 }
 // end: Aligned malloc and free
 
+/* Frame-scoped arena allocator
+ */
+vp_arena_t* vp_arena_create(const size_t capacity) {
+    vp_arena_t* arena;
+    if((arena = malloc(sizeof(vp_arena_t))) == NULL)
+        return NULL;
+    if(_aligned_malloc((void**)&arena->base, SIMD_ALIGNMENT, capacity)) {
+        free(arena);
+        return NULL;
+    }
+    arena->capacity = capacity;
+    arena->offset = 0;
+    arena->high_water = 0;
+    return arena;
+}
+
+void* vp_arena_alloc(vp_arena_t* const arena, const size_t size,
+                     const size_t alignment) {
+    // Round the offset up to alignment, a power of two
+    size_t offset = (arena->offset + alignment - 1) & ~(alignment - 1);
+    if(offset + size > arena->capacity)
+        return NULL;
+    arena->offset = offset + size;
+    if(arena->offset > arena->high_water)
+        arena->high_water = arena->offset;
+    return arena->base + offset;
+}
+
+void vp_arena_reset(vp_arena_t* const arena) {
+    arena->offset = 0;
+}
+
+void vp_arena_destroy(vp_arena_t* arena) {
+    if(arena == NULL)
+        return;
+    _aligned_free(arena->base);
+    free(arena);
+}
+// end: Frame-scoped arena allocator
+
 /* 8-bit unsigned fixed-point datatype
  */
 vp_tensor_ufix8_t* vp_tensor_ufix8_malloc(
@@ -120,6 +160,86 @@ vp_scalar_ufix8_t* vp_scalar_ufix8_calloc(
     memcpy(result, &temp, sizeof(vp_scalar_ufix8_t));
     return result;
 }
+
+vp_tensor_ufix8_t* vp_tensor_ufix8_arena_malloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset)
+{
+    // bump-allocate in a memory-aligned manner
+    uint8_t* data;
+    if((data = vp_arena_alloc(arena, sizeof(uint8_t)*n*c*h*w, SIMD_ALIGNMENT)) == NULL)
+        return NULL;
+    data = __builtin_assume_aligned(data, SIMD_ALIGNMENT);
+    vp_tensor_ufix8_t temp = {.status=uninitialized, .n=n, .c=c, .h=h, .w=w,
+                          .exp_offset=exp_offset, .data=data};
+    
+    // bump-allocate space for returned struct
+    vp_tensor_ufix8_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_tensor_ufix8_t), _Alignof(vp_tensor_ufix8_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_tensor_ufix8_t));
+    return result;
+}
+
+vp_tensor_ufix8_t* vp_tensor_ufix8_arena_calloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset, const uint8_t* const src)
+{
+    // bump-allocate in a memory-aligned manner
+    uint8_t* data;
+    size_t size = sizeof(uint8_t)*n*c*h*w;
+    if((data = vp_arena_alloc(arena, size, SIMD_ALIGNMENT)) == NULL)
+        return NULL;
+    data = __builtin_assume_aligned(data, SIMD_ALIGNMENT);
+    vp_tensor_ufix8_t temp = {.status=valid, .n=n, .c=c, .h=h, .w=w,
+                          .exp_offset=exp_offset, .data=data};
+    
+    // bump-allocate space for returned struct
+    vp_tensor_ufix8_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_tensor_ufix8_t), _Alignof(vp_tensor_ufix8_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_tensor_ufix8_t));
+    
+    // initialization
+    if(src == NULL)
+        memset(result->data, 0, size);
+    else
+        memcpy(result->data, src, size);
+    return result;
+}
+
+vp_scalar_ufix8_t* vp_scalar_ufix8_arena_malloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset) 
+{
+    vp_scalar_ufix8_t temp = {.status=uninitialized,
+                          .exp_offset=exp_offset, .data=0};
+    
+    // bump-allocate space for returned struct
+    vp_scalar_ufix8_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_scalar_ufix8_t), _Alignof(vp_scalar_ufix8_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_scalar_ufix8_t));
+    return result;
+}
+
+vp_scalar_ufix8_t* vp_scalar_ufix8_arena_calloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset,
+        const uint8_t input) 
+{
+    vp_scalar_ufix8_t temp = {.status=valid, 
+                          .exp_offset=exp_offset, .data=input};
+    
+    // bump-allocate space for returned struct
+    vp_scalar_ufix8_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_scalar_ufix8_t), _Alignof(vp_scalar_ufix8_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_scalar_ufix8_t));
+    return result;
+}
 // end: 8-bit unsigned fixed-point datatype
 
 /* 8-bit signed fixed-point datatype
@@ -201,6 +321,86 @@ vp_scalar_fix8_t* vp_scalar_fix8_calloc(
     memcpy(result, &temp, sizeof(vp_scalar_fix8_t));
     return result;
 }
+
+vp_tensor_fix8_t* vp_tensor_fix8_arena_malloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset)
+{
+    // bump-allocate in a memory-aligned manner
+    int8_t* data;
+    if((data = vp_arena_alloc(arena, sizeof(int8_t)*n*c*h*w, SIMD_ALIGNMENT)) == NULL)
+        return NULL;
+    data = __builtin_assume_aligned(data, SIMD_ALIGNMENT);
+    vp_tensor_fix8_t temp = {.status=uninitialized, .n=n, .c=c, .h=h, .w=w,
+                         .exp_offset=exp_offset, .data=data};
+    
+    // bump-allocate space for returned struct
+    vp_tensor_fix8_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_tensor_fix8_t), _Alignof(vp_tensor_fix8_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_tensor_fix8_t));
+    return result;
+}
+
+vp_tensor_fix8_t* vp_tensor_fix8_arena_calloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset, const int8_t* const src)
+{
+    // bump-allocate in a memory-aligned manner
+    int8_t* data;
+    size_t size = sizeof(int8_t)*n*c*h*w;
+    if((data = vp_arena_alloc(arena, size, SIMD_ALIGNMENT)) == NULL)
+        return NULL;
+    data = __builtin_assume_aligned(data, SIMD_ALIGNMENT);
+    vp_tensor_fix8_t temp = {.status=valid, .n=n, .c=c, .h=h, .w=w,
+                         .exp_offset=exp_offset, .data=data};
+    
+    // bump-allocate space for returned struct
+    vp_tensor_fix8_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_tensor_fix8_t), _Alignof(vp_tensor_fix8_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_tensor_fix8_t));
+    
+    // initialization
+    if(src == NULL)
+        memset(result->data, 0, size);
+    else
+        memcpy(result->data, src, size);
+    return result;
+}
+
+vp_scalar_fix8_t* vp_scalar_fix8_arena_malloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset) 
+{
+    vp_scalar_fix8_t temp = {.status=uninitialized,
+                         .exp_offset=exp_offset, .data=0};
+    
+    // bump-allocate space for returned struct
+    vp_scalar_fix8_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_scalar_fix8_t), _Alignof(vp_scalar_fix8_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_scalar_fix8_t));
+    return result;
+}
+
+vp_scalar_fix8_t* vp_scalar_fix8_arena_calloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset,
+        const int8_t input) 
+{
+    vp_scalar_fix8_t temp = {.status=valid, 
+                         .exp_offset=exp_offset, .data=input};
+    
+    // bump-allocate space for returned struct
+    vp_scalar_fix8_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_scalar_fix8_t), _Alignof(vp_scalar_fix8_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_scalar_fix8_t));
+    return result;
+}
 // end: 8-bit signed fixed-point datatype
 
 /* 16-bit unsigned fixed-point datatype
@@ -282,6 +482,86 @@ vp_scalar_ufix16_t* vp_scalar_ufix16_calloc(
     memcpy(result, &temp, sizeof(vp_scalar_ufix16_t));
     return result;
 }
+
+vp_tensor_ufix16_t* vp_tensor_ufix16_arena_malloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset)
+{
+    // bump-allocate in a memory-aligned manner
+    uint16_t* data;
+    if((data = vp_arena_alloc(arena, sizeof(uint16_t)*n*c*h*w, SIMD_ALIGNMENT)) == NULL)
+        return NULL;
+    data = __builtin_assume_aligned(data, SIMD_ALIGNMENT);
+    vp_tensor_ufix16_t temp = {.status=uninitialized, .n=n, .c=c, .h=h, .w=w,
+                           .exp_offset=exp_offset, .data=data};
+    
+    // bump-allocate space for returned struct
+    vp_tensor_ufix16_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_tensor_ufix16_t), _Alignof(vp_tensor_ufix16_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_tensor_ufix16_t));
+    return result;
+}
+
+vp_tensor_ufix16_t* vp_tensor_ufix16_arena_calloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset, const uint16_t* const src)
+{
+    // bump-allocate in a memory-aligned manner
+    uint16_t* data;
+    size_t size = sizeof(uint16_t)*n*c*h*w;
+    if((data = vp_arena_alloc(arena, size, SIMD_ALIGNMENT)) == NULL)
+        return NULL;
+    data = __builtin_assume_aligned(data, SIMD_ALIGNMENT);
+    vp_tensor_ufix16_t temp = {.status=valid, .n=n, .c=c, .h=h, .w=w,
+                           .exp_offset=exp_offset, .data=data};
+    
+    // bump-allocate space for returned struct
+    vp_tensor_ufix16_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_tensor_ufix16_t), _Alignof(vp_tensor_ufix16_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_tensor_ufix16_t));
+    
+    // initialization
+    if(src == NULL)
+        memset(result->data, 0, size);
+    else
+        memcpy(result->data, src, size);
+    return result;
+}
+
+vp_scalar_ufix16_t* vp_scalar_ufix16_arena_malloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset) 
+{
+    vp_scalar_ufix16_t temp = {.status=uninitialized,
+                           .exp_offset=exp_offset, .data=0};
+    
+    // bump-allocate space for returned struct
+    vp_scalar_ufix16_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_scalar_ufix16_t), _Alignof(vp_scalar_ufix16_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_scalar_ufix16_t));
+    return result;
+}
+
+vp_scalar_ufix16_t* vp_scalar_ufix16_arena_calloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset,
+        const uint16_t input) 
+{
+    vp_scalar_ufix16_t temp = {.status=valid, 
+                           .exp_offset=exp_offset, .data=input};
+    
+    // bump-allocate space for returned struct
+    vp_scalar_ufix16_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_scalar_ufix16_t), _Alignof(vp_scalar_ufix16_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_scalar_ufix16_t));
+    return result;
+}
 // end: 16-bit unsigned fixed-point datatype
 
 /* 16-bit signed fixed-point datatype
@@ -363,6 +643,86 @@ vp_scalar_fix16_t* vp_scalar_fix16_calloc(
     memcpy(result, &temp, sizeof(vp_scalar_fix16_t));
     return result;
 }
+
+vp_tensor_fix16_t* vp_tensor_fix16_arena_malloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset)
+{
+    // bump-allocate in a memory-aligned manner
+    int16_t* data;
+    if((data = vp_arena_alloc(arena, sizeof(int16_t)*n*c*h*w, SIMD_ALIGNMENT)) == NULL)
+        return NULL;
+    data = __builtin_assume_aligned(data, SIMD_ALIGNMENT);
+    vp_tensor_fix16_t temp = {.status=uninitialized, .n=n, .c=c, .h=h, .w=w,
+                          .exp_offset=exp_offset, .data=data};
+    
+    // bump-allocate space for returned struct
+    vp_tensor_fix16_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_tensor_fix16_t), _Alignof(vp_tensor_fix16_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_tensor_fix16_t));
+    return result;
+}
+
+vp_tensor_fix16_t* vp_tensor_fix16_arena_calloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset, const int16_t* const src)
+{
+    // bump-allocate in a memory-aligned manner
+    int16_t* data;
+    size_t size = sizeof(int16_t)*n*c*h*w;
+    if((data = vp_arena_alloc(arena, size, SIMD_ALIGNMENT)) == NULL)
+        return NULL;
+    data = __builtin_assume_aligned(data, SIMD_ALIGNMENT);
+    vp_tensor_fix16_t temp = {.status=valid, .n=n, .c=c, .h=h, .w=w,
+                          .exp_offset=exp_offset, .data=data};
+    
+    // bump-allocate space for returned struct
+    vp_tensor_fix16_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_tensor_fix16_t), _Alignof(vp_tensor_fix16_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_tensor_fix16_t));
+    
+    // initialization
+    if(src == NULL)
+        memset(result->data, 0, size);
+    else
+        memcpy(result->data, src, size);
+    return result;
+}
+
+vp_scalar_fix16_t* vp_scalar_fix16_arena_malloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset) 
+{
+    vp_scalar_fix16_t temp = {.status=uninitialized,
+                          .exp_offset=exp_offset, .data=0};
+    
+    // bump-allocate space for returned struct
+    vp_scalar_fix16_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_scalar_fix16_t), _Alignof(vp_scalar_fix16_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_scalar_fix16_t));
+    return result;
+}
+
+vp_scalar_fix16_t* vp_scalar_fix16_arena_calloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset,
+        const int16_t input) 
+{
+    vp_scalar_fix16_t temp = {.status=valid, 
+                          .exp_offset=exp_offset, .data=input};
+    
+    // bump-allocate space for returned struct
+    vp_scalar_fix16_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_scalar_fix16_t), _Alignof(vp_scalar_fix16_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_scalar_fix16_t));
+    return result;
+}
 // end: 16-bit signed fixed-point datatype
 
 /* 32-bit signed floating-point datatype WITHOUT denormalization
@@ -429,6 +789,76 @@ vp_scalar_float32_t* vp_scalar_float32_calloc(const float input)
     temp->data = input;
     return temp;
 }
+
+vp_tensor_float32_t* vp_tensor_float32_arena_malloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w)
+{
+    // bump-allocate in a memory-aligned manner
+    float* data;
+    if((data = vp_arena_alloc(arena, sizeof(float)*n*c*h*w, SIMD_ALIGNMENT)) == NULL)
+        return NULL;
+    data = __builtin_assume_aligned(data, SIMD_ALIGNMENT);
+    vp_tensor_float32_t temp = {.status=uninitialized,
+                                .n=n, .c=c, .h=h, .w=w, .data=data};
+    
+    // bump-allocate space for returned struct
+    vp_tensor_float32_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_tensor_float32_t), _Alignof(vp_tensor_float32_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_tensor_float32_t));
+    return result;
+}
+
+vp_tensor_float32_t* vp_tensor_float32_arena_calloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const float* const src)
+{
+    // bump-allocate in a memory-aligned manner
+    float* data;
+    size_t size = sizeof(float)*n*c*h*w;
+    if((data = vp_arena_alloc(arena, size, SIMD_ALIGNMENT)) == NULL)
+        return NULL;
+    data = __builtin_assume_aligned(data, SIMD_ALIGNMENT);
+    vp_tensor_float32_t temp = {.status=valid, 
+                                .n=n, .c=c, .h=h, .w=w, .data=data};
+    
+    // bump-allocate space for returned struct
+    vp_tensor_float32_t* result;
+    if((result = vp_arena_alloc(arena, sizeof(vp_tensor_float32_t), _Alignof(vp_tensor_float32_t))) == NULL)
+        return NULL;
+    memcpy(result, &temp, sizeof(vp_tensor_float32_t));
+    
+    // initialization
+    if(src == NULL)
+        memset(result->data, 0, size);
+    else
+        memcpy(result->data, src, size);
+    return result;
+}
+
+vp_scalar_float32_t* vp_scalar_float32_arena_malloc(vp_arena_t* const arena)
+{
+    vp_scalar_float32_t* temp;
+    temp = vp_arena_alloc(arena, sizeof(vp_scalar_float32_t), _Alignof(vp_scalar_float32_t));
+    if(temp == NULL)
+        return NULL;
+    temp->status = uninitialized;
+    return temp;
+}
+
+vp_scalar_float32_t* vp_scalar_float32_arena_calloc(vp_arena_t* const arena,
+                                                    const float input)
+{
+    vp_scalar_float32_t* temp;
+    temp = vp_arena_alloc(arena, sizeof(vp_scalar_float32_t), _Alignof(vp_scalar_float32_t));
+    if(temp == NULL)
+        return NULL;
+    temp->status = valid;
+    temp->data = input;
+    return temp;
+}
 // end: 32-bit signed floating-point datatype WITHOUT denormalization
 
 /* Free functions for all datatypes
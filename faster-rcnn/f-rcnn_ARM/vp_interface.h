@@ -21,6 +21,7 @@
  *   - 2 struct definitions
  *   - 4 type aliases
  *   - 4 malloc/calloc functions
+ *   - 4 arena-backed malloc/calloc functions
  * Specifically, for fixed-point datatypes, they are:
  *   - Struct definitions:
  *       - typedef struct vp_tensor_dtype {
@@ -57,6 +58,9 @@
  *   - The interface for float32 is slightly different.
  *   - Calloc is slow, so please use it with caution.
  *   - Use vp_tensor_free or vp_scalar_free to prevent memory leak.
+ *   - The arena-backed variants, e.g. vp_tensor_dtype_arena_malloc(arena,
+ *     ...), take a vp_arena_t* first and are released all at once with
+ *     vp_arena_reset. They remove malloc/free from the per-frame loop.
  *
  * July 24, 2018
  */
@@ -77,6 +81,29 @@ int _aligned_malloc(void** memptr, size_t alignment, size_t size);
 void _aligned_free(void* ptr);
 // end: Aligned malloc and free
 
+/* Frame-scoped arena allocator
+ * - vp_arena_create() makes one aligned allocation of capacity bytes
+ * - vp_arena_alloc() bumps a pointer; returns NULL once the arena is full
+ * - vp_arena_reset() releases everything allocated from the arena in O(1),
+ *   typically once per frame
+ * - high_water records the largest offset ever reached, for sizing
+ * - Tensors and scalars from the *_arena_* constructors below live in the
+ *   arena; never pass them to vp_tensor_free or vp_scalar_free
+ */
+typedef struct vp_arena {
+    uint8_t* base;
+    size_t capacity;
+    size_t offset;
+    size_t high_water;
+} vp_arena_t;
+
+vp_arena_t* vp_arena_create(const size_t capacity);
+void* vp_arena_alloc(vp_arena_t* const arena, const size_t size,
+                     const size_t alignment);
+void vp_arena_reset(vp_arena_t* const arena);
+void vp_arena_destroy(vp_arena_t* arena);
+// end: Frame-scoped arena allocator
+
 /* 8-bit unsigned fixed-point datatype
  */
 typedef struct vp_tensor_ufix8 {
@@ -108,6 +135,21 @@ vp_scalar_ufix8_t* vp_scalar_ufix8_malloc(
 vp_scalar_ufix8_t* vp_scalar_ufix8_calloc(
         const uint_fast8_t exp_offset,
         const uint8_t input);
+vp_tensor_ufix8_t* vp_tensor_ufix8_arena_malloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset);
+vp_tensor_ufix8_t* vp_tensor_ufix8_arena_calloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset, const uint8_t* const src);
+vp_scalar_ufix8_t* vp_scalar_ufix8_arena_malloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset);
+vp_scalar_ufix8_t* vp_scalar_ufix8_arena_calloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset,
+        const uint8_t input);
 // end: 8-bit unsigned fixed-point datatype
 
 /* 8-bit signed fixed-point datatype
@@ -141,6 +183,21 @@ vp_scalar_fix8_t* vp_scalar_fix8_malloc(
 vp_scalar_fix8_t* vp_scalar_fix8_calloc(
         const uint_fast8_t exp_offset,
         const int8_t input);
+vp_tensor_fix8_t* vp_tensor_fix8_arena_malloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset);
+vp_tensor_fix8_t* vp_tensor_fix8_arena_calloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset, const int8_t* const src);
+vp_scalar_fix8_t* vp_scalar_fix8_arena_malloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset);
+vp_scalar_fix8_t* vp_scalar_fix8_arena_calloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset,
+        const int8_t input);
 // end: 8-bit signed fixed-point datatype
 
 /* 16-bit unsigned fixed-point datatype
@@ -174,6 +231,21 @@ vp_scalar_ufix16_t* vp_scalar_ufix16_malloc(
 vp_scalar_ufix16_t* vp_scalar_ufix16_calloc(
         const uint_fast8_t exp_offset,
         const uint16_t input);
+vp_tensor_ufix16_t* vp_tensor_ufix16_arena_malloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset);
+vp_tensor_ufix16_t* vp_tensor_ufix16_arena_calloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset, const uint16_t* const src);
+vp_scalar_ufix16_t* vp_scalar_ufix16_arena_malloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset);
+vp_scalar_ufix16_t* vp_scalar_ufix16_arena_calloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset,
+        const uint16_t input);
 // end: 16-bit unsigned fixed-point datatype
 
 /* 16-bit signed fixed-point datatype
@@ -207,6 +279,21 @@ vp_scalar_fix16_t* vp_scalar_fix16_malloc(
 vp_scalar_fix16_t* vp_scalar_fix16_calloc(
         const uint_fast8_t exp_offset,
         const int16_t input);
+vp_tensor_fix16_t* vp_tensor_fix16_arena_malloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset);
+vp_tensor_fix16_t* vp_tensor_fix16_arena_calloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const uint_fast8_t exp_offset, const int16_t* const src);
+vp_scalar_fix16_t* vp_scalar_fix16_arena_malloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset);
+vp_scalar_fix16_t* vp_scalar_fix16_arena_calloc(
+        vp_arena_t* const arena,
+        const uint_fast8_t exp_offset,
+        const int16_t input);
 // end: 16-bit signed fixed-point datatype
 
 /* 32-bit signed floating-point datatype WITHOUT denormalization
@@ -234,6 +321,16 @@ vp_tensor_float32_t* vp_tensor_float32_calloc(
         const float* const src);
 vp_scalar_float32_t* vp_scalar_float32_malloc();
 vp_scalar_float32_t* vp_scalar_float32_calloc(const float input);
+vp_tensor_float32_t* vp_tensor_float32_arena_malloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w);
+vp_tensor_float32_t* vp_tensor_float32_arena_calloc(
+        vp_arena_t* const arena,
+        const size_t n, const size_t c, const size_t h, const size_t w,
+        const float* const src);
+vp_scalar_float32_t* vp_scalar_float32_arena_malloc(vp_arena_t* const arena);
+vp_scalar_float32_t* vp_scalar_float32_arena_calloc(vp_arena_t* const arena,
+                                                    const float input);
 // end: 32-bit signed floating-point datatype WITHOUT denormalization
 
 /* Free functions for all datatypes
@@ -11,8 +11,9 @@ def init():
     FS.Stream('anchors', '/path/to/predefined_anchors')
     CVflow.DAG('rpn', 'frcnn_rpn.pb') # Region Proposal Network, includes feature_extractor
     ARM.JIT('nms', 'nms.h', 'nms.c') # Regressor
-    ARM.JIT('map_scores', 'map_scores.h', 'map_scores.c') # Just a simple mapping function
-    ARM.JIT('crop', 'crop.h', 'crop.c') # Crop feature map based on nms-ed region proposals
+    ARM.JIT('nms_indexed', 'nms.h', 'nms.c') # Regressor, also returns the index of each surviving proposal
+    ARM.JIT('map_scores_indexed', 'map_scores.h', 'map_scores.c') # Just a simple mapping function
+    ARM.JIT('crop_and_resize', 'crop.h', 'crop.c') # Crop feature map based on nms-ed region proposals, bilinearly resized to a fixed size
     CVflow.DAG('classifier', 'frcnn_pool_and_classify.pb') # Foreground/background classifier and bounding box predictor
 
 def loop():
@@ -29,14 +30,14 @@ def loop():
     ##########################################################################################################
     feature_map, region_proposals, scores = CVflow.rpn(anchors, img)
 
-    # perform nms on region_proposals to get rois
-    rois = ARM.nms(scores, region_proposals, len(scores))
+    # perform nms on region_proposals to get rois, and the index of each roi in region_proposals
+    rois, roi_indices = ARM.nms_indexed(scores, region_proposals, len(scores))
 
     # re-map rois to respective scores (due to truncation of region_proposals)
-    mapped_scores = ARM.map_scores(scores, rois, region_proposals)
+    mapped_scores = ARM.map_scores_indexed(scores, roi_indices)
 
-    # preprocessing to generate input for roi pooling layer
-    cropped_feature_maps = ARM.crop(rois, feature_map)
+    # preprocessing to generate input for roi pooling layer: (len(rois), 14, 14, 576), NHWC like feature_map
+    cropped_feature_maps = ARM.crop_and_resize(rois, feature_map, 14, 14, ARM.VP_NHWC)
     
     ##########################################################################################################
     # ---------------------- ROI pooling followed by classification and box-prediction --------------------- #
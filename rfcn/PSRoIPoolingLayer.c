@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <omp.h>
 #include "blob.h"
 #include "PSRoIPoolingLayer.h"
 
@@ -23,6 +25,85 @@ const static int spatial_scale = 4; // 0.0625 == 2^-4
 const static int pooled_height = 7;
 const static int pooled_width = 7;
 
+/* Per-layer state, indexed by id */
+typedef struct psroi_state_t {
+    enum psroi_mode mode;
+    int num_threads; // 0 is treated as 1
+    int32_t* integral; // (c, h+1, w+1) summed-area tables of bottom1
+    size_t integral_size;
+    float* scores; // top->data
+    size_t max_rois, scores_size;
+} psroi_state;
+static psroi_state states[PSROI_MAX_LAYERS];
+
+void psroipooling_set_mode(int id, enum psroi_mode mode) {
+    assert(id >= 0 && id < PSROI_MAX_LAYERS);
+    states[id].mode = mode;
+}
+
+void psroipooling_set_num_threads(int id, int num_threads) {
+    assert(id >= 0 && id < PSROI_MAX_LAYERS);
+    assert(num_threads >= 1);
+    states[id].num_threads = num_threads;
+}
+
+void psroipooling_set_max_rois(int id, size_t max_rois) {
+    assert(id >= 0 && id < PSROI_MAX_LAYERS);
+    states[id].max_rois = max_rois;
+}
+
+/* Grows the output of a layer to num RoIs of output_c scores, if needed */
+static bool reserve_scores(psroi_state* state, size_t num, size_t output_c) {
+    size_t size = num * output_c;
+    if(size <= state->scores_size)
+        return true;
+    free(state->scores);
+    if((state->scores = malloc(size * sizeof(float))) == NULL) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
+        state->scores_size = 0;
+        return false;
+    }
+    state->scores_size = size;
+    return true;
+}
+
+/* Grows the summed-area table of a layer to fit bottom1, if needed */
+static void reserve_integral(psroi_state* state, blob* bottom1) {
+    size_t size = (size_t)bottom1->c * (bottom1->h + 1) * (bottom1->w + 1);
+    if(state->mode != PSROI_INTEGRAL || size <= state->integral_size)
+        return;
+    free(state->integral);
+    if((state->integral = malloc(size * sizeof(int32_t))) == NULL) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
+        state->integral_size = 0;
+        state->mode = PSROI_DIRECT;
+        return;
+    }
+    state->integral_size = size;
+}
+
+/* table[c][y][x] = sum of features[c][0:y][0:x], with a zero first row and
+ * column, so any rectangle sum is four lookups */
+static void build_integral(const int8_t* restrict features, size_t channels,
+                           int height, int width, int32_t* restrict table,
+                           int num_threads) {
+    size_t stride = width + 1;
+    #pragma omp parallel for num_threads(num_threads) if(num_threads > 1)
+    for(size_t c = 0; c < channels; c++) {
+        const int8_t* src = features + c * height * width;
+        int32_t* dst = table + c * (height + 1) * stride;
+        memset(dst, 0, stride * sizeof(int32_t));
+        for(int h = 0; h < height; h++) {
+            int32_t row_sum = 0;
+            dst[(h+1)*stride] = 0;
+            for(int w = 0; w < width; w++) {
+                row_sum += src[h*width + w];
+                dst[(h+1)*stride + w+1] = dst[h*stride + w+1] + row_sum;
+            }
+        }
+    }
+}
+
 void psroipooling_setup(
         int id,
         blob* bottom1, blob* bottom2,
@@ -32,6 +113,18 @@ void psroipooling_setup(
     assert(1 == top->h);
     assert(1 == top->w);
     assert(bottom1->n == 1);
+    assert(id >= 0 && id < PSROI_MAX_LAYERS);
+    reserve_integral(&states[id], bottom1);
+    reserve_scores(&states[id], states[id].max_rois, top->c);
+    top->n = 0;
+    top->data = states[id].scores;
+
+    // Start the worker threads now rather than in the first forward pass
+    if(states[id].num_threads < 1)
+        states[id].num_threads = 1;
+    int num_threads = states[id].num_threads;
+    #pragma omp parallel num_threads(num_threads) if(num_threads > 1)
+    {}
     return;
 }
 
@@ -47,13 +140,34 @@ void psroipooling_forward(
     int height = bottom1->h;
 
     // Extract data arrays
+    psroi_state* state = &states[id];
+    if(!reserve_scores(state, num, output_c)) {
+        top->n = 0;
+        top->data = NULL;
+        return;
+    }
     top->n = bottom2->n;
-    top->data = malloc(num * output_c * sizeof(float));
+    top->data = state->scores;
     uint16_t* rois = bottom2->data;
     int8_t* features = bottom1->data;
     float* scores = top->data;
 
-    // Loop through each RoI
+    // Summed-area tables, shared by all RoIs and categories
+    const int32_t* integral = NULL;
+    size_t stride = width + 1;
+    size_t plane = (height + 1) * stride;
+    int num_threads = state->num_threads;
+    reserve_integral(state, bottom1);
+    if(state->mode == PSROI_INTEGRAL) {
+        build_integral(features, bottom1->c, height, width, state->integral,
+                       num_threads);
+        integral = state->integral;
+    }
+
+    // Loop through each RoI; each RoI writes only its own scores, so the
+    // output is the same for any number of threads
+    #pragma omp parallel for num_threads(num_threads) if(num_threads > 1) \
+                             schedule(dynamic, 4)
     for(size_t i = 0; i < num; i++) {
         int roi_batch_ind = rois[5*i];
         int roi_start_w = rois[5*i+1] >> spatial_scale;
@@ -70,6 +184,17 @@ void psroipooling_forward(
         int bin_size_h = roi_height / pooled_height;
         int bin_excess_w = roi_width % pooled_width;
         int bin_excess_h = roi_height % pooled_height;
+
+        // Bin (ph,pw) covers [edge_w[pw],edge_w[pw+1]) X [edge_h[ph],edge_h[ph+1])
+        // for every category
+        int edge_w[pooled_width + 1];
+        int edge_h[pooled_height + 1];
+        for(size_t pw = 0; pw <= output_w; pw++)
+            edge_w[pw] = clamp((int)(pw * bin_size_w + min(pw, bin_excess_w))
+                               + roi_start_w, width, 0);
+        for(size_t ph = 0; ph <= output_h; ph++)
+            edge_h[ph] = clamp((int)(ph * bin_size_h + min(ph, bin_excess_h))
+                               + roi_start_h, height, 0);
         
         // Loop through each category
         for(size_t pc = 0; pc < output_c; pc++) {
@@ -80,26 +205,29 @@ void psroipooling_forward(
             // Loop through each bin
             for(size_t ph = 0; ph < output_h; ph++) {
                 for(size_t pw = 0; pw < output_w; pw++) {
-                    // Bin's area [wstart,wend) X [hstart,hend)
-                    int wstart = (pw * bin_size_w + min(pw, bin_excess_w));
-                    int hstart = (ph * bin_size_h + min(ph, bin_excess_h));
-                    int wend = ((pw+1) * bin_size_w + min(pw+1, bin_excess_w));
-                    int hend = ((ph+1) * bin_size_h + min(ph+1, bin_excess_h));
-                    wstart = clamp(wstart + roi_start_w, width, 0);
-                    hstart = clamp(hstart + roi_start_h, height, 0);
-                    wend = clamp(wend + roi_start_w, width, 0);
-                    hend = clamp(hend + roi_start_h, height, 0);
+                    int wstart = edge_w[pw];
+                    int hstart = edge_h[ph];
+                    int wend = edge_w[pw+1];
+                    int hend = edge_h[ph+1];
 
                     // Sum over the bin
-                    size_t feature_idx = pc * (pooled_width * pooled_height
-                                               * width * height)
-                                       + ph * (pooled_width * width * height)
-                                       + pw * (width * height);
+                    size_t channel = (pc * pooled_height + ph) * pooled_width
+                                   + pw;
                     long int partial_sum = 0L;
-                    for(size_t h = hstart; h < hend; h++) {
-                        for(size_t w = wstart; w < wend; w++) {
-                            size_t bin_idx = h * width + w;
-                            partial_sum += features[feature_idx + bin_idx];
+                    if(integral != NULL) {
+                        const int32_t* table = integral + channel * plane;
+                        partial_sum = table[hend*stride + wend]
+                                    - table[hstart*stride + wend]
+                                    - table[hend*stride + wstart]
+                                    + table[hstart*stride + wstart];
+                    }
+                    else {
+                        size_t feature_idx = channel * (width * height);
+                        for(size_t h = hstart; h < hend; h++) {
+                            for(size_t w = wstart; w < wend; w++) {
+                                size_t bin_idx = h * width + w;
+                                partial_sum += features[feature_idx + bin_idx];
+                            }
                         }
                     }
 
@@ -120,6 +248,20 @@ void psroipooling_reshape(
         int id,
         blob* bottom1, blob* bottom2,
         blob* top) {
+    assert(id >= 0 && id < PSROI_MAX_LAYERS);
+    reserve_integral(&states[id], bottom1);
     return;
 }
 
+void psroipooling_teardown(int id, blob* top) {
+    assert(id >= 0 && id < PSROI_MAX_LAYERS);
+    psroi_state* state = &states[id];
+    free(state->integral);
+    free(state->scores);
+    state->integral = NULL;
+    state->scores = NULL;
+    state->integral_size = state->scores_size = 0;
+    top->data = NULL;
+    top->n = 0;
+}
+
@@ -1,15 +1,48 @@
 #ifndef PSROIPOOLING_H_
 #define PSROIPOOLING_H_
+#include <stddef.h>
 #include "blob.h"
 
+/* Pooling modes
+ *   - PSROI_DIRECT sums every pixel of every bin (default).
+ *   - PSROI_INTEGRAL builds a per-channel int32 summed-area table of bottom1
+ *     once per forward pass, so each bin sum takes four lookups regardless
+ *     of the RoI size. Results are identical to PSROI_DIRECT. */
+enum psroi_mode{PSROI_DIRECT, PSROI_INTEGRAL};
+
+/* Maximum number of PSRoIPooling layers, i.e. maximum id + 1 */
+#define PSROI_MAX_LAYERS 4
+
+/* Selects the pooling mode of layer id, from the next forward pass on.
+ * Called before setup(), the summed-area table is allocated there rather
+ * than in the first forward pass. */
+void psroipooling_set_mode(int id, enum psroi_mode mode);
+
+/* Number of threads layer id splits its RoIs across (default 1). Threads
+ * come from the OpenMP pool, which is started in setup() and reused by every
+ * forward pass. Outputs do not depend on the thread count. Must be called
+ * before setup(). */
+void psroipooling_set_num_threads(int id, int num_threads);
+
+/* Number of RoIs layer id reserves its output for in setup(), e.g. the
+ * post_nms_top_n of the proposal layer feeding it. A forward pass with more
+ * RoIs grows the output, so steady-state forward passes do not allocate.
+ * Must be called before setup(). */
+void psroipooling_set_max_rois(int id, size_t max_rois);
+
 /* Similar to setup() in Caffe. Called once at the beginning. */
 void psroipooling_setup(int id, blob* bottom1, blob* bottom2, blob* top);
 
-/* Similar to forward() in Caffe. Called once per forward pass. */
+/* Similar to forward() in Caffe. Called once per forward pass. If the
+ * output cannot grow to the RoIs of bottom2, prints an error and outputs no
+ * scores (top->n == 0). */
 void psroipooling_forward(int id, blob* bottom1, blob* bottom2, blob* top);
 
 /* Similar to reshape() in Caffe. Not implmented. */
 void psroipooling_reshape(int id, blob* bottom1, blob* bottom2, blob* top);
 
+/* Frees the buffers of layer id, including top->data. */
+void psroipooling_teardown(int id, blob* top);
+
 #endif
 
@@ -3,10 +3,14 @@
 #include <malloc.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 #include <stdbool.h>
 #include <immintrin.h>
 #include "blob.h"
 #include "ProposalLayer.h"
+#include "nms.h"
+#include "exp_lut.h"
+#include "proposal_decode.h"
 
 /* Util Macros */
 #define clampf(num, max, min) (fmaxf(fminf(num, max), min))
@@ -21,228 +25,673 @@
                               __typeof__ (min) _min = (min); \
                               _num > _max ? _max : _num < _min ? _min : _num;})
 
-/* Quicksort algorithm */
-// assumes little-endianness
-#include <endian.h>
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-    #define SORT_NAME     sorter
-    #define SORT_TYPE     int32_t
-    #define SORT_CMP(x,y) (((y<<16)>>16) - ((x<<16)>>16))
-    #include "sort/sort.h"
-#else 
-    assert(0)
+/* Configurations forward() is compiled for with constant parameters, as
+ * X(name, initializer). A layer whose config equals one of them runs that
+ * copy, in which the compiler folds the parameters into the code; any other
+ * config runs the generic copy. Define PROPOSAL_GENERIC_ONLY to always run
+ * the generic copy. */
+#ifdef PROPOSAL_GENERIC_ONLY
+#define PROPOSAL_SPECIALIZATIONS(X)
+#else
+#define PROPOSAL_SPECIALIZATIONS(X) \
+    X(default, PROPOSAL_DEFAULT_CONFIG)
 #endif
 
-/* Global Constants */
-#define NMS_THRESH 0.7f
-#define PRE_NMS_TOP_N 6000U
-#define POST_NMS_TOP_N 300U
-#define MIN_SIZE 16U
-static const int num_anchors = 9;
-static const int feat_stride = 16;
-static const int anchors[9][4] = {
-    { -84,  -40,  99,  55},
-    {-176,  -88, 191, 103},
-    {-360, -184, 375, 199},
-    { -56,  -56,  71,  71},
-    {-120, -120, 135, 135},
-    {-248, -248, 263, 263},
-    { -36,  -80,  51,  95},
-    { -80, -168,  95, 183},
-    {-168, -344, 183, 359}
-};
-
-//#pragma omp declare simd
-static float iou(int* restrict xmins, int* restrict ymins,
-                        int* restrict xmaxs, int* restrict ymaxs, 
-                        int* restrict areas, int i, int j) {
-    int x1 = max(xmins[i], xmins[j]);
-    int y1 = max(ymins[i], ymins[j]);
-    int x2 = min(xmaxs[i], xmaxs[j]);
-    int y2 = min(ymaxs[i], ymaxs[j]);
-    int area1 = areas[i];
-    int area2 = areas[j];
-
-    int i_area = max(x2 - x1, 0) * max(y2 - y1, 0);
-
-    int u_area = area1 + area2 - i_area;
-    
-    return clampf(((float)i_area)/((float)u_area), 1.0f, 0.0f);
-}
-
-
-inline bool* nms(int16_t* restrict idx_scores,
-                 int* restrict proposals, int N) {
-    int counter = 0;
-    int* xmins = malloc(N * sizeof(int));
-    int* xmaxs = malloc(N * sizeof(int));
-    int* ymins = malloc(N * sizeof(int));
-    int* ymaxs = malloc(N * sizeof(int));
-    int* areas = malloc(N * sizeof(int));
-    bool* keep = malloc(N * sizeof(bool));
-   
-    // Rearrange elements 
-    for(size_t i = 0; i < N; i++) {
-        uint16_t idx = idx_scores[i*2+1];
-        xmins[counter] = proposals[idx*4+0];
-        ymins[counter] = proposals[idx*4+1];
-        xmaxs[counter] = proposals[idx*4+2];
-        ymaxs[counter] = proposals[idx*4+3];
-        counter++;
-    }
-    //#pragma omp simd
-    for(size_t i = 0; i < N; i++)
-        areas[i] = (xmaxs[i]-xmins[i]) * (ymaxs[i]-ymins[i]);
-    //#pragma omp simd
-    for(size_t i = 0; i < N; i++)
-        keep[i] = true;
-
-    // NMS main loop
-    for(size_t i = 0; i < N; i++) {
-        if(!keep[i])
-            continue;
-        //#pragma omp simd
-        //#pragma vector aligned
-        for(size_t j = i+1; j < N; j++) {
-            if(!keep[j])
-                continue;
-            float iou_result = iou(xmins, ymins, xmaxs, ymaxs, areas, i, j);
-            if(iou_result > NMS_THRESH)
-                keep[j] = false;
+/* RoI size that maps to the level of stride FPN_CANONICAL_STRIDE, as in
+ * Eq. (1) of the FPN paper (k0 = 4 for a 224 x 224 RoI) */
+#define FPN_CANONICAL_SIZE 224.0f
+#define FPN_CANONICAL_STRIDE 16
+
+/* Per-layer workspace, indexed by id
+ * Sized in setup() for the feature-map shapes seen then, grown by reshape()
+ * if needed, and reused by every forward pass, so that steady-state forward
+ * passes do not allocate. rois is handed out as top->data.
+ * The shifted anchors only depend on the feature-map shapes, so their
+ * centers and sizes are tabulated (one array per field, in anchor index
+ * order) whenever a shape changes, and forward() just streams over them.
+ * With several pyramid levels, the anchors of level l occupy indices
+ * [level_start[l], level_start[l+1]) of the table and of every candidate
+ * buffer, so all levels share one top-K selection and one NMS. The index
+ * half of indexed_scores is 16-bit, so with several levels the candidates
+ * are moved to (score, index) int32 pairs after decoding, and the wide_*
+ * buffers take the place of indexed_scores, top_scores and temp_scores.
+ * The decoded proposals are kept as one array per coordinate, the layout
+ * proposal_decode() writes and nms_in_soa() reads.
+ * valid is cleared whenever the workspace does not fit the last shapes
+ * given, and forward() then outputs no rois instead of using it. */
+typedef struct proposal_state_t {
+    bool valid;
+    size_t capacity; // number of anchors, sum of h * w * num_anchors
+    int16_t* indexed_scores;
+    int16_t* top_scores;
+    int16_t* temp_scores;
+    int32_t* wide_scores; // int32 pairs, with several levels
+    int32_t* wide_top;
+    int32_t* wide_temp;
+    int* xmins;
+    int* ymins;
+    int* xmaxs;
+    int* ymaxs;
+    uint16_t* rois;
+    uint16_t* level_rois; // rois grouped by level, with several levels
+    uint8_t* roi_levels;  // level of each roi, with several levels
+    size_t roi_level_counts[PROPOSAL_MAX_LEVELS];
+    nms_workspace nms;
+    size_t table_h[PROPOSAL_MAX_LEVELS]; // feature-map shapes of the table
+    size_t table_w[PROPOSAL_MAX_LEVELS];
+    size_t level_start[PROPOSAL_MAX_LEVELS + 1];
+    int* anchor_ctr_x;
+    int* anchor_ctr_y;
+    int* anchor_w;
+    int* anchor_h;
+    proposal_config config;
+    bool has_config;
+    int specialization; // index in PROPOSAL_SPECIALIZATIONS, -1 if generic
+    bool has_score_floor;
+    int16_t score_floor;
+    proposal_stats stats;
+} proposal_state;
+static proposal_state states[PROPOSAL_MAX_LAYERS];
+
+/* exp(d / 64) in Q14 for every int8 size delta, filled by proposal_setup() */
+static int32_t exp_lut[EXP_LUT_SIZE];
+
+/* Tabulates the anchors of every position of the feature map of each
+ * level; level l has stride feat_stride << l and anchors scaled by 2^l */
+static void build_anchor_table(proposal_state* state, blob* const* bottom1) {
+    const proposal_config* config = &state->config;
+    size_t num_anchors = config->num_anchors;
+    for(int l = 0; l < config->num_levels; l++) {
+        size_t h = bottom1[l]->h;
+        size_t w = bottom1[l]->w;
+        int stride = config->feat_stride << l;
+        for(size_t i = 0; i < h; i++) {
+            for(size_t j = 0; j < w; j++) {
+                int shift_x = j * stride;
+                int shift_y = i * stride;
+                for(size_t k = 0; k < num_anchors; k++) {
+                    const int* base = config->anchors[k];
+                    size_t index = state->level_start[l]
+                                 + i*w*num_anchors + j*num_anchors + k;
+                    int width = base[2] - base[0] + 1;
+                    int height = base[3] - base[1] + 1;
+                    int ctr_x = base[0] + width / 2;
+                    int ctr_y = base[1] + height / 2;
+                    state->anchor_w[index] = width << l;
+                    state->anchor_h[index] = height << l;
+                    state->anchor_ctr_x[index] = (ctr_x << l) + shift_x
+                                               + ((1 << l) - 1) / 2;
+                    state->anchor_ctr_y[index] = (ctr_y << l) + shift_y
+                                               + ((1 << l) - 1) / 2;
+                }
+            }
+        }
+        state->table_h[l] = h;
+        state->table_w[l] = w;
+    }
+}
+
+/* Grows the workspace of a layer to fit the feature maps in bottom1, one
+ * per level, and rebuilds the anchor table if any of their shapes changed.
+ * Sets state->valid to the return value. */
+static bool reserve_workspace(proposal_state* state, blob* const* bottom1,
+                              blob* top) {
+    const proposal_config* config = &state->config;
+    int num_levels = config->num_levels;
+    bool table_valid = true;
+    state->valid = false;
+    state->level_start[0] = 0;
+    for(int l = 0; l < num_levels; l++) {
+        state->level_start[l+1] = state->level_start[l]
+            + (size_t)bottom1[l]->h * bottom1[l]->w * config->num_anchors;
+        table_valid &= state->table_h[l] == bottom1[l]->h
+                    && state->table_w[l] == bottom1[l]->w;
+    }
+    size_t count = state->level_start[num_levels];
+    size_t top_n = min(count, config->pre_nms_top_n);
+    // The index half of the (score, index) pairs is 16-bit with one level,
+    // 32-bit with several
+    size_t max_count = num_levels > 1 ? (size_t)INT32_MAX
+                                      : (size_t)UINT16_MAX + 1;
+    if(count > max_count) {
+        fprintf(stderr, "ERROR: %zu anchors exceed the %zu a proposal layer "
+                "can index.\n", count, max_count);
+        return false;
+    }
+    if(state->rois == NULL) {
+        state->rois = malloc(5 * config->post_nms_top_n * _sizeof(top->type));
+        if(num_levels > 1) {
+            state->level_rois = malloc(5 * config->post_nms_top_n
+                                       * _sizeof(top->type));
+            state->roi_levels = malloc(config->post_nms_top_n);
         }
     }
+    if(count > state->capacity) {
+        free(state->indexed_scores);
+        free(state->top_scores);
+        free(state->temp_scores);
+        free(state->wide_scores);
+        free(state->wide_top);
+        free(state->wide_temp);
+        free(state->xmins);
+        free(state->ymins);
+        free(state->xmaxs);
+        free(state->ymaxs);
+        free(state->anchor_ctr_x);
+        free(state->anchor_ctr_y);
+        free(state->anchor_w);
+        free(state->anchor_h);
+        state->indexed_scores = malloc(count * 2 * sizeof(int16_t));
+        state->top_scores = malloc(top_n * 2 * sizeof(int16_t));
+        state->temp_scores = malloc(top_n * 2 * sizeof(int16_t));
+        if(num_levels > 1) {
+            state->wide_scores = malloc(count * 2 * sizeof(int32_t));
+            state->wide_top = malloc(top_n * 2 * sizeof(int32_t));
+            state->wide_temp = malloc(top_n * 2 * sizeof(int32_t));
+        } else {
+            state->wide_scores = NULL;
+            state->wide_top = NULL;
+            state->wide_temp = NULL;
+        }
+        state->xmins = malloc(count * sizeof(int));
+        state->ymins = malloc(count * sizeof(int));
+        state->xmaxs = malloc(count * sizeof(int));
+        state->ymaxs = malloc(count * sizeof(int));
+        state->anchor_ctr_x = malloc(count * sizeof(int));
+        state->anchor_ctr_y = malloc(count * sizeof(int));
+        state->anchor_w = malloc(count * sizeof(int));
+        state->anchor_h = malloc(count * sizeof(int));
+        state->capacity = count;
+        table_valid = false;
+    }
+    if(!state->indexed_scores || !state->top_scores || !state->temp_scores
+       || !state->xmins || !state->ymins || !state->xmaxs || !state->ymaxs
+       || !state->rois || !state->anchor_ctr_x
+       || !state->anchor_ctr_y || !state->anchor_w || !state->anchor_h
+       || (num_levels > 1 && (!state->level_rois || !state->roi_levels
+                              || !state->wide_scores || !state->wide_top
+                              || !state->wide_temp))
+       || !nms_reserve(&state->nms, top_n)) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
+        // Reallocate everything on the next attempt
+        state->capacity = 0;
+        return false;
+    }
+    if(!table_valid)
+        build_anchor_table(state, bottom1);
+    top->data = state->rois;
+    state->valid = true;
+    return true;
+}
+
+/* Pyramid level of a w x h RoI: the level whose stride is
+ * FPN_CANONICAL_STRIDE for a FPN_CANONICAL_SIZE RoI, one level up for every
+ * doubling of sqrt(w * h), clamped to the levels of the layer */
+static int roi_level(const proposal_config* config, int w, int h) {
+    int canonical = lroundf(log2f((float)FPN_CANONICAL_STRIDE
+                                  / config->feat_stride));
+    float area = max(w * h, 1);
+    int level = canonical
+              + (int)floorf(log2f(sqrtf(area) / FPN_CANONICAL_SIZE));
+    return min(max(level, 0), config->num_levels - 1);
+}
+
+/* Reorders the num_rois rois of state by level, stably, so that each level
+ * can be pooled from its own feature map as one contiguous run */
+static void group_rois_by_level(proposal_state* state,
+                                const proposal_config* config,
+                                size_t num_rois) {
+    size_t* counts = state->roi_level_counts;
+    size_t offsets[PROPOSAL_MAX_LEVELS];
+    uint16_t* rois = state->rois;
+    memset(counts, 0, sizeof(state->roi_level_counts));
+    for(size_t i = 0; i < num_rois; i++) {
+        int w = rois[5*i+3] - rois[5*i+1] + 1;
+        int h = rois[5*i+4] - rois[5*i+2] + 1;
+        state->roi_levels[i] = roi_level(config, w, h);
+        counts[state->roi_levels[i]]++;
+    }
+    size_t offset = 0;
+    for(int l = 0; l < config->num_levels; l++) {
+        offsets[l] = offset;
+        offset += counts[l];
+    }
+    for(size_t i = 0; i < num_rois; i++) {
+        size_t pos = offsets[state->roi_levels[i]]++;
+        memcpy(state->level_rois + 5*pos, rois + 5*i, 5 * sizeof(uint16_t));
+    }
+    memcpy(rois, state->level_rois, 5 * num_rois * sizeof(uint16_t));
+}
+
+/* Moves the (score, index) pairs scoring at least floor to the front of
+ * pairs, in index order, and returns their count. Anchors dropped by the
+ * min_size filter score INT16_MIN, and floor is above that, so they go too.
+ * Each pair is copied unconditionally and the count advanced by the
+ * predicate, which keeps the loop free of branches. *num_sized is set to
+ * the number of pairs not dropped by the min_size filter. */
+static size_t compact_candidates(int16_t* pairs, size_t n, int16_t floor,
+                                 size_t* num_sized) {
+    size_t count = 0, sized = 0;
+    for(size_t i = 0; i < n; i++) {
+        int16_t score = pairs[2*i+0];
+        int16_t index = pairs[2*i+1];
+        pairs[2*count+0] = score;
+        pairs[2*count+1] = index;
+        count += score >= floor;
+        sized += score != INT16_MIN;
+    }
+    *num_sized = sized;
+    return count;
+}
+
+/* Same as compact_candidates(), but writes the pairs to wide as int32, with
+ * the position in pairs as index, for candidates beyond a 16-bit index */
+static size_t compact_candidates_wide(const int16_t* restrict pairs, size_t n,
+                                      int16_t floor, int32_t* restrict wide,
+                                      size_t* num_sized) {
+    size_t count = 0, sized = 0;
+    for(size_t i = 0; i < n; i++) {
+        int16_t score = pairs[2*i+0];
+        wide[2*count+0] = score;
+        wide[2*count+1] = i;
+        count += score >= floor;
+        sized += score != INT16_MIN;
+    }
+    *num_sized = sized;
+    return count;
+}
+
+/* Top-K selection
+ * Scores are int16, so instead of sorting every (score, index) pair, the
+ * n pairs are mapped to 16-bit keys where a smaller key means a higher score.
+ * One histogram pass over the high byte, and one over the low byte of the
+ * boundary bucket, yield the key of the k-th best pair. The k survivors are
+ * then compacted in index order and sorted with a two-pass LSD radix sort,
+ * which is stable, so ties keep ascending index order. O(n + k) overall.
+ * Writes the k (or n, if fewer) best pairs to out in descending score
+ * order, using temp (same size as out) as scratch. Returns the count.
+ * The pairs are int16, or int32 if wide; the body is always inlined into
+ * select_top_k() and select_top_k_wide(), so each gets its own copy. */
+#define TOPK_KEY(score) ((uint16_t)(INT16_MAX - (score)))
+
+static inline int16_t pair_score(const void* pairs, size_t i, bool wide) {
+    return wide ? ((const int32_t*)pairs)[2*i] : ((const int16_t*)pairs)[2*i];
+}
+
+static inline void copy_pair(void* dst, size_t j, const void* src, size_t i,
+                             bool wide) {
+    if(wide)
+        memcpy((int32_t*)dst + 2*j, (const int32_t*)src + 2*i,
+               2 * sizeof(int32_t));
+    else
+        memcpy((int16_t*)dst + 2*j, (const int16_t*)src + 2*i,
+               2 * sizeof(int16_t));
+}
+
+static inline __attribute__((always_inline))
+size_t select_pairs(const void* restrict in, size_t n, size_t k,
+                    void* restrict out, void* restrict temp, bool wide) {
+    size_t hist[256];
+    uint16_t threshold = UINT16_MAX;
+    size_t num_ties = n; // pairs with key == threshold that are selected
+    k = min(k, n);
+
+    // Find the key of the k-th best pair
+    if(k < n) {
+        size_t below = 0;
+        memset(hist, 0, sizeof(hist));
+        for(size_t i = 0; i < n; i++)
+            hist[TOPK_KEY(pair_score(in, i, wide)) >> 8]++;
+        size_t hi = 0;
+        while(below + hist[hi] < k)
+            below += hist[hi++];
+
+        memset(hist, 0, sizeof(hist));
+        for(size_t i = 0; i < n; i++) {
+            uint16_t key = TOPK_KEY(pair_score(in, i, wide));
+            if((key >> 8) == hi)
+                hist[key & 0xFF]++;
+        }
+        size_t lo = 0;
+        while(below + hist[lo] < k)
+            below += hist[lo++];
+        threshold = (hi << 8) | lo;
+        num_ties = k - below;
+    }
+
+    // Compact survivors in index order
+    size_t count = 0;
+    for(size_t i = 0; i < n && count < k; i++) {
+        uint16_t key = TOPK_KEY(pair_score(in, i, wide));
+        bool take = key < threshold;
+        if(key == threshold && num_ties > 0) {
+            take = true;
+            num_ties--;
+        }
+        if(take) {
+            copy_pair(temp, count, in, i, wide);
+            count++;
+        }
+    }
+
+    // Stable LSD radix sort of the survivors, low byte then high byte
+    for(size_t shift = 0; shift < 16; shift += 8) {
+        void* src = shift ? out : temp;
+        void* dst = shift ? temp : out;
+        size_t offset = 0;
+        memset(hist, 0, sizeof(hist));
+        for(size_t i = 0; i < count; i++)
+            hist[(TOPK_KEY(pair_score(src, i, wide)) >> shift) & 0xFF]++;
+        for(size_t b = 0; b < 256; b++) {
+            size_t c = hist[b];
+            hist[b] = offset;
+            offset += c;
+        }
+        for(size_t i = 0; i < count; i++) {
+            uint16_t key = TOPK_KEY(pair_score(src, i, wide));
+            size_t pos = hist[(key >> shift) & 0xFF]++;
+            copy_pair(dst, pos, src, i, wide);
+        }
+    }
+    size_t pair_size = wide ? 2 * sizeof(int32_t) : 2 * sizeof(int16_t);
+    memcpy(out, temp, count * pair_size);
+
+    return count;
+}
+
+static size_t select_top_k(const int16_t* restrict in, size_t n, size_t k,
+                           int16_t* restrict out, int16_t* restrict temp) {
+    return select_pairs(in, n, k, out, temp, false);
+}
+
+static size_t select_top_k_wide(const int32_t* restrict in, size_t n,
+                                size_t k, int32_t* restrict out,
+                                int32_t* restrict temp) {
+    return select_pairs(in, n, k, out, temp, true);
+}
+
+void proposal_set_config(int id, const proposal_config* config) {
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    assert(config->num_anchors > 0
+           && config->num_anchors <= PROPOSAL_MAX_ANCHORS);
+    assert(config->num_levels > 0
+           && config->num_levels <= PROPOSAL_MAX_LEVELS);
+    states[id].config = *config;
+    states[id].has_config = true;
+}
+
+void proposal_set_score_floor(int id, int16_t floor) {
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    assert(floor > INT16_MIN);
+    states[id].has_score_floor = true;
+    states[id].score_floor = floor;
+}
 
-    // Free alloc'ed memory
-    free(xmins);
-    free(xmaxs);
-    free(ymins);
-    free(ymaxs);
-    free(areas);
-    
-    return keep;
+void proposal_get_stats(int id, proposal_stats* stats) {
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    *stats = states[id].stats;
+}
+
+void proposal_get_level_counts(int id, size_t* counts) {
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    memcpy(counts, states[id].roi_level_counts,
+           states[id].config.num_levels * sizeof(size_t));
+}
+
+/* setup() of both modes, with one bottom1 per level */
+static bool setup_levels(int id, blob* const* bottom1, blob* top) {
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    proposal_state* state = &states[id];
+    top->n = 0;
+    exp_lut_init(exp_lut);
+    if(!state->has_config) {
+        proposal_config config = PROPOSAL_DEFAULT_CONFIG;
+        state->config = config;
+        state->has_config = true;
+    }
+    state->specialization = -1;
+    int index = 0;
+    #define MATCH_SPECIALIZATION(name, initializer) { \
+        proposal_config candidate = initializer; \
+        if(state->specialization < 0 \
+           && proposal_config_equal(&state->config, &candidate)) \
+            state->specialization = index; \
+        index++; \
+    }
+    PROPOSAL_SPECIALIZATIONS(MATCH_SPECIALIZATION)
+    #undef MATCH_SPECIALIZATION
+    (void)index;
+    return reserve_workspace(state, bottom1, top);
 }
 
-void proposal_setup(
+bool proposal_setup(
         int id, 
         blob* bottom1, blob* bottom2, blob* bottom3,
         blob* top) {
-    // Nothing to do
-    return;
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    assert(!states[id].has_config || states[id].config.num_levels == 1);
+    return setup_levels(id, &bottom1, top);
 }
 
-void proposal_forward(
-        int id, 
-        blob* bottom1, blob* bottom2, blob* bottom3,
+bool proposal_fpn_setup(
+        int id,
+        blob* const* bottom1, blob* const* bottom2, blob* bottom3,
         blob* top) {
-    size_t h = bottom1->h;
-    size_t w = bottom1->w;
-    size_t K = h * w;
-    int16_t* scores = ((int16_t*) bottom1->data) + num_anchors*h*w;
-    int8_t* bbox_delta = (int8_t*) bottom2->data;
+    return setup_levels(id, bottom1, top);
+}
+
+/* Body of forward(). Always inlined, so that each copy below is compiled
+ * for its own config; with a constant config the parameters become
+ * immediates and the loops over anchors get constant trip factors. */
+static inline __attribute__((always_inline))
+void forward_impl(proposal_state* state, const proposal_config* config,
+                  blob* const* bottom1, blob* const* bottom2, blob* bottom3,
+                  blob* top) {
+    size_t num_anchors = config->num_anchors;
     uint32_t im_info[3] = {0};
     memcpy(im_info, bottom3->data, 3 * _sizeof(UINT32));
 
     // Initialization    
-    int16_t* indexed_scores = malloc((K*num_anchors*2) * sizeof(int16_t));
-    int* proposals = malloc((K*num_anchors*4) * sizeof(int));
-
-    //#pragma omp simd
-    for(size_t i = 0; i < h; i++) {
-        for(size_t j = 0; j < w; j++) {
-            int shift[4] = {j*feat_stride, i*feat_stride,
-                               j*feat_stride, i*feat_stride};
-            for(size_t k = 0; k < num_anchors; k++) {
-                const int* base = anchors[k];
-                int anchor[4] = {base[0]+shift[0], base[1]+shift[1],
-                                 base[2]+shift[2], base[3]+shift[3]};
-                size_t index = i*w*num_anchors + j*num_anchors + k;
-
-                // Implement bbox_transform
-                int width = anchor[2] - anchor[1] + 1;
-                int height = anchor[3] - anchor[1] + 1;
-                int ctr_x = anchor[0] + width / 2;
-                int ctr_y = anchor[1] + height / 2;
-                int pred_ctr_x = ((bbox_delta[index*4+0]*width)>>6) + ctr_x;
-                int pred_ctr_y = ((bbox_delta[index*4+1]*height)>>6) + ctr_y;
-                int pred_w = ldexpf(1.0157477086f,bbox_delta[index*4+2])*width;
-                int pred_h = ldexpf(1.0157477086f,bbox_delta[index*4+3])*height;
-                int pred_box[4] = {pred_ctr_x - pred_w / 2,
-                                   pred_ctr_y - pred_h / 2,
-                                   pred_ctr_x + pred_w / 2,
-                                   pred_ctr_y + pred_h / 2};
-
-                // Implement clip_boxes
-                int proposal[4] = {clamp(pred_box[0], im_info[1], 0),
-                                   clamp(pred_box[1], im_info[0], 0),
-                                   clamp(pred_box[2], im_info[1], 0),
-                                   clamp(pred_box[3], im_info[0], 0)};
-
-                // Implement _filter_boxes
-                float scaling = *((float*)&im_info[2]);
-                int min_size = MIN_SIZE * scaling;
-                int ws = proposal[2] - proposal[0] + 1;
-                int hs = proposal[3] - proposal[1] + 1;
-                if(ws < min_size || hs < min_size) {
-                    indexed_scores[index*2+0] = INT16_MIN;
-                    indexed_scores[index*2+1] = index;
-                    proposals[index*4+0] = 0;
-                    proposals[index*4+1] = 0;
-                    proposals[index*4+2] = 0;
-                    proposals[index*4+3] = 0;
-                }
-                else {
-                    indexed_scores[index*2+0] = scores[index];
-                    indexed_scores[index*2+1] = index;
-                    proposals[index*4+0] = proposal[0];
-                    proposals[index*4+1] = proposal[1];
-                    proposals[index*4+2] = proposal[2];
-                    proposals[index*4+3] = proposal[3];
-                }
-            }
-        }
-    }
+    size_t count = state->level_start[config->num_levels];
+    assert(count <= state->capacity);
+    int16_t* indexed_scores = state->indexed_scores;
+    nms_boxes boxes = {state->xmins, state->ymins, state->xmaxs, state->ymaxs};
+    float scaling = *((float*)&im_info[2]);
+    int min_size = config->min_size * scaling;
 
-    //#pragma omp simd
-    {
-        sorter_quick_sort((int32_t*)indexed_scores, K*num_anchors);
+    // bbox_transform, clip_boxes and _filter_boxes in one pass over the
+    // anchors of each level, into the shared candidate buffers
+    for(int l = 0; l < config->num_levels; l++) {
+        size_t h = bottom1[l]->h;
+        size_t w = bottom1[l]->w;
+        size_t first = state->level_start[l];
+        assert(state->table_h[l] == h && state->table_w[l] == w);
+        int16_t* scores = ((int16_t*) bottom1[l]->data) + num_anchors*h*w;
+        int8_t* bbox_delta = (int8_t*) bottom2[l]->data;
+        proposal_decode(h*w*num_anchors, bbox_delta, scores,
+                        state->anchor_ctr_x + first, state->anchor_ctr_y + first,
+                        state->anchor_w + first, state->anchor_h + first,
+                        exp_lut, (int)im_info[1], (int)im_info[0], min_size,
+                        first, indexed_scores + 2*first, state->xmins + first,
+                        state->ymins + first, state->xmaxs + first,
+                        state->ymaxs + first);
     }
 
+    // Drop filtered and below-floor anchors before selecting
+    proposal_stats* stats = &state->stats;
+    int16_t floor = state->has_score_floor ? state->score_floor
+                                           : INT16_MIN + 1;
+    // With several levels, as int32 pairs that index past 65535
+    bool wide = config->num_levels > 1;
+    stats->num_anchors = count;
+    if(wide)
+        stats->num_candidates = compact_candidates_wide(
+                indexed_scores, count, floor, state->wide_scores,
+                &stats->num_sized);
+    else
+        stats->num_candidates = compact_candidates(indexed_scores, count,
+                                                   floor, &stats->num_sized);
+
+    // Keep the best pre_nms_top_n proposals, in descending score order
+    int16_t* top_scores = state->top_scores;
+    int32_t* wide_top = state->wide_top;
+    size_t num_proposals;
+    if(wide)
+        num_proposals = select_top_k_wide(state->wide_scores,
+                                          stats->num_candidates,
+                                          config->pre_nms_top_n, wide_top,
+                                          state->wide_temp);
+    else
+        num_proposals = select_top_k(indexed_scores, stats->num_candidates,
+                                     config->pre_nms_top_n, top_scores,
+                                     state->temp_scores);
+    stats->num_pre_nms = num_proposals;
+
     // Non-maximum suppression
-    size_t num_proposals = min(K*num_anchors, PRE_NMS_TOP_N);
-    bool* keep = nms(indexed_scores, proposals, num_proposals);
-    for(size_t i = 0; i < K*num_anchors; i++)
-        if (i >= num_proposals || !keep[i])
-            indexed_scores[2*i+0] = INT16_MIN;
-    //#pragma omp simd
-    {
-        sorter_quick_sort((int32_t*)indexed_scores, K*num_anchors);
-    }
-
-    // Copy to result
-    top->n = POST_NMS_TOP_N;
-    top->data = malloc(5 * POST_NMS_TOP_N * _sizeof(top->type));
+    bool* keep = wide ? nms_in_soa_wide(&state->nms, wide_top, &boxes,
+                                        num_proposals, config->nms_thresh,
+                                        config->nms_grid_cell)
+                      : nms_in_soa(&state->nms, top_scores, &boxes,
+                                   num_proposals, config->nms_thresh,
+                                   config->nms_grid_cell);
+    if(keep == NULL) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
+        top->n = 0;
+        stats->num_rois = 0;
+        memset(state->roi_level_counts, 0, sizeof(state->roi_level_counts));
+        return;
+    }
+
+    // Copy the first post_nms_top_n survivors to result, order preserved
+    top->data = state->rois;
     uint16_t* result = top->data;    
-    for(size_t i = 0; i < POST_NMS_TOP_N; i++) {
-        int16_t idx = indexed_scores[2*i+1];
-        result[5*i] = 0U;
-        result[5*i+1] = proposals[4*idx+0];
-        result[5*i+2] = proposals[4*idx+1];
-        result[5*i+3] = proposals[4*idx+2];
-        result[5*i+4] = proposals[4*idx+3];
+    size_t num_rois = 0;
+    for(size_t i = 0; i < num_proposals && num_rois < config->post_nms_top_n; i++) {
+        if(!keep[i])
+            continue;
+        size_t idx = wide ? (uint32_t)wide_top[2*i+1]
+                          : (uint16_t)top_scores[2*i+1];
+        result[5*num_rois] = 0U;
+        result[5*num_rois+1] = boxes.xmins[idx];
+        result[5*num_rois+2] = boxes.ymins[idx];
+        result[5*num_rois+3] = boxes.xmaxs[idx];
+        result[5*num_rois+4] = boxes.ymaxs[idx];
+        num_rois++;
     }
+    top->n = num_rois;
+    stats->num_rois = num_rois;
 
-    free(indexed_scores);
-    free(proposals);    
-    free(keep);
+    // Assign the rois to the levels they are pooled from
+    if(wide)
+        group_rois_by_level(state, config, num_rois);
+    else
+        state->roi_level_counts[0] = num_rois;
 
     return;
 }
 
-void proposal_reshape(
+#define DEFINE_SPECIALIZATION(name, initializer) \
+    static void forward_##name(proposal_state* state, blob* const* bottom1, \
+                               blob* const* bottom2, blob* bottom3, \
+                               blob* top) { \
+        static const proposal_config config = initializer; \
+        forward_impl(state, &config, bottom1, bottom2, bottom3, top); \
+    }
+PROPOSAL_SPECIALIZATIONS(DEFINE_SPECIALIZATION)
+#undef DEFINE_SPECIALIZATION
+
+/* forward() of both modes, with one bottom1 and bottom2 per level */
+static void forward_levels(int id, blob* const* bottom1, blob* const* bottom2,
+                           blob* bottom3, blob* top) {
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    proposal_state* state = &states[id];
+    if(!state->valid) {
+        fprintf(stderr, "ERROR: Proposal layer %d has no workspace for its "
+                "input shapes.\n", id);
+        top->n = 0;
+        memset(&state->stats, 0, sizeof(proposal_stats));
+        memset(state->roi_level_counts, 0, sizeof(state->roi_level_counts));
+        return;
+    }
+    int index = 0;
+    #define CALL_SPECIALIZATION(name, initializer) \
+        if(state->specialization == index++) { \
+            forward_##name(state, bottom1, bottom2, bottom3, top); \
+            return; \
+        }
+    PROPOSAL_SPECIALIZATIONS(CALL_SPECIALIZATION)
+    #undef CALL_SPECIALIZATION
+    (void)index;
+    forward_impl(state, &state->config, bottom1, bottom2, bottom3, top);
+}
+
+void proposal_forward(
         int id, 
         blob* bottom1, blob* bottom2, blob* bottom3,
         blob* top) {
-    // Nothing to do
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    assert(states[id].config.num_levels == 1);
+    forward_levels(id, &bottom1, &bottom2, bottom3, top);
     return;
 }
 
+void proposal_fpn_forward(
+        int id,
+        blob* const* bottom1, blob* const* bottom2, blob* bottom3,
+        blob* top) {
+    forward_levels(id, bottom1, bottom2, bottom3, top);
+    return;
+}
+
+bool proposal_reshape(
+        int id, 
+        blob* bottom1, blob* bottom2, blob* bottom3,
+        blob* top) {
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    assert(states[id].config.num_levels == 1);
+    return reserve_workspace(&states[id], &bottom1, top);
+}
+
+bool proposal_fpn_reshape(
+        int id,
+        blob* const* bottom1, blob* const* bottom2, blob* bottom3,
+        blob* top) {
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    return reserve_workspace(&states[id], bottom1, top);
+}
+
+void proposal_teardown(int id, blob* top) {
+    assert(id >= 0 && id < PROPOSAL_MAX_LAYERS);
+    proposal_state* state = &states[id];
+    free(state->indexed_scores);
+    free(state->top_scores);
+    free(state->temp_scores);
+    free(state->wide_scores);
+    free(state->wide_top);
+    free(state->wide_temp);
+    free(state->xmins);
+    free(state->ymins);
+    free(state->xmaxs);
+    free(state->ymaxs);
+    free(state->rois);
+    free(state->level_rois);
+    free(state->roi_levels);
+    free(state->anchor_ctr_x);
+    free(state->anchor_ctr_y);
+    free(state->anchor_w);
+    free(state->anchor_h);
+    nms_release(&state->nms);
+    // Keep the configuration for a later setup()
+    proposal_config config = state->config;
+    bool has_config = state->has_config;
+    bool has_score_floor = state->has_score_floor;
+    int16_t score_floor = state->score_floor;
+    memset(state, 0, sizeof(proposal_state));
+    state->config = config;
+    state->has_config = has_config;
+    state->has_score_floor = has_score_floor;
+    state->score_floor = score_floor;
+    top->data = NULL;
+    top->n = 0;
+}
+
@@ -2,20 +2,82 @@
 #define PROPOSAL_H_
 #include <stdbool.h>
 #include "blob.h"
+#include "nms.h"
+#include "proposal_config.h"
 
-bool* nms(int16_t* restrict idx_scores, int* restrict proposals, int N);
+/* Maximum number of proposal layers, i.e. maximum id + 1 */
+#define PROPOSAL_MAX_LAYERS 4
 
-/* Similar to setup() in Caffe. Called once at the beginning. */
-void proposal_setup(int id, blob* bottom1, blob* bottom2, 
+/* Number of anchors that survive each stage of the last forward pass */
+typedef struct proposal_stats_t {
+    size_t num_anchors;    // h * w * num_anchors, summed over levels
+    size_t num_sized;      // not smaller than min_size after clipping
+    size_t num_candidates; // of those, scoring at least the score floor
+    size_t num_pre_nms;    // of those, the best pre_nms_top_n
+    size_t num_rois;       // of those, kept by NMS, at most post_nms_top_n
+} proposal_stats;
+
+/* Sets the parameters of layer id (see proposal_config.h); without this call
+ * the layer uses PROPOSAL_DEFAULT_CONFIG. Must be called before setup().
+ * Configs equal to one of PROPOSAL_SPECIALIZATIONS in ProposalLayer.c run a
+ * copy of forward() compiled for those constant parameters. */
+void proposal_set_config(int id, const proposal_config* config);
+
+/* Drops the anchors of layer id that score below floor, in the same units as
+ * the scores in bottom1, before the top-K selection. Without a floor only
+ * the anchors removed by the min_size filter are dropped. Since most anchors
+ * of a typical frame are background, a floor makes the selection and NMS
+ * work scale with the number of foreground anchors instead of the map area.
+ * May be called at any time; applies from the next forward pass. */
+void proposal_set_score_floor(int id, int16_t floor);
+
+/* Copies the stage counts of the last forward pass of layer id to stats. */
+void proposal_get_stats(int id, proposal_stats* stats);
+
+/* Similar to setup() in Caffe. Called once at the beginning. Allocates the
+ * workspace of layer id for the shape of bottom1, including top->data.
+ * The single-level functions need a config with num_levels == 1.
+ * setup() and reshape() return false, with a message on stderr, if out of
+ * memory or if bottom1 holds more than 65536 anchors; forward() then
+ * outputs no rois (top->n == 0) until a later reshape() succeeds. */
+bool proposal_setup(int id, blob* bottom1, blob* bottom2, 
                     blob* bottom3, blob* top);
 
 /* Similar to forward() in Caffe. Called once per forward pass. */
 void proposal_forward(int id, blob* bottom1, blob* bottom2, 
                       blob* bottom3, blob* top);
 
-/* Similar to reshape() in Caffe. Not implmented. */
-void proposal_reshape(int id, blob* bottom1, blob* bottom2, 
+/* Similar to reshape() in Caffe. Grows the workspace of layer id if bottom1
+ * is larger than at setup(). */
+bool proposal_reshape(int id, blob* bottom1, blob* bottom2, 
                       blob* bottom3, blob* top);
 
+/* Multi-level (FPN) mode, for a config with num_levels > 1 (see
+ * proposal_config.h). bottom1[l] and bottom2[l] are the scores and deltas of
+ * level l, laid out as for the single-level functions; bottom3 is im_info.
+ * The anchors of all levels are decoded into one candidate buffer, which
+ * goes through a single top-K selection and a single NMS, so pre_nms_top_n
+ * and post_nms_top_n apply to all levels together. The rois are then
+ * assigned to levels by size (Eq. (1) of the FPN paper, a 224 x 224 RoI
+ * going to the level of stride 16) and grouped by level, in score order
+ * within each level; see proposal_get_level_counts(). The candidates carry
+ * 32-bit indices, so the levels together may hold more than the 65536
+ * anchors of a single map. */
+bool proposal_fpn_setup(int id, blob* const* bottom1, blob* const* bottom2,
+                        blob* bottom3, blob* top);
+void proposal_fpn_forward(int id, blob* const* bottom1, blob* const* bottom2,
+                          blob* bottom3, blob* top);
+bool proposal_fpn_reshape(int id, blob* const* bottom1, blob* const* bottom2,
+                          blob* bottom3, blob* top);
+
+/* Copies to counts[l] the number of rois of the last forward pass of layer
+ * id assigned to level l, for each of its num_levels levels. The rois of
+ * level 0 come first in top->data, then those of level 1, and so on. */
+void proposal_get_level_counts(int id, size_t* counts);
+
+/* Frees the workspace of layer id, including top->data. The config and
+ * the score floor are kept for a later setup(). */
+void proposal_teardown(int id, blob* top);
+
 #endif
 
@@ -1,4 +1,11 @@
+#include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "blob.h"
 
 uint8_t _sizeof(enum dtype type) {
@@ -16,6 +23,67 @@ uint8_t _sizeof(enum dtype type) {
     }
 }
 
+bool blob_map_file(const char* path, blob_mapping* mapping, int flags,
+                   size_t min_length) {
+    if((flags & BLOB_MAP_KEEP) && mapping->addr != NULL
+       && strcmp(mapping->path, path) == 0 && mapping->length >= min_length)
+        return true;
+    blob_unmap(mapping);
+
+    int fd;
+    struct stat st;
+    if((fd = open(path, O_RDONLY)) == -1) {
+        fprintf(stderr, "ERROR: Cannot open file \"%s\"\n", path);
+        return false;
+    }
+    if(fstat(fd, &st) == -1 || (size_t)st.st_size < min_length
+       || st.st_size == 0) {
+        fprintf(stderr, "ERROR: File \"%s\" is shorter than the %zu bytes "
+                "expected\n", path, min_length);
+        close(fd);
+        return false;
+    }
+    size_t length = st.st_size;
+    void* addr = mmap(NULL, length, PROT_READ,
+                      MAP_PRIVATE | (flags & BLOB_MAP_POPULATE ? MAP_POPULATE : 0),
+                      fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Cannot map file \"%s\"\n", path);
+        return false;
+    }
+    if(flags & BLOB_MAP_SEQUENTIAL)
+        madvise(addr, length, MADV_SEQUENTIAL);
+    if(flags & BLOB_MAP_WILLNEED)
+        madvise(addr, length, MADV_WILLNEED);
+
+    mapping->addr = addr;
+    mapping->length = length;
+    if((mapping->path = strdup(path)) == NULL) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
+        blob_unmap(mapping);
+        return false;
+    }
+    return true;
+}
+
+bool blob_map(const char* path, blob* output, blob_mapping* mapping,
+              int flags) {
+    size_t length = (size_t)output->n * output->c * output->h * output->w
+                  * _sizeof(output->type);
+    if(!blob_map_file(path, mapping, flags, length))
+        return false;
+    output->data = mapping->addr;
+    return true;
+}
+
+void blob_unmap(blob_mapping* mapping) {
+    if(mapping->addr != NULL)
+        munmap(mapping->addr, mapping->length);
+    free(mapping->path);
+    memset(mapping, 0, sizeof(blob_mapping));
+}
+
 void test() {
     return;
 }
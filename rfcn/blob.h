@@ -1,6 +1,8 @@
 #ifndef BLOB_H_
 #define BLOB_H_
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 enum dtype{INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32};
 
@@ -12,5 +14,40 @@ typedef struct blob_t {
 
 uint8_t _sizeof(enum dtype type);
 
+/* Options of blob_map() */
+#define BLOB_MAP_SEQUENTIAL 1 // the data is read front to back (MADV_SEQUENTIAL)
+#define BLOB_MAP_WILLNEED   2 // start reading the whole file now (MADV_WILLNEED)
+#define BLOB_MAP_KEEP       4 // reuse a live mapping of the same path
+#define BLOB_MAP_POPULATE   8 // read the whole file before returning (MAP_POPULATE)
+
+/* A file mapped by blob_map(). Zero-initialize before the first use. */
+typedef struct blob_mapping_t {
+    void* addr;
+    size_t length;
+    char* path;
+} blob_mapping;
+
+/* Points output->data at the pages of the file at path, without copying.
+ * The file must hold at least n * c * h * w elements of output->type.
+ * The mapping is read-only: output->data is shared with the page cache
+ * and must not be written.
+ * Any previous mapping in mapping is released first, unless BLOB_MAP_KEEP is
+ * set and it maps the same path, in which case it is reused as is; this
+ * serves replaying the same inputs every frame without touching the file
+ * system. Returns false, with a message on stderr, if the file cannot be
+ * opened, is too short or cannot be mapped. */
+bool blob_map(const char* path, blob* output, blob_mapping* mapping,
+              int flags);
+
+/* Maps the whole file at path into mapping, read-only, failing if it is
+ * shorter than min_length bytes or empty. flags and the reuse of a live
+ * mapping are as for blob_map(), which is built on it, as is
+ * tensor_file_open(). */
+bool blob_map_file(const char* path, blob_mapping* mapping, int flags,
+                   size_t min_length);
+
+/* Releases the mapping and resets it to zero. */
+void blob_unmap(blob_mapping* mapping);
+
 #endif
 
@@ -0,0 +1,7 @@
+#include <math.h>
+#include "exp_lut.h"
+
+void exp_lut_init(int32_t lut[EXP_LUT_SIZE]) {
+    for(int d = -128; d < 128; d++)
+        lut[d + 128] = (int32_t)lround(exp(d / 64.0) * (1 << EXP_LUT_FRAC_BITS));
+}
@@ -0,0 +1,22 @@
+#ifndef EXP_LUT_H_
+#define EXP_LUT_H_
+#include <stdint.h>
+
+/* Fixed-point exp(d / 64) for the int8 size deltas of bbox_transform
+ * The deltas are quantized with 6 fractional bits, so pred_w is
+ * width * exp(d / 64) for one of only 256 values of d. lut[d + 128] holds
+ * exp(d / 64) in Q14, rounded to nearest; the largest entry, exp(127 / 64)
+ * in Q14, needs 17 bits, so entries are int32. */
+#define EXP_LUT_SIZE 256
+#define EXP_LUT_FRAC_BITS 14
+
+/* Fills lut with round(exp(d / 64) * 2^EXP_LUT_FRAC_BITS) for d = -128..127 */
+void exp_lut_init(int32_t lut[EXP_LUT_SIZE]);
+
+/* size * exp(d / 64), truncated like the float expression it replaces.
+ * Exact to within 1 for sizes up to 2^14. */
+static inline int exp_lut_scale(const int32_t* lut, int8_t d, int size) {
+    return (lut[d + 128] * size) >> EXP_LUT_FRAC_BITS;
+}
+
+#endif
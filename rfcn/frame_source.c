@@ -0,0 +1,131 @@
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "frame_source.h"
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+static void* read_frames(void* arg) {
+    frame_source* source = arg;
+    for(size_t i = 0; i < source->num_paths; i++) {
+        pthread_mutex_lock(&source->lock);
+        while(source->num_read - source->num_released == source->depth
+              && !source->stopping)
+            pthread_cond_wait(&source->freed, &source->lock);
+        bool stopping = source->stopping;
+        pthread_mutex_unlock(&source->lock);
+        if(stopping)
+            break;
+
+        // The slot is free, so it is only touched here until it is published
+        uint64_t start = now_ns();
+        bool ok = tensor_file_open(source->paths[i],
+                                   &source->slots[i % source->depth],
+                                   source->flags);
+        uint64_t io_ns = now_ns() - start;
+
+        pthread_mutex_lock(&source->lock);
+        source->stats.io_ns += io_ns;
+        if(ok)
+            source->num_read++;
+        else
+            source->failed = true;
+        pthread_cond_signal(&source->ready);
+        pthread_mutex_unlock(&source->lock);
+        if(!ok)
+            break;
+    }
+    pthread_mutex_lock(&source->lock);
+    source->stopping = true;
+    pthread_cond_signal(&source->ready);
+    pthread_mutex_unlock(&source->lock);
+    return NULL;
+}
+
+bool frame_source_start(frame_source* source, const char* const* paths,
+                        size_t num_paths, size_t depth, int flags) {
+    assert(!source->running);
+    assert(depth >= 1 && depth <= FRAME_SOURCE_MAX_DEPTH);
+    source->paths = paths;
+    source->num_paths = num_paths;
+    source->depth = depth;
+    // Each path is read once, so there is no mapping to keep
+    source->flags = (flags | BLOB_MAP_POPULATE) & ~BLOB_MAP_KEEP;
+    source->num_read = source->num_taken = source->num_released = 0;
+    source->failed = source->stopping = false;
+    memset(&source->stats, 0, sizeof(frame_source_stats));
+    pthread_mutex_init(&source->lock, NULL);
+    pthread_cond_init(&source->ready, NULL);
+    pthread_cond_init(&source->freed, NULL);
+    if(pthread_create(&source->reader, NULL, read_frames, source) != 0) {
+        fprintf(stderr, "ERROR: Cannot start the frame reader thread\n");
+        pthread_cond_destroy(&source->freed);
+        pthread_cond_destroy(&source->ready);
+        pthread_mutex_destroy(&source->lock);
+        return false;
+    }
+    source->running = true;
+    return true;
+}
+
+const tensor_file* frame_source_next(frame_source* source) {
+    assert(source->running);
+    assert(source->num_taken == source->num_released);
+    uint64_t start = now_ns();
+    pthread_mutex_lock(&source->lock);
+    while(source->num_read == source->num_taken && !source->stopping)
+        pthread_cond_wait(&source->ready, &source->lock);
+    const tensor_file* frame = NULL;
+    if(source->num_read > source->num_taken) {
+        frame = &source->slots[source->num_taken % source->depth];
+        source->num_taken++;
+        source->stats.num_frames++;
+    }
+    source->stats.wait_ns += now_ns() - start;
+    pthread_mutex_unlock(&source->lock);
+    return frame;
+}
+
+void frame_source_release(frame_source* source) {
+    assert(source->num_taken == source->num_released + 1);
+    // The reader does not touch a taken slot, so it is closed unlocked
+    tensor_file_close(&source->slots[source->num_released % source->depth]);
+    pthread_mutex_lock(&source->lock);
+    source->num_released++;
+    pthread_cond_signal(&source->freed);
+    pthread_mutex_unlock(&source->lock);
+}
+
+bool frame_source_failed(frame_source* source) {
+    pthread_mutex_lock(&source->lock);
+    bool failed = source->failed;
+    pthread_mutex_unlock(&source->lock);
+    return failed;
+}
+
+void frame_source_get_stats(frame_source* source, frame_source_stats* stats) {
+    pthread_mutex_lock(&source->lock);
+    *stats = source->stats;
+    pthread_mutex_unlock(&source->lock);
+}
+
+void frame_source_stop(frame_source* source) {
+    if(!source->running)
+        return;
+    pthread_mutex_lock(&source->lock);
+    source->stopping = true;
+    pthread_cond_signal(&source->freed);
+    pthread_mutex_unlock(&source->lock);
+    pthread_join(source->reader, NULL);
+    for(size_t i = 0; i < source->depth; i++)
+        tensor_file_close(&source->slots[i]);
+    pthread_cond_destroy(&source->freed);
+    pthread_cond_destroy(&source->ready);
+    pthread_mutex_destroy(&source->lock);
+    source->running = false;
+}
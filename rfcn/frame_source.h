@@ -0,0 +1,73 @@
+/*
+ * Frame source: replays a list of tensor files (see tensor_file.h) through
+ * a ring of preloaded frames, the C counterpart of FS.Stream in
+ * template_frcnn.py
+ *   - A reader thread opens the files in order with BLOB_MAP_POPULATE, so
+ *     every page is read in before the frame is handed out, and it keeps up
+ *     to depth frames ahead of the consumer. Compute only waits when the
+ *     reader falls behind, and that wait is counted apart.
+ *   - Files are mapped read-only, so a frame in the ring is the page cache
+ *     itself, not a copy of it, and its blobs must not be written.
+ *   - The consumer takes frames with frame_source_next() and hands each one
+ *     back with frame_source_release() before taking the next.
+ */
+#ifndef FRAME_SOURCE_H_
+#define FRAME_SOURCE_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "tensor_file.h"
+
+/* Maximum number of frames read ahead */
+#define FRAME_SOURCE_MAX_DEPTH 16
+
+typedef struct frame_source_stats_t {
+    size_t num_frames;  // frames handed out so far
+    uint64_t io_ns;     // time the reader spent opening and reading files
+    uint64_t wait_ns;   // time frame_source_next() waited for the reader
+} frame_source_stats;
+
+/* Zero-initialize before frame_source_start(). */
+typedef struct frame_source_t {
+    const char* const* paths;
+    size_t num_paths;
+    size_t depth;
+    int flags;
+    tensor_file slots[FRAME_SOURCE_MAX_DEPTH];
+    size_t num_read;     // files read by the reader
+    size_t num_taken;    // frames taken by the consumer
+    size_t num_released; // frames handed back
+    bool failed, stopping;
+    frame_source_stats stats;
+    pthread_mutex_t lock;
+    pthread_cond_t ready, freed;
+    pthread_t reader;
+    bool running;
+} frame_source;
+
+/* Starts reading the num_paths files at paths, in order, depth frames ahead
+ * (1 to FRAME_SOURCE_MAX_DEPTH). flags are those of tensor_file_open();
+ * BLOB_MAP_POPULATE is always added. paths must outlive the source.
+ * Returns false, with a message on stderr, if the thread cannot start. */
+bool frame_source_start(frame_source* source, const char* const* paths,
+                        size_t num_paths, size_t depth, int flags);
+
+/* The next frame, waiting for the reader if needed. Returns NULL after the
+ * last frame, or when a file fails to open (the reader reports it on
+ * stderr, and frame_source_failed() tells both cases apart). */
+const tensor_file* frame_source_next(frame_source* source);
+
+/* Hands the frame from the last frame_source_next() back to the reader. Its
+ * blobs must not be used afterwards. */
+void frame_source_release(frame_source* source);
+
+/* Whether the reader stopped on a file that failed to open */
+bool frame_source_failed(frame_source* source);
+
+void frame_source_get_stats(frame_source* source, frame_source_stats* stats);
+
+/* Stops the reader and closes the frames still in the ring. */
+void frame_source_stop(frame_source* source);
+
+#endif
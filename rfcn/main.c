@@ -3,157 +3,151 @@
 #include <malloc.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
 #include "blob.h"
+#include "tensor_file.h"
+#include "frame_source.h"
+#include "vp_stub.h"
 #include "ProposalLayer.h"
 #include "PSRoIPoolingLayer.h"
+#include "nms.h"
 
-void read_bin(char* path, blob* output) {
-    size_t length;
-    size_t n = output->n;
-    size_t c = output->c;
-    size_t h = output->h;
-    size_t w = output->w;
-    length = n * c * h * w;
-    size_t size = _sizeof(output->type);
-    
-    if((output->data = malloc(length * size)) == NULL)
-        fprintf(stderr, "ERROR: Ran out of memory.\n");
-    
-    FILE* f;
-    if((f = fopen(path, "rb")) == NULL)
-        fprintf(stderr, "ERROR: Cannot open file \"%s\"\n", path);
-    fread(output->data, size, length, f);
-    fclose(f);
-    
-    return;
-}
+#define CLASS_NMS_THRESH 0.7f
+#define CONF_THRESH 0.3f
 
-int main(int argc, char* argv[]) {
+/* The four VP outputs of a frame, in one tensor file (see tensor_file.h).
+ * Frames are replayed from the files given after the config, or from
+ * FRAME_PATH, by a reader thread that keeps FRAME_DEPTH frames read ahead,
+ * so the timed region only covers compute. */
+#define FRAME_PATH "../py-rfcn/rfcn_out/frame.tensors"
+#define FRAME_DEPTH 4
+
+/* In loop mode (-l), the sustained rate is printed every LOOP_REPORT frames */
+#define LOOP_REPORT 100
+
+static const char* const output_names[] = {"rpn_cls_prob_reshape",
+                                           "rpn_bbox_pred", "rfcn_cls",
+                                           "rfcn_bbox"};
+
+/* The blobs of the network and the buffers of the post-processing, all set
+ * up once, so a frame only changes where the four inputs point */
+typedef struct network_t {
     blob rpn_cls_prob_reshape, rpn_bbox_pred, im_info;
     blob rfcn_cls, rfcn_bbox;
     blob rois, cls_score, bbox_pred_pre;
-    
-    // Initialization
-    rpn_cls_prob_reshape.type = INT16;
-    rpn_cls_prob_reshape.n = 1;
-    rpn_cls_prob_reshape.c = 18;
-    rpn_cls_prob_reshape.h = 24;
-    rpn_cls_prob_reshape.w = 32;
-    rpn_bbox_pred.type = INT8;
-    rpn_bbox_pred.n = 1;
-    rpn_bbox_pred.c = 36;
-    rpn_bbox_pred.h = 24;
-    rpn_bbox_pred.w = 32;
-    im_info.type = UINT32;
-    im_info.n = 1;
-    im_info.c = 1;
-    im_info.h = 1;
-    im_info.w = 3;
-    rfcn_cls.type = INT8;
-    rfcn_cls.n = 1;
-    rfcn_cls.c = (20+1)*7*7;
-    rfcn_cls.h = 24;
-    rfcn_cls.w = 32;
-    rfcn_bbox.type = INT8;
-    rfcn_bbox.n = 1;
-    rfcn_bbox.c = 8*7*7;
-    rfcn_bbox.h = 24;
-    rfcn_bbox.w = 32;
-    rois.type = UINT16;
-    rois.c = 1;
-    rois.h = 1;
-    rois.w = 5;
-    cls_score.type = FLOAT32;
-    cls_score.c = 20+1;
-    cls_score.h = 1;
-    cls_score.w = 1;
-    bbox_pred_pre.type = FLOAT32;
-    bbox_pred_pre.c = 8;
-    bbox_pred_pre.h = 1;
-    bbox_pred_pre.w = 1;
+    nms_batch_workspace class_nms;
+    int16_t* scores;  // softmax of cls_score, in Q15
+    int* proposals;   // boxes of the rois
+    uint32_t im_info_data[3];
+    int psroi_threads;          // OpenMP threads of each PSRoIPooling layer
+    enum psroi_mode psroi_mode;
+} network;
+
+static unsigned long elapsed_ns(const struct timespec* start,
+                                const struct timespec* stop) {
+    return (stop->tv_sec - start->tv_sec) * 1000000000L
+         + (stop->tv_nsec - start->tv_nsec);
+}
+
+/* Sets up the layers for inputs of the types and shapes in net */
+static void setup_network(network* net, const proposal_config* config) {
+    net->im_info.type = UINT32;
+    net->im_info.n = 1;
+    net->im_info.c = 1;
+    net->im_info.h = 1;
+    net->im_info.w = 3;
+    net->rois.type = UINT16;
+    net->rois.c = 1;
+    net->rois.h = 1;
+    net->rois.w = 5;
+    net->cls_score.type = FLOAT32;
+    net->cls_score.c = 20+1;
+    net->cls_score.h = 1;
+    net->cls_score.w = 1;
+    net->bbox_pred_pre.type = FLOAT32;
+    net->bbox_pred_pre.c = 8;
+    net->bbox_pred_pre.h = 1;
+    net->bbox_pred_pre.w = 1;
 
     // Setup prior to entrance into infinite loop
-    proposal_setup(
-            0, 
-            &rpn_cls_prob_reshape, &rpn_bbox_pred, &im_info,
-            &rois
-        );
+    if(!proposal_setup(
+            0,
+            &net->rpn_cls_prob_reshape, &net->rpn_bbox_pred, &net->im_info,
+            &net->rois
+        ))
+        exit(EXIT_FAILURE);
+    for(int id = 0; id < 2; id++) {
+        psroipooling_set_max_rois(id, config->post_nms_top_n);
+        psroipooling_set_num_threads(id, net->psroi_threads);
+        psroipooling_set_mode(id, net->psroi_mode);
+    }
     psroipooling_setup(
             0,
-            &rfcn_cls, &rois,
-            &cls_score
+            &net->rfcn_cls, &net->rois,
+            &net->cls_score
         );
     psroipooling_setup(
             1,
-            &rfcn_bbox, &rois,
-            &bbox_pred_pre
+            &net->rfcn_bbox, &net->rois,
+            &net->bbox_pred_pre
         );
-    im_info.type = UINT32;
-    im_info.data = malloc(3 * _sizeof(UINT32));
-    uint32_t* im_info_data = im_info.data;
-    im_info_data[0] = 375;
-    im_info_data[1] = 500;
+    net->im_info_data[0] = 375;
+    net->im_info_data[1] = 500;
     float scaling = 1.0f;
-    im_info_data[2] = *((uint32_t*)&scaling);
-
-    // Should be an infinite loop during deployment
-    /*
-     * while(True) {
-     *     while(!VP_output_ready) {};
-     */
-
-    // Timing logic
-    struct timespec start, stop;
-    clockid_t clk_id = CLOCK_MONOTONIC;
-    if(clock_gettime(clk_id, &start) == -1)
+    memcpy(&net->im_info_data[2], &scaling, sizeof(float));
+    net->im_info.data = net->im_info_data;
+
+    size_t max_rois = config->post_nms_top_n;
+    net->scores = malloc(max_rois * (20+1) * sizeof(int16_t));
+    net->proposals = malloc(max_rois * 4 * sizeof(int));
+    if(net->scores == NULL || net->proposals == NULL
+       || !nms_batch_reserve(&net->class_nms, max_rois, 20+1)) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
         exit(EXIT_FAILURE);
+    }
+}
 
-    // Parse .bin files
-    // Fetch output from VP during deployment
-    read_bin("../py-rfcn/rfcn_out/rfcn_bbox.bin", &rfcn_bbox);
-    read_bin("../py-rfcn/rfcn_out/rfcn_cls.bin", &rfcn_cls);
-    read_bin("../py-rfcn/rfcn_out/rpn_cls_prob_reshape.bin", 
-             &rpn_cls_prob_reshape);
-    read_bin("../py-rfcn/rfcn_out/rpn_bbox_pred.bin", &rpn_bbox_pred);
-   
+/* Runs the layers and the post-processing on the inputs in net */
+static void run_network(network* net) {
     // Prepare layers
     proposal_reshape(
-            0, 
-            &rpn_cls_prob_reshape, &rpn_bbox_pred, &im_info,
-            &rois
+            0,
+            &net->rpn_cls_prob_reshape, &net->rpn_bbox_pred, &net->im_info,
+            &net->rois
         );
     psroipooling_reshape(
             0,
-            &rfcn_cls, &rois,
-            &cls_score
+            &net->rfcn_cls, &net->rois,
+            &net->cls_score
         );
     psroipooling_reshape(
             1,
-            &rfcn_bbox, &rois,
-            &bbox_pred_pre
+            &net->rfcn_bbox, &net->rois,
+            &net->bbox_pred_pre
         );
-    
+
     // Evoke layers
     proposal_forward(
-            0, 
-            &rpn_cls_prob_reshape, &rpn_bbox_pred, &im_info,
-            &rois
+            0,
+            &net->rpn_cls_prob_reshape, &net->rpn_bbox_pred, &net->im_info,
+            &net->rois
         );
     psroipooling_forward(
             0,
-            &rfcn_cls, &rois,
-            &cls_score
+            &net->rfcn_cls, &net->rois,
+            &net->cls_score
         );
     psroipooling_forward(
             1,
-            &rfcn_bbox, &rois,
-            &bbox_pred_pre
+            &net->rfcn_bbox, &net->rois,
+            &net->bbox_pred_pre
         );
 
     // Apply softmax
-    int num = cls_score.n;
-    float* data = cls_score.data;
-    float* bbox = bbox_pred_pre.data;
+    int num = net->cls_score.n;
+    float* data = net->cls_score.data;
     for(int i = 0; i < num; i++) {
         double sum = 0.0;
         for(int class = 0; class < 20+1; class++)
@@ -162,59 +156,239 @@ int main(int argc, char* argv[]) {
             data[i*(20+1) + class] /= sum;
         }
     }
-    
+
     /* Print results */
     // Initialization
-    int16_t* idx_scores = malloc(num * 2 * sizeof(int16_t));
-    int* proposals = malloc(num * 4 * sizeof(int));
+    int16_t* scores = net->scores;
+    int* proposals = net->proposals;
+    const uint16_t* rois = net->rois.data;
     for(int i = 0; i < num; i++) {
-        idx_scores[2*i+1] = i;
-        proposals[4*i+0] = ((uint16_t*)rois.data)[4*i+0]; //bbox[8*i+4];
-        proposals[4*i+1] = ((uint16_t*)rois.data)[4*i+1]; //bbox[8*i+5];
-        proposals[4*i+2] = ((uint16_t*)rois.data)[4*i+2]; //bbox[8*i+6];
-        proposals[4*i+3] = ((uint16_t*)rois.data)[4*i+3]; //bbox[8*i+7];
+        for(int class = 0; class < 20+1; class++)
+            scores[i*(20+1) + class] = data[i*(20+1) + class] * INT16_MAX;
+        proposals[4*i+0] = rois[5*i+1];
+        proposals[4*i+1] = rois[5*i+2];
+        proposals[4*i+2] = rois[5*i+3];
+        proposals[4*i+3] = rois[5*i+4];
     }
-    // Loop through each class
+
+    // Perform nms for every class at once; class 0 is the background
+    nms_batch_workspace* class_nms = &net->class_nms;
+    float thresholds[20+1];
+    thresholds[0] = -1.0f;
+    for(int class = 1; class < 20+1; class++)
+        thresholds[class] = CLASS_NMS_THRESH;
+    nms_batched(class_nms, scores, proposals, num, 20+1, thresholds);
+}
+
+/* Prints the detections and the proposal counts of the last run_network().
+ * They only live in net, so the frame may be released first. */
+static void print_results(network* net) {
+    const int16_t* scores = net->scores;
+    const int* proposals = net->proposals;
+    const nms_batch_workspace* class_nms = &net->class_nms;
     for(int class = 1; class < 20+1; class++) {
-        // Extract scores for the class
-        for(int i = 0; i < num; i++)
-            idx_scores[2*i+0] = data[i*(20+1) + class];
-
-        // Perform nms
-        bool* keep = nms(idx_scores, proposals, num);
-        for(int i = 0; i < num; i++)
-            if(keep[i] && idx_scores[2*i] > 0.3*INT16_MAX)
+        const int* keep = class_nms->keep + class * class_nms->capacity;
+        for(size_t k = 0; k < class_nms->num_keep[class]; k++) {
+            int i = keep[k];
+            int16_t score = scores[i*(20+1) + class];
+            if(score > CONF_THRESH*INT16_MAX)
                 printf("Class %d (conf:%f) -- (%d,%d,%d,%d)\n",
-                       class, (float)idx_scores[2*i]/INT16_MAX,
-                       proposals[4*idx_scores[2*i+1]+0],
-                       proposals[4*idx_scores[2*i+1]+1],
-                       proposals[4*idx_scores[2*i+1]+2],
-                       proposals[4*idx_scores[2*i+1]+3]);
-        
-        // Free memory
-        free(keep);
+                       class, (float)score/INT16_MAX,
+                       proposals[4*i+0], proposals[4*i+1],
+                       proposals[4*i+2], proposals[4*i+3]);
+        }
     }
-    
-    // Timing logic
-    if(clock_gettime(clk_id, &stop) == -1)
+
+    proposal_stats stats;
+    proposal_get_stats(0, &stats);
+    printf("Proposals: %zu anchors, %zu sized, %zu above floor, "
+           "%zu pre-NMS, %zu rois\n", stats.num_anchors, stats.num_sized,
+           stats.num_candidates, stats.num_pre_nms, stats.num_rois);
+}
+
+static void teardown_network(network* net) {
+    free(net->scores);
+    free(net->proposals);
+    nms_batch_release(&net->class_nms);
+    psroipooling_teardown(0, &net->cls_score);
+    psroipooling_teardown(1, &net->bbox_pred_pre);
+    proposal_teardown(0, &net->rois);
+}
+
+/* Processes every frame once, as read ahead by a frame_source */
+static void replay(network* net, const proposal_config* config,
+                   const char* const* paths, size_t num_paths) {
+    frame_source source = {0};
+    blob* inputs[] = {&net->rpn_cls_prob_reshape, &net->rpn_bbox_pred,
+                      &net->rfcn_cls, &net->rfcn_bbox};
+    if(!frame_source_start(&source, paths, num_paths, FRAME_DEPTH,
+                           BLOB_MAP_WILLNEED))
         exit(EXIT_FAILURE);
-    unsigned long time_spent = (stop.tv_sec - start.tv_sec) * 1000000000L
-                             + (stop.tv_nsec - start.tv_nsec);
-    printf("TIME ELAPSED: %ld ms\n", time_spent / 1000000L);
-
-    // Free memory
-    free(rpn_bbox_pred.data);
-    free(rpn_cls_prob_reshape.data);
-    free(rfcn_bbox.data);
-    free(rfcn_cls.data);
-    free(idx_scores);
-    free(proposals);
-
-    // End of while loop
-    /*
-     * } // should not reach here
-     * return 0;
-     */
-    return 1;
+
+    // The VP outputs take their types and shapes from the first frame;
+    // every later frame must match them
+    const tensor_file* frame = frame_source_next(&source);
+    if(frame == NULL)
+        exit(EXIT_FAILURE);
+    for(int i = 0; i < 4; i++)
+        if(!tensor_file_describe(frame, output_names[i], inputs[i]))
+            exit(EXIT_FAILURE);
+    if(net->rpn_cls_prob_reshape.c != 2 * config->num_anchors
+       || net->rpn_bbox_pred.c != 4 * config->num_anchors) {
+        fprintf(stderr, "ERROR: The RPN outputs of \"%s\" do not have %d "
+                "anchors\n", paths[0], config->num_anchors);
+        exit(EXIT_FAILURE);
+    }
+    setup_network(net, config);
+
+    unsigned long compute_ns = 0;
+    for(; frame != NULL; frame = frame_source_next(&source)) {
+        // Timing logic
+        struct timespec start, stop;
+        clockid_t clk_id = CLOCK_MONOTONIC;
+        if(clock_gettime(clk_id, &start) == -1)
+            exit(EXIT_FAILURE);
+
+        for(int i = 0; i < 4; i++)
+            if(!tensor_file_get(frame, output_names[i], inputs[i]))
+                exit(EXIT_FAILURE);
+        run_network(net);
+
+        // Timing logic
+        if(clock_gettime(clk_id, &stop) == -1)
+            exit(EXIT_FAILURE);
+        compute_ns += elapsed_ns(&start, &stop);
+        frame_source_release(&source);
+        print_results(net);
+    }
+    if(frame_source_failed(&source))
+        exit(EXIT_FAILURE);
+
+    // Compute and I/O are timed apart; I/O overlaps compute, so only the
+    // wait for the reader adds to the wall time
+    frame_source_stats io;
+    frame_source_get_stats(&source, &io);
+    printf("TIME ELAPSED: %ld ms\n", compute_ns / 1000000L);
+    printf("Frames: %zu, %.1f ms compute per frame, %.1f ms I/O on the "
+           "reader thread, %.1f ms waited for it\n", io.num_frames,
+           compute_ns / 1e6 / io.num_frames, io.io_ns / 1e6,
+           io.wait_ns / 1e6);
+    frame_source_stop(&source);
+}
+
+static void print_loop_stats(vp_stub* vp, const struct timespec* start,
+                             unsigned long compute_ns) {
+    struct timespec now;
+    vp_stub_stats stats;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    vp_stub_get_stats(vp, &stats);
+    double wall_s = elapsed_ns(start, &now) / 1e9;
+    printf("Loop: %zu frames, %.1f frames/s, %.1f ms compute per frame, "
+           "%.1f ms waited for the VP, %.1f ms VP stalled, %zu late\n",
+           stats.num_frames, stats.num_frames / wall_s,
+           compute_ns / 1e6 / stats.num_frames, stats.wait_ns / 1e6,
+           stats.stall_ns / 1e6, stats.num_late);
 }
 
+/* The deployment loop: the VP stub writes frame t+1 into one buffer set
+ * while frame t is processed from the other */
+static void loop(network* net, const proposal_config* config,
+                 const char* const* paths, size_t num_paths, double fps,
+                 size_t num_frames) {
+    vp_stub vp = {0};
+    blob* inputs[] = {&net->rpn_cls_prob_reshape, &net->rpn_bbox_pred,
+                      &net->rfcn_cls, &net->rfcn_bbox};
+    if(!vp_stub_start(&vp, paths, num_paths, output_names, 4, fps,
+                      num_frames))
+        exit(EXIT_FAILURE);
+
+    // Both buffer sets have the shapes of the first file
+    for(int i = 0; i < 4; i++)
+        *inputs[i] = vp.buffers[0].outputs[i];
+    if(net->rpn_cls_prob_reshape.c != 2 * config->num_anchors
+       || net->rpn_bbox_pred.c != 4 * config->num_anchors) {
+        fprintf(stderr, "ERROR: The RPN outputs of \"%s\" do not have %d "
+                "anchors\n", paths[0], config->num_anchors);
+        exit(EXIT_FAILURE);
+    }
+    setup_network(net, config);
+
+    struct timespec start, frame_start, frame_stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long compute_ns = 0;
+    const vp_frame* frame;
+    while((frame = vp_stub_wait(&vp)) != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &frame_start);
+        size_t index = frame->index;
+        for(int i = 0; i < 4; i++)
+            inputs[i]->data = frame->outputs[i].data;
+        run_network(net);
+        clock_gettime(CLOCK_MONOTONIC, &frame_stop);
+        compute_ns += elapsed_ns(&frame_start, &frame_stop);
+        vp_stub_release(&vp);
+        if(index == 0)
+            print_results(net);
+        if((index + 1) % LOOP_REPORT == 0)
+            print_loop_stats(&vp, &start, compute_ns);
+    }
+    if(vp_stub_failed(&vp))
+        exit(EXIT_FAILURE);
+    print_loop_stats(&vp, &start, compute_ns);
+    vp_stub_stop(&vp);
+}
+
+int main(int argc, char* argv[]) {
+    network net = {0};
+
+    // Usage: main [-l FPS [-n FRAMES]] [-t THREADS] [-i] [CONFIG [FRAME...]]
+    //   -l FPS      loop over the frames at FPS frames/s (0: as fast as the
+    //               ARM side keeps up) instead of processing each once
+    //   -n FRAMES   stop the loop after FRAMES frames (default: never)
+    //   -t THREADS  threads of each PSRoIPooling layer (default: all cores)
+    //   -i          PSRoIPooling with summed-area tables (PSROI_INTEGRAL)
+    //   CONFIG      proposal config, "-" for the default
+    bool looping = false;
+    double fps = 0.0;
+    size_t num_frames = 0;
+    net.psroi_threads = omp_get_num_procs();
+    net.psroi_mode = PSROI_DIRECT;
+    int opt;
+    while((opt = getopt(argc, argv, "l:n:t:i")) != -1) {
+        if(opt == 'l') {
+            looping = true;
+            fps = atof(optarg);
+        }
+        else if(opt == 'n')
+            num_frames = strtoul(optarg, NULL, 10);
+        else if(opt == 't' && atoi(optarg) >= 1)
+            net.psroi_threads = atoi(optarg);
+        else if(opt == 'i')
+            net.psroi_mode = PSROI_INTEGRAL;
+        else {
+            fprintf(stderr, "Usage: %s [-l FPS [-n FRAMES]] [-t THREADS] "
+                    "[-i] [CONFIG [FRAME...]]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    // Proposal parameters
+    proposal_config config = PROPOSAL_DEFAULT_CONFIG;
+    if(argc > 0 && strcmp(argv[0], "-") != 0
+       && !proposal_config_load(argv[0], &config))
+        exit(EXIT_FAILURE);
+    proposal_set_config(0, &config);
+    static const char* const default_paths[] = {FRAME_PATH};
+    const char* const* paths = argc > 1 ? (const char* const*)argv + 1
+                                        : default_paths;
+    size_t num_paths = argc > 1 ? (size_t)argc - 1 : 1;
+
+    if(looping)
+        loop(&net, &config, paths, num_paths, fps, num_frames);
+    else
+        replay(&net, &config, paths, num_paths);
+
+    teardown_network(&net);
+    return 0;
+}
@@ -0,0 +1,656 @@
+#include <math.h>
+#include <stdio.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "nms.h"
+#include "iou.h"
+#include "nms_grid.h"
+
+/* Util Macros */
+#define clampf(num, max, min) (fmaxf(fminf(num, max), min))
+#define min(a,b) ({ __typeof__ (a) _a = (a); \
+                    __typeof__ (b) _b = (b); \
+                    _a > _b ? _b : _a; })
+#define max(a,b) ({ __typeof__ (a) _a = (a); \
+                    __typeof__ (b) _b = (b); \
+                    _a > _b ? _a : _b; })
+
+/* Global Constants */
+#define NMS_THRESH 0.7f
+#define NMS_THRESH_Q IOU_THRESH_Q(NMS_THRESH)
+#define NMS_BLOCK 64 // boxes per suppression mask word
+
+// Floating-point IoU, only used by nms_reference()
+static inline float iou(const int* restrict xmins, const int* restrict ymins,
+                        const int* restrict xmaxs, const int* restrict ymaxs,
+                        const int* restrict areas, size_t i, size_t j) {
+    int x1 = max(xmins[i], xmins[j]);
+    int y1 = max(ymins[i], ymins[j]);
+    int x2 = min(xmaxs[i], xmaxs[j]);
+    int y2 = min(ymaxs[i], ymaxs[j]);
+    int area1 = areas[i];
+    int area2 = areas[j];
+
+    int i_area = max(x2 - x1, 0) * max(y2 - y1, 0);
+
+    int u_area = area1 + area2 - i_area;
+
+    return clampf(((float)i_area)/((float)u_area), 1.0f, 0.0f);
+}
+
+/* Gather the sorted boxes into zero-padded coordinate arrays of length
+ * padded, so that every mask word covers a full block of NMS_BLOCK boxes.
+ * Box idx is read at boxes->xmins[idx * stride] etc., which covers both
+ * interleaved proposals (stride 4) and separate arrays (stride 1).
+ * idx_scores holds int16 pairs, or int32 pairs if wide. */
+static void rearrange(const void* restrict idx_scores, bool wide,
+                      const nms_boxes* boxes, size_t stride, size_t N,
+                      size_t padded,
+                      int* restrict xmins, int* restrict ymins,
+                      int* restrict xmaxs, int* restrict ymaxs,
+                      int* restrict areas) {
+    for(size_t i = 0; i < N; i++) {
+        size_t idx = wide ? (uint32_t)((const int32_t*)idx_scores)[i*2+1]
+                          : (uint16_t)((const int16_t*)idx_scores)[i*2+1];
+        xmins[i] = boxes->xmins[idx*stride];
+        ymins[i] = boxes->ymins[idx*stride];
+        xmaxs[i] = boxes->xmaxs[idx*stride];
+        ymaxs[i] = boxes->ymaxs[idx*stride];
+    }
+    for(size_t i = N; i < padded; i++) {
+        xmins[i] = 0;
+        ymins[i] = 0;
+        xmaxs[i] = 0;
+        ymaxs[i] = 0;
+    }
+    //#pragma omp simd
+    for(size_t i = 0; i < padded; i++)
+        areas[i] = (xmaxs[i]-xmins[i]) * (ymaxs[i]-ymins[i]);
+}
+
+/* Views interleaved 4-int proposals as nms_boxes, with a stride of 4 */
+static nms_boxes interleaved(const int* proposals) {
+    nms_boxes boxes = {proposals, proposals+1, proposals+2, proposals+3};
+    return boxes;
+}
+
+bool nms_reserve(nms_workspace* ws, size_t max_n) {
+    if(max_n <= ws->capacity)
+        return true;
+    nms_release(ws);
+    size_t blocks = (max_n + NMS_BLOCK - 1) / NMS_BLOCK;
+    size_t padded = blocks * NMS_BLOCK;
+    ws->xmins = malloc(padded * sizeof(int));
+    ws->ymins = malloc(padded * sizeof(int));
+    ws->xmaxs = malloc(padded * sizeof(int));
+    ws->ymaxs = malloc(padded * sizeof(int));
+    ws->areas = malloc(padded * sizeof(int));
+    ws->mask = malloc(max_n * blocks * sizeof(uint64_t));
+    ws->removed = malloc(blocks * sizeof(uint64_t));
+    ws->keep = malloc(max_n * sizeof(bool));
+    ws->scores = malloc(max_n * sizeof(float));
+    ws->indices = malloc(max_n * sizeof(int));
+    if(!ws->xmins || !ws->ymins || !ws->xmaxs || !ws->ymaxs || !ws->areas
+       || !ws->mask || !ws->removed || !ws->keep || !ws->scores
+       || !ws->indices) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
+        nms_release(ws);
+        return false;
+    }
+    ws->capacity = max_n;
+    return true;
+}
+
+void nms_release(nms_workspace* ws) {
+    free(ws->xmins);
+    free(ws->ymins);
+    free(ws->xmaxs);
+    free(ws->ymaxs);
+    free(ws->areas);
+    free(ws->mask);
+    free(ws->removed);
+    free(ws->keep);
+    free(ws->scores);
+    free(ws->indices);
+    free(ws->grid_starts);
+    free(ws->grid_entries);
+    memset(ws, 0, sizeof(nms_workspace));
+}
+
+/* Bitmask NMS
+ * The suppression matrix is built first: bit (j % 64) of word mask[i][j / 64]
+ * is set iff box j > i overlaps box i by more than NMS_THRESH. Rows do not
+ * depend on each other, so they are spread across threads, and each 64-wide
+ * block is a branch-free loop feeding the integer IoU kernel in iou.h.
+ * A single sequential scan then ORs the rows of the surviving boxes into a
+ * "removed" bitset, which is exactly the greedy order of the reference
+ * implementation. */
+static bool* suppress_matrix(nms_workspace* ws, int N, int64_t thresh_q) {
+    size_t blocks = (N + NMS_BLOCK - 1) / NMS_BLOCK;
+    size_t padded = blocks * NMS_BLOCK;
+    const int* xmins = ws->xmins;
+    const int* ymins = ws->ymins;
+    const int* xmaxs = ws->xmaxs;
+    const int* ymaxs = ws->ymaxs;
+    const int* areas = ws->areas;
+    uint64_t* mask = ws->mask;
+    uint64_t* removed = ws->removed;
+    bool* keep = ws->keep;
+
+    memset(removed, 0, blocks * sizeof(uint64_t));
+
+    // Build suppression matrix; only words at or after row i are ever read
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(size_t i = 0; i < N; i++) {
+        uint64_t* row = mask + i * blocks;
+        for(size_t b = i / NMS_BLOCK; b < blocks; b++) {
+            size_t start = b * NMS_BLOCK;
+            int32_t i_areas[NMS_BLOCK];
+            int32_t u_areas[NMS_BLOCK];
+            for(size_t k = 0; k < NMS_BLOCK; k++) {
+                size_t j = start + k;
+                int x1 = max(xmins[i], xmins[j]);
+                int y1 = max(ymins[i], ymins[j]);
+                int x2 = min(xmaxs[i], xmaxs[j]);
+                int y2 = min(ymaxs[i], ymaxs[j]);
+                i_areas[k] = max(x2 - x1, 0) * max(y2 - y1, 0);
+                u_areas[k] = areas[i] + areas[j] - i_areas[k];
+            }
+            uint64_t bits = iou_exceeds_mask(i_areas, u_areas, NMS_BLOCK,
+                                             thresh_q);
+            // Drop the diagonal, boxes before i, and the zero padding
+            if(b == i / NMS_BLOCK)
+                bits &= (~0ULL << (i % NMS_BLOCK)) << 1;
+            if(start + NMS_BLOCK > N)
+                bits &= ~0ULL >> (padded - N);
+            row[b] = bits;
+        }
+    }
+
+    // Resolve suppression in score order
+    for(size_t i = 0; i < N; i++) {
+        size_t b = i / NMS_BLOCK;
+        keep[i] = !((removed[b] >> (i % NMS_BLOCK)) & 1ULL);
+        if(!keep[i])
+            continue;
+        const uint64_t* row = mask + i * blocks;
+        for(; b < blocks; b++)
+            removed[b] |= row[b];
+    }
+
+    return keep;
+}
+
+/* Grid-pruned NMS
+ * Every box is listed in the grid cells it touches. Each surviving box, in
+ * score order, then only tests the later boxes listed in its own cells, and
+ * removes those that overlap it by more than NMS_THRESH. Pairs outside a
+ * common cell do not intersect and could not suppress each other anyway. */
+static bool* suppress_grid(nms_workspace* ws, int N, int cell,
+                           int64_t thresh_q) {
+    const int* xmins = ws->xmins;
+    const int* ymins = ws->ymins;
+    const int* xmaxs = ws->xmaxs;
+    const int* ymaxs = ws->ymaxs;
+    const int* areas = ws->areas;
+    bool* keep = ws->keep;
+
+    // Lay the grid over the bounding rectangle of all boxes
+    int x_lo = INT32_MAX, y_lo = INT32_MAX, x_hi = INT32_MIN, y_hi = INT32_MIN;
+    for(int i = 0; i < N; i++) {
+        x_lo = min(x_lo, min(xmins[i], xmaxs[i]));
+        y_lo = min(y_lo, min(ymins[i], ymaxs[i]));
+        x_hi = max(x_hi, max(xmins[i], xmaxs[i]));
+        y_hi = max(y_hi, max(ymins[i], ymaxs[i]));
+    }
+    nms_grid_t grid;
+    nms_grid_layout(&grid, x_lo, y_lo, x_hi, y_hi, cell);
+    if(ws->grid_starts == NULL)
+        ws->grid_starts = malloc((NMS_GRID_MAX_CELLS + 1) * sizeof(uint32_t));
+    if(ws->grid_starts == NULL) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
+        return NULL;
+    }
+    grid.starts = ws->grid_starts;
+    memset(grid.starts, 0, (nms_grid_num_cells(&grid) + 1) * sizeof(uint32_t));
+    for(int i = 0; i < N; i++)
+        nms_grid_count(&grid, min(xmins[i], xmaxs[i]), min(ymins[i], ymaxs[i]),
+                       max(xmins[i], xmaxs[i]), max(ymins[i], ymaxs[i]));
+    size_t total = nms_grid_prefix(&grid);
+    if(total > ws->grid_capacity) {
+        free(ws->grid_entries);
+        ws->grid_entries = malloc(total * sizeof(uint32_t));
+        ws->grid_capacity = ws->grid_entries != NULL ? total : 0;
+        if(ws->grid_entries == NULL) {
+            fprintf(stderr, "ERROR: Ran out of memory.\n");
+            return NULL;
+        }
+    }
+    grid.entries = ws->grid_entries;
+    for(int i = 0; i < N; i++)
+        nms_grid_insert(&grid, i, min(xmins[i], xmaxs[i]),
+                        min(ymins[i], ymaxs[i]), max(xmins[i], xmaxs[i]),
+                        max(ymins[i], ymaxs[i]));
+    nms_grid_finish(&grid);
+
+    // Greedy scan in score order
+    for(int i = 0; i < N; i++)
+        keep[i] = true;
+    for(int i = 0; i < N; i++) {
+        if(!keep[i])
+            continue;
+        int32_t c0, r0, c1, r1;
+        nms_grid_span(&grid, min(xmins[i], xmaxs[i]), min(ymins[i], ymaxs[i]),
+                      max(xmins[i], xmaxs[i]), max(ymins[i], ymaxs[i]),
+                      &c0, &r0, &c1, &r1);
+        for(int32_t r = r0; r <= r1; r++) {
+            for(int32_t c = c0; c <= c1; c++) {
+                const uint32_t* cell_begin = grid.entries + grid.starts[r * grid.cols + c];
+                const uint32_t* cell_end = grid.entries + grid.starts[r * grid.cols + c + 1];
+                // Entries are ascending, so walk back until the boxes before i
+                while(cell_end != cell_begin && *(cell_end - 1) > (uint32_t)i) {
+                    uint32_t j = *--cell_end;
+                    if(!keep[j])
+                        continue;
+                    int x1 = max(xmins[i], xmins[j]);
+                    int y1 = max(ymins[i], ymins[j]);
+                    if(!nms_grid_owns(&grid, c, r, x1, y1))
+                        continue;
+                    int x2 = min(xmaxs[i], xmaxs[j]);
+                    int y2 = min(ymaxs[i], ymaxs[j]);
+                    int i_area = max(x2 - x1, 0) * max(y2 - y1, 0);
+                    int u_area = areas[i] + areas[j] - i_area;
+                    if(iou_exceeds(i_area, u_area, thresh_q))
+                        keep[j] = false;
+                }
+            }
+        }
+    }
+
+    return keep;
+}
+
+/* Gathers the boxes in score order into ws and runs the matrix, or the grid
+ * if cell > 0, with fixed-point IoU threshold thresh_q */
+static bool* nms_gathered(nms_workspace* ws, const void* restrict idx_scores,
+                          bool wide, const nms_boxes* boxes, size_t stride,
+                          int N, int cell, int64_t thresh_q) {
+    if(!nms_reserve(ws, N))
+        return NULL;
+    size_t padded = (N + NMS_BLOCK - 1) / NMS_BLOCK * NMS_BLOCK;
+    rearrange(idx_scores, wide, boxes, stride, N, padded,
+              ws->xmins, ws->ymins, ws->xmaxs, ws->ymaxs, ws->areas);
+    return cell > 0 ? suppress_grid(ws, N, cell, thresh_q)
+                    : suppress_matrix(ws, N, thresh_q);
+}
+
+bool* nms_in(nms_workspace* ws, int16_t* restrict idx_scores,
+             int* restrict proposals, int N) {
+    nms_boxes boxes = interleaved(proposals);
+    return nms_gathered(ws, idx_scores, false, &boxes, 4, N, 0, NMS_THRESH_Q);
+}
+
+bool* nms_in_grid(nms_workspace* ws, int16_t* restrict idx_scores,
+                  int* restrict proposals, int N, int cell) {
+    nms_boxes boxes = interleaved(proposals);
+    return nms_gathered(ws, idx_scores, false, &boxes, 4, N, max(cell, 1),
+                        NMS_THRESH_Q);
+}
+
+bool* nms_in_soa(nms_workspace* ws, int16_t* restrict idx_scores,
+                 const nms_boxes* boxes, int N, float thresh, int cell) {
+    return nms_gathered(ws, idx_scores, false, boxes, 1, N, cell,
+                        IOU_THRESH_Q(thresh));
+}
+
+bool* nms_in_soa_wide(nms_workspace* ws, int32_t* restrict idx_scores,
+                      const nms_boxes* boxes, int N, float thresh, int cell) {
+    return nms_gathered(ws, idx_scores, true, boxes, 1, N, cell,
+                        IOU_THRESH_Q(thresh));
+}
+
+bool* nms(int16_t* restrict idx_scores, int* restrict proposals, int N) {
+    nms_workspace ws = {0};
+    bool* keep = nms_in(&ws, idx_scores, proposals, N);
+
+    // Hand the mask over to the caller
+    ws.keep = NULL;
+    nms_release(&ws);
+
+    return keep;
+}
+
+/* Soft-NMS
+ * The remaining boxes are kept packed at the front of the workspace arrays.
+ * Each selection makes one pass over them that decays their scores, drops
+ * those below the floor while preserving order, and finds the next best box,
+ * so the cost is (number of detections) x (remaining boxes) instead of N^2.
+ * Decay only lowers scores, so detections come out in descending order. */
+int nms_soft(nms_workspace* ws, const nms_soft_params* params,
+             int16_t* restrict idx_scores, int* restrict proposals, int N) {
+    if(!nms_reserve(ws, N))
+        return -1;
+    int* xmins = ws->xmins;
+    int* ymins = ws->ymins;
+    int* xmaxs = ws->xmaxs;
+    int* ymaxs = ws->ymaxs;
+    int* areas = ws->areas;
+    float* scores = ws->scores;
+    int* indices = ws->indices;
+    const nms_mode mode = params->mode;
+    const int64_t thresh_q = IOU_THRESH_Q(params->iou_thresh);
+    const float inv_sigma = 1.0f / params->sigma;
+    const float floor = params->score_floor;
+    const size_t limit = params->max_detections > 0
+                       ? min(params->max_detections, (size_t)N) : (size_t)N;
+
+    // Gather the boxes above the floor, and find the best one
+    size_t n = 0;
+    size_t best = 0;
+    for(int i = 0; i < N; i++) {
+        float score = idx_scores[i*2];
+        if(score < floor)
+            continue;
+        uint16_t idx = idx_scores[i*2+1];
+        xmins[n] = proposals[idx*4+0];
+        ymins[n] = proposals[idx*4+1];
+        xmaxs[n] = proposals[idx*4+2];
+        ymaxs[n] = proposals[idx*4+3];
+        areas[n] = (xmaxs[n]-xmins[n]) * (ymaxs[n]-ymins[n]);
+        scores[n] = score;
+        indices[n] = idx;
+        if(score > scores[best])
+            best = n;
+        n++;
+    }
+
+    size_t count = 0;
+    while(n > 0 && count < limit) {
+        // Emit the best box
+        idx_scores[count*2+0] = (int16_t)lrintf(scores[best]);
+        idx_scores[count*2+1] = indices[best];
+        count++;
+        const int bx1 = xmins[best], by1 = ymins[best];
+        const int bx2 = xmaxs[best], by2 = ymaxs[best];
+        const int barea = areas[best];
+        const size_t selected = best;
+
+        // Decay, compact and find the next best box in one pass
+        size_t m = 0;
+        best = 0;
+        for(size_t k = 0; k < n; k++) {
+            if(k == selected)
+                continue;
+            int x1 = max(bx1, xmins[k]);
+            int y1 = max(by1, ymins[k]);
+            int x2 = min(bx2, xmaxs[k]);
+            int y2 = min(by2, ymaxs[k]);
+            int i_area = max(x2 - x1, 0) * max(y2 - y1, 0);
+            int u_area = barea + areas[k] - i_area;
+            float weight = 1.0f;
+            if(mode == NMS_SOFT_GAUSSIAN) {
+                if(i_area > 0) {
+                    float ratio = (float)i_area / (float)u_area;
+                    weight = expf(-ratio * ratio * inv_sigma);
+                }
+            }
+            else if(iou_exceeds(i_area, u_area, thresh_q))
+                weight = mode == NMS_HARD
+                       ? 0.0f : 1.0f - (float)i_area / (float)u_area;
+            float score = scores[k] * weight;
+            if(weight == 0.0f || score < floor)
+                continue;
+            xmins[m] = xmins[k];
+            ymins[m] = ymins[k];
+            xmaxs[m] = xmaxs[k];
+            ymaxs[m] = ymaxs[k];
+            areas[m] = areas[k];
+            scores[m] = score;
+            indices[m] = indices[k];
+            if(score > scores[best])
+                best = m;
+            m++;
+        }
+        n = m;
+    }
+
+    return count;
+}
+
+bool nms_batch_reserve(nms_batch_workspace* ws, size_t max_n,
+                       size_t num_classes) {
+    if(max_n <= ws->capacity && num_classes <= ws->num_classes)
+        return true;
+    max_n = max(max_n, ws->capacity);
+    num_classes = max(num_classes, ws->num_classes);
+    nms_batch_release(ws);
+    size_t blocks = (max_n + NMS_BLOCK - 1) / NMS_BLOCK;
+    size_t padded = blocks * NMS_BLOCK;
+    ws->xmins = malloc(padded * sizeof(int));
+    ws->ymins = malloc(padded * sizeof(int));
+    ws->xmaxs = malloc(padded * sizeof(int));
+    ws->ymaxs = malloc(padded * sizeof(int));
+    ws->areas = malloc(padded * sizeof(int));
+    ws->masks = malloc(num_classes * max_n * blocks * sizeof(uint64_t));
+    ws->thresh_qs = malloc(num_classes * sizeof(int64_t));
+    ws->mask_of_class = malloc(num_classes * sizeof(int));
+    ws->sorted = malloc(num_classes * max_n * 2 * sizeof(int16_t));
+    ws->temp = malloc(num_classes * max_n * 2 * sizeof(int16_t));
+    ws->removed = malloc(num_classes * blocks * sizeof(uint64_t));
+    ws->keep = malloc(num_classes * max_n * sizeof(int));
+    ws->num_keep = malloc(num_classes * sizeof(size_t));
+    if(!ws->xmins || !ws->ymins || !ws->xmaxs || !ws->ymaxs || !ws->areas
+       || !ws->masks || !ws->thresh_qs || !ws->mask_of_class || !ws->sorted
+       || !ws->temp || !ws->removed || !ws->keep || !ws->num_keep) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
+        nms_batch_release(ws);
+        return false;
+    }
+    ws->capacity = max_n;
+    ws->num_classes = num_classes;
+    return true;
+}
+
+void nms_batch_release(nms_batch_workspace* ws) {
+    free(ws->xmins);
+    free(ws->ymins);
+    free(ws->xmaxs);
+    free(ws->ymaxs);
+    free(ws->areas);
+    free(ws->masks);
+    free(ws->thresh_qs);
+    free(ws->mask_of_class);
+    free(ws->sorted);
+    free(ws->temp);
+    free(ws->removed);
+    free(ws->keep);
+    free(ws->num_keep);
+    memset(ws, 0, sizeof(nms_batch_workspace));
+}
+
+/* Stable sort of n (score, index) pairs by descending score, a two-pass LSD
+ * radix sort on 16-bit keys where a smaller key means a higher score. */
+#define SCORE_KEY(score) ((uint16_t)(INT16_MAX - (score)))
+
+static void sort_by_score(int16_t* restrict pairs, size_t n,
+                          int16_t* restrict temp) {
+    size_t hist[256];
+    for(size_t shift = 0; shift < 16; shift += 8) {
+        int16_t* src = shift ? temp : pairs;
+        int16_t* dst = shift ? pairs : temp;
+        size_t offset = 0;
+        memset(hist, 0, sizeof(hist));
+        for(size_t i = 0; i < n; i++)
+            hist[(SCORE_KEY(src[2*i]) >> shift) & 0xFF]++;
+        for(size_t b = 0; b < 256; b++) {
+            size_t c = hist[b];
+            hist[b] = offset;
+            offset += c;
+        }
+        for(size_t i = 0; i < n; i++) {
+            size_t pos = hist[(SCORE_KEY(src[2*i]) >> shift) & 0xFF]++;
+            dst[2*pos+0] = src[2*i+0];
+            dst[2*pos+1] = src[2*i+1];
+        }
+    }
+}
+
+/* Batched NMS
+ * Overlap does not depend on the class, so boxes are gathered and their
+ * areas computed once, and the full symmetric overlap matrix (bit j of row i
+ * set iff boxes i and j overlap by more than the threshold) is built once per
+ * distinct threshold, rows in parallel. Each class then only sorts its
+ * scores and scans its boxes in that order, ORing the rows of the survivors
+ * into its own "removed" bitset; classes run in parallel. A box overlapping
+ * an earlier survivor is removed before it is reached, and a survivor only
+ * overlaps boxes that come after it, so the unordered matrix gives the greedy
+ * result. */
+bool nms_batched(nms_batch_workspace* ws, const int16_t* restrict scores,
+                 const int* restrict proposals, int N, int C,
+                 const float* restrict thresholds) {
+    if(!nms_batch_reserve(ws, N, C))
+        return false;
+    size_t blocks = (N + NMS_BLOCK - 1) / NMS_BLOCK;
+    size_t padded = blocks * NMS_BLOCK;
+    size_t capacity = ws->capacity;
+    int* xmins = ws->xmins;
+    int* ymins = ws->ymins;
+    int* xmaxs = ws->xmaxs;
+    int* ymaxs = ws->ymaxs;
+    int* areas = ws->areas;
+
+    // Shared coordinates and areas, zero-padded
+    for(size_t i = 0; i < N; i++) {
+        xmins[i] = proposals[i*4+0];
+        ymins[i] = proposals[i*4+1];
+        xmaxs[i] = proposals[i*4+2];
+        ymaxs[i] = proposals[i*4+3];
+    }
+    for(size_t i = N; i < padded; i++) {
+        xmins[i] = 0;
+        ymins[i] = 0;
+        xmaxs[i] = 0;
+        ymaxs[i] = 0;
+    }
+    for(size_t i = 0; i < padded; i++)
+        areas[i] = (xmaxs[i]-xmins[i]) * (ymaxs[i]-ymins[i]);
+
+    // One overlap matrix per distinct threshold
+    int num_masks = 0;
+    for(int c = 0; c < C; c++) {
+        ws->mask_of_class[c] = -1;
+        if(thresholds[c] < 0.0f)
+            continue;
+        int64_t thresh_q = IOU_THRESH_Q(thresholds[c]);
+        int m = 0;
+        while(m < num_masks && ws->thresh_qs[m] != thresh_q)
+            m++;
+        if(m == num_masks)
+            ws->thresh_qs[num_masks++] = thresh_q;
+        ws->mask_of_class[c] = m;
+    }
+    for(int m = 0; m < num_masks; m++) {
+        uint64_t* mask = ws->masks + m * capacity * blocks;
+        int64_t thresh_q = ws->thresh_qs[m];
+        #pragma omp parallel for schedule(dynamic, 16)
+        for(size_t i = 0; i < N; i++) {
+            uint64_t* row = mask + i * blocks;
+            for(size_t b = 0; b < blocks; b++) {
+                size_t start = b * NMS_BLOCK;
+                int32_t i_areas[NMS_BLOCK];
+                int32_t u_areas[NMS_BLOCK];
+                for(size_t k = 0; k < NMS_BLOCK; k++) {
+                    size_t j = start + k;
+                    int x1 = max(xmins[i], xmins[j]);
+                    int y1 = max(ymins[i], ymins[j]);
+                    int x2 = min(xmaxs[i], xmaxs[j]);
+                    int y2 = min(ymaxs[i], ymaxs[j]);
+                    i_areas[k] = max(x2 - x1, 0) * max(y2 - y1, 0);
+                    u_areas[k] = areas[i] + areas[j] - i_areas[k];
+                }
+                uint64_t bits = iou_exceeds_mask(i_areas, u_areas, NMS_BLOCK,
+                                                 thresh_q);
+                // Drop the diagonal and the zero padding
+                if(b == i / NMS_BLOCK)
+                    bits &= ~(1ULL << (i % NMS_BLOCK));
+                if(start + NMS_BLOCK > N)
+                    bits &= ~0ULL >> (padded - N);
+                row[b] = bits;
+            }
+        }
+    }
+
+    // Per-class sort and scan
+    #pragma omp parallel for schedule(dynamic)
+    for(int c = 0; c < C; c++) {
+        int* keep = ws->keep + c * capacity;
+        ws->num_keep[c] = 0;
+        if(ws->mask_of_class[c] < 0)
+            continue;
+        const uint64_t* mask = ws->masks
+                             + ws->mask_of_class[c] * capacity * blocks;
+        int16_t* sorted = ws->sorted + c * capacity * 2;
+        uint64_t* removed = ws->removed + c * blocks;
+        for(size_t i = 0; i < N; i++) {
+            sorted[2*i+0] = scores[i*C + c];
+            sorted[2*i+1] = i;
+        }
+        sort_by_score(sorted, N, ws->temp + c * capacity * 2);
+        memset(removed, 0, blocks * sizeof(uint64_t));
+
+        size_t num_keep = 0;
+        for(size_t r = 0; r < N; r++) {
+            size_t i = (uint16_t)sorted[2*r+1];
+            if((removed[i / NMS_BLOCK] >> (i % NMS_BLOCK)) & 1ULL)
+                continue;
+            keep[num_keep++] = i;
+            const uint64_t* row = mask + i * blocks;
+            for(size_t b = 0; b < blocks; b++)
+                removed[b] |= row[b];
+        }
+        ws->num_keep[c] = num_keep;
+    }
+
+    return true;
+}
+
+bool* nms_reference(int16_t* restrict idx_scores,
+                    int* restrict proposals, int N) {
+    int* xmins = malloc(N * sizeof(int));
+    int* xmaxs = malloc(N * sizeof(int));
+    int* ymins = malloc(N * sizeof(int));
+    int* ymaxs = malloc(N * sizeof(int));
+    int* areas = malloc(N * sizeof(int));
+    bool* keep = malloc(N * sizeof(bool));
+
+    nms_boxes boxes = interleaved(proposals);
+    rearrange(idx_scores, false, &boxes, 4, N, N,
+              xmins, ymins, xmaxs, ymaxs, areas);
+    for(size_t i = 0; i < N; i++)
+        keep[i] = true;
+
+    // NMS main loop
+    for(size_t i = 0; i < N; i++) {
+        if(!keep[i])
+            continue;
+        for(size_t j = i+1; j < N; j++) {
+            if(!keep[j])
+                continue;
+            float iou_result = iou(xmins, ymins, xmaxs, ymaxs, areas, i, j);
+            if(iou_result > NMS_THRESH)
+                keep[j] = false;
+        }
+    }
+
+    // Free alloc'ed memory
+    free(xmins);
+    free(xmaxs);
+    free(ymins);
+    free(ymaxs);
+    free(areas);
+
+    return keep;
+}
@@ -0,0 +1,146 @@
+#ifndef NMS_H_
+#define NMS_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Scratch memory of nms_in(), reused across calls. Zero-initialize before
+ * the first use. */
+typedef struct nms_workspace_t {
+    size_t capacity; // maximum number of boxes
+    int* xmins;
+    int* ymins;
+    int* xmaxs;
+    int* ymaxs;
+    int* areas;
+    uint64_t* mask; // suppression matrix, capacity x ceil(capacity/64) words
+    uint64_t* removed;
+    bool* keep;
+    float* scores; // nms_soft(): decayed score of each remaining box
+    int* indices;  // nms_soft(): proposal index of each remaining box
+    uint32_t* grid_starts;  // nms_in_grid(): cell offsets
+    uint32_t* grid_entries; // nms_in_grid(): box indices of each cell
+    size_t grid_capacity;   // size of grid_entries
+} nms_workspace;
+
+/* Grows ws to hold at least max_n boxes. Returns false if out of memory. */
+bool nms_reserve(nms_workspace* ws, size_t max_n);
+
+/* Frees the memory of ws and resets it to zero. */
+void nms_release(nms_workspace* ws);
+
+/* Non-maximum suppression over N boxes already sorted by descending score.
+ * idx_scores holds (score, index) int16 pairs; index refers to the 4-int box
+ * in proposals. Returns the keep[N] mask, which lives in ws until the next
+ * call. Only allocates if N exceeds the capacity of ws. */
+bool* nms_in(nms_workspace* ws, int16_t* restrict idx_scores,
+             int* restrict proposals, int N);
+
+/* Box coordinates as separate arrays (structure of arrays), indexed by the
+ * index half of the (score, index) pairs */
+typedef struct nms_boxes_t {
+    const int* xmins;
+    const int* ymins;
+    const int* xmaxs;
+    const int* ymaxs;
+} nms_boxes;
+
+/* Same as nms_in(), or nms_in_grid() if cell > 0, for boxes stored as
+ * separate coordinate arrays, such as those written by proposal_decode(),
+ * and suppressing above IoU thresh instead of NMS_THRESH. */
+bool* nms_in_soa(nms_workspace* ws, int16_t* restrict idx_scores,
+                 const nms_boxes* boxes, int N, float thresh, int cell);
+
+/* Same as nms_in_soa(), with (score, index) int32 pairs, for boxes indexed
+ * beyond the 65536 an int16 index reaches. Scores still fit in int16. */
+bool* nms_in_soa_wide(nms_workspace* ws, int32_t* restrict idx_scores,
+                      const nms_boxes* boxes, int N, float thresh, int cell);
+
+/* Same as nms_in(), but only boxes that share a cell of a uniform grid with
+ * cell x cell pixel cells are compared (see nms_grid.h), in one greedy scan
+ * instead of a full suppression matrix. The result is bit-identical to
+ * nms_in(). With cells about the size of a typical box, the work grows with
+ * N times the number of neighbours rather than N^2. */
+bool* nms_in_grid(nms_workspace* ws, int16_t* restrict idx_scores,
+                  int* restrict proposals, int N, int cell);
+
+/* Same as nms_in(), with a temporary workspace. Returns a malloc'ed keep[N]
+ * mask owned by the caller. */
+bool* nms(int16_t* restrict idx_scores, int* restrict proposals, int N);
+
+/* How nms_soft() treats the boxes that overlap a selected box. */
+typedef enum nms_mode_t {
+    NMS_HARD,          // discard them if IoU > iou_thresh, like nms_in()
+    NMS_SOFT_LINEAR,   // scale their score by (1 - IoU) if IoU > iou_thresh
+    NMS_SOFT_GAUSSIAN  // scale their score by exp(-IoU^2 / sigma)
+} nms_mode;
+
+typedef struct nms_soft_params_t {
+    nms_mode mode;
+    float iou_thresh;      // NMS_HARD and NMS_SOFT_LINEAR
+    float sigma;           // NMS_SOFT_GAUSSIAN
+    int16_t score_floor;   // boxes whose decayed score drops below are discarded
+    size_t max_detections; // stop after this many boxes, 0 for no limit
+} nms_soft_params;
+
+/* Soft-NMS defaults of Bodla et al., floor at 0.001 of a Q15 score. */
+#define NMS_SOFT_DEFAULT_PARAMS { .mode = NMS_SOFT_LINEAR, .iou_thresh = 0.3f, \
+    .sigma = 0.5f, .score_floor = 33, .max_detections = 0 }
+
+/* Soft-NMS over N boxes in any order. idx_scores holds (score, index) int16
+ * pairs, as for nms_in(). Boxes are selected by highest (decayed) score, ties
+ * going to the earlier pair. Each selection decays the scores of the
+ * remaining boxes according to params->mode, and drops those that fall below
+ * params->score_floor, so the work is about N per detection. Selection stops
+ * when no box is left above the floor, or after params->max_detections.
+ * The first (returned count) pairs of idx_scores are overwritten with the
+ * detections and their decayed scores, in selection order. With NMS_HARD
+ * and every score above the floor, the detections are the boxes kept by
+ * nms_in(). Returns -1 if out of memory. */
+int nms_soft(nms_workspace* ws, const nms_soft_params* params,
+             int16_t* restrict idx_scores, int* restrict proposals, int N);
+
+/* Scratch memory and results of nms_batched(), reused across calls.
+ * Zero-initialize before the first use. */
+typedef struct nms_batch_workspace_t {
+    size_t capacity;    // maximum number of boxes
+    size_t num_classes; // maximum number of classes
+    int* xmins;         // box coordinates and areas, shared by all classes
+    int* ymins;
+    int* xmaxs;
+    int* ymaxs;
+    int* areas;
+    uint64_t* masks;    // one overlap matrix per distinct threshold
+    int64_t* thresh_qs; // fixed-point threshold of each matrix
+    int* mask_of_class; // matrix used by each class, -1 if skipped
+    int16_t* sorted;    // per class, (score, index) pairs by descending score
+    int16_t* temp;      // per class, sort buffer
+    uint64_t* removed;  // per class, suppressed boxes
+    int* keep;          // per class, capacity entries: indices of kept boxes
+    size_t* num_keep;   // per class, number of kept boxes
+} nms_batch_workspace;
+
+/* Grows ws to hold at least max_n boxes and num_classes classes. Returns
+ * false if out of memory. */
+bool nms_batch_reserve(nms_batch_workspace* ws, size_t max_n,
+                       size_t num_classes);
+
+/* Frees the memory of ws and resets it to zero. */
+void nms_batch_release(nms_batch_workspace* ws);
+
+/* Class-aware NMS of N boxes over C classes in one call.
+ * scores is an N x C row-major matrix, and proposals holds N 4-int boxes.
+ * Class c suppresses with IoU threshold thresholds[c]; a negative threshold
+ * skips the class (e.g. the background). On return, class c kept the
+ * ws->num_keep[c] boxes listed in ws->keep + c * ws->capacity, by descending
+ * score, ties in ascending index order. Each class gives the same result as
+ * sorting its column and calling nms_in(). Returns false if out of memory. */
+bool nms_batched(nms_batch_workspace* ws, const int16_t* restrict scores,
+                 const int* restrict proposals, int N, int C,
+                 const float* restrict thresholds);
+
+/* Straightforward O(N^2) floating-point NMS, kept as a reference for the
+ * above in equivalence tests. */
+bool* nms_reference(int16_t* restrict idx_scores, int* restrict proposals,
+                    int N);
+
+#endif
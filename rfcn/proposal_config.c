@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proposal_config.h"
+
+#define MAX_LINE 256
+
+/* Reads exactly one integer in [lo, hi] from value */
+static bool parse_int(const char* value, long lo, long hi, long* out) {
+    char rest;
+    return sscanf(value, "%ld %c", out, &rest) == 1 && *out >= lo
+        && *out <= hi;
+}
+
+/* Parses one line, without its comment. Returns false on an error. */
+static bool parse_line(const char* line, int number, bool* anchors_reset,
+                       proposal_config* config) {
+    char key[32];
+    int consumed = 0;
+    if(sscanf(line, " %31s%n", key, &consumed) != 1)
+        return true; // blank line
+    const char* value = line + consumed;
+    char rest;
+    long n;
+    bool ok;
+
+    if(strcmp(key, "nms_thresh") == 0) {
+        float thresh;
+        ok = sscanf(value, "%f %c", &thresh, &rest) == 1
+          && thresh > 0.0f && thresh <= 1.0f;
+        if(ok)
+            config->nms_thresh = thresh;
+    } else if(strcmp(key, "pre_nms_top_n") == 0) {
+        // Indices of the (score, index) pairs are 16-bit
+        if((ok = parse_int(value, 1, UINT16_MAX, &n)))
+            config->pre_nms_top_n = n;
+    } else if(strcmp(key, "post_nms_top_n") == 0) {
+        if((ok = parse_int(value, 1, UINT16_MAX, &n)))
+            config->post_nms_top_n = n;
+    } else if(strcmp(key, "min_size") == 0) {
+        if((ok = parse_int(value, 0, INT16_MAX, &n)))
+            config->min_size = n;
+    } else if(strcmp(key, "feat_stride") == 0) {
+        if((ok = parse_int(value, 1, INT16_MAX, &n)))
+            config->feat_stride = n;
+    } else if(strcmp(key, "num_levels") == 0) {
+        if((ok = parse_int(value, 1, PROPOSAL_MAX_LEVELS, &n)))
+            config->num_levels = n;
+    } else if(strcmp(key, "nms_grid_cell") == 0) {
+        if((ok = parse_int(value, 0, INT16_MAX, &n)))
+            config->nms_grid_cell = n;
+    } else if(strcmp(key, "anchor") == 0) {
+        int box[4];
+        if(!*anchors_reset) {
+            config->num_anchors = 0;
+            *anchors_reset = true;
+        }
+        ok = sscanf(value, "%d %d %d %d %c", &box[0], &box[1], &box[2],
+                    &box[3], &rest) == 4
+          && box[0] <= box[2] && box[1] <= box[3]
+          && config->num_anchors < PROPOSAL_MAX_ANCHORS;
+        if(ok)
+            memcpy(config->anchors[config->num_anchors++], box, sizeof(box));
+    } else {
+        fprintf(stderr, "ERROR: Unknown proposal config key \"%s\" on line "
+                "%d\n", key, number);
+        return false;
+    }
+
+    if(!ok)
+        fprintf(stderr, "ERROR: Invalid value of \"%s\" on line %d of the "
+                "proposal config\n", key, number);
+    return ok;
+}
+
+bool proposal_config_parse(const char* text, proposal_config* config) {
+    bool anchors_reset = false;
+    int number = 1;
+    while(*text) {
+        size_t length = strcspn(text, "\n");
+        size_t kept = strcspn(text, "#\n");
+        char line[MAX_LINE];
+        if(kept >= MAX_LINE) {
+            fprintf(stderr, "ERROR: Line %d of the proposal config is too "
+                    "long\n", number);
+            return false;
+        }
+        memcpy(line, text, kept);
+        line[kept] = '\0';
+        if(!parse_line(line, number, &anchors_reset, config))
+            return false;
+        text += length + (text[length] == '\n');
+        number++;
+    }
+    return true;
+}
+
+bool proposal_config_load(const char* path, proposal_config* config) {
+    FILE* f;
+    if((f = fopen(path, "rb")) == NULL) {
+        fprintf(stderr, "ERROR: Cannot open file \"%s\"\n", path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* text = malloc(size + 1);
+    if(text == NULL) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
+        fclose(f);
+        return false;
+    }
+    text[fread(text, 1, size, f)] = '\0';
+    fclose(f);
+    bool ok = proposal_config_parse(text, config);
+    free(text);
+    return ok;
+}
+
+bool proposal_config_equal(const proposal_config* a,
+                           const proposal_config* b) {
+    return a->nms_thresh == b->nms_thresh
+        && a->pre_nms_top_n == b->pre_nms_top_n
+        && a->post_nms_top_n == b->post_nms_top_n
+        && a->min_size == b->min_size
+        && a->feat_stride == b->feat_stride
+        && a->num_levels == b->num_levels
+        && a->nms_grid_cell == b->nms_grid_cell
+        && a->num_anchors == b->num_anchors
+        && memcmp(a->anchors, b->anchors,
+                  a->num_anchors * sizeof(a->anchors[0])) == 0;
+}
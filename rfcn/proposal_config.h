@@ -0,0 +1,80 @@
+/*
+ * Parameters of the proposal layer
+ *   - PROPOSAL_DEFAULT_CONFIG holds the values of proposal_layer.py for the
+ *     R-FCN ResNet-50 model: 9 anchors of 3 scales and 3 aspect ratios on a
+ *     stride-16 feature map.
+ *   - proposal_config_parse() reads a text config, one "key value" per line.
+ *     Keys that are absent keep the value already in the config, so start
+ *     from PROPOSAL_DEFAULT_CONFIG. '#' starts a comment.
+ *         nms_thresh 0.7
+ *         pre_nms_top_n 6000
+ *         post_nms_top_n 300
+ *         min_size 16
+ *         feat_stride 16
+ *         num_levels 1
+ *         nms_grid_cell 0
+ *         anchor -84 -40 99 55
+ *     Each "anchor x1 y1 x2 y2" line adds one base anchor; the first one
+ *     replaces the whole table, so a config lists either all anchors or none.
+ *   - With num_levels > 1 the layer takes a feature pyramid (FPN): level l
+ *     has stride feat_stride << l and the base anchors scaled by 2^l, so the
+ *     anchors keep the same size relative to the stride on every level.
+ */
+#ifndef PROPOSAL_CONFIG_H_
+#define PROPOSAL_CONFIG_H_
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Maximum number of base anchors */
+#define PROPOSAL_MAX_ANCHORS 32
+
+/* Maximum number of pyramid levels */
+#define PROPOSAL_MAX_LEVELS 6
+
+/* Default cell size of the NMS grid index (see nms_in_grid()), 0 for the
+ * suppression matrix. The grid pays off when proposals are small next to the
+ * image, e.g. 4 * feat_stride for dense small-object frames. Both give the
+ * same rois. */
+#ifndef NMS_GRID_CELL
+#define NMS_GRID_CELL 0
+#endif
+
+typedef struct proposal_config_t {
+    float nms_thresh;      // IoU above which a proposal is suppressed
+    size_t pre_nms_top_n;  // proposals kept for NMS, by descending score
+    size_t post_nms_top_n; // proposals kept after NMS, capacity of the rois
+    int min_size;          // minimum box side at scale 1, in pixels
+    int feat_stride;       // input pixels per feature-map cell, of level 0
+    int num_levels;        // pyramid levels, 1 for a single feature map
+    int nms_grid_cell;     // see NMS_GRID_CELL
+    int num_anchors;
+    int anchors[PROPOSAL_MAX_ANCHORS][4]; // (x1, y1, x2, y2) of cell (0, 0)
+} proposal_config;
+
+#define PROPOSAL_DEFAULT_CONFIG { .nms_thresh = 0.7f, \
+    .pre_nms_top_n = 6000, .post_nms_top_n = 300, .min_size = 16, \
+    .feat_stride = 16, .num_levels = 1, .nms_grid_cell = NMS_GRID_CELL, \
+    .num_anchors = 9, \
+    .anchors = { \
+        { -84,  -40,  99,  55}, \
+        {-176,  -88, 191, 103}, \
+        {-360, -184, 375, 199}, \
+        { -56,  -56,  71,  71}, \
+        {-120, -120, 135, 135}, \
+        {-248, -248, 263, 263}, \
+        { -36,  -80,  51,  95}, \
+        { -80, -168,  95, 183}, \
+        {-168, -344, 183, 359} } }
+
+/* Overrides the fields of config with those set in text. Returns false, with
+ * a message on stderr, on an unknown key or an invalid value; config may then
+ * be partially updated. */
+bool proposal_config_parse(const char* text, proposal_config* config);
+
+/* Same as proposal_config_parse(), for the contents of the file at path. */
+bool proposal_config_load(const char* path, proposal_config* config);
+
+/* Whether a and b hold the same parameters */
+bool proposal_config_equal(const proposal_config* a, const proposal_config* b);
+
+#endif
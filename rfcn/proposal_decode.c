@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "proposal_decode.h"
+#include "exp_lut.h"
+
+#if defined(PROPOSAL_DECODE_SCALAR)
+    #define DECODE_SCALAR_ONLY
+#elif defined(__AVX2__)
+    #define DECODE_AVX2
+    #include <immintrin.h>
+#elif defined(__SSE4_2__)
+    #define DECODE_SSE4
+    #include <immintrin.h>
+#else
+    #define DECODE_SCALAR_ONLY
+#endif
+
+static inline int clip(int value, int max_value) {
+    return value < 0 ? 0 : value > max_value ? max_value : value;
+}
+
+/* One anchor; the reference for the vector variants */
+static inline void decode_one(size_t i,
+                              const int8_t* restrict bbox_delta,
+                              const int16_t* restrict scores,
+                              const int* restrict anchor_ctr_x,
+                              const int* restrict anchor_ctr_y,
+                              const int* restrict anchor_w,
+                              const int* restrict anchor_h,
+                              const int32_t* restrict exp_lut,
+                              int im_w, int im_h, int min_size,
+                              size_t index_base,
+                              int16_t* restrict indexed_scores,
+                              int* restrict xmins, int* restrict ymins,
+                              int* restrict xmaxs, int* restrict ymaxs) {
+    // Implement bbox_transform
+    int width = anchor_w[i];
+    int height = anchor_h[i];
+    int pred_ctr_x = ((bbox_delta[i*4+0]*width)>>6) + anchor_ctr_x[i];
+    int pred_ctr_y = ((bbox_delta[i*4+1]*height)>>6) + anchor_ctr_y[i];
+    int pred_w = exp_lut_scale(exp_lut, bbox_delta[i*4+2], width);
+    int pred_h = exp_lut_scale(exp_lut, bbox_delta[i*4+3], height);
+
+    // Implement clip_boxes
+    int x1 = clip(pred_ctr_x - pred_w / 2, im_w);
+    int y1 = clip(pred_ctr_y - pred_h / 2, im_h);
+    int x2 = clip(pred_ctr_x + pred_w / 2, im_w);
+    int y2 = clip(pred_ctr_y + pred_h / 2, im_h);
+
+    // Implement _filter_boxes
+    bool small = x2 - x1 + 1 < min_size || y2 - y1 + 1 < min_size;
+    indexed_scores[i*2+0] = small ? INT16_MIN : scores[i];
+    indexed_scores[i*2+1] = index_base + i;
+    xmins[i] = small ? 0 : x1;
+    ymins[i] = small ? 0 : y1;
+    xmaxs[i] = small ? 0 : x2;
+    ymaxs[i] = small ? 0 : y2;
+}
+
+void proposal_decode(size_t count,
+                     const int8_t* restrict bbox_delta,
+                     const int16_t* restrict scores,
+                     const int* restrict anchor_ctr_x,
+                     const int* restrict anchor_ctr_y,
+                     const int* restrict anchor_w,
+                     const int* restrict anchor_h,
+                     const int32_t* restrict exp_lut,
+                     int im_w, int im_h, int min_size,
+                     size_t index_base, int16_t* restrict indexed_scores,
+                     int* restrict xmins, int* restrict ymins,
+                     int* restrict xmaxs, int* restrict ymaxs) {
+    size_t i = 0;
+
+#if defined(DECODE_AVX2)
+    // Each 32-bit lane of the delta load holds one anchor's (dx, dy, dw, dh)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max_x = _mm256_set1_epi32(im_w);
+    const __m256i max_y = _mm256_set1_epi32(im_h);
+    const __m256i min_sz = _mm256_set1_epi32(min_size);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i score_min = _mm256_set1_epi32(INT16_MIN);
+    const __m256i low_half = _mm256_set1_epi32(0xFFFF);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const int* lut = (const int*)exp_lut + 128;
+    for(; i + 8 <= count; i += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(bbox_delta + i*4));
+        __m256i dx = _mm256_srai_epi32(_mm256_slli_epi32(d, 24), 24);
+        __m256i dy = _mm256_srai_epi32(_mm256_slli_epi32(d, 16), 24);
+        __m256i dw = _mm256_srai_epi32(_mm256_slli_epi32(d, 8), 24);
+        __m256i dh = _mm256_srai_epi32(d, 24);
+        __m256i width = _mm256_loadu_si256((const __m256i*)(anchor_w + i));
+        __m256i height = _mm256_loadu_si256((const __m256i*)(anchor_h + i));
+        __m256i ctr_x = _mm256_add_epi32(
+                _mm256_srai_epi32(_mm256_mullo_epi32(dx, width), 6),
+                _mm256_loadu_si256((const __m256i*)(anchor_ctr_x + i)));
+        __m256i ctr_y = _mm256_add_epi32(
+                _mm256_srai_epi32(_mm256_mullo_epi32(dy, height), 6),
+                _mm256_loadu_si256((const __m256i*)(anchor_ctr_y + i)));
+        __m256i half_w = _mm256_srai_epi32(_mm256_srai_epi32(_mm256_mullo_epi32(
+                _mm256_i32gather_epi32(lut, dw, 4), width), EXP_LUT_FRAC_BITS), 1);
+        __m256i half_h = _mm256_srai_epi32(_mm256_srai_epi32(_mm256_mullo_epi32(
+                _mm256_i32gather_epi32(lut, dh, 4), height), EXP_LUT_FRAC_BITS), 1);
+
+        __m256i x1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(ctr_x, half_w), zero), max_x);
+        __m256i y1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(ctr_y, half_h), zero), max_y);
+        __m256i x2 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(ctr_x, half_w), zero), max_x);
+        __m256i y2 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(ctr_y, half_h), zero), max_y);
+
+        __m256i small = _mm256_or_si256(
+                _mm256_cmpgt_epi32(min_sz, _mm256_add_epi32(_mm256_sub_epi32(x2, x1), one)),
+                _mm256_cmpgt_epi32(min_sz, _mm256_add_epi32(_mm256_sub_epi32(y2, y1), one)));
+        _mm256_storeu_si256((__m256i*)(xmins + i), _mm256_andnot_si256(small, x1));
+        _mm256_storeu_si256((__m256i*)(ymins + i), _mm256_andnot_si256(small, y1));
+        _mm256_storeu_si256((__m256i*)(xmaxs + i), _mm256_andnot_si256(small, x2));
+        _mm256_storeu_si256((__m256i*)(ymaxs + i), _mm256_andnot_si256(small, y2));
+
+        // (score, index) pairs: score in the low half of each lane
+        __m256i score = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(scores + i)));
+        score = _mm256_blendv_epi8(score, score_min, small);
+        __m256i index = _mm256_add_epi32(lanes, _mm256_set1_epi32((int)(index_base + i)));
+        __m256i pairs = _mm256_or_si256(_mm256_and_si256(score, low_half),
+                                        _mm256_slli_epi32(index, 16));
+        _mm256_storeu_si256((__m256i*)(indexed_scores + i*2), pairs);
+    }
+#elif defined(DECODE_SSE4)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max_x = _mm_set1_epi32(im_w);
+    const __m128i max_y = _mm_set1_epi32(im_h);
+    const __m128i min_sz = _mm_set1_epi32(min_size);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i score_min = _mm_set1_epi32(INT16_MIN);
+    const __m128i low_half = _mm_set1_epi32(0xFFFF);
+    const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    const int32_t* lut = exp_lut + 128;
+    for(; i + 4 <= count; i += 4) {
+        const int8_t* delta = bbox_delta + i*4;
+        __m128i d = _mm_loadu_si128((const __m128i*)delta);
+        __m128i dx = _mm_srai_epi32(_mm_slli_epi32(d, 24), 24);
+        __m128i dy = _mm_srai_epi32(_mm_slli_epi32(d, 16), 24);
+        __m128i width = _mm_loadu_si128((const __m128i*)(anchor_w + i));
+        __m128i height = _mm_loadu_si128((const __m128i*)(anchor_h + i));
+        __m128i scale_w = _mm_setr_epi32(lut[delta[2]], lut[delta[6]], lut[delta[10]], lut[delta[14]]);
+        __m128i scale_h = _mm_setr_epi32(lut[delta[3]], lut[delta[7]], lut[delta[11]], lut[delta[15]]);
+        __m128i ctr_x = _mm_add_epi32(_mm_srai_epi32(_mm_mullo_epi32(dx, width), 6),
+                                      _mm_loadu_si128((const __m128i*)(anchor_ctr_x + i)));
+        __m128i ctr_y = _mm_add_epi32(_mm_srai_epi32(_mm_mullo_epi32(dy, height), 6),
+                                      _mm_loadu_si128((const __m128i*)(anchor_ctr_y + i)));
+        __m128i half_w = _mm_srai_epi32(_mm_srai_epi32(_mm_mullo_epi32(scale_w, width), EXP_LUT_FRAC_BITS), 1);
+        __m128i half_h = _mm_srai_epi32(_mm_srai_epi32(_mm_mullo_epi32(scale_h, height), EXP_LUT_FRAC_BITS), 1);
+
+        __m128i x1 = _mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(ctr_x, half_w), zero), max_x);
+        __m128i y1 = _mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(ctr_y, half_h), zero), max_y);
+        __m128i x2 = _mm_min_epi32(_mm_max_epi32(_mm_add_epi32(ctr_x, half_w), zero), max_x);
+        __m128i y2 = _mm_min_epi32(_mm_max_epi32(_mm_add_epi32(ctr_y, half_h), zero), max_y);
+
+        __m128i small = _mm_or_si128(
+                _mm_cmpgt_epi32(min_sz, _mm_add_epi32(_mm_sub_epi32(x2, x1), one)),
+                _mm_cmpgt_epi32(min_sz, _mm_add_epi32(_mm_sub_epi32(y2, y1), one)));
+        _mm_storeu_si128((__m128i*)(xmins + i), _mm_andnot_si128(small, x1));
+        _mm_storeu_si128((__m128i*)(ymins + i), _mm_andnot_si128(small, y1));
+        _mm_storeu_si128((__m128i*)(xmaxs + i), _mm_andnot_si128(small, x2));
+        _mm_storeu_si128((__m128i*)(ymaxs + i), _mm_andnot_si128(small, y2));
+
+        __m128i score = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*)(scores + i)));
+        score = _mm_blendv_epi8(score, score_min, small);
+        __m128i index = _mm_add_epi32(lanes, _mm_set1_epi32((int)(index_base + i)));
+        __m128i pairs = _mm_or_si128(_mm_and_si128(score, low_half), _mm_slli_epi32(index, 16));
+        _mm_storeu_si128((__m128i*)(indexed_scores + i*2), pairs);
+    }
+#endif
+
+    // Remainder, or everything in the plain C variant
+    #pragma omp simd
+    for(size_t r = i; r < count; r++)
+        decode_one(r, bbox_delta, scores, anchor_ctr_x, anchor_ctr_y,
+                   anchor_w, anchor_h, exp_lut, im_w, im_h, min_size,
+                   index_base, indexed_scores, xmins, ymins, xmaxs, ymaxs);
+}
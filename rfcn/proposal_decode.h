@@ -0,0 +1,41 @@
+/*
+ * Proposal decode kernel: bbox_transform, clip_boxes and _filter_boxes of
+ * proposal_layer.py in one pass over the anchors
+ *   - Anchors come from the tables built by proposal_setup(): center and
+ *     size of every shifted anchor, one array per field.
+ *   - Boxes are clipped to [0, im_w] x [0, im_h]. Boxes narrower or shorter
+ *     than min_size after clipping get score INT16_MIN and coordinates 0,
+ *     through a mask rather than a branch.
+ *   - The output is written as (score, index) pairs for the top-K selection,
+ *     and as separate xmins, ymins, xmaxs and ymaxs arrays, which
+ *     nms_in_soa() reads directly.
+ *   - The variant is selected at build time:
+ *       - AVX2 (__AVX2__), 8 anchors per step, table lookups by gather
+ *       - SSE4.2 (__SSE4_2__), 4 anchors per step
+ *       - plain C otherwise, or when PROPOSAL_DECODE_SCALAR is defined
+ *     All variants give identical results; the remainder of a vector step
+ *     goes through the plain C loop.
+ */
+#ifndef PROPOSAL_DECODE_H_
+#define PROPOSAL_DECODE_H_
+#include <stddef.h>
+#include <stdint.h>
+
+/* Decodes anchors [0, count). exp_lut is the table of exp_lut_init(). Pair i
+ * gets index index_base + i, so that several feature maps can be decoded
+ * into one buffer, each at its own offset. The index is kept to its low
+ * 16 bits; past 65536 anchors, only the score half of the pairs is usable. */
+void proposal_decode(size_t count,
+                     const int8_t* restrict bbox_delta,
+                     const int16_t* restrict scores,
+                     const int* restrict anchor_ctr_x,
+                     const int* restrict anchor_ctr_y,
+                     const int* restrict anchor_w,
+                     const int* restrict anchor_h,
+                     const int32_t* restrict exp_lut,
+                     int im_w, int im_h, int min_size,
+                     size_t index_base, int16_t* restrict indexed_scores,
+                     int* restrict xmins, int* restrict ymins,
+                     int* restrict xmaxs, int* restrict ymaxs);
+
+#endif
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tensor_file.h"
+
+#define HEADER_SIZE 16
+
+_Static_assert(sizeof(tensor_entry) == 64, "tensor_entry must be 64 bytes");
+
+static const char* dtype_names[] = {"INT8", "UINT8", "INT16", "UINT16",
+                                    "INT32", "UINT32", "FLOAT32"};
+
+/* Checks an entry against a file of length bytes */
+static bool check_entry(const char* path, const tensor_entry* entry,
+                        size_t length) {
+    if(memchr(entry->name, '\0', TENSOR_NAME_LENGTH) == NULL) {
+        fprintf(stderr, "ERROR: Unterminated tensor name in \"%s\"\n", path);
+        return false;
+    }
+    if(entry->dtype > FLOAT32) {
+        fprintf(stderr, "ERROR: Tensor \"%s\" in \"%s\" has unknown dtype "
+                "%d\n", entry->name, path, entry->dtype);
+        return false;
+    }
+    uint64_t expected = (uint64_t)entry->n * entry->c * entry->h * entry->w
+                      * _sizeof(entry->dtype);
+    if(entry->length != expected || entry->offset % TENSOR_FILE_ALIGN != 0
+       || entry->offset > length || entry->length > length - entry->offset) {
+        fprintf(stderr, "ERROR: Tensor \"%s\" in \"%s\" (%s %dx%dx%dx%d) has "
+                "a bad payload: %llu bytes at offset %llu of %zu\n",
+                entry->name, path, dtype_names[entry->dtype], entry->n,
+                entry->c, entry->h, entry->w,
+                (unsigned long long)entry->length,
+                (unsigned long long)entry->offset, length);
+        return false;
+    }
+    return true;
+}
+
+bool tensor_file_open(const char* path, tensor_file* file, int flags) {
+    blob_mapping* mapping = &file->mapping;
+    if((flags & BLOB_MAP_KEEP) && mapping->addr != NULL
+       && strcmp(mapping->path, path) == 0)
+        return true;
+    tensor_file_close(file);
+    if(!blob_map_file(path, mapping, flags & ~BLOB_MAP_KEEP, HEADER_SIZE))
+        return false;
+    size_t length = mapping->length;
+    void* addr = mapping->addr;
+
+    // Header
+    const uint8_t* header = addr;
+    uint16_t version, count;
+    memcpy(&version, header + 4, sizeof(uint16_t));
+    memcpy(&count, header + 6, sizeof(uint16_t));
+    if(memcmp(header, TENSOR_FILE_MAGIC, 4) != 0
+       || version != TENSOR_FILE_VERSION
+       || HEADER_SIZE + (size_t)count * sizeof(tensor_entry) > length) {
+        fprintf(stderr, "ERROR: \"%s\" is not a version %d tensor file\n",
+                path, TENSOR_FILE_VERSION);
+        tensor_file_close(file);
+        return false;
+    }
+    file->count = count;
+    file->entries = (const tensor_entry*)(header + HEADER_SIZE);
+    for(size_t i = 0; i < count; i++) {
+        if(!check_entry(path, &file->entries[i], length)) {
+            tensor_file_close(file);
+            return false;
+        }
+    }
+    return true;
+}
+
+void tensor_file_close(tensor_file* file) {
+    blob_unmap(&file->mapping);
+    memset(file, 0, sizeof(tensor_file));
+}
+
+const tensor_entry* tensor_file_find(const tensor_file* file,
+                                     const char* name) {
+    for(size_t i = 0; i < file->count; i++)
+        if(strncmp(file->entries[i].name, name, TENSOR_NAME_LENGTH) == 0)
+            return &file->entries[i];
+    return NULL;
+}
+
+/* The entry named name, or NULL with a message on stderr */
+static const tensor_entry* require(const tensor_file* file,
+                                   const char* name) {
+    const tensor_entry* entry = tensor_file_find(file, name);
+    if(entry == NULL)
+        fprintf(stderr, "ERROR: No tensor \"%s\" in \"%s\"\n", name,
+                file->mapping.path);
+    return entry;
+}
+
+bool tensor_file_describe(const tensor_file* file, const char* name,
+                          blob* output) {
+    const tensor_entry* entry = require(file, name);
+    if(entry == NULL)
+        return false;
+    output->type = entry->dtype;
+    output->n = entry->n;
+    output->c = entry->c;
+    output->h = entry->h;
+    output->w = entry->w;
+    output->data = (uint8_t*)file->mapping.addr + entry->offset;
+    return true;
+}
+
+bool tensor_file_get(const tensor_file* file, const char* name,
+                     blob* output) {
+    const tensor_entry* entry = require(file, name);
+    if(entry == NULL)
+        return false;
+    if(entry->dtype != output->type || entry->n != output->n
+       || entry->c != output->c || entry->h != output->h
+       || entry->w != output->w) {
+        fprintf(stderr, "ERROR: Tensor \"%s\" in \"%s\" is %s %dx%dx%dx%d, "
+                "expected %s %dx%dx%dx%d\n", name, file->mapping.path,
+                dtype_names[entry->dtype], entry->n, entry->c, entry->h,
+                entry->w, dtype_names[output->type], output->n, output->c,
+                output->h, output->w);
+        return false;
+    }
+    output->data = (uint8_t*)file->mapping.addr + entry->offset;
+    return true;
+}
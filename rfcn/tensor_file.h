@@ -0,0 +1,76 @@
+/*
+ * Tensor files: several named tensors with their type and shape, in one file
+ *   - Layout, little-endian, every offset from the start of the file:
+ *         0   header      magic "TNSR", uint16 version (1), uint16 count,
+ *                         8 reserved bytes
+ *         16  entries     count entries of 64 bytes:
+ *                           char name[32], NUL-padded
+ *                           uint8 dtype, a value of enum dtype in blob.h
+ *                           uint8 exp_offset, fixed-point fraction bits
+ *                           2 reserved bytes
+ *                           uint16 n, c, h, w
+ *                           4 reserved bytes
+ *                           uint64 offset of the payload, a multiple of 64
+ *                           uint64 length of the payload in bytes, that of
+ *                           n*c*h*w elements
+ *         ...     payloads, NCHW, each at its 64-byte aligned offset
+ *   - tensor_file_open() maps the file and validates every entry, so a
+ *     wrong shape or a truncated file is caught at load time, not when a
+ *     layer reads past its input. Payloads are used in place: blob data
+ *     points into the mapping, and stays valid until tensor_file_close().
+ *   - rfcn/tensor_file.py writes these files from numpy arrays.
+ */
+#ifndef TENSOR_FILE_H_
+#define TENSOR_FILE_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "blob.h"
+
+#define TENSOR_FILE_MAGIC "TNSR"
+#define TENSOR_FILE_VERSION 1
+#define TENSOR_FILE_ALIGN 64
+#define TENSOR_NAME_LENGTH 32
+
+typedef struct tensor_entry_t {
+    char name[TENSOR_NAME_LENGTH];
+    uint8_t dtype;
+    uint8_t exp_offset;
+    uint8_t reserved[2];
+    uint16_t n, c, h, w;
+    uint8_t padding[4];
+    uint64_t offset;
+    uint64_t length;
+} tensor_entry;
+
+/* A mapped tensor file. Zero-initialize before the first use. */
+typedef struct tensor_file_t {
+    blob_mapping mapping;
+    size_t count;
+    const tensor_entry* entries;
+} tensor_file;
+
+/* Maps the file at path into file, releasing what file held before, and
+ * validates its header and entries. flags are those of blob_map(); with
+ * BLOB_MAP_KEEP, a file already open from the same path is kept as is.
+ * Returns false, with a message on stderr, if the file is missing or
+ * malformed. */
+bool tensor_file_open(const char* path, tensor_file* file, int flags);
+
+/* Unmaps the file and resets it to zero. */
+void tensor_file_close(tensor_file* file);
+
+/* The entry named name, or NULL */
+const tensor_entry* tensor_file_find(const tensor_file* file,
+                                     const char* name);
+
+/* Sets the type, shape and data of output from tensor name. */
+bool tensor_file_describe(const tensor_file* file, const char* name,
+                          blob* output);
+
+/* Points output->data at tensor name, after checking that its type and
+ * shape are those of output. */
+bool tensor_file_get(const tensor_file* file, const char* name,
+                     blob* output);
+
+#endif
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""Writer (and reader, for checks) of the tensor files read by tensor_file.c.
+
+See tensor_file.h for the layout. Usage from the Python side:
+
+    from tensor_file import write_tensors
+    write_tensors("frame.tensors", [
+        ("rpn_cls_prob_reshape", rpn_cls_prob_reshape, 15),
+        ("rpn_bbox_pred", rpn_bbox_pred, 6),
+    ])
+
+or from the command line, to pack raw .bin files of known shapes:
+
+    python3 tensor_file.py frame.tensors \\
+        rpn_bbox_pred:int8:1x36x24x32:6=rpn_bbox_pred.bin ...
+"""
+
+import struct
+import sys
+
+import numpy as np
+
+MAGIC = b"TNSR"
+VERSION = 1
+ALIGN = 64
+NAME_LENGTH = 32
+HEADER = struct.Struct("<4sHH8x")
+ENTRY = struct.Struct("<32sBB2x4H4xQQ")
+
+# Values of enum dtype in blob.h
+DTYPES = [np.int8, np.uint8, np.int16, np.uint16, np.int32, np.uint32,
+          np.float32]
+
+
+def _dtype_code(dtype):
+    for code, candidate in enumerate(DTYPES):
+        if np.dtype(candidate) == dtype:
+            return code
+    raise ValueError("unsupported dtype %s" % dtype)
+
+
+def _nchw(shape):
+    if len(shape) > 4:
+        raise ValueError("more than 4 dimensions: %s" % (shape,))
+    shape = (1,) * (4 - len(shape)) + tuple(shape)
+    if any(d > 0xFFFF for d in shape):
+        raise ValueError("dimension over 65535: %s" % (shape,))
+    return shape
+
+
+def write_tensors(path, tensors):
+    """Writes (name, array, exp_offset) tensors, arrays up to 4-D NCHW."""
+    entries = []
+    offset = HEADER.size + ENTRY.size * len(tensors)
+    for name, array, exp_offset in tensors:
+        encoded = name.encode()
+        if len(encoded) >= NAME_LENGTH:
+            raise ValueError("name longer than %d bytes: %s"
+                             % (NAME_LENGTH - 1, name))
+        array = np.ascontiguousarray(array)
+        offset = (offset + ALIGN - 1) // ALIGN * ALIGN
+        entries.append((encoded, _dtype_code(array.dtype), exp_offset,
+                        _nchw(array.shape), offset, array))
+        offset += array.nbytes
+
+    with open(path, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, len(entries)))
+        for name, code, exp_offset, shape, offset, array in entries:
+            f.write(ENTRY.pack(name, code, exp_offset, *shape, offset,
+                               array.nbytes))
+        for _, _, _, _, offset, array in entries:
+            f.write(b"\0" * (offset - f.tell()))
+            f.write(array.tobytes())
+
+
+def read_tensors(path):
+    """Returns {name: (array, exp_offset)}."""
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, version, count = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("%s is not a version %d tensor file"
+                         % (path, VERSION))
+    tensors = {}
+    for i in range(count):
+        name, code, exp_offset, n, c, h, w, offset, length = \
+            ENTRY.unpack_from(data, HEADER.size + i * ENTRY.size)
+        array = np.frombuffer(data, DTYPES[code], n * c * h * w, offset)
+        tensors[name.rstrip(b"\0").decode()] = \
+            (array.reshape(n, c, h, w), exp_offset)
+    return tensors
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.exit("usage: %s OUT NAME:DTYPE:NxCxHxW:EXP_OFFSET=FILE.bin ..."
+                 % argv[0])
+    tensors = []
+    for spec in argv[2:]:
+        header, source = spec.split("=", 1)
+        name, dtype, shape, exp_offset = header.split(":")
+        shape = tuple(int(d) for d in shape.split("x"))
+        array = np.fromfile(source, np.dtype(dtype))
+        tensors.append((name, array.reshape(shape), int(exp_offset)))
+    write_tensors(argv[1], tensors)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
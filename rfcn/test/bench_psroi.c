@@ -0,0 +1,87 @@
+/*
+ * Scaling of RoI-parallel PSRoI pooling on the 300-RoI R-FCN workload, from
+ * 1 to the number of available cores, in both pooling modes. Also checks
+ * that the outputs do not depend on the thread count.
+ */
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+#include "blob.h"
+#include "PSRoIPoolingLayer.h"
+
+#define NUM_ROIS 300
+#define NUM_CLASSES (20+1)
+#define NUM_ITERATIONS 50
+
+static double elapsed_ms(struct timespec* start, struct timespec* stop) {
+    return (stop->tv_sec - start->tv_sec) * 1e3
+         + (stop->tv_nsec - start->tv_nsec) * 1e-6;
+}
+
+int main(int argc, char* argv[]) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : omp_get_num_procs();
+    blob rfcn_cls = {.n=1, .c=NUM_CLASSES*7*7, .h=24, .w=32, .type=INT8};
+    blob rois = {.n=NUM_ROIS, .c=1, .h=1, .w=5, .type=UINT16};
+    size_t size = rfcn_cls.c * rfcn_cls.h * rfcn_cls.w;
+
+    // Random features and RoIs within a (375,500) image
+    srand(0);
+    rfcn_cls.data = malloc(size);
+    for(size_t i = 0; i < size; i++)
+        ((int8_t*)rfcn_cls.data)[i] = rand() % 128;
+    uint16_t* roi_data = rois.data = malloc(NUM_ROIS * 5 * sizeof(uint16_t));
+    for(size_t i = 0; i < NUM_ROIS; i++) {
+        roi_data[5*i+0] = 0;
+        roi_data[5*i+1] = rand() % 400;
+        roi_data[5*i+2] = rand() % 300;
+        roi_data[5*i+3] = roi_data[5*i+1] + 16 + rand() % (500 - 16 - roi_data[5*i+1]);
+        roi_data[5*i+4] = roi_data[5*i+2] + 16 + rand() % (375 - 16 - roi_data[5*i+2]);
+    }
+
+    // Layer 0 is set up for each (mode, thread count) pair and torn down
+    // after it; every pair must reproduce the first output
+    float* reference = NULL;
+    for(int mode = PSROI_DIRECT; mode <= PSROI_INTEGRAL; mode++) {
+        double base_ms = 0.0;
+        for(int threads = 1; threads <= max_threads; threads++) {
+            blob cls_score = {.c=NUM_CLASSES, .h=1, .w=1, .type=FLOAT32};
+            psroipooling_set_mode(0, mode);
+            psroipooling_set_num_threads(0, threads);
+            psroipooling_set_max_rois(0, NUM_ROIS);
+            psroipooling_setup(0, &rfcn_cls, &rois, &cls_score);
+
+            struct timespec start, stop;
+            double total_ms = 0.0;
+            for(int it = 0; it < NUM_ITERATIONS; it++) {
+                psroipooling_reshape(0, &rfcn_cls, &rois, &cls_score);
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                psroipooling_forward(0, &rfcn_cls, &rois, &cls_score);
+                clock_gettime(CLOCK_MONOTONIC, &stop);
+                total_ms += elapsed_ms(&start, &stop);
+                if(reference == NULL) {
+                    reference = malloc(NUM_ROIS * NUM_CLASSES * sizeof(float));
+                    memcpy(reference, cls_score.data,
+                           NUM_ROIS * NUM_CLASSES * sizeof(float));
+                }
+                else
+                    assert(!memcmp(reference, cls_score.data,
+                                   NUM_ROIS * NUM_CLASSES * sizeof(float)));
+            }
+            psroipooling_teardown(0, &cls_score);
+            double ms = total_ms / NUM_ITERATIONS;
+            if(threads == 1)
+                base_ms = ms;
+            printf("%s, %d thread(s): %.3f ms (%.2fx)\n",
+                   mode == PSROI_DIRECT ? "direct" : "integral",
+                   threads, ms, base_ms / ms);
+        }
+    }
+
+    free(reference);
+    free(rois.data);
+    free(rfcn_cls.data);
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Checks proposal_decode() against a plain per-anchor decode, for counts
+ * that are and are not a multiple of the vector width, with deltas that push
+ * boxes past every image edge, and times the decode of one 38x50 feature map
+ * with 9 anchors. Build it plain, with -msse4.2 and with -mavx2 (or with
+ * -DPROPOSAL_DECODE_SCALAR) to check each variant.
+ */
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include "exp_lut.h"
+#include "proposal_decode.h"
+
+#define NUM_ANCHORS (38*50*9)
+#define NUM_ITERATIONS 500
+#define IM_W 800
+#define IM_H 600
+#define MIN_SIZE 16
+
+static double elapsed_ms(struct timespec* start, struct timespec* stop) {
+    return (stop->tv_sec - start->tv_sec) * 1e3
+         + (stop->tv_nsec - start->tv_nsec) * 1e-6;
+}
+
+static int clip(int value, int max_value) {
+    return value < 0 ? 0 : value > max_value ? max_value : value;
+}
+
+static void reference_decode(size_t count, const int8_t* bbox_delta,
+                             const int16_t* scores, const int* ctr_x,
+                             const int* ctr_y, const int* w, const int* h,
+                             const int32_t* lut, size_t index_base,
+                             int16_t* indexed_scores, int* boxes) {
+    for(size_t i = 0; i < count; i++) {
+        int pred_ctr_x = ((bbox_delta[i*4+0]*w[i])>>6) + ctr_x[i];
+        int pred_ctr_y = ((bbox_delta[i*4+1]*h[i])>>6) + ctr_y[i];
+        int pred_w = exp_lut_scale(lut, bbox_delta[i*4+2], w[i]);
+        int pred_h = exp_lut_scale(lut, bbox_delta[i*4+3], h[i]);
+        int box[4] = {clip(pred_ctr_x - pred_w / 2, IM_W),
+                      clip(pred_ctr_y - pred_h / 2, IM_H),
+                      clip(pred_ctr_x + pred_w / 2, IM_W),
+                      clip(pred_ctr_y + pred_h / 2, IM_H)};
+        int small = box[2] - box[0] + 1 < MIN_SIZE
+                 || box[3] - box[1] + 1 < MIN_SIZE;
+        indexed_scores[i*2+0] = small ? INT16_MIN : scores[i];
+        indexed_scores[i*2+1] = index_base + i;
+        for(int c = 0; c < 4; c++)
+            boxes[i*4+c] = small ? 0 : box[c];
+    }
+}
+
+int main() {
+    static const int sizes[9][2] = {{184, 96}, {368, 192}, {736, 384},
+                                    {128, 128}, {256, 256}, {512, 512},
+                                    {88, 176}, {176, 352}, {352, 704}};
+    int32_t lut[EXP_LUT_SIZE];
+    exp_lut_init(lut);
+
+    int8_t* deltas = malloc(NUM_ANCHORS * 4);
+    int16_t* scores = malloc(NUM_ANCHORS * sizeof(int16_t));
+    int* ctr_x = malloc(NUM_ANCHORS * sizeof(int));
+    int* ctr_y = malloc(NUM_ANCHORS * sizeof(int));
+    int* w = malloc(NUM_ANCHORS * sizeof(int));
+    int* h = malloc(NUM_ANCHORS * sizeof(int));
+    int16_t* expected_scores = malloc(NUM_ANCHORS * 2 * sizeof(int16_t));
+    int* expected_boxes = malloc(NUM_ANCHORS * 4 * sizeof(int));
+    int16_t* indexed_scores = malloc(NUM_ANCHORS * 2 * sizeof(int16_t));
+    int* xmins = malloc(NUM_ANCHORS * sizeof(int));
+    int* ymins = malloc(NUM_ANCHORS * sizeof(int));
+    int* xmaxs = malloc(NUM_ANCHORS * sizeof(int));
+    int* ymaxs = malloc(NUM_ANCHORS * sizeof(int));
+
+    srand(0);
+    for(size_t i = 0; i < NUM_ANCHORS; i++) {
+        size_t position = i / 9;
+        for(int c = 0; c < 4; c++)
+            deltas[i*4+c] = rand() % 256 - 128;
+        scores[i] = rand() % 65536 - 32768;
+        w[i] = sizes[i % 9][0];
+        h[i] = sizes[i % 9][1];
+        ctr_x[i] = (position % 50) * 16 + 8;
+        ctr_y[i] = (position / 50) * 16 + 8;
+    }
+
+    // Every count up to a few vector widths, then the full map, at index
+    // base 0 and at an offset as for a later pyramid level
+    size_t counts[] = {0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, NUM_ANCHORS};
+    for(size_t t = 0; t < 2 * sizeof(counts) / sizeof(counts[0]); t++) {
+        size_t count = counts[t / 2];
+        size_t index_base = t % 2 ? 1000 : 0;
+        reference_decode(count, deltas, scores, ctr_x, ctr_y, w, h, lut,
+                         index_base, expected_scores, expected_boxes);
+        proposal_decode(count, deltas, scores, ctr_x, ctr_y, w, h, lut,
+                        IM_W, IM_H, MIN_SIZE, index_base, indexed_scores,
+                        xmins, ymins, xmaxs, ymaxs);
+        assert(memcmp(indexed_scores, expected_scores,
+                      count * 2 * sizeof(int16_t)) == 0);
+        for(size_t i = 0; i < count; i++) {
+            assert(xmins[i] == expected_boxes[i*4+0]);
+            assert(ymins[i] == expected_boxes[i*4+1]);
+            assert(xmaxs[i] == expected_boxes[i*4+2]);
+            assert(ymaxs[i] == expected_boxes[i*4+3]);
+        }
+    }
+    size_t clipped = 0, filtered = 0;
+    for(size_t i = 0; i < NUM_ANCHORS; i++) {
+        bool small = indexed_scores[i*2] == INT16_MIN && scores[i] != INT16_MIN;
+        filtered += small;
+        clipped += !small && (xmins[i] == 0 || ymins[i] == 0
+                              || xmaxs[i] == IM_W || ymaxs[i] == IM_H);
+    }
+    printf("proposal_decode: matches the reference on %zu counts "
+           "(%zu boxes touch an edge, %zu filtered)\n",
+           sizeof(counts) / sizeof(counts[0]), clipped, filtered);
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t iteration = 0; iteration < NUM_ITERATIONS; iteration++)
+        reference_decode(NUM_ANCHORS, deltas, scores, ctr_x, ctr_y, w, h, lut,
+                         0, expected_scores, expected_boxes);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double reference_ms = elapsed_ms(&start, &stop);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t iteration = 0; iteration < NUM_ITERATIONS; iteration++)
+        proposal_decode(NUM_ANCHORS, deltas, scores, ctr_x, ctr_y, w, h, lut,
+                        IM_W, IM_H, MIN_SIZE, 0, indexed_scores,
+                        xmins, ymins, xmaxs, ymaxs);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double decode_ms = elapsed_ms(&start, &stop);
+    printf("decode of %d anchors: reference %.2f us, proposal_decode %.2f us "
+           "per frame\n", NUM_ANCHORS, 1e3 * reference_ms / NUM_ITERATIONS,
+           1e3 * decode_ms / NUM_ITERATIONS);
+
+    free(deltas);
+    free(scores);
+    free(ctr_x);
+    free(ctr_y);
+    free(w);
+    free(h);
+    free(expected_scores);
+    free(expected_boxes);
+    free(indexed_scores);
+    free(xmins);
+    free(ymins);
+    free(xmaxs);
+    free(ymaxs);
+    return 0;
+}
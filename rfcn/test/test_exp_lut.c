@@ -0,0 +1,99 @@
+/*
+ * Accuracy of the fixed-point exp(d / 64) table used by proposal_forward()
+ * against the double-precision expression it replaces, over every int8 delta
+ * and every box size up to 4096, and a microbenchmark of the size decode of
+ * one 24x32 feature map with 9 anchors (6912 boxes) with expf() and with
+ * the table.
+ */
+#include <time.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "exp_lut.h"
+
+#define MAX_SIZE 4096
+#define NUM_BOXES (24*32*9)
+#define NUM_ITERATIONS 2000
+
+static double elapsed_ms(struct timespec* start, struct timespec* stop) {
+    return (stop->tv_sec - start->tv_sec) * 1e3
+         + (stop->tv_nsec - start->tv_nsec) * 1e-6;
+}
+
+int main() {
+    int32_t lut[EXP_LUT_SIZE];
+    exp_lut_init(lut);
+
+    // Entries: rounded to nearest in Q14
+    double max_entry_error = 0.0;
+    for(int d = -128; d < 128; d++) {
+        double exact = exp(d / 64.0) * (1 << EXP_LUT_FRAC_BITS);
+        double error = fabs(lut[d + 128] - exact);
+        assert(error <= 0.5);
+        max_entry_error = fmax(max_entry_error, error / exact);
+    }
+    printf("exp_lut: max relative error of the entries %.2e\n",
+           max_entry_error);
+
+    // Scaled sizes: within 1 of the truncated exact product
+    size_t mismatches = 0;
+    for(int d = -128; d < 128; d++) {
+        for(int size = 1; size <= MAX_SIZE; size++) {
+            int exact = exp(d / 64.0) * size;
+            int scaled = exp_lut_scale(lut, d, size);
+            assert(abs(scaled - exact) <= 1);
+            mismatches += scaled != exact;
+        }
+    }
+    printf("exp_lut_scale: %zu of %d products off by 1, none by more\n",
+           mismatches, 256 * MAX_SIZE);
+
+    // Decode of widths and heights, float against table
+    static const int sizes[9][2] = {{184, 96}, {368, 192}, {736, 384},
+                                    {128, 128}, {256, 256}, {512, 512},
+                                    {88, 176}, {176, 352}, {352, 704}};
+    int8_t* deltas = malloc(NUM_BOXES * 2);
+    int* widths = malloc(NUM_BOXES * sizeof(int));
+    int* heights = malloc(NUM_BOXES * sizeof(int));
+    int* pred = malloc(NUM_BOXES * 2 * sizeof(int));
+    srand(0);
+    for(size_t i = 0; i < NUM_BOXES; i++) {
+        deltas[2*i+0] = rand() % 256 - 128;
+        deltas[2*i+1] = rand() % 256 - 128;
+        widths[i] = sizes[i % 9][0];
+        heights[i] = sizes[i % 9][1];
+    }
+    struct timespec start, stop;
+    long checksum_float = 0, checksum_lut = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t iteration = 0; iteration < NUM_ITERATIONS; iteration++) {
+        for(size_t i = 0; i < NUM_BOXES; i++) {
+            pred[2*i+0] = expf(deltas[2*i+0] / 64.0f) * widths[i];
+            pred[2*i+1] = expf(deltas[2*i+1] / 64.0f) * heights[i];
+        }
+        checksum_float += pred[iteration % (2 * NUM_BOXES)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double float_ms = elapsed_ms(&start, &stop);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t iteration = 0; iteration < NUM_ITERATIONS; iteration++) {
+        for(size_t i = 0; i < NUM_BOXES; i++) {
+            pred[2*i+0] = exp_lut_scale(lut, deltas[2*i+0], widths[i]);
+            pred[2*i+1] = exp_lut_scale(lut, deltas[2*i+1], heights[i]);
+        }
+        checksum_lut += pred[iteration % (2 * NUM_BOXES)];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double lut_ms = elapsed_ms(&start, &stop);
+    printf("decode of %d boxes: expf %.2f us, table %.2f us per frame "
+           "(checksums %ld, %ld)\n", NUM_BOXES,
+           1e3 * float_ms / NUM_ITERATIONS, 1e3 * lut_ms / NUM_ITERATIONS,
+           checksum_float, checksum_lut);
+
+    free(deltas);
+    free(widths);
+    free(heights);
+    free(pred);
+    return 0;
+}
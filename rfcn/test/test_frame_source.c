@@ -0,0 +1,104 @@
+/*
+ * Checks frame_source on tensor files built here
+ *   - Frames come out in the order of their paths, with their own payloads,
+ *     for depths 1 to 4 and a consumer slower than the reader.
+ *   - The reader never holds more than depth frames.
+ *   - A missing file ends the stream after the frames before it, and
+ *     frame_source_failed() reports it.
+ *   - Stopping mid-stream joins the reader and closes the ring.
+ */
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "frame_source.h"
+
+#define NUM_FRAMES 12
+#define PAYLOAD_OFFSET 128
+
+static char paths[NUM_FRAMES][64];
+static const char* path_list[NUM_FRAMES + 1];
+
+/* One INT32 1x1x1x16 tensor "id", filled with id */
+static void write_frame(const char* path, int32_t id) {
+    uint8_t data[PAYLOAD_OFFSET + 16 * sizeof(int32_t)] = {0};
+    uint16_t version = TENSOR_FILE_VERSION, count = 1;
+    memcpy(data, TENSOR_FILE_MAGIC, 4);
+    memcpy(data + 4, &version, sizeof(version));
+    memcpy(data + 6, &count, sizeof(count));
+    tensor_entry entry = {.name = "id", .dtype = INT32, .n = 1, .c = 1,
+                          .h = 1, .w = 16, .offset = PAYLOAD_OFFSET,
+                          .length = 16 * sizeof(int32_t)};
+    memcpy(data + 16, &entry, sizeof(entry));
+    for(int i = 0; i < 16; i++)
+        memcpy(data + PAYLOAD_OFFSET + i * sizeof(int32_t), &id,
+               sizeof(int32_t));
+    FILE* f = fopen(path, "wb");
+    assert(f != NULL);
+    assert(fwrite(data, 1, sizeof(data), f) == sizeof(data));
+    fclose(f);
+}
+
+static void check_frame(const tensor_file* frame, int32_t id) {
+    blob b = {0};
+    assert(frame != NULL);
+    assert(tensor_file_describe(frame, "id", &b));
+    for(int i = 0; i < 16; i++)
+        assert(((int32_t*)b.data)[i] == id);
+}
+
+int main() {
+    for(int i = 0; i < NUM_FRAMES; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/tmp/test_frame_source_%d", i);
+        write_frame(paths[i], i);
+        path_list[i] = paths[i];
+    }
+    path_list[NUM_FRAMES] = "/tmp/test_frame_source_missing";
+
+    // In order, every depth
+    const struct timespec pause = {0, 200000};
+    for(size_t depth = 1; depth <= 4; depth++) {
+        frame_source source = {0};
+        assert(frame_source_start(&source, path_list, NUM_FRAMES, depth, 0));
+        for(int i = 0; i < NUM_FRAMES; i++) {
+            check_frame(frame_source_next(&source), i);
+            nanosleep(&pause, NULL);
+            pthread_mutex_lock(&source.lock);
+            assert(source.num_read - source.num_released <= depth);
+            pthread_mutex_unlock(&source.lock);
+            frame_source_release(&source);
+        }
+        assert(frame_source_next(&source) == NULL);
+        assert(!frame_source_failed(&source));
+        frame_source_stats stats;
+        frame_source_get_stats(&source, &stats);
+        assert(stats.num_frames == NUM_FRAMES);
+        frame_source_stop(&source);
+    }
+    printf("frame_source: %d frames in order at depths 1 to 4\n", NUM_FRAMES);
+
+    // Missing file
+    frame_source source = {0};
+    assert(frame_source_start(&source, path_list + NUM_FRAMES - 2, 3, 2, 0));
+    for(int i = NUM_FRAMES - 2; i < NUM_FRAMES; i++) {
+        check_frame(frame_source_next(&source), i);
+        frame_source_release(&source);
+    }
+    assert(frame_source_next(&source) == NULL);
+    assert(frame_source_failed(&source));
+    frame_source_stop(&source);
+    printf("frame_source: a missing file ends the stream\n");
+
+    // Early stop with frames still in the ring
+    assert(frame_source_start(&source, path_list, NUM_FRAMES, 4, 0));
+    check_frame(frame_source_next(&source), 0);
+    frame_source_release(&source);
+    frame_source_stop(&source);
+    for(int i = 0; i < FRAME_SOURCE_MAX_DEPTH; i++)
+        assert(source.slots[i].mapping.addr == NULL);
+    printf("frame_source: stopped mid-stream\n");
+
+    for(int i = 0; i < NUM_FRAMES; i++)
+        remove(paths[i]);
+    return 0;
+}
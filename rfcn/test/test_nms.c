@@ -0,0 +1,307 @@
+/*
+ * Equivalence tests of the NMS kernels on random boxes
+ *   - iou_exceeds_mask() against iou_exceeds(), counting the mismatches of
+ *     both against a float IoU.
+ *   - nms() (integer IoU kernel, bitmask engine) and nms_in_grid() against
+ *     nms_reference() (floating-point IoU, greedy loop).
+ *   - nms_soft() in NMS_HARD mode against nms(), and in linear and Gaussian
+ *     modes against a straightforward Soft-NMS loop.
+ *   - nms_batched() against a per-class sort and greedy loop.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+#include "iou.h"
+#include "nms.h"
+
+#define NUM_TRIALS 20
+#define NUM_BOXES 6000
+#define NUM_PAIRS 1000000
+#define NUM_CLASSES 21
+#define NUM_ROIS 300
+
+// Stable descending sort of one class column, then greedy float NMS at thresh
+static size_t reference_class(const int16_t* scores, const int* proposals,
+                              int N, int C, int c, float thresh, int* keep) {
+    int* order = malloc(N * sizeof(int));
+    bool* removed = calloc(N, sizeof(bool));
+    for(int i = 0; i < N; i++)
+        order[i] = i;
+    for(int i = 1; i < N; i++) { // insertion sort, stable
+        int v = order[i];
+        int j = i;
+        while(j > 0 && scores[order[j-1]*C + c] < scores[v*C + c]) {
+            order[j] = order[j-1];
+            j--;
+        }
+        order[j] = v;
+    }
+    size_t num_keep = 0;
+    for(int r = 0; r < N; r++) {
+        int i = order[r];
+        if(removed[r])
+            continue;
+        keep[num_keep++] = i;
+        const int* a = &proposals[4*i];
+        int area_a = (a[2]-a[0]) * (a[3]-a[1]);
+        for(int s = r+1; s < N; s++) {
+            const int* b = &proposals[4*order[s]];
+            int area_b = (b[2]-b[0]) * (b[3]-b[1]);
+            int w = (a[2] < b[2] ? a[2] : b[2]) - (a[0] > b[0] ? a[0] : b[0]);
+            int h = (a[3] < b[3] ? a[3] : b[3]) - (a[1] > b[1] ? a[1] : b[1]);
+            int i_area = (w > 0 ? w : 0) * (h > 0 ? h : 0);
+            int u_area = area_a + area_b - i_area;
+            if(u_area > 0 && (float)i_area / (float)u_area > thresh)
+                removed[s] = true;
+        }
+    }
+    free(order);
+    free(removed);
+    return num_keep;
+}
+
+// Textbook Soft-NMS: repeatedly select the best remaining box, then decay
+// the others. Writes the selected indices and scores, returns their count.
+static size_t reference_soft(const int16_t* idx_scores, const int* proposals,
+                             int N, const nms_soft_params* params,
+                             int* selected, int16_t* selected_scores) {
+    float* scores = malloc(N * sizeof(float));
+    bool* removed = calloc(N, sizeof(bool));
+    size_t limit = params->max_detections ? params->max_detections : N;
+    for(int i = 0; i < N; i++) {
+        scores[i] = idx_scores[2*i];
+        removed[i] = scores[i] < params->score_floor;
+    }
+    size_t count = 0;
+    while(count < limit) {
+        int best = -1;
+        for(int i = 0; i < N; i++)
+            if(!removed[i] && (best < 0 || scores[i] > scores[best]))
+                best = i;
+        if(best < 0)
+            break;
+        selected[count] = idx_scores[2*best+1];
+        selected_scores[count++] = (int16_t)lrintf(scores[best]);
+        removed[best] = true;
+        const int* a = &proposals[4*idx_scores[2*best+1]];
+        int area_a = (a[2]-a[0]) * (a[3]-a[1]);
+        for(int i = 0; i < N; i++) {
+            if(removed[i])
+                continue;
+            const int* b = &proposals[4*idx_scores[2*i+1]];
+            int area_b = (b[2]-b[0]) * (b[3]-b[1]);
+            int w = (a[2] < b[2] ? a[2] : b[2]) - (a[0] > b[0] ? a[0] : b[0]);
+            int h = (a[3] < b[3] ? a[3] : b[3]) - (a[1] > b[1] ? a[1] : b[1]);
+            int i_area = (w > 0 ? w : 0) * (h > 0 ? h : 0);
+            int u_area = area_a + area_b - i_area;
+            float ratio = u_area > 0 ? (float)i_area / (float)u_area : 0.0f;
+            float weight = 1.0f;
+            if(params->mode == NMS_SOFT_GAUSSIAN)
+                weight = i_area > 0 ? expf(-ratio * ratio / params->sigma) : 1;
+            else if(ratio > params->iou_thresh)
+                weight = params->mode == NMS_HARD ? 0.0f : 1.0f - ratio;
+            scores[i] *= weight;
+            removed[i] = weight == 0.0f || scores[i] < params->score_floor;
+        }
+    }
+    free(scores);
+    free(removed);
+    return count;
+}
+
+int main() {
+    int16_t* idx_scores = malloc(NUM_BOXES * 2 * sizeof(int16_t));
+    int* proposals = malloc(NUM_BOXES * 4 * sizeof(int));
+    srand(0);
+
+    // IoU kernel: vector variant against scalar, and against float division
+    int32_t i_areas[64], u_areas[64];
+    size_t mismatches = 0;
+    for(size_t trial = 0; trial < NUM_PAIRS / 64; trial++) {
+        for(size_t k = 0; k < 64; k++) {
+            u_areas[k] = 1 + rand() % 200000;
+            i_areas[k] = rand() % (u_areas[k] + 1);
+        }
+        int64_t thresh_q = IOU_THRESH_Q(0.7f);
+        uint64_t bits = iou_exceeds_mask(i_areas, u_areas, 64, thresh_q);
+        for(size_t k = 0; k < 64; k++) {
+            bool scalar = iou_exceeds(i_areas[k], u_areas[k], thresh_q);
+            bool ref = (float)i_areas[k] / (float)u_areas[k] > 0.7f;
+            assert(((bits >> k) & 1) == scalar);
+            mismatches += scalar != ref;
+        }
+    }
+    printf("iou_exceeds: %zu mismatches against float in %d pairs\n",
+           mismatches, NUM_PAIRS);
+
+    // NMS
+    nms_workspace grid_ws = {0};
+    for(size_t trial = 0; trial < NUM_TRIALS; trial++) {
+        int N = 1 + rand() % NUM_BOXES;
+        for(int i = 0; i < N; i++) {
+            int x = rand() % 450, y = rand() % 330;
+            idx_scores[2*i+0] = N - i;
+            idx_scores[2*i+1] = i;
+            proposals[4*i+0] = x;
+            proposals[4*i+1] = y;
+            proposals[4*i+2] = x + 8 + rand() % 160;
+            proposals[4*i+3] = y + 8 + rand() % 160;
+        }
+        bool* keep = nms(idx_scores, proposals, N);
+        bool* keep_ref = nms_reference(idx_scores, proposals, N);
+        bool* keep_grid = nms_in_grid(&grid_ws, idx_scores, proposals, N,
+                                      8 << (trial % 6));
+        for(int i = 0; i < N; i++) {
+            assert(keep[i] == keep_ref[i]);
+            assert(keep_grid[i] == keep_ref[i]);
+        }
+        free(keep);
+        free(keep_ref);
+    }
+    printf("nms, nms_in_grid: %d trials match nms_reference\n", NUM_TRIALS);
+
+    // Grid against matrix on a dense frame: many small boxes
+    {
+        int N = NUM_BOXES;
+        for(int i = 0; i < N; i++) {
+            int x = rand() % 480, y = rand() % 355;
+            idx_scores[2*i+0] = N - i;
+            idx_scores[2*i+1] = i;
+            proposals[4*i+0] = x;
+            proposals[4*i+1] = y;
+            proposals[4*i+2] = x + 16 + rand() % 48;
+            proposals[4*i+3] = y + 16 + rand() % 48;
+        }
+        nms_workspace matrix_ws = {0};
+        struct timespec t0, t1, t2;
+        nms_in(&matrix_ws, idx_scores, proposals, N); // warm up
+        nms_in_grid(&grid_ws, idx_scores, proposals, N, 64);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        bool* keep = nms_in(&matrix_ws, idx_scores, proposals, N);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        bool* keep_grid = nms_in_grid(&grid_ws, idx_scores, proposals, N, 64);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        for(int i = 0; i < N; i++)
+            assert(keep[i] == keep_grid[i]);
+        printf("nms_in: %.3f ms, nms_in_grid: %.3f ms on %d boxes\n",
+               (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6,
+               (t2.tv_sec - t1.tv_sec) * 1e3 + (t2.tv_nsec - t1.tv_nsec) / 1e6,
+               N);
+        nms_release(&matrix_ws);
+    }
+    nms_release(&grid_ws);
+
+    // Soft-NMS with NMS_HARD keeps what nms() keeps, in the same order
+    int16_t* soft = malloc(NUM_BOXES * 2 * sizeof(int16_t));
+    int* selected = malloc(NUM_BOXES * sizeof(int));
+    int16_t* selected_scores = malloc(NUM_BOXES * sizeof(int16_t));
+    nms_workspace soft_ws = {0};
+    nms_soft_params hard = { .mode = NMS_HARD, .iou_thresh = 0.7f,
+                             .score_floor = 1, .max_detections = 0 };
+    for(size_t trial = 0; trial < NUM_TRIALS; trial++) {
+        int N = 1 + rand() % NUM_BOXES;
+        for(int i = 0; i < N; i++) {
+            int x = rand() % 450, y = rand() % 330;
+            idx_scores[2*i+0] = N - i;
+            idx_scores[2*i+1] = i;
+            proposals[4*i+0] = x;
+            proposals[4*i+1] = y;
+            proposals[4*i+2] = x + 8 + rand() % 160;
+            proposals[4*i+3] = y + 8 + rand() % 160;
+        }
+        bool* keep = nms(idx_scores, proposals, N);
+        memcpy(soft, idx_scores, N * 2 * sizeof(int16_t));
+        int count = nms_soft(&soft_ws, &hard, soft, proposals, N);
+        int k = 0;
+        for(int i = 0; i < N; i++) {
+            if(!keep[i])
+                continue;
+            assert(k < count && soft[2*k+1] == idx_scores[2*i+1]);
+            k++;
+        }
+        assert(k == count);
+        free(keep);
+    }
+    printf("nms_soft: %d trials of NMS_HARD match nms\n", NUM_TRIALS);
+
+    // Linear and Gaussian modes, with and without a cap, against the
+    // textbook loop on unsorted scores
+    nms_soft_params linear = NMS_SOFT_DEFAULT_PARAMS;
+    nms_soft_params gaussian = NMS_SOFT_DEFAULT_PARAMS;
+    gaussian.mode = NMS_SOFT_GAUSSIAN;
+    gaussian.score_floor = 3000;
+    nms_soft_params* modes[2] = {&linear, &gaussian};
+    for(size_t trial = 0; trial < NUM_TRIALS; trial++) {
+        int N = 1 + rand() % NUM_ROIS;
+        for(int i = 0; i < N; i++) {
+            int x = rand() % 450, y = rand() % 330;
+            idx_scores[2*i+0] = rand() % INT16_MAX;
+            idx_scores[2*i+1] = i;
+            proposals[4*i+0] = x;
+            proposals[4*i+1] = y;
+            proposals[4*i+2] = x + 8 + rand() % 160;
+            proposals[4*i+3] = y + 8 + rand() % 160;
+        }
+        nms_soft_params* params = modes[trial % 2];
+        params->max_detections = trial % 4 < 2 ? 0 : 1 + rand() % 20;
+        size_t num_ref = reference_soft(idx_scores, proposals, N, params,
+                                        selected, selected_scores);
+        memcpy(soft, idx_scores, N * 2 * sizeof(int16_t));
+        int count = nms_soft(&soft_ws, params, soft, proposals, N);
+        assert(count == (int)num_ref);
+        for(int k = 0; k < count; k++) {
+            assert(soft[2*k+1] == selected[k]);
+            assert(soft[2*k] == selected_scores[k]);
+            assert(k == 0 || soft[2*k] <= soft[2*k-2]);
+        }
+    }
+    printf("nms_soft: %d trials of linear and Gaussian decay match reference\n",
+           NUM_TRIALS);
+    nms_release(&soft_ws);
+    free(soft);
+    free(selected);
+    free(selected_scores);
+
+    // Batched NMS, with a skipped background class and per-class thresholds
+    int16_t* scores = malloc(NUM_ROIS * NUM_CLASSES * sizeof(int16_t));
+    int* keep_ref = malloc(NUM_ROIS * sizeof(int));
+    float thresholds[NUM_CLASSES];
+    nms_batch_workspace ws = {0};
+    thresholds[0] = -1.0f;
+    for(int c = 1; c < NUM_CLASSES; c++)
+        thresholds[c] = c % 3 == 0 ? 0.3f : 0.7f;
+    for(size_t trial = 0; trial < NUM_TRIALS; trial++) {
+        int N = 1 + rand() % NUM_ROIS;
+        for(int i = 0; i < N; i++) {
+            int x = rand() % 450, y = rand() % 330;
+            proposals[4*i+0] = x;
+            proposals[4*i+1] = y;
+            proposals[4*i+2] = x + 8 + rand() % 160;
+            proposals[4*i+3] = y + 8 + rand() % 160;
+            for(int c = 0; c < NUM_CLASSES; c++)
+                scores[i*NUM_CLASSES + c] = rand() % 64; // plenty of ties
+        }
+        bool ok = nms_batched(&ws, scores, proposals, N, NUM_CLASSES,
+                              thresholds);
+        assert(ok);
+        assert(ws.num_keep[0] == 0);
+        for(int c = 1; c < NUM_CLASSES; c++) {
+            size_t num_ref = reference_class(scores, proposals, N, NUM_CLASSES,
+                                             c, thresholds[c], keep_ref);
+            assert(ws.num_keep[c] == num_ref);
+            for(size_t k = 0; k < num_ref; k++)
+                assert(ws.keep[c * ws.capacity + k] == keep_ref[k]);
+        }
+    }
+    printf("nms_batched: %d trials match per-class reference\n", NUM_TRIALS);
+    nms_batch_release(&ws);
+
+    free(scores);
+    free(keep_ref);
+    free(idx_scores);
+    free(proposals);
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Checks proposal_config_parse(): defaults are kept for absent keys,
+ * comments and blank lines are skipped, anchor lines replace the table, and
+ * unknown keys or invalid values are rejected.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "proposal_config.h"
+
+int main() {
+    const proposal_config defaults = PROPOSAL_DEFAULT_CONFIG;
+    proposal_config config = defaults;
+
+    // Empty and comment-only texts change nothing
+    assert(proposal_config_parse("", &config));
+    assert(proposal_config_parse("# nothing\n\n   \n", &config));
+    assert(proposal_config_equal(&config, &defaults));
+
+    // Scalars, with comments and no final newline
+    assert(proposal_config_parse(
+            "nms_thresh 0.5  # looser\n"
+            "  pre_nms_top_n 12000\n"
+            "post_nms_top_n 2000\n"
+            "min_size 8\n"
+            "feat_stride 8\n"
+            "num_levels 4\n"
+            "nms_grid_cell 64", &config));
+    assert(config.nms_thresh == 0.5f);
+    assert(config.pre_nms_top_n == 12000);
+    assert(config.post_nms_top_n == 2000);
+    assert(config.min_size == 8);
+    assert(config.feat_stride == 8);
+    assert(config.num_levels == 4);
+    assert(config.nms_grid_cell == 64);
+    assert(config.num_anchors == defaults.num_anchors);
+    assert(!proposal_config_equal(&config, &defaults));
+
+    // The first anchor line replaces the table
+    config = defaults;
+    assert(proposal_config_parse("anchor -8 -8 23 23\n"
+                                 "anchor -16 -16 31 31\n", &config));
+    assert(config.num_anchors == 2);
+    assert(config.anchors[1][0] == -16 && config.anchors[1][3] == 31);
+
+    // Errors
+    config = defaults;
+    const char* invalid[] = {"nms_threshold 0.7", "nms_thresh 1.5",
+                             "nms_thresh", "pre_nms_top_n 0", "num_levels 0",
+                             "post_nms_top_n 70000", "feat_stride 0",
+                             "min_size 16 32", "anchor 1 2 3",
+                             "anchor 10 0 0 10"};
+    for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+        assert(!proposal_config_parse(invalid[i], &config));
+    char many[64 * (PROPOSAL_MAX_ANCHORS + 1)] = "";
+    for(int i = 0; i <= PROPOSAL_MAX_ANCHORS; i++)
+        strcat(many, "anchor 0 0 15 15\n");
+    assert(!proposal_config_parse(many, &config));
+
+    printf("proposal_config_parse: all cases pass\n");
+    return 0;
+}
@@ -0,0 +1,297 @@
+/*
+ * Checks the multi-level (FPN) mode of the proposal layer
+ *   - With a single level, proposal_fpn_forward() gives the same rois as
+ *     proposal_forward().
+ *   - proposal_reshape() refuses a map of more than 65536 anchors, and
+ *     forward() then outputs no rois until a reshape() back succeeds.
+ *   - The config of a layer survives proposal_teardown().
+ *   - With 4 levels (strides 4 to 32, 3 anchors each) on a 375x500 image,
+ *     and on a 768x1024 image whose levels hold more than 65536 anchors
+ *     together, the rois match a brute-force reference: every anchor of
+ *     every level decoded into one list, sorted by score, cut to
+ *     pre_nms_top_n, passed to nms_reference(), cut to post_nms_top_n, then
+ *     grouped by the FPN level of each roi.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "ProposalLayer.h"
+#include "exp_lut.h"
+#include "nms.h"
+
+#define IM_H 375
+#define IM_W 500
+#define LARGE_IM_H 768
+#define LARGE_IM_W 1024
+#define NUM_LEVELS 4
+
+static uint32_t im_info_data[3];
+
+static void fill_level(blob* scores, blob* deltas, int num_anchors, int h,
+                       int w) {
+    size_t count = (size_t)num_anchors * h * w;
+    scores->type = INT16;
+    scores->n = 1;
+    scores->c = 2 * num_anchors;
+    scores->h = h;
+    scores->w = w;
+    scores->data = malloc(2 * count * sizeof(int16_t));
+    deltas->type = INT8;
+    deltas->n = 1;
+    deltas->c = 4 * num_anchors;
+    deltas->h = h;
+    deltas->w = w;
+    deltas->data = malloc(4 * count);
+    for(size_t i = 0; i < 2 * count; i++)
+        ((int16_t*)scores->data)[i] = rand() % 32768;
+    for(size_t i = 0; i < 4 * count; i++)
+        ((int8_t*)deltas->data)[i] = rand() % 64 - 32;
+}
+
+static int compare_pairs(const void* a, const void* b) {
+    const int32_t* x = a;
+    const int32_t* y = b;
+    if(x[0] != y[0])
+        return y[0] - x[0];
+    return x[1] - y[1];
+}
+
+static int clip(int value, int max_value) {
+    return value < 0 ? 0 : value > max_value ? max_value : value;
+}
+
+/* Rois of the brute-force reference on an im_w x im_h image, grouped by
+ * level into expected. The pairs are int32, as the anchors of all levels
+ * may exceed a 16-bit index. */
+static size_t reference_rois(const proposal_config* config,
+                             blob* const* scores, blob* const* deltas,
+                             int im_h, int im_w,
+                             uint16_t* expected, size_t* level_counts) {
+    int32_t lut[EXP_LUT_SIZE];
+    exp_lut_init(lut);
+    size_t total = 0;
+    for(int l = 0; l < config->num_levels; l++)
+        total += (size_t)config->num_anchors * scores[l]->h * scores[l]->w;
+    int32_t* pairs = malloc(total * 2 * sizeof(int32_t));
+    int* boxes = malloc(total * 4 * sizeof(int));
+
+    size_t index = 0, num_pairs = 0;
+    for(int l = 0; l < config->num_levels; l++) {
+        int stride = config->feat_stride << l;
+        size_t hw = (size_t)scores[l]->h * scores[l]->w;
+        const int16_t* fg = (int16_t*)scores[l]->data + config->num_anchors*hw;
+        const int8_t* delta = deltas[l]->data;
+        for(size_t p = 0; p < hw; p++) {
+            for(int k = 0; k < config->num_anchors; k++, index++) {
+                const int* base = config->anchors[k];
+                size_t a = p * config->num_anchors + k;
+                int width = (base[2] - base[0] + 1) << l;
+                int height = (base[3] - base[1] + 1) << l;
+                int ctr_x = ((base[0] + (base[2] - base[0] + 1) / 2) << l)
+                          + (p % scores[l]->w) * stride + ((1 << l) - 1) / 2;
+                int ctr_y = ((base[1] + (base[3] - base[1] + 1) / 2) << l)
+                          + (p / scores[l]->w) * stride + ((1 << l) - 1) / 2;
+                ctr_x += (delta[a*4+0] * width) >> 6;
+                ctr_y += (delta[a*4+1] * height) >> 6;
+                int pred_w = exp_lut_scale(lut, delta[a*4+2], width);
+                int pred_h = exp_lut_scale(lut, delta[a*4+3], height);
+                int* box = boxes + 4*index;
+                box[0] = clip(ctr_x - pred_w / 2, im_w);
+                box[1] = clip(ctr_y - pred_h / 2, im_h);
+                box[2] = clip(ctr_x + pred_w / 2, im_w);
+                box[3] = clip(ctr_y + pred_h / 2, im_h);
+                if(box[2] - box[0] + 1 < config->min_size
+                   || box[3] - box[1] + 1 < config->min_size)
+                    continue;
+                pairs[2*num_pairs+0] = fg[a];
+                pairs[2*num_pairs+1] = index;
+                num_pairs++;
+            }
+        }
+    }
+    qsort(pairs, num_pairs, 2 * sizeof(int32_t), compare_pairs);
+    size_t n = num_pairs < config->pre_nms_top_n ? num_pairs
+                                                 : config->pre_nms_top_n;
+
+    // nms_reference() takes int16 pairs, so gather the n best boxes first
+    int16_t* top_pairs = malloc(n * 2 * sizeof(int16_t));
+    int* top_boxes = malloc(n * 4 * sizeof(int));
+    for(size_t i = 0; i < n; i++) {
+        top_pairs[2*i+0] = pairs[2*i+0];
+        top_pairs[2*i+1] = i;
+        memcpy(top_boxes + 4*i, boxes + 4*pairs[2*i+1], 4 * sizeof(int));
+    }
+    bool* keep = nms_reference(top_pairs, top_boxes, n);
+
+    // Survivors in score order, then stably grouped by level
+    uint16_t* rois = malloc(5 * config->post_nms_top_n * sizeof(uint16_t));
+    int* levels = malloc(config->post_nms_top_n * sizeof(int));
+    size_t num_rois = 0;
+    for(size_t i = 0; i < n && num_rois < config->post_nms_top_n; i++) {
+        if(!keep[i])
+            continue;
+        const int* box = top_boxes + 4*i;
+        rois[5*num_rois] = 0;
+        for(int c = 0; c < 4; c++)
+            rois[5*num_rois+1+c] = box[c];
+        // k = 4 + floor(log2(sqrt(wh) / 224)) with level 0 at stride 4 (k = 2)
+        float wh = (float)(box[2] - box[0] + 1) * (box[3] - box[1] + 1);
+        int k = 4 + (int)floorf(log2f(sqrtf(wh) / 224.0f));
+        k = k < 2 ? 2 : k > 1 + config->num_levels ? 1 + config->num_levels : k;
+        levels[num_rois++] = k - 2;
+    }
+    size_t out = 0;
+    for(int l = 0; l < config->num_levels; l++) {
+        level_counts[l] = 0;
+        for(size_t i = 0; i < num_rois; i++) {
+            if(levels[i] != l)
+                continue;
+            memcpy(expected + 5*out++, rois + 5*i, 5 * sizeof(uint16_t));
+            level_counts[l]++;
+        }
+    }
+
+    free(pairs);
+    free(boxes);
+    free(top_pairs);
+    free(top_boxes);
+    free(keep);
+    free(rois);
+    free(levels);
+    return num_rois;
+}
+
+/* Runs a 4-level layer on an im_w x im_h image against reference_rois().
+ * With check_teardown, also checks that the config survives teardown(), so
+ * a new setup() gives the same rois. */
+static void check_pyramid(int im_h, int im_w, bool check_teardown) {
+    float scaling = 1.0f;
+    uint32_t info[3] = {im_h, im_w};
+    memcpy(&info[2], &scaling, sizeof(float));
+    blob im_info = {1, 1, 1, 3, UINT32, info};
+    blob rois_fpn = {0};
+    rois_fpn.type = UINT16;
+
+    proposal_config config = PROPOSAL_DEFAULT_CONFIG;
+    const int anchors[3][4] = {{-44, -20, 47, 23}, {-30, -30, 33, 33},
+                               {-20, -44, 23, 47}};
+    config.feat_stride = 4;
+    config.num_levels = NUM_LEVELS;
+    config.num_anchors = 3;
+    config.min_size = 4;
+    config.post_nms_top_n = 1000;
+    memcpy(config.anchors, anchors, sizeof(anchors));
+    blob pyramid_scores[NUM_LEVELS], pyramid_deltas[NUM_LEVELS];
+    blob* level_scores[NUM_LEVELS];
+    blob* level_deltas[NUM_LEVELS];
+    for(int l = 0; l < NUM_LEVELS; l++) {
+        int stride = config.feat_stride << l;
+        fill_level(&pyramid_scores[l], &pyramid_deltas[l], config.num_anchors,
+                   (im_h + stride - 1) / stride, (im_w + stride - 1) / stride);
+        level_scores[l] = &pyramid_scores[l];
+        level_deltas[l] = &pyramid_deltas[l];
+    }
+    proposal_set_config(2, &config);
+    bool ok = proposal_fpn_setup(2, level_scores, level_deltas, &im_info,
+                                 &rois_fpn);
+    assert(ok);
+    proposal_fpn_forward(2, level_scores, level_deltas, &im_info, &rois_fpn);
+
+    uint16_t* expected = malloc(5 * config.post_nms_top_n * sizeof(uint16_t));
+    size_t expected_counts[NUM_LEVELS], counts[NUM_LEVELS];
+    size_t num_expected = reference_rois(&config, level_scores, level_deltas,
+                                         im_h, im_w, expected,
+                                         expected_counts);
+    proposal_get_level_counts(2, counts);
+    assert(rois_fpn.n == num_expected);
+    assert(memcmp(counts, expected_counts, sizeof(counts)) == 0);
+    assert(memcmp(rois_fpn.data, expected,
+                  5 * num_expected * sizeof(uint16_t)) == 0);
+    proposal_stats stats;
+    proposal_get_stats(2, &stats);
+    printf("proposal_fpn_forward: %d levels, %zu anchors, %zu rois match the "
+           "reference (per level:", NUM_LEVELS, stats.num_anchors,
+           num_expected);
+    for(int l = 0; l < NUM_LEVELS; l++)
+        printf(" %zu", counts[l]);
+    printf(")\n");
+
+    if(check_teardown) {
+        proposal_teardown(2, &rois_fpn);
+        ok = proposal_fpn_setup(2, level_scores, level_deltas, &im_info,
+                                &rois_fpn);
+        assert(ok);
+        proposal_fpn_forward(2, level_scores, level_deltas, &im_info,
+                             &rois_fpn);
+        assert(rois_fpn.n == num_expected);
+        assert(memcmp(rois_fpn.data, expected,
+                      5 * num_expected * sizeof(uint16_t)) == 0);
+        printf("proposal_teardown: config kept for the next setup\n");
+    }
+    proposal_teardown(2, &rois_fpn);
+    for(int l = 0; l < NUM_LEVELS; l++) {
+        free(pyramid_scores[l].data);
+        free(pyramid_deltas[l].data);
+    }
+    free(expected);
+}
+
+int main() {
+    srand(0);
+    float scaling = 1.0f;
+    im_info_data[0] = IM_H;
+    im_info_data[1] = IM_W;
+    memcpy(&im_info_data[2], &scaling, sizeof(float));
+    blob im_info = {1, 1, 1, 3, UINT32, im_info_data};
+
+    // One level: both entry points agree
+    blob scores, deltas, rois_single = {0}, rois_fpn = {0};
+    rois_single.type = rois_fpn.type = UINT16;
+    fill_level(&scores, &deltas, 9, 24, 32);
+    blob* level_scores[NUM_LEVELS] = {&scores};
+    blob* level_deltas[NUM_LEVELS] = {&deltas};
+    bool ok = proposal_setup(0, &scores, &deltas, &im_info, &rois_single);
+    assert(ok);
+    proposal_forward(0, &scores, &deltas, &im_info, &rois_single);
+    ok = proposal_fpn_setup(1, level_scores, level_deltas, &im_info,
+                            &rois_fpn);
+    assert(ok);
+    proposal_fpn_forward(1, level_scores, level_deltas, &im_info, &rois_fpn);
+    assert(rois_single.n == rois_fpn.n && rois_single.n > 0);
+    assert(memcmp(rois_single.data, rois_fpn.data,
+                  5 * rois_single.n * sizeof(uint16_t)) == 0);
+    printf("proposal_fpn_forward: 1 level matches proposal_forward "
+           "(%d rois)\n", rois_single.n);
+
+    // A map of more than 65536 anchors is refused, and forward() outputs
+    // nothing until a reshape() to a smaller map
+    int num_rois = rois_single.n;
+    blob large_scores, large_deltas;
+    fill_level(&large_scores, &large_deltas, 9, 96, 96);
+    ok = proposal_reshape(0, &large_scores, &large_deltas, &im_info,
+                          &rois_single);
+    assert(!ok);
+    proposal_forward(0, &large_scores, &large_deltas, &im_info, &rois_single);
+    assert(rois_single.n == 0);
+    ok = proposal_reshape(0, &scores, &deltas, &im_info, &rois_single);
+    assert(ok);
+    proposal_forward(0, &scores, &deltas, &im_info, &rois_single);
+    assert(rois_single.n == num_rois);
+    assert(memcmp(rois_single.data, rois_fpn.data,
+                  5 * num_rois * sizeof(uint16_t)) == 0);
+    printf("proposal_reshape: refuses %d anchors\n", 9 * 96 * 96);
+    free(large_scores.data);
+    free(large_deltas.data);
+    proposal_teardown(0, &rois_single);
+    proposal_teardown(1, &rois_fpn);
+    free(scores.data);
+    free(deltas.data);
+
+    // Four levels against the reference, then on an image whose levels
+    // hold more than 65536 anchors together
+    check_pyramid(IM_H, IM_W, false);
+    check_pyramid(LARGE_IM_H, LARGE_IM_W, true);
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Checks tensor_file_open() and friends on files built here
+ *   - A file of two tensors is read back with the right types, shapes,
+ *     exp_offsets and payloads.
+ *   - tensor_file_get() rejects a blob of another shape or type.
+ *   - Files with a bad magic, a misaligned or truncated payload, or a
+ *     length that does not match the shape are rejected at open.
+ *   - With BLOB_MAP_KEEP, reopening the same path keeps the mapping.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "tensor_file.h"
+
+#define PATH "/tmp/test_tensor_file.tensors"
+#define SCORES_OFFSET 192
+#define DELTAS_OFFSET 1216
+
+static _Alignas(64) uint8_t file_data[DELTAS_OFFSET + 2*8*4*4];
+
+static void set_entry(int i, const char* name, enum dtype type, int c,
+                      uint64_t offset) {
+    tensor_entry entry = {0};
+    strcpy(entry.name, name);
+    entry.dtype = type;
+    entry.exp_offset = 10 + i;
+    entry.n = 1;
+    entry.c = c;
+    entry.h = 4;
+    entry.w = 8;
+    entry.offset = offset;
+    entry.length = (uint64_t)c * 4 * 8 * _sizeof(type);
+    memcpy(file_data + 16 + i * sizeof(tensor_entry), &entry, sizeof(entry));
+}
+
+/* A valid file: INT16 1x4x4x8 "scores", then INT8 1x8x4x8 "deltas" */
+static void build() {
+    uint16_t version = TENSOR_FILE_VERSION, count = 2;
+    memset(file_data, 0, sizeof(file_data));
+    memcpy(file_data, TENSOR_FILE_MAGIC, 4);
+    memcpy(file_data + 4, &version, sizeof(version));
+    memcpy(file_data + 6, &count, sizeof(count));
+    set_entry(0, "scores", INT16, 4, SCORES_OFFSET);
+    set_entry(1, "deltas", INT8, 8, DELTAS_OFFSET);
+    for(int i = 0; i < 4*4*8; i++)
+        ((int16_t*)(file_data + SCORES_OFFSET))[i] = i - 64;
+    for(int i = 0; i < 8*4*8; i++)
+        ((int8_t*)(file_data + DELTAS_OFFSET))[i] = i % 64 - 32;
+}
+
+static void write_file(size_t length) {
+    FILE* f = fopen(PATH, "wb");
+    assert(f != NULL);
+    assert(fwrite(file_data, 1, length, f) == length);
+    fclose(f);
+}
+
+/* Whether the file built so far, cut to length bytes, opens */
+static bool opens(size_t length) {
+    tensor_file file = {0};
+    write_file(length);
+    bool ok = tensor_file_open(PATH, &file, 0);
+    tensor_file_close(&file);
+    return ok;
+}
+
+int main() {
+    // Read back
+    build();
+    write_file(sizeof(file_data));
+    tensor_file file = {0};
+    assert(tensor_file_open(PATH, &file, BLOB_MAP_KEEP));
+    assert(file.count == 2);
+    assert(tensor_file_find(&file, "missing") == NULL);
+    const tensor_entry* entry = tensor_file_find(&file, "deltas");
+    assert(entry != NULL && entry->exp_offset == 11);
+
+    blob scores = {0}, deltas = {0};
+    assert(tensor_file_describe(&file, "scores", &scores));
+    assert(tensor_file_describe(&file, "deltas", &deltas));
+    assert(scores.type == INT16 && scores.n == 1 && scores.c == 4
+           && scores.h == 4 && scores.w == 8);
+    assert(deltas.type == INT8 && deltas.c == 8);
+    assert(memcmp(scores.data, file_data + SCORES_OFFSET, 4*4*8*2) == 0);
+    assert(memcmp(deltas.data, file_data + DELTAS_OFFSET, 8*4*8) == 0);
+    assert(!tensor_file_describe(&file, "missing", &scores));
+
+    // Shape and type checks
+    blob other = deltas;
+    assert(tensor_file_get(&file, "deltas", &other));
+    assert(other.data == deltas.data);
+    other.h = 8;
+    assert(!tensor_file_get(&file, "deltas", &other));
+    other = deltas;
+    other.type = UINT8;
+    assert(!tensor_file_get(&file, "deltas", &other));
+
+    // Kept mapping
+    void* addr = file.mapping.addr;
+    assert(tensor_file_open(PATH, &file, BLOB_MAP_KEEP));
+    assert(file.mapping.addr == addr && file.count == 2);
+    tensor_file_close(&file);
+    assert(file.mapping.addr == NULL && file.count == 0);
+    printf("tensor_file: 2 tensors read back\n");
+
+    // Malformed files
+    assert(!opens(8));
+    assert(!opens(sizeof(file_data) - 1));
+    file_data[0] = 'X';
+    assert(!opens(sizeof(file_data)));
+    build();
+    set_entry(1, "deltas", INT8, 8, DELTAS_OFFSET + 8);
+    assert(!opens(sizeof(file_data)));
+    build();
+    set_entry(1, "deltas", INT8, 4, DELTAS_OFFSET);
+    ((tensor_entry*)(file_data + 16 + sizeof(tensor_entry)))->c = 8;
+    assert(!opens(sizeof(file_data)));
+    build();
+    ((tensor_entry*)(file_data + 16 + sizeof(tensor_entry)))->dtype = 9;
+    assert(!opens(sizeof(file_data)));
+    build();
+    assert(opens(sizeof(file_data)));
+    printf("tensor_file: malformed files rejected\n");
+
+    remove(PATH);
+    return 0;
+}
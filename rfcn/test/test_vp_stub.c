@@ -0,0 +1,109 @@
+/*
+ * Checks vp_stub on tensor files built here
+ *   - Frames cycle through the files in order, each copied into one of two
+ *     fixed buffer sets, and stop after num_frames.
+ *   - A frame held by the consumer is not overwritten while the stub writes
+ *     the next one.
+ *   - At 200 frames/s, 20 frames take at least 95 ms.
+ *   - A tensor of another shape in a later file stops the stub.
+ */
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "vp_stub.h"
+
+#define NUM_FILES 3
+#define PAYLOAD_OFFSET 128
+
+static char paths[NUM_FILES + 1][64];
+static const char* path_list[NUM_FILES + 1];
+static const char* const names[] = {"id"};
+
+/* One INT32 1x1x1xwidth tensor "id", filled with id */
+static void write_file(const char* path, int32_t id, int width) {
+    uint8_t data[PAYLOAD_OFFSET + 32 * sizeof(int32_t)] = {0};
+    uint16_t version = TENSOR_FILE_VERSION, count = 1;
+    memcpy(data, TENSOR_FILE_MAGIC, 4);
+    memcpy(data + 4, &version, sizeof(version));
+    memcpy(data + 6, &count, sizeof(count));
+    tensor_entry entry = {.name = "id", .dtype = INT32, .n = 1, .c = 1,
+                          .h = 1, .w = width, .offset = PAYLOAD_OFFSET,
+                          .length = width * sizeof(int32_t)};
+    memcpy(data + 16, &entry, sizeof(entry));
+    for(int i = 0; i < width; i++)
+        memcpy(data + PAYLOAD_OFFSET + i * sizeof(int32_t), &id,
+               sizeof(int32_t));
+    FILE* f = fopen(path, "wb");
+    assert(f != NULL);
+    size_t length = PAYLOAD_OFFSET + width * sizeof(int32_t);
+    assert(fwrite(data, 1, length, f) == length);
+    fclose(f);
+}
+
+static void check_frame(const vp_frame* frame, int32_t id) {
+    assert(frame != NULL);
+    assert(frame->outputs[0].w == 16);
+    for(int i = 0; i < 16; i++)
+        assert(((int32_t*)frame->outputs[0].data)[i] == id);
+}
+
+int main() {
+    for(int i = 0; i <= NUM_FILES; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/tmp/test_vp_stub_%d", i);
+        write_file(paths[i], i, i < NUM_FILES ? 16 : 32);
+        path_list[i] = paths[i];
+    }
+
+    // Cycle, double buffering, held frames untouched
+    vp_stub vp = {0};
+    const struct timespec pause = {0, 500000};
+    assert(vp_stub_start(&vp, path_list, NUM_FILES, names, 1, 0.0, 10));
+    void* buffers[2] = {vp.buffers[0].outputs[0].data,
+                        vp.buffers[1].outputs[0].data};
+    for(size_t f = 0; f < 10; f++) {
+        const vp_frame* frame = vp_stub_wait(&vp);
+        assert(frame->index == f);
+        assert(frame->outputs[0].data == buffers[f % 2]);
+        check_frame(frame, f % NUM_FILES);
+        nanosleep(&pause, NULL);
+        check_frame(frame, f % NUM_FILES);
+        vp_stub_release(&vp);
+    }
+    assert(vp_stub_wait(&vp) == NULL);
+    assert(!vp_stub_failed(&vp));
+    vp_stub_stop(&vp);
+    printf("vp_stub: 10 frames cycled through 2 buffers\n");
+
+    // Pacing
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(vp_stub_start(&vp, path_list, 1, names, 1, 200.0, 20));
+    const vp_frame* frame;
+    size_t count = 0;
+    while((frame = vp_stub_wait(&vp)) != NULL) {
+        check_frame(frame, 0);
+        vp_stub_release(&vp);
+        count++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double ms = (stop.tv_sec - start.tv_sec) * 1e3
+              + (stop.tv_nsec - start.tv_nsec) / 1e6;
+    assert(count == 20 && ms >= 95.0);
+    vp_stub_stop(&vp);
+    printf("vp_stub: 20 frames at 200 frames/s in %.1f ms\n", ms);
+
+    // Shape change
+    assert(vp_stub_start(&vp, path_list + NUM_FILES - 1, 2, names, 1, 0.0,
+                         0));
+    check_frame(vp_stub_wait(&vp), NUM_FILES - 1);
+    vp_stub_release(&vp);
+    assert(vp_stub_wait(&vp) == NULL);
+    assert(vp_stub_failed(&vp));
+    vp_stub_stop(&vp);
+    printf("vp_stub: a shape change stops the stub\n");
+
+    for(int i = 0; i <= NUM_FILES; i++)
+        remove(paths[i]);
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <malloc.h>
+#include "vp_stub.h"
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+static size_t blob_size(const blob* b) {
+    return (size_t)b->n * b->c * b->h * b->w * _sizeof(b->type);
+}
+
+/* Copies the tensors of the file at path into frame */
+static bool load_frame(vp_stub* vp, const char* path, vp_frame* frame) {
+    if(!tensor_file_open(path, &vp->file, BLOB_MAP_WILLNEED | BLOB_MAP_KEEP))
+        return false;
+    for(size_t i = 0; i < vp->num_outputs; i++) {
+        blob source = frame->outputs[i];
+        if(!tensor_file_get(&vp->file, vp->names[i], &source))
+            return false;
+        memcpy(frame->outputs[i].data, source.data, blob_size(&source));
+    }
+    return true;
+}
+
+static void* produce_frames(void* arg) {
+    vp_stub* vp = arg;
+    uint64_t period = vp->fps > 0.0 ? (uint64_t)(1e9 / vp->fps) : 0;
+    uint64_t start = now_ns();
+    for(size_t f = 0; vp->num_frames == 0 || f < vp->num_frames; f++) {
+        // Frame f is due at start + f * period
+        uint64_t due = start + f * period;
+        uint64_t now = now_ns();
+        if(now < due) {
+            struct timespec t = {due / 1000000000u, due % 1000000000u};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+        }
+
+        uint64_t stall = now_ns();
+        pthread_mutex_lock(&vp->lock);
+        while(vp->num_written - vp->num_released == 2 && !vp->stopping)
+            pthread_cond_wait(&vp->freed, &vp->lock);
+        bool stopping = vp->stopping;
+        pthread_mutex_unlock(&vp->lock);
+        if(stopping)
+            break;
+        stall = now_ns() - stall;
+
+        // The buffer is free, so it is only touched here until it is ready
+        vp_frame* frame = &vp->buffers[f % 2];
+        frame->index = f;
+        bool ok = load_frame(vp, vp->paths[f % vp->num_paths], frame);
+
+        pthread_mutex_lock(&vp->lock);
+        vp->stats.stall_ns += stall;
+        if(period != 0 && now_ns() > due + period)
+            vp->stats.num_late++;
+        if(ok)
+            vp->num_written++;
+        else
+            vp->failed = true;
+        pthread_cond_signal(&vp->ready);
+        pthread_mutex_unlock(&vp->lock);
+        if(!ok)
+            break;
+    }
+    pthread_mutex_lock(&vp->lock);
+    vp->stopping = true;
+    pthread_cond_signal(&vp->ready);
+    pthread_mutex_unlock(&vp->lock);
+    return NULL;
+}
+
+bool vp_stub_start(vp_stub* vp, const char* const* paths, size_t num_paths,
+                   const char* const* names, size_t num_outputs, double fps,
+                   size_t num_frames) {
+    assert(!vp->running);
+    assert(num_paths >= 1);
+    assert(num_outputs >= 1 && num_outputs <= VP_STUB_MAX_OUTPUTS);
+    vp->paths = paths;
+    vp->num_paths = num_paths;
+    vp->names = names;
+    vp->num_outputs = num_outputs;
+    vp->fps = fps;
+    vp->num_frames = num_frames;
+    vp->num_written = vp->num_taken = vp->num_released = 0;
+    vp->failed = vp->stopping = false;
+    memset(&vp->stats, 0, sizeof(vp_stub_stats));
+
+    // Both buffer sets in one block, each tensor 64-byte aligned
+    size_t size = 0;
+    if(!tensor_file_open(paths[0], &vp->file, BLOB_MAP_KEEP))
+        return false;
+    for(size_t i = 0; i < num_outputs; i++) {
+        blob* output = &vp->buffers[0].outputs[i];
+        if(!tensor_file_describe(&vp->file, names[i], output)) {
+            tensor_file_close(&vp->file);
+            return false;
+        }
+        vp->buffers[1].outputs[i] = *output;
+        size += (blob_size(output) + 63) & ~(size_t)63;
+    }
+    if((vp->memory = memalign(64, 2 * size)) == NULL) {
+        fprintf(stderr, "ERROR: Ran out of memory.\n");
+        tensor_file_close(&vp->file);
+        return false;
+    }
+    uint8_t* data = vp->memory;
+    for(int b = 0; b < 2; b++) {
+        for(size_t i = 0; i < num_outputs; i++) {
+            blob* output = &vp->buffers[b].outputs[i];
+            output->data = data;
+            data += (blob_size(output) + 63) & ~(size_t)63;
+        }
+    }
+
+    pthread_mutex_init(&vp->lock, NULL);
+    pthread_cond_init(&vp->ready, NULL);
+    pthread_cond_init(&vp->freed, NULL);
+    if(pthread_create(&vp->thread, NULL, produce_frames, vp) != 0) {
+        fprintf(stderr, "ERROR: Cannot start the VP stub thread\n");
+        pthread_cond_destroy(&vp->freed);
+        pthread_cond_destroy(&vp->ready);
+        pthread_mutex_destroy(&vp->lock);
+        tensor_file_close(&vp->file);
+        free(vp->memory);
+        vp->memory = NULL;
+        return false;
+    }
+    vp->running = true;
+    return true;
+}
+
+const vp_frame* vp_stub_wait(vp_stub* vp) {
+    assert(vp->running);
+    assert(vp->num_taken == vp->num_released);
+    uint64_t start = now_ns();
+    pthread_mutex_lock(&vp->lock);
+    while(vp->num_written == vp->num_taken && !vp->stopping)
+        pthread_cond_wait(&vp->ready, &vp->lock);
+    const vp_frame* frame = NULL;
+    if(vp->num_written > vp->num_taken) {
+        frame = &vp->buffers[vp->num_taken % 2];
+        vp->num_taken++;
+        vp->stats.num_frames++;
+    }
+    vp->stats.wait_ns += now_ns() - start;
+    pthread_mutex_unlock(&vp->lock);
+    return frame;
+}
+
+void vp_stub_release(vp_stub* vp) {
+    assert(vp->num_taken == vp->num_released + 1);
+    pthread_mutex_lock(&vp->lock);
+    vp->num_released++;
+    pthread_cond_signal(&vp->freed);
+    pthread_mutex_unlock(&vp->lock);
+}
+
+bool vp_stub_failed(vp_stub* vp) {
+    pthread_mutex_lock(&vp->lock);
+    bool failed = vp->failed;
+    pthread_mutex_unlock(&vp->lock);
+    return failed;
+}
+
+void vp_stub_get_stats(vp_stub* vp, vp_stub_stats* stats) {
+    pthread_mutex_lock(&vp->lock);
+    *stats = vp->stats;
+    pthread_mutex_unlock(&vp->lock);
+}
+
+void vp_stub_stop(vp_stub* vp) {
+    if(!vp->running)
+        return;
+    pthread_mutex_lock(&vp->lock);
+    vp->stopping = true;
+    pthread_cond_signal(&vp->freed);
+    pthread_mutex_unlock(&vp->lock);
+    pthread_join(vp->thread, NULL);
+    tensor_file_close(&vp->file);
+    free(vp->memory);
+    vp->memory = NULL;
+    pthread_cond_destroy(&vp->freed);
+    pthread_cond_destroy(&vp->ready);
+    pthread_mutex_destroy(&vp->lock);
+    vp->running = false;
+}
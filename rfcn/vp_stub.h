@@ -0,0 +1,83 @@
+/*
+ * Stand-in for the vector processor (VP) in the continuous loop of main.c
+ *   - The VP writes its outputs into two fixed sets of buffers in turn:
+ *     while the ARM side processes frame t from one, frame t+1 is written
+ *     into the other. The buffers are allocated once, from the shapes of
+ *     the first file, so blob data only ever points at one of two places.
+ *   - The stub thread replays tensor files (see tensor_file.h) in a cycle at
+ *     a fixed frame rate, copying the named tensors into the free set, as
+ *     the VP DMA would. When neither set is free, i.e. the ARM side still
+ *     holds one and the other is ready but not yet taken, the stub stalls
+ *     rather than dropping the frame, and the stall is counted.
+ */
+#ifndef VP_STUB_H_
+#define VP_STUB_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "tensor_file.h"
+
+/* Maximum number of tensors per frame */
+#define VP_STUB_MAX_OUTPUTS 8
+
+typedef struct vp_frame_t {
+    blob outputs[VP_STUB_MAX_OUTPUTS]; // in the order of the names
+    size_t index;                      // frame number, from 0
+} vp_frame;
+
+typedef struct vp_stub_stats_t {
+    size_t num_frames; // frames handed out so far
+    size_t num_late;   // frames written after their slot, as neither buffer
+                       // was free in time
+    uint64_t stall_ns; // time the stub waited for a free buffer
+    uint64_t wait_ns;  // time vp_stub_wait() waited for the stub
+} vp_stub_stats;
+
+/* Zero-initialize before vp_stub_start(). */
+typedef struct vp_stub_t {
+    const char* const* paths;
+    size_t num_paths;
+    const char* const* names;
+    size_t num_outputs;
+    double fps;
+    size_t num_frames;
+    vp_frame buffers[2];
+    void* memory;
+    tensor_file file;
+    size_t num_written, num_taken, num_released;
+    bool failed, stopping;
+    vp_stub_stats stats;
+    pthread_mutex_t lock;
+    pthread_cond_t ready, freed;
+    pthread_t thread;
+    bool running;
+} vp_stub;
+
+/* Allocates the two buffer sets for the num_outputs tensors names, with the
+ * types and shapes they have in paths[0], and starts replaying the
+ * num_paths files at paths in a cycle, at fps frames per second (0 for as
+ * fast as buffers free up), for num_frames frames (0 for no end). paths and
+ * names must outlive the stub. Returns false, with a message on stderr, if
+ * the first file or a tensor is missing or the thread cannot start. */
+bool vp_stub_start(vp_stub* vp, const char* const* paths, size_t num_paths,
+                   const char* const* names, size_t num_outputs, double fps,
+                   size_t num_frames);
+
+/* The outputs of the next frame, i.e. VP_output_ready. Returns NULL after
+ * num_frames frames, or when a file fails to load (reported on stderr, and
+ * by vp_stub_failed()). */
+const vp_frame* vp_stub_wait(vp_stub* vp);
+
+/* Hands the buffers of the last vp_stub_wait() back to the stub. */
+void vp_stub_release(vp_stub* vp);
+
+/* Whether the stub stopped on a file that failed to load */
+bool vp_stub_failed(vp_stub* vp);
+
+void vp_stub_get_stats(vp_stub* vp, vp_stub_stats* stats);
+
+/* Stops the stub and frees the buffers. */
+void vp_stub_stop(vp_stub* vp);
+
+#endif
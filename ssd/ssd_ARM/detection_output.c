@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "vp_interface.h"
+#include "detection_output.h"
+#include "iou.h"
+#include "trace.h"
+
+/* ----------------------------------------------------------------------
+--------------------------- Utility Macros ------------------------------
+---------------------------------------------------------------------- */
+#define MIN(a, b) ({ __typeof__ (a) _a = (a); \
+                    __typeof__ (b) _b = (b); \
+                    _a < _b ? _a : _b; })
+#define MAX(a, b) ({ __typeof__ (a) _a = (a); \
+                    __typeof__ (b) _b = (b); \
+                    _a > _b ? _a : _b; })
+#define CLAMPF(num, max, min) (fmaxf(fminf(num, max), min))
+
+// A (class, prior) pair that passed the confidence threshold
+typedef struct candidate {
+    float score;
+    int32_t prior;
+    int32_t label;
+} candidate_t;
+
+struct ssd_detection {
+    ssd_detection_config_t config;
+    int64_t nms_thresh_q; // fixed-point nms_threshold for iou_exceeds()
+    size_t num_priors;
+
+    // Prior table in image pixels, as centers and sizes
+    float* prior_cx;
+    float* prior_cy;
+    float* prior_w;
+    float* prior_h;
+
+    // Workspace
+    size_t* counts;          // candidates per class
+    candidate_t* candidates; // num_classes x num_priors, class-major
+    candidate_t* detections; // (num_classes - 1) x top_k survivors of per-class NMS
+    int16_t* boxes;          // num_priors x 4, decoded on first use in a frame
+    int32_t* areas;          // num_priors
+    uint32_t* decoded;       // frame in which each prior was last decoded
+    uint32_t frame;
+    int32_t* kept;           // top_k priors kept by the current class' NMS
+};
+
+// Descending score, then ascending class and prior, so the output does not depend on the sort
+static int compare_candidates(const void* a, const void* b) {
+    const candidate_t* x = a;
+    const candidate_t* y = b;
+    if(x->score != y->score)
+        return x->score > y->score ? -1 : 1;
+    if(x->label != y->label)
+        return x->label < y->label ? -1 : 1;
+    return (x->prior > y->prior) - (x->prior < y->prior);
+}
+
+static inline void swap_candidates(candidate_t* a, candidate_t* b) {
+    candidate_t temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+// Moves the k best of n candidates to the front, sorted, with quickselect on the rest; returns MIN(k, n)
+static size_t select_top_k(candidate_t* candidates, size_t n, size_t k) {
+    if(k < n) {
+        // Partition around the middle element until it lands at k - 1
+        size_t lo = 0;
+        size_t hi = n - 1;
+        while(lo < hi) {
+            swap_candidates(&candidates[lo + (hi - lo) / 2], &candidates[hi]);
+            size_t store = lo;
+            for(size_t i = lo; i < hi; i++)
+                if(compare_candidates(&candidates[i], &candidates[hi]) < 0)
+                    swap_candidates(&candidates[i], &candidates[store++]);
+            swap_candidates(&candidates[store], &candidates[hi]);
+            if(store == k - 1)
+                break;
+            else if(store < k - 1)
+                lo = store + 1;
+            else
+                hi = store - 1;
+        }
+        n = k;
+    }
+    qsort(candidates, n, sizeof(candidate_t), compare_candidates);
+    return n;
+}
+
+ssd_detection_t* ssd_detection_create(const ssd_detection_config_t* config, vp_tensor_float32_input priors) {
+    // Safety checks
+    assert(priors->w == 4 && priors->h > 0);
+    assert(config->num_classes > 1 && config->background_id < config->num_classes);
+    assert(config->top_k > 0 && config->keep_top_k > 0);
+
+    ssd_detection_t* detection = calloc(1, sizeof(ssd_detection_t));
+    if(detection == NULL)
+        return NULL;
+    size_t num_priors = priors->h;
+    size_t num_classes = config->num_classes;
+    size_t top_k = MIN(config->top_k, num_priors);
+    detection->config = *config;
+    detection->config.top_k = top_k;
+    detection->nms_thresh_q = IOU_THRESH_Q(config->nms_threshold);
+    detection->num_priors = num_priors;
+    detection->prior_cx = malloc(num_priors * sizeof(float));
+    detection->prior_cy = malloc(num_priors * sizeof(float));
+    detection->prior_w = malloc(num_priors * sizeof(float));
+    detection->prior_h = malloc(num_priors * sizeof(float));
+    detection->counts = malloc(num_classes * sizeof(size_t));
+    detection->candidates = malloc(num_classes * num_priors * sizeof(candidate_t));
+    detection->detections = malloc((num_classes - 1) * top_k * sizeof(candidate_t));
+    detection->boxes = malloc(num_priors * 4 * sizeof(int16_t));
+    detection->areas = malloc(num_priors * sizeof(int32_t));
+    detection->decoded = calloc(num_priors, sizeof(uint32_t));
+    detection->kept = malloc(top_k * sizeof(int32_t));
+    if(!detection->prior_cx || !detection->prior_cy || !detection->prior_w || !detection->prior_h
+       || !detection->counts || !detection->candidates || !detection->detections || !detection->boxes
+       || !detection->areas || !detection->decoded || !detection->kept) {
+        perror("Could not allocate the detection output workspace");
+        ssd_detection_destroy(detection);
+        return NULL;
+    }
+
+    // Prior table
+    for(size_t p = 0; p < num_priors; p++) {
+        const float* prior = &priors->data[p*4];
+        detection->prior_cx[p] = 0.5f * (prior[0] + prior[2]) * config->image_w;
+        detection->prior_cy[p] = 0.5f * (prior[1] + prior[3]) * config->image_h;
+        detection->prior_w[p] = (prior[2] - prior[0]) * config->image_w;
+        detection->prior_h[p] = (prior[3] - prior[1]) * config->image_h;
+    }
+    return detection;
+}
+
+void ssd_detection_destroy(ssd_detection_t* detection) {
+    if(detection == NULL)
+        return;
+    free(detection->prior_cx);
+    free(detection->prior_cy);
+    free(detection->prior_w);
+    free(detection->prior_h);
+    free(detection->counts);
+    free(detection->candidates);
+    free(detection->detections);
+    free(detection->boxes);
+    free(detection->areas);
+    free(detection->decoded);
+    free(detection->kept);
+    free(detection);
+}
+
+// Decodes prior p against its location offsets (Caffe's CENTER_SIZE coding), clipped to the image
+static void decode_box(const ssd_detection_t* detection, const int16_t* restrict offsets, float scale, size_t p,
+                       int16_t* restrict box) {
+    const float* variance = detection->config.variance;
+    float cx = detection->prior_cx[p] + offsets[0] * scale * variance[0] * detection->prior_w[p];
+    float cy = detection->prior_cy[p] + offsets[1] * scale * variance[1] * detection->prior_h[p];
+    float w = detection->prior_w[p] * expf(offsets[2] * scale * variance[2]);
+    float h = detection->prior_h[p] * expf(offsets[3] * scale * variance[3]);
+    box[0] = lrintf(CLAMPF(cx - 0.5f * w, detection->config.image_w, 0.0f));
+    box[1] = lrintf(CLAMPF(cy - 0.5f * h, detection->config.image_h, 0.0f));
+    box[2] = lrintf(CLAMPF(cx + 0.5f * w, detection->config.image_w, 0.0f));
+    box[3] = lrintf(CLAMPF(cy + 0.5f * h, detection->config.image_h, 0.0f));
+}
+
+vp_tensor_fix16_t* ssd_detection_forward(ssd_detection_t* detection, vp_tensor_fix16_input loc, vp_tensor_float32_input conf,
+                                         vp_tensor_float32_t** scores) {
+    const ssd_detection_config_t* config = &detection->config;
+    const size_t num_priors = detection->num_priors;
+    const size_t num_classes = config->num_classes;
+
+    // Safety checks
+    assert(loc->h == num_priors && loc->w == 4);
+    assert(conf->h == num_priors && conf->w == num_classes);
+
+    // Confidence threshold: one pass over the raw confidences, nothing decoded yet
+    size_t* counts = detection->counts;
+    candidate_t* candidates = detection->candidates;
+    memset(counts, 0, num_classes * sizeof(size_t));
+    for(size_t p = 0; p < num_priors; p++) {
+        const float* confidences = &conf->data[p * num_classes];
+        for(size_t c = 0; c < num_classes; c++) {
+            if(confidences[c] <= config->confidence_threshold || c == config->background_id)
+                continue;
+            candidate_t* candidate = &candidates[c * num_priors + counts[c]++];
+            candidate->score = confidences[c];
+            candidate->prior = p;
+            candidate->label = c;
+        }
+    }
+
+    // Boxes are decoded at most once per frame, and only for the top-K candidates of some class
+    const float scale = ldexpf(1.0f, -(int)loc->exp_offset);
+    int16_t* boxes = detection->boxes;
+    int32_t* areas = detection->areas;
+    uint32_t* decoded = detection->decoded;
+    if(++detection->frame == 0) {
+        memset(decoded, 0, num_priors * sizeof(uint32_t));
+        detection->frame = 1;
+    }
+    const uint32_t frame = detection->frame;
+
+    // Per-class top-K and NMS
+    candidate_t* detections = detection->detections;
+    int32_t* kept = detection->kept;
+    size_t num_detections = 0;
+    for(size_t c = 0; c < num_classes; c++) {
+        if(counts[c] == 0)
+            continue;
+        candidate_t* ranked = &candidates[c * num_priors];
+        size_t num_ranked = select_top_k(ranked, counts[c], config->top_k);
+        size_t num_kept = 0;
+        for(size_t i = 0; i < num_ranked; i++) {
+            int32_t p = ranked[i].prior;
+            int16_t* box = &boxes[p*4];
+            if(decoded[p] != frame) {
+                decode_box(detection, &loc->data[p*4], scale, p, box);
+                areas[p] = (int32_t)(box[2] - box[0]) * (box[3] - box[1]);
+                decoded[p] = frame;
+            }
+            // Greedy NMS: compare against the boxes this class has kept so far
+            int suppressed = 0;
+            for(size_t k = 0; k < num_kept && !suppressed; k++) {
+                const int16_t* other = &boxes[kept[k]*4];
+                int32_t x1 = MAX(box[0], other[0]);
+                int32_t y1 = MAX(box[1], other[1]);
+                int32_t x2 = MIN(box[2], other[2]);
+                int32_t y2 = MIN(box[3], other[3]);
+                int32_t i_area = MAX(x2 - x1, 0) * MAX(y2 - y1, 0);
+                int32_t u_area = areas[p] + areas[kept[k]] - i_area;
+                suppressed = iou_exceeds(i_area, u_area, detection->nms_thresh_q);
+                if(suppressed)
+                    TRACE(TRACE_NMS_DISCARD, p, kept[k], 0, 0);
+            }
+            if(suppressed)
+                continue;
+            kept[num_kept++] = p;
+            detections[num_detections++] = ranked[i];
+        }
+    }
+
+    // Keep the best keep_top_k detections over all classes
+    num_detections = select_top_k(detections, num_detections, config->keep_top_k);
+    vp_tensor_fix16_t* output = vp_tensor_fix16_malloc(1, 1, num_detections, 5, 0);
+    if(output == NULL)
+        return NULL;
+    vp_tensor_float32_t* output_scores = NULL;
+    if(scores != NULL) {
+        output_scores = vp_tensor_float32_malloc(1, 1, 1, num_detections);
+        if(output_scores == NULL) {
+            vp_tensor_free(output);
+            return NULL;
+        }
+        *scores = output_scores;
+    }
+    for(size_t i = 0; i < num_detections; i++) {
+        const int16_t* box = &boxes[detections[i].prior*4];
+        TRACE(TRACE_NMS_KEEP, i, detections[i].prior, 0, 0);
+        output->data[i*5+0] = box[0];
+        output->data[i*5+1] = box[1];
+        output->data[i*5+2] = box[2];
+        output->data[i*5+3] = box[3];
+        output->data[i*5+4] = detections[i].label;
+        if(output_scores != NULL)
+            output_scores->data[i] = detections[i].score;
+    }
+    return output;
+}
+
+/* -----------------------------------------------------------------------
+------------------------------- Testing ----------------------------------
+----------------------------------------------------------------------- */
+#ifdef DETECTION_OUTPUT_MAIN
+// Decode everything, sort each class fully and run float NMS, for comparison
+static size_t reference_forward(const ssd_detection_t* detection, vp_tensor_fix16_input loc, vp_tensor_float32_input conf,
+                                candidate_t* out) {
+    const ssd_detection_config_t* config = &detection->config;
+    size_t num_priors = detection->num_priors;
+    float scale = ldexpf(1.0f, -(int)loc->exp_offset);
+    int16_t* boxes = malloc(num_priors * 4 * sizeof(int16_t));
+    candidate_t* ranked = malloc(num_priors * sizeof(candidate_t));
+    int32_t* kept = malloc(num_priors * sizeof(int32_t));
+    for(size_t p = 0; p < num_priors; p++)
+        decode_box(detection, &loc->data[p*4], scale, p, &boxes[p*4]);
+    size_t num_out = 0;
+    for(size_t c = 0; c < config->num_classes; c++) {
+        if(c == config->background_id)
+            continue;
+        size_t n = 0;
+        for(size_t p = 0; p < num_priors; p++) {
+            float score = conf->data[p * config->num_classes + c];
+            if(score > config->confidence_threshold)
+                ranked[n++] = (candidate_t){.score = score, .prior = p, .label = c};
+        }
+        qsort(ranked, n, sizeof(candidate_t), compare_candidates);
+        n = MIN(n, config->top_k);
+        size_t num_kept = 0;
+        for(size_t i = 0; i < n; i++) {
+            const int16_t* a = &boxes[ranked[i].prior*4];
+            int suppressed = 0;
+            for(size_t k = 0; k < num_kept && !suppressed; k++) {
+                const int16_t* b = &boxes[kept[k]*4];
+                float i_area = MAX(MIN(a[2], b[2]) - MAX(a[0], b[0]), 0) * MAX(MIN(a[3], b[3]) - MAX(a[1], b[1]), 0);
+                float u_area = (a[2] - a[0]) * (a[3] - a[1]) + (b[2] - b[0]) * (b[3] - b[1]) - i_area;
+                suppressed = u_area > 0 && i_area / u_area > config->nms_threshold;
+            }
+            if(!suppressed) {
+                kept[num_kept++] = ranked[i].prior;
+                out[num_out++] = ranked[i];
+            }
+        }
+    }
+    qsort(out, num_out, sizeof(candidate_t), compare_candidates);
+    free(boxes);
+    free(ranked);
+    free(kept);
+    return MIN(num_out, config->keep_top_k);
+}
+
+int main() {
+    // 4 x 4 grid of priors with 3 sizes each, 4 classes
+    #define GRID 4
+    #define SIZES 3
+    #define NUM_PRIORS (GRID * GRID * SIZES)
+    #define NUM_CLASSES 4
+    float prior_data[NUM_PRIORS * 4];
+    for(size_t i = 0; i < GRID; i++) {
+        for(size_t j = 0; j < GRID; j++) {
+            for(size_t s = 0; s < SIZES; s++) {
+                float* prior = &prior_data[((i*GRID + j)*SIZES + s)*4];
+                float cx = (j + 0.5f) / GRID;
+                float cy = (i + 0.5f) / GRID;
+                float half = 0.1f + 0.01f * s;
+                prior[0] = cx - half;
+                prior[1] = cy - half;
+                prior[2] = cx + half;
+                prior[3] = cy + half;
+            }
+        }
+    }
+    vp_tensor_float32_t* priors = vp_tensor_float32_calloc(1, 1, NUM_PRIORS, 4, prior_data);
+    ssd_detection_config_t config = SSD_DETECTION_DEFAULT_CONFIG;
+    config.num_classes = NUM_CLASSES;
+    config.confidence_threshold = 0.3f;
+    config.top_k = 20;
+    config.keep_top_k = 25;
+    ssd_detection_t* detection = ssd_detection_create(&config, priors);
+    assert(detection != NULL);
+
+    // Zero offsets decode to the priors themselves; overlapping priors of the same class are suppressed,
+    // those of different classes are not, and the background class is never reported
+    vp_tensor_fix16_t* loc = vp_tensor_fix16_calloc(1, 1, NUM_PRIORS, 4, 8, NULL);
+    vp_tensor_float32_t* conf = vp_tensor_float32_calloc(1, 1, NUM_PRIORS, NUM_CLASSES, NULL);
+    conf->data[0*NUM_CLASSES + 1] = 0.9f; // prior 0 and prior 1 share a center, IoU = (60 / 66)^2
+    conf->data[1*NUM_CLASSES + 1] = 0.8f;
+    conf->data[1*NUM_CLASSES + 2] = 0.7f;
+    conf->data[5*NUM_CLASSES + 0] = 0.99f;
+    conf->data[6*NUM_CLASSES + 3] = 0.2f; // below the confidence threshold
+    vp_tensor_float32_t* scores = NULL;
+    vp_tensor_fix16_t* output = ssd_detection_forward(detection, loc, conf, &scores);
+    printf("\nWe have %zd detections\n\n", output->h);
+    for(size_t i = 0; i < output->h; i++)
+        printf("Dims: (%d, %d), (%d, %d).   Class_ID = %d, score = %f\n", output->data[i*5+0], output->data[i*5+1],
+               output->data[i*5+2], output->data[i*5+3], output->data[i*5+4], scores->data[i]);
+    assert(output->h == 2);
+    assert(output->data[4] == 1 && scores->data[0] == 0.9f);
+    assert(output->data[9] == 2 && scores->data[1] == 0.7f);
+    assert(abs(output->data[0] - (int)lrintf(prior_data[0] * config.image_w)) <= 1);
+    vp_tensor_free(output);
+    vp_tensor_free(scores);
+    vp_tensor_free(loc);
+    vp_tensor_free(conf);
+
+    // Random frames must match decoding everything and sorting each class
+    srand(1);
+    candidate_t reference[NUM_CLASSES * NUM_PRIORS];
+    for(size_t frame = 0; frame < 200; frame++) {
+        loc = vp_tensor_fix16_malloc(1, 1, NUM_PRIORS, 4, 8);
+        conf = vp_tensor_float32_malloc(1, 1, NUM_PRIORS, NUM_CLASSES);
+        for(size_t i = 0; i < NUM_PRIORS * 4; i++)
+            loc->data[i] = rand() % 512 - 256;
+        for(size_t i = 0; i < NUM_PRIORS * NUM_CLASSES; i++)
+            conf->data[i] = (float)rand() / RAND_MAX;
+        output = ssd_detection_forward(detection, loc, conf, &scores);
+        size_t num_reference = reference_forward(detection, loc, conf, reference);
+        assert(output->h == num_reference);
+        for(size_t i = 0; i < num_reference; i++) {
+            const int16_t* box = &output->data[i*5];
+            int16_t expected[4];
+            decode_box(detection, &loc->data[reference[i].prior*4], ldexpf(1.0f, -8), reference[i].prior, expected);
+            assert(memcmp(box, expected, 4 * sizeof(int16_t)) == 0);
+            assert(box[4] == reference[i].label && scores->data[i] == reference[i].score);
+        }
+        vp_tensor_free(output);
+        vp_tensor_free(scores);
+        vp_tensor_free(loc);
+        vp_tensor_free(conf);
+    }
+
+    trace_dump(stdout);
+    ssd_detection_destroy(detection);
+    vp_tensor_free(priors);
+    return 0;
+}
+#endif
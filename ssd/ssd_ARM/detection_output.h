@@ -0,0 +1,45 @@
+#ifndef DETECTION_OUTPUT_H_
+#define DETECTION_OUTPUT_H_
+#include "vp_interface.h"
+
+// Parameters of the DetectionOutput stage, as in Caffe's detection_output_param
+typedef struct ssd_detection_config {
+    size_t num_classes;         // including the background class
+    size_t background_id;       // class that is never detected
+    float confidence_threshold; // confidences at or below are dropped before any box is decoded
+    size_t top_k;               // candidates per class that go into NMS
+    float nms_threshold;        // IoU above which a lower-scoring box of the same class is suppressed
+    size_t keep_top_k;          // detections per frame, over all classes
+    float variance[4];          // prior variances of (cx, cy, w, h)
+    int16_t image_w, image_h;   // decoded boxes are scaled to and clipped at the image size
+} ssd_detection_config_t;
+
+// SSD300 on PASCAL VOC
+#define SSD_DETECTION_DEFAULT_CONFIG {                                          \
+    .num_classes = 21, .background_id = 0, .confidence_threshold = 0.01f,      \
+    .top_k = 400, .nms_threshold = 0.45f, .keep_top_k = 200,                   \
+    .variance = {0.1f, 0.1f, 0.2f, 0.2f}, .image_w = 300, .image_h = 300 }
+
+// Prior table and per-frame workspace, allocated once by ssd_detection_create()
+typedef struct ssd_detection ssd_detection_t;
+
+// priors - (1, 1, num_priors, 4) tensor of normalized [xmin, ymin, xmax, ymax] prior boxes
+ssd_detection_t* ssd_detection_create(const ssd_detection_config_t* config, vp_tensor_float32_input priors);
+void ssd_detection_destroy(ssd_detection_t* detection);
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------- //
+// vp_tensor_fix16_t* ssd_detection_forward() takes ssd_detection_t*     detection - from ssd_detection_create()                                      //
+//                                                  vp_tensor_fix16_t*   loc       - (1, 1, num_priors, 4) raw location offsets (dx, dy, dw, dh),      //
+//                                                                                   exp_offset fractional bits                                        //
+//                                                  vp_tensor_float32_t* conf      - (1, 1, num_priors, num_classes) class confidences                 //
+//                                                  vp_tensor_float32_t** scores   - if not NULL, receives a (1, 1, 1, num_detections) tensor of the   //
+//                                                                                   confidence of each detection                                      //
+// as arguments, returns a                          vp_tensor_fix16_t*             - (1, 1, num_detections, 5) detections in descending confidence    //
+//                                                                                   order: [top-left(x, y), bottom-right(x, y), class ID, ...] in     //
+//                                                                                   image pixels                                                      //
+// Free the returned tensors with vp_tensor_free.                                                                                                     //
+// -------------------------------------------------------------------------------------------------------------------------------------------------- //
+vp_tensor_fix16_t* ssd_detection_forward(ssd_detection_t* detection, vp_tensor_fix16_input loc, vp_tensor_float32_input conf,
+                                         vp_tensor_float32_t** scores);
+
+#endif // DETECTION_OUTPUT_H_
@@ -0,0 +1,119 @@
+/*
+ * Division-free IoU threshold test shared by all NMS implementations
+ *   - NMS only needs to know whether i_area / u_area exceeds a threshold,
+ *     so the ratio is never formed. Instead, the threshold is converted once
+ *     to a fixed-point numerator thresh_q over IOU_DEN = 2^IOU_FRAC_BITS,
+ *     and each pair tests
+ *         i_area * IOU_DEN > thresh_q * u_area
+ *     in 64-bit integer arithmetic: no int-to-float conversion, no division
+ *     and no clamping.
+ *   - thresh_q rounds the threshold up to the next multiple of 2^-24, so a
+ *     pair whose IoU is exactly the (decimal) threshold is not suppressed,
+ *     as in py_cpu_nms.py. Other results agree with exact arithmetic to
+ *     within 2^-24.
+ *   - Degenerate pairs with u_area <= 0 never exceed the threshold.
+ *   - The variant is selected at build time:
+ *       - AVX2 (__AVX2__), 8 pairs per step
+ *       - SSE4.2 (__SSE4_2__), 4 pairs per step
+ *       - GCC vector extensions (__GNUC__), 8 pairs per step, which lowers to
+ *         NEON on ARM
+ *       - plain scalar code otherwise, or when IOU_SCALAR is defined
+ *   - This header is duplicated in rfcn/, faster-rcnn/f-rcnn_ARM/ and
+ *     ssd/ssd_ARM/; keep the copies identical.
+ */
+#ifndef IOU_H_
+#define IOU_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define IOU_FRAC_BITS 24
+#define IOU_DEN (1LL << IOU_FRAC_BITS)
+/* Fixed-point numerator of an IoU threshold, e.g. IOU_THRESH_Q(0.7f) */
+#define IOU_THRESH_Q(thresh) ((int64_t)((double)(thresh) * IOU_DEN) + 1)
+
+#if defined(IOU_SCALAR)
+    #define IOU_SCALAR_ONLY
+#elif defined(__AVX2__)
+    #define IOU_AVX2
+    #include <immintrin.h>
+#elif defined(__SSE4_2__)
+    #define IOU_SSE42
+    #include <immintrin.h>
+#elif defined(__GNUC__)
+    #define IOU_VECTOR_EXT
+#else
+    #define IOU_SCALAR_ONLY
+#endif
+
+/* Whether one pair exceeds the threshold */
+static inline bool iou_exceeds(int32_t i_area, int32_t u_area,
+                               int64_t thresh_q) {
+    return (u_area > 0) &
+           ((int64_t)i_area * IOU_DEN > thresh_q * (int64_t)u_area);
+}
+
+/* Tests n <= 64 pairs; bit k of the result is set iff pair k exceeds the
+ * threshold. */
+static inline uint64_t iou_exceeds_mask(const int32_t* restrict i_areas,
+                                        const int32_t* restrict u_areas,
+                                        size_t n, int64_t thresh_q) {
+    uint64_t bits = 0;
+    size_t k = 0;
+#if defined(IOU_AVX2)
+    // 32x32->64 bit products on the even and odd lanes separately
+    const __m256i den = _mm256_set1_epi32((int32_t)IOU_DEN);
+    const __m256i thresh = _mm256_set1_epi32((int32_t)thresh_q);
+    const __m256i zero = _mm256_setzero_si256();
+    for(; k < (n & ~(size_t)7); k += 8) {
+        __m256i i_area = _mm256_loadu_si256((const __m256i*)(i_areas + k));
+        __m256i u_area = _mm256_loadu_si256((const __m256i*)(u_areas + k));
+        __m256i even = _mm256_cmpgt_epi64(_mm256_mul_epi32(i_area, den),
+                                          _mm256_mul_epi32(u_area, thresh));
+        __m256i odd = _mm256_cmpgt_epi64(
+                _mm256_mul_epi32(_mm256_srli_epi64(i_area, 32), den),
+                _mm256_mul_epi32(_mm256_srli_epi64(u_area, 32), thresh));
+        __m256i gt = _mm256_blend_epi32(even, odd, 0xAA);
+        gt = _mm256_and_si256(gt, _mm256_cmpgt_epi32(u_area, zero));
+        bits |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(gt)) << k;
+    }
+#elif defined(IOU_SSE42)
+    const __m128i den = _mm_set1_epi32((int32_t)IOU_DEN);
+    const __m128i thresh = _mm_set1_epi32((int32_t)thresh_q);
+    const __m128i zero = _mm_setzero_si128();
+    for(; k < (n & ~(size_t)3); k += 4) {
+        __m128i i_area = _mm_loadu_si128((const __m128i*)(i_areas + k));
+        __m128i u_area = _mm_loadu_si128((const __m128i*)(u_areas + k));
+        __m128i even = _mm_cmpgt_epi64(_mm_mul_epi32(i_area, den),
+                                       _mm_mul_epi32(u_area, thresh));
+        __m128i odd = _mm_cmpgt_epi64(
+                _mm_mul_epi32(_mm_srli_epi64(i_area, 32), den),
+                _mm_mul_epi32(_mm_srli_epi64(u_area, 32), thresh));
+        __m128i gt = _mm_blend_epi16(even, odd, 0xCC);
+        gt = _mm_and_si128(gt, _mm_cmpgt_epi32(u_area, zero));
+        bits |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(gt)) << k;
+    }
+#elif defined(IOU_VECTOR_EXT)
+    typedef int32_t v8si __attribute__((vector_size(32)));
+    typedef int64_t v8di __attribute__((vector_size(64)));
+    const v8si lane_bits = {1, 2, 4, 8, 16, 32, 64, 128};
+    for(; k < (n & ~(size_t)7); k += 8) {
+        v8si i_area, u_area;
+        __builtin_memcpy(&i_area, i_areas + k, sizeof(v8si));
+        __builtin_memcpy(&u_area, u_areas + k, sizeof(v8si));
+        v8si gt = __builtin_convertvector(
+                __builtin_convertvector(i_area, v8di) * IOU_DEN
+                > __builtin_convertvector(u_area, v8di) * thresh_q, v8si);
+        v8si sel = gt & (u_area > 0) & lane_bits;
+        uint32_t byte = 0;
+        for(size_t l = 0; l < 8; l++)
+            byte |= sel[l];
+        bits |= (uint64_t)byte << k;
+    }
+#endif
+    for(; k < n; k++)
+        bits |= (uint64_t)iou_exceeds(i_areas[k], u_areas[k], thresh_q) << k;
+    return bits;
+}
+
+#endif /*IOU_H_*/
@@ -2,7 +2,13 @@
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
+#include <stdbool.h>
+#include <string.h>
 #include "vp_interface.h"
+#include "nms.h"
+#include "iou.h"
+#include "nms_grid.h"
+#include "trace.h"
 
 /* ----------------------------------------------------------------------
 --------------------------- Utility Macros ------------------------------
@@ -15,9 +21,10 @@
                     _a > _b ? _a : _b; })
 #define CLAMPF(num, max, min) (fmaxf(fminf(num, max), min))
 #define NMS_THRESH 0.1f // Global IoU threshold
+#define NMS_THRESH_Q IOU_THRESH_Q(NMS_THRESH) // Fixed-point threshold for iou_exceeds()
 #define NUM_ANCHORS 9 // Number of anchor boxes per proposal region
 
-// Intersection area over Union area
+// Intersection area over Union area (floating-point reference for iou_exceeds())
 static void iou(vp_tensor_fix16_input xmins, vp_tensor_fix16_input ymins,
                  vp_tensor_fix16_input xmaxs, vp_tensor_fix16_input ymaxs,
                  vp_tensor_fix16_input areas, int16_t i, int16_t j,
@@ -40,7 +47,101 @@ static void iou(vp_tensor_fix16_input xmins, vp_tensor_fix16_input ymins,
     int16_t u_area = area1 + area2 - i_area;
     
     out->data = CLAMPF(((float)i_area)/((float)u_area), 1.0f, 0.0f);
-    printf("\nComparing entries %d and %d: i_area = %d, u_area = %d, iou = %f\n",i, j, i_area, u_area, out->data);
+    TRACE(TRACE_NMS_IOU, i, j, i_area, u_area);
+}
+
+// Bytes of scratch that nms_impl() needs with a grid of num_entries entries: NMS_ARENA_SIZE(N), the cell offsets,
+// the entries and a candidate list of up to N proposals
+#define NMS_GRID_SCRATCH_SIZE(N, num_entries) (NMS_ARENA_SIZE(N) + (NMS_GRID_MAX_CELLS + 1 + (size_t)(num_entries) + (size_t)(N)) \
+                                               * sizeof(uint32_t) + 3 * SIMD_ALIGNMENT)
+
+// Lays a grid of cell x cell pixels over the proposals. Returns the number of entries it needs.
+static size_t grid_layout(nms_grid_t* grid, vp_tensor_fix16_input proposals, size_t N, int32_t cell) {
+    int32_t x_lo = INT16_MAX, y_lo = INT16_MAX, x_hi = INT16_MIN, y_hi = INT16_MIN;
+    for(size_t i = 0; i < N; i++) {
+        x_lo = MIN(x_lo, (int32_t)MIN(proposals->data[i*5+0], proposals->data[i*5+2]));
+        y_lo = MIN(y_lo, (int32_t)MIN(proposals->data[i*5+1], proposals->data[i*5+3]));
+        x_hi = MAX(x_hi, (int32_t)MAX(proposals->data[i*5+0], proposals->data[i*5+2]));
+        y_hi = MAX(y_hi, (int32_t)MAX(proposals->data[i*5+1], proposals->data[i*5+3]));
+    }
+    nms_grid_layout(grid, x_lo, y_lo, x_hi, y_hi, cell);
+    size_t num_entries = 0;
+    for(size_t i = 0; i < N; i++)
+        num_entries += nms_grid_box_cells(grid, MIN(proposals->data[i*5+0], proposals->data[i*5+2]),
+                                          MIN(proposals->data[i*5+1], proposals->data[i*5+3]),
+                                          MAX(proposals->data[i*5+0], proposals->data[i*5+2]),
+                                          MAX(proposals->data[i*5+1], proposals->data[i*5+3]));
+    return num_entries;
+}
+
+// Fills a grid laid out by grid_layout(), with its cells taken from scratch. Returns false if scratch is too small.
+static bool grid_build(nms_grid_t* grid, vp_arena_t* scratch, vp_tensor_fix16_input proposals, size_t N) {
+    size_t num_cells = nms_grid_num_cells(grid);
+    grid->starts = vp_arena_alloc(scratch, (num_cells + 1) * sizeof(uint32_t), _Alignof(uint32_t));
+    if(grid->starts == NULL)
+        return false;
+    memset(grid->starts, 0, (num_cells + 1) * sizeof(uint32_t));
+    for(size_t i = 0; i < N; i++)
+        nms_grid_count(grid, MIN(proposals->data[i*5+0], proposals->data[i*5+2]),
+                       MIN(proposals->data[i*5+1], proposals->data[i*5+3]),
+                       MAX(proposals->data[i*5+0], proposals->data[i*5+2]),
+                       MAX(proposals->data[i*5+1], proposals->data[i*5+3]));
+    size_t num_entries = nms_grid_prefix(grid);
+    grid->entries = vp_arena_alloc(scratch, num_entries * sizeof(uint32_t), _Alignof(uint32_t));
+    if(grid->entries == NULL)
+        return false;
+    for(size_t i = 0; i < N; i++)
+        nms_grid_insert(grid, i, MIN(proposals->data[i*5+0], proposals->data[i*5+2]),
+                        MIN(proposals->data[i*5+1], proposals->data[i*5+3]),
+                        MAX(proposals->data[i*5+0], proposals->data[i*5+2]),
+                        MAX(proposals->data[i*5+1], proposals->data[i*5+3]));
+    nms_grid_finish(grid);
+    return true;
+}
+
+static int compare_index(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// The later proposals that are still kept and that share with proposal i the grid cell where their intersection
+// starts, in ascending order, i.e. the order the exhaustive loop visits them in. Returns their number.
+static size_t grid_candidates(const nms_grid_t* grid, size_t i,
+                              vp_tensor_fix16_input xmins, vp_tensor_fix16_input ymins,
+                              vp_tensor_fix16_input xmaxs, vp_tensor_fix16_input ymaxs,
+                              vp_tensor_fix16_input keep, uint32_t* candidates) {
+    const int32_t x_lo = MIN(xmins->data[i], xmaxs->data[i]), y_lo = MIN(ymins->data[i], ymaxs->data[i]);
+    const int32_t x_hi = MAX(xmins->data[i], xmaxs->data[i]), y_hi = MAX(ymins->data[i], ymaxs->data[i]);
+    int32_t c0, r0, c1, r1;
+    nms_grid_span(grid, x_lo, y_lo, x_hi, y_hi, &c0, &r0, &c1, &r1);
+    size_t num_candidates = 0;
+    for(int32_t r = r0; r <= r1; r++) {
+        for(int32_t c = c0; c <= c1; c++) {
+            const uint32_t* begin = grid->entries + grid->starts[r * grid->cols + c];
+            const uint32_t* end = grid->entries + grid->starts[r * grid->cols + c + 1];
+            // Entries are ascending, so walk back until the proposals before i
+            while(end != begin && *(end - 1) > i) {
+                uint32_t j = *--end;
+                if(keep->data[j] != 1)
+                    continue;
+                int32_t x = MAX(x_lo, (int32_t)MIN(xmins->data[j], xmaxs->data[j]));
+                int32_t y = MAX(y_lo, (int32_t)MIN(ymins->data[j], ymaxs->data[j]));
+                if(nms_grid_owns(grid, c, r, x, y))
+                    candidates[num_candidates++] = j;
+            }
+        }
+    }
+    if(r0 == r1 && c0 == c1) {
+        // A single cell was walked in descending order
+        for(size_t k = 0; k < num_candidates / 2; k++) {
+            uint32_t j = candidates[k];
+            candidates[k] = candidates[num_candidates - 1 - k];
+            candidates[num_candidates - 1 - k] = j;
+        }
+    }
+    else
+        qsort(candidates, num_candidates, sizeof(uint32_t), compare_index);
+    return num_candidates;
 }
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------- //
@@ -52,18 +153,29 @@ static void iou(vp_tensor_fix16_input xmins, vp_tensor_fix16_input ymins,
 // as arguments, returns a        vp_tensor_fix16_t*              - proposals with redundancies (non-maximal scores for overlapping regions) removed. //      
 // -------------------------------------------------------------------------------------------------------------------------------------------------- //
 
-vp_tensor_fix16_t* nms(vp_tensor_float32_input idx_scores,    // Scores of each anchor proposal, N scores 
-                       vp_tensor_fix16_input proposals,       // There will be 1 entry in idx_scores corresponding to each proposal (5 entries, 5th column is proposal ID)
-                       vp_scalar_fix16_input N) {             // Number of proposals
+// Temporaries come from scratch; the output comes from out_arena, or from the heap if out_arena is NULL.
+// If layout is not NULL, only the candidate pairs of a grid with that layout are compared, with the same result.
+static vp_tensor_fix16_t* nms_impl(vp_arena_t* scratch, vp_arena_t* out_arena,
+                                   vp_tensor_float32_input idx_scores,
+                                   vp_tensor_fix16_input proposals,
+                                   vp_scalar_fix16_input N,
+                                   const bool class_aware,
+                                   const nms_grid_t* layout) {
     assert(N->data > 0);
-    vp_tensor_fix16_t* xmins = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);
-    vp_tensor_fix16_t* xmaxs = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);
-    vp_tensor_fix16_t* ymins = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);
-    vp_tensor_fix16_t* ymaxs = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);
-    vp_tensor_fix16_t* areas = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);
-    vp_tensor_fix16_t* keep = vp_tensor_fix16_malloc(1, 1, 1, N->data, 0);      // maps i-th proposal to keep[i] = 1 or 0 corresponding to 1: Keep proposal, 0: Discard proposal
+    if(scratch == NULL)
+        return NULL;
+    vp_tensor_fix16_t* xmins = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* xmaxs = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* ymins = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* ymaxs = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* areas = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);
+    vp_tensor_fix16_t* keep = vp_tensor_fix16_arena_malloc(scratch, 1, 1, 1, N->data, 0);      // maps i-th proposal to keep[i] = 1 or 0 corresponding to 1: Keep proposal, 0: Discard proposal
+    if(keep == NULL)
+        return NULL; // arena too small; earlier allocations are released with it
 
     // Initialize array values
+    int32_t lowest = INT16_MAX;
+    int32_t highest = INT16_MIN;
     for(size_t i = 0; i < N->data; i++) {
         xmins->data[i] = proposals->data[i*5+0];
         ymins->data[i] = proposals->data[i*5+1];
@@ -71,51 +183,78 @@ vp_tensor_fix16_t* nms(vp_tensor_float32_input idx_scores,    // Scores of each
         ymaxs->data[i] = proposals->data[i*5+3];
         areas->data[i] = abs(xmaxs->data[i] - xmins->data[i]) * abs(ymaxs->data[i] - ymins->data[i]);
         keep->data[i] = 1;
-        printf("Dims: (%d, %d), (%d, %d).   Class_ID = %d\n", xmins->data[i], ymins->data[i], xmaxs->data[i], ymaxs->data[i], proposals->data[i*5+4]);   
+        lowest = MIN(lowest, MIN(MIN(xmins->data[i], ymins->data[i]), MIN(xmaxs->data[i], ymaxs->data[i])));
+        highest = MAX(highest, MAX(MAX(xmins->data[i], ymins->data[i]), MAX(xmaxs->data[i], ymaxs->data[i])));
+    }
+
+    // Class-aware mode: shifting every box by class ID x span along both axes puts each class in its own
+    // region of the plane, so boxes of different classes never overlap and one pass handles all classes
+    const int32_t span = class_aware ? highest - lowest + 1 : 0;
+
+    // Grid mode: pairs outside a common cell do not intersect, so iou_exceeds() would not fire on them anyway. Class
+    // offsets only ever separate boxes, so the grid is built on the unshifted coordinates.
+    nms_grid_t grid;
+    uint32_t* candidates = NULL;
+    if(layout != NULL) {
+        grid = *layout;
+        candidates = vp_arena_alloc(scratch, N->data * sizeof(uint32_t), _Alignof(uint32_t));
+        if(candidates == NULL || !grid_build(&grid, scratch, proposals, N->data))
+            return NULL;
     }
 
     // Main NMS loops
     int16_t num_keep = N->data;             // Keeps track of the number of 1's in keep[]
     for(size_t i = 0; i < N->data; i++) {
-        if(keep->data[i] != 1){
-            printf("Oh no\n");
+        if(keep->data[i] != 1)
             continue;
-        } 
-        for(size_t j = i+1; j < N->data; j++) {
+        size_t num_candidates = layout == NULL ? N->data - i - 1
+                              : grid_candidates(&grid, i, xmins, ymins, xmaxs, ymaxs, keep, candidates);
+        for(size_t c = 0; c < num_candidates; c++) {
+            size_t j = layout == NULL ? i + 1 + c : candidates[c];
             if(keep->data[j] != 1)
                 continue;
-            vp_scalar_float32_t* iou_result = vp_scalar_float32_malloc();
-            iou(xmins, ymins, xmaxs, ymaxs, areas, i, j, iou_result);
-            // printf("IoU for ID %d: %f\n", j, iou_result->data);
-            if(iou_result->data > NMS_THRESH) {
+            // Intersection and union areas, widened to 32 bits
+            const int32_t offset_i = span * proposals->data[i*5+4];
+            const int32_t offset_j = span * proposals->data[j*5+4];
+            int32_t x1 = MAX(xmins->data[i] + offset_i, xmins->data[j] + offset_j);
+            int32_t y1 = MIN(ymins->data[i] + offset_i, ymins->data[j] + offset_j);
+            int32_t x2 = MIN(xmaxs->data[i] + offset_i, xmaxs->data[j] + offset_j);
+            int32_t y2 = MAX(ymaxs->data[i] + offset_i, ymaxs->data[j] + offset_j);
+            int32_t i_area = MAX(x2 - x1, 0) * MAX(y1 - y2, 0);
+            int32_t u_area = areas->data[i] + areas->data[j] - i_area;
+            if(iou_exceeds(i_area, u_area, NMS_THRESH_Q)) {
                 // Exceeded IoU threshold, keep higher score of the 2 proposals
+                TRACE(TRACE_NMS_EXCEEDED, i, j, i_area, u_area);
                 num_keep--;
                 if(idx_scores->data[i] > idx_scores->data[j]) {
                     keep->data[j] = 0;
-                    printf("Setting keep[proposal %zd] to 0\n", j);
+                    TRACE(TRACE_NMS_DISCARD, j, i, 0, 0);
                 }
                 else {
                     keep->data[i] = 0;
-                    printf("Setting keep[proposal %zd] to 0\n", i);
+                    TRACE(TRACE_NMS_DISCARD, i, j, 0, 0);
                     break;
                 }
-                printf("NMS threshold exceeded. iou value = %f\n", iou_result->data);
             }
             else
-                printf("Did not exceed NMS threshold, iou value = %f\n", iou_result->data);
+                TRACE(TRACE_NMS_NOT_EXCEEDED, i, j, i_area, u_area);
         }
     }
     assert(num_keep <= N->data);
 
     // Re-generate proposals, discard redundant proposals
     int16_t idx = 0;
-    vp_tensor_fix16_t* output = vp_tensor_fix16_malloc(1, 1, num_keep, 5, 0);    
+    vp_tensor_fix16_t* output = out_arena == NULL
+                              ? vp_tensor_fix16_malloc(1, 1, num_keep, 5, 0)
+                              : vp_tensor_fix16_arena_malloc(out_arena, 1, 1, num_keep, 5, 0);
+    if(output == NULL)
+        return NULL;
     for(size_t i = 0; i < num_keep; i++) {
         // Find next i such that keep[i] = 1 
         while(keep->data[idx] != 1) {
             idx++;
         }
-        printf("\nAdding proposal number: %d\n", idx);    
+        TRACE(TRACE_NMS_KEEP, i, idx, 0, 0);
         output->data[i*5+0] = proposals->data[idx*5+0];
         output->data[i*5+1] = proposals->data[idx*5+1];
         output->data[i*5+2] = proposals->data[idx*5+2];
@@ -126,6 +265,51 @@ vp_tensor_fix16_t* nms(vp_tensor_float32_input idx_scores,    // Scores of each
     return output;
 }
 
+// Scratch arena for the temporaries of nms(), one per thread, grown on demand and reset on every call
+static __thread vp_arena_t* scratch_arena = NULL;
+
+static vp_arena_t* reset_scratch_arena(size_t size) {
+    if(scratch_arena == NULL || scratch_arena->capacity < size) {
+        vp_arena_destroy(scratch_arena);
+        scratch_arena = vp_arena_create(size);
+    }
+    else
+        vp_arena_reset(scratch_arena);
+    return scratch_arena;
+}
+
+vp_tensor_fix16_t* nms(vp_tensor_float32_input idx_scores,    // Scores of each anchor proposal, N scores 
+                       vp_tensor_fix16_input proposals,       // There will be 1 entry in idx_scores corresponding to each proposal (5 entries, 5th column is proposal ID)
+                       vp_scalar_fix16_input N) {             // Number of proposals
+    vp_arena_t* scratch = reset_scratch_arena(NMS_ARENA_SIZE(N->data));
+    return nms_impl(scratch, NULL, idx_scores, proposals, N, false, NULL);
+}
+
+vp_tensor_fix16_t* nms_class_aware(vp_tensor_float32_input idx_scores,
+                                   vp_tensor_fix16_input proposals,
+                                   vp_scalar_fix16_input N) {
+    vp_arena_t* scratch = reset_scratch_arena(NMS_ARENA_SIZE(N->data));
+    return nms_impl(scratch, NULL, idx_scores, proposals, N, true, NULL);
+}
+
+vp_tensor_fix16_t* nms_with_grid(vp_tensor_float32_input idx_scores,
+                                 vp_tensor_fix16_input proposals,
+                                 vp_scalar_fix16_input N,
+                                 vp_scalar_fix16_input cell) {
+    assert(N->data > 0);
+    nms_grid_t layout;
+    size_t num_entries = grid_layout(&layout, proposals, N->data, cell->data);
+    vp_arena_t* scratch = reset_scratch_arena(NMS_GRID_SCRATCH_SIZE(N->data, num_entries));
+    return nms_impl(scratch, NULL, idx_scores, proposals, N, false, &layout);
+}
+
+vp_tensor_fix16_t* nms_arena(vp_arena_t* arena,
+                             vp_tensor_float32_input idx_scores,
+                             vp_tensor_fix16_input proposals,
+                             vp_scalar_fix16_input N) {
+    return nms_impl(arena, arena, idx_scores, proposals, N, false, NULL);
+}
+
 /* -----------------------------------------------------------------------
 ------------------------------- Testing ----------------------------------
 ----------------------------------------------------------------------- */
@@ -147,6 +331,12 @@ int main() {
     iou(xmins, ymins, xmaxs, ymaxs, areas, 0, 1, iou_output);
     printf("IoU Output: %f\n", iou_output->data);
 
+    // Compare iou_exceeds() against the floating-point iou()
+    int32_t i_area = MAX(MIN(data_xmaxs[0], data_xmaxs[1]) - MAX(data_xmins[0], data_xmins[1]), 0)
+                   * MAX(MIN(data_ymins[0], data_ymins[1]) - MAX(data_ymaxs[0], data_ymaxs[1]), 0);
+    int32_t u_area = data_areas[0] + data_areas[1] - i_area;
+    assert((iou_output->data > NMS_THRESH) == iou_exceeds(i_area, u_area, NMS_THRESH_Q));
+
     // Test nms
     #define NUM_PROPOSALS 4
     const float data_scores[NUM_PROPOSALS] = {0.4, 0.85, 0.65, 0.77};
@@ -167,6 +357,75 @@ int main() {
         printf("Dims: (%d, %d), (%d, %d).   Class_ID = %d\n", output->data[i*5+0], output->data[i*5+1], output->data[i*5+2], output->data[i*5+3], output->data[i*5+4]);
     }
 
+    // nms_arena() must match nms(), and a reset arena must be reusable frame after frame
+    vp_arena_t* arena = vp_arena_create(NMS_ARENA_SIZE(NUM_PROPOSALS));
+    for(size_t frame = 0; frame < 3; frame++) {
+        vp_arena_reset(arena);
+        vp_tensor_fix16_t* output_arena = nms_arena(arena, idx_scores, proposals, N);
+        assert(output_arena != NULL && output_arena->h == output->h);
+        assert(memcmp(output_arena->data, output->data, output->h * 5 * sizeof(int16_t)) == 0);
+        assert(arena->offset <= NMS_ARENA_SIZE(NUM_PROPOSALS));
+    }
+    vp_arena_destroy(arena);
+
+    // nms_class_aware() must keep the same rows as running nms() on each class separately, even when the classes
+    // are stacked on top of each other
+    int16_t data_stacked[NUM_PROPOSALS * 5];
+    memcpy(data_stacked, data_proposals, sizeof(data_proposals));
+    memcpy(&data_stacked[2*5], data_proposals, 2 * 5 * sizeof(int16_t));
+    data_stacked[2*5+4] = data_stacked[3*5+4] = 1;
+    vp_tensor_fix16_t* stacked = vp_tensor_fix16_calloc(1, 1, N->data, 5, 0, data_stacked);
+    vp_tensor_fix16_t* output_class_aware = nms_class_aware(idx_scores, stacked, N);
+    vp_scalar_fix16_t* N_class = vp_scalar_fix16_calloc(0, 2);
+    size_t row = 0;
+    for(size_t c = 0; c < 2; c++) {
+        vp_tensor_float32_t* class_scores = vp_tensor_float32_calloc(1, 1, 2, 1, &data_scores[c*2]);
+        vp_tensor_fix16_t* class_proposals = vp_tensor_fix16_calloc(1, 1, 2, 5, 0, &data_stacked[c*2*5]);
+        vp_tensor_fix16_t* class_output = nms(class_scores, class_proposals, N_class);
+        assert(row + class_output->h <= output_class_aware->h);
+        assert(memcmp(&output_class_aware->data[row*5], class_output->data, class_output->h * 5 * sizeof(int16_t)) == 0);
+        row += class_output->h;
+        vp_tensor_free(class_scores);
+        vp_tensor_free(class_proposals);
+        vp_tensor_free(class_output);
+    }
+    assert(row == output_class_aware->h);
+    vp_tensor_free(stacked);
+    vp_tensor_free(output_class_aware);
+    vp_scalar_free(N_class);
+
+    // nms_with_grid() must return exactly what nms() returns, for any cell size
+    #define NUM_DENSE 2000
+    vp_scalar_fix16_t* N_dense = vp_scalar_fix16_calloc(0, NUM_DENSE);
+    vp_tensor_fix16_t* dense_proposals = vp_tensor_fix16_malloc(1, 1, NUM_DENSE, 5, 0);
+    vp_tensor_float32_t* dense_scores = vp_tensor_float32_malloc(1, 1, 1, NUM_DENSE);
+    srand(2);
+    for(size_t i = 0; i < NUM_DENSE; i++) {
+        int16_t x = rand() % 280, y = rand() % 280;
+        dense_proposals->data[i*5+0] = x;
+        dense_proposals->data[i*5+1] = y + 4 + rand() % 40;     // top edge has the larger y here
+        dense_proposals->data[i*5+2] = x + 4 + rand() % 40;
+        dense_proposals->data[i*5+3] = y;
+        dense_proposals->data[i*5+4] = rand() % 4;
+        dense_scores->data[i] = (float)rand() / RAND_MAX;
+    }
+    vp_tensor_fix16_t* output_dense = nms(dense_scores, dense_proposals, N_dense);
+    const int16_t cells[4] = {4, 32, 64, 1024};
+    for(size_t k = 0; k < 4; k++) {
+        vp_scalar_fix16_t* cell = vp_scalar_fix16_calloc(0, cells[k]);
+        vp_tensor_fix16_t* output_grid = nms_with_grid(dense_scores, dense_proposals, N_dense, cell);
+        assert(output_grid->h == output_dense->h);
+        assert(memcmp(output_grid->data, output_dense->data, output_dense->h * 5 * sizeof(int16_t)) == 0);
+        vp_scalar_free(cell);
+        vp_tensor_free(output_grid);
+    }
+    printf("\nnms_with_grid matches nms on %d proposals (%zd kept)\n", NUM_DENSE, output_dense->h);
+    vp_scalar_free(N_dense);
+    vp_tensor_free(dense_proposals);
+    vp_tensor_free(dense_scores);
+    vp_tensor_free(output_dense);
+
+    trace_dump(stdout);
     printf("\nDon't compile on a windows machine, posix is a unix library.\n");
     return 0;
 }
\ No newline at end of file
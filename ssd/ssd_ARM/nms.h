@@ -1,6 +1,23 @@
 #ifndef NMS_H_
+#define NMS_H_
 #include "vp_interface.h"
 
 inline vp_tensor_fix16_t* nms(vp_tensor_float32_input idx_scores, vp_tensor_fix16_input proposals, vp_scalar_fix16_input N);
 
+// Same as nms(), but the 5th proposal column (class ID) is honored: proposals of different classes never suppress each other
+vp_tensor_fix16_t* nms_class_aware(vp_tensor_float32_input idx_scores, vp_tensor_fix16_input proposals, vp_scalar_fix16_input N);
+
+// Same as nms(), but only proposals that share a cell of a uniform grid of cell x cell pixels are compared (see
+// nms_grid.h); the output is bit-identical. With cells about the size of a typical proposal, the work grows with N
+// times the number of neighbours rather than N^2, which pays off on frames dense with small proposals.
+vp_tensor_fix16_t* nms_with_grid(vp_tensor_float32_input idx_scores, vp_tensor_fix16_input proposals, vp_scalar_fix16_input N,
+                                 vp_scalar_fix16_input cell);
+
+// Bytes of arena that nms_arena() needs for N proposals: 6 temporaries of N entries and an output of up to N x 5
+#define NMS_ARENA_SIZE(N) (11 * (size_t)(N) * sizeof(int16_t) + 7 * (sizeof(vp_tensor_fix16_t) + 2 * SIMD_ALIGNMENT))
+
+// Same as nms(), but the temporaries and the returned tensor come from arena and are released by vp_arena_reset(arena).
+// Returns NULL if arena has less than NMS_ARENA_SIZE(N->data) bytes left.
+vp_tensor_fix16_t* nms_arena(vp_arena_t* arena, vp_tensor_float32_input idx_scores, vp_tensor_fix16_input proposals, vp_scalar_fix16_input N);
+
 #endif // NMS_H_
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "trace.h"
+
+#ifdef VP_TRACE
+trace_record_t trace_ring[TRACE_RING_SIZE];
+uint64_t trace_head = 0;
+
+static const char* const trace_formats[TRACE_NUM_EVENTS] = {
+    [TRACE_NMS_IOU]          = "nms: iou of %d and %d: i_area = %d, u_area = %d\n",
+    [TRACE_NMS_EXCEEDED]     = "nms: %d and %d exceed threshold: i_area = %d, u_area = %d\n",
+    [TRACE_NMS_NOT_EXCEEDED] = "nms: %d and %d within threshold: i_area = %d, u_area = %d\n",
+    [TRACE_NMS_DISCARD]      = "nms: discard proposal %d, outscored by %d\n",
+    [TRACE_NMS_KEEP]         = "nms: output %d is proposal %d\n",
+    [TRACE_CROP_ALLOC]       = "crop: allocated %d entries\n",
+    [TRACE_CROP_ROI]         = "crop: roi %d, roi_area = %d\n",
+    [TRACE_MAP_SCORES_MATCH] = "map_scores: roi %d is proposal %d\n",
+};
+
+void trace_dump(FILE* stream) {
+    uint64_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    if(first > 0)
+        fprintf(stream, "trace: %llu older records overwritten\n",
+                (unsigned long long)first);
+    for(uint64_t i = first; i < head; i++) {
+        const trace_record_t* record = &trace_ring[i & (TRACE_RING_SIZE - 1)];
+        if(record->event >= TRACE_NUM_EVENTS)
+            continue;
+        fprintf(stream, trace_formats[record->event], record->args[0],
+                record->args[1], record->args[2], record->args[3]);
+    }
+    __atomic_store_n(&trace_head, 0, __ATOMIC_RELEASE);
+}
+#endif
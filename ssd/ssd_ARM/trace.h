@@ -0,0 +1,67 @@
+/*
+ * Compile-time trace facility for the ARM kernels
+ *   - Compiled out unless VP_TRACE is defined: TRACE() and trace_dump() then
+ *     expand to nothing and their arguments are never evaluated, so hot loops
+ *     pay nothing for being instrumented.
+ *   - With -DVP_TRACE, TRACE(event, a, b, c, d) stores one fixed-size binary
+ *     record (no formatting, no I/O, no allocation) in a global ring buffer of
+ *     TRACE_RING_SIZE records. Once the ring is full the oldest records are
+ *     overwritten. Slots are claimed atomically, so kernels may trace from
+ *     several threads.
+ *   - trace_dump(stream) formats the records still in the ring, oldest
+ *     first, and empties it. Call it outside of the traced kernels.
+ *   - This header and trace.c are duplicated in faster-rcnn/f-rcnn_ARM/ and
+ *     ssd/ssd_ARM/; keep the copies identical.
+ */
+#ifndef TRACE_H_
+#define TRACE_H_
+#include <stdio.h>
+#include <stdint.h>
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 4096 // records, must be a power of two
+#endif
+
+// Each event has a format string for its four arguments in trace.c
+typedef enum trace_event {
+    TRACE_NMS_IOU = 0,      // i, j, i_area, u_area
+    TRACE_NMS_EXCEEDED,     // i, j, i_area, u_area
+    TRACE_NMS_NOT_EXCEEDED, // i, j, i_area, u_area
+    TRACE_NMS_DISCARD,      // discarded proposal, kept proposal
+    TRACE_NMS_KEEP,         // output row, proposal
+    TRACE_CROP_ALLOC,       // number of entries
+    TRACE_CROP_ROI,         // roi, roi_area
+    TRACE_MAP_SCORES_MATCH, // roi, proposal
+    TRACE_NUM_EVENTS
+} trace_event_t;
+
+typedef struct trace_record {
+    uint32_t event;
+    int32_t args[4];
+} trace_record_t;
+
+#ifdef VP_TRACE
+extern trace_record_t trace_ring[TRACE_RING_SIZE];
+extern uint64_t trace_head; // total number of records ever written
+
+static inline void trace_record(trace_event_t event, int32_t a, int32_t b,
+                                int32_t c, int32_t d) {
+    uint64_t slot = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    trace_record_t* record = &trace_ring[slot & (TRACE_RING_SIZE - 1)];
+    record->event = event;
+    record->args[0] = a;
+    record->args[1] = b;
+    record->args[2] = c;
+    record->args[3] = d;
+}
+
+void trace_dump(FILE* stream);
+
+#define TRACE(event, a, b, c, d) \
+    trace_record((event), (int32_t)(a), (int32_t)(b), (int32_t)(c), (int32_t)(d))
+#else
+#define TRACE(event, a, b, c, d) ((void)0)
+#define trace_dump(stream) ((void)0)
+#endif
+
+#endif /*TRACE_H_*/
@@ -7,22 +7,27 @@ from amb import CVflow, ARM, FS
 
 # Global variables
 prev1, prev2 = None, None
+detection = None
 
 # Required
 def init():
+    global detection
     FS.Stream('input', '/path/to/images')
+    FS.Stream('priors', '/path/to/prior_boxes')
     CVflow.DAG('main_ssd', 'ssd_vgg_without_nms.pb') # Primary CNN for feature extraction, detection and classification
-    ARM.JIT('nms', 'nms.h', 'nms.c') # Regressor
+    ARM.JIT('ssd_detection_create', 'detection_output.h', 'detection_output.c') # Prior table and workspace, built once
+    ARM.JIT('ssd_detection_forward', 'detection_output.h', 'detection_output.c') # Fused decode, per-class top-K and NMS
+    detection = ARM.ssd_detection_create(ARM.SSD_DETECTION_DEFAULT_CONFIG, next(FS.priors))
 
 def loop():
     # data dependency graph:                            
     #                                                   
-    # > SSD ---> NMS ------                         
+    # > SSD ---> DetectionOutput ------                         
     img = next(FS.input)
     
-    # SSD model does most of the work, nms removes redundant priors
-    class_detections = CVflow.main_ssd(img)
-    predictions = ARM.nms(class_detections)
-    yield predictions
+    # SSD model does most of the work; DetectionOutput decodes the confident priors and removes redundant ones per class
+    locations, confidences = CVflow.main_ssd(img)
+    predictions, scores = ARM.ssd_detection_forward(detection, locations, confidences)
+    yield predictions, scores
 
 